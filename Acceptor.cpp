@@ -2,6 +2,7 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "Acceptor.h"
 #include "Logger.h"
@@ -18,10 +19,11 @@ static int createNonBlocking()
 
 
 Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reuseport)
-	: _loop{loop}, _acceptSocket{createNonBlocking()}, _acceptChannel(loop, _acceptSocket.fd()), _listening{false}
+	: _loop{loop}, _acceptSocket{createNonBlocking()}, _acceptChannel(loop, _acceptSocket.fd()), _listening{false},
+	_acceptBudget{ kDefaultAcceptBudget }, _idleFd{ ::open("/dev/null", O_RDONLY | O_CLOEXEC) }
 {
 	_acceptSocket.setReuseAddr(true);
-	_acceptSocket.setReusePort(true);
+	_acceptSocket.setReusePort(reuseport);
 	_acceptSocket.bindAddress(listenAddr);
 	// TcpServer::start() => Acceptor.listen() 如果有新用户连接 要执行一个回调(accept => connfd => 打包成Channel => 唤醒subloop)
     // mainloop监听到有事件发生 => acceptChannel_(listenfd) => 执行该回调函数
@@ -29,10 +31,22 @@ Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reusepor
 }
 
 
+Acceptor::Acceptor(EventLoop* loop, int listenfd)
+	: _loop{loop}, _acceptSocket{listenfd}, _acceptChannel(loop, listenfd), _listening{false},
+	_acceptBudget{ kDefaultAcceptBudget }, _idleFd{ ::open("/dev/null", O_RDONLY | O_CLOEXEC) }
+{
+	// 非阻塞标志属于两个进程共享的打开文件 这里再设置一次以防旧进程没有设置
+	::fcntl(listenfd, F_SETFL, ::fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	_acceptChannel.setReadCallback(std::bind(&Acceptor::handleRead, this));
+}
+
+
 Acceptor::~Acceptor()
 {
     _acceptChannel.disableAll();    // 把Poller中感兴趣的事件删除掉
     _acceptChannel.remove();        // 调用EventLoop->removeChannel => Poller->removeChannel 把Poller的ChannelMap对应的部分删除
+	if (_idleFd >= 0)
+		::close(_idleFd);
 }
 
 
@@ -43,26 +57,55 @@ void Acceptor::listen()
 	_acceptChannel.enableReading(); // _acceptChannel 注册至Poller !重要
 }
 
-// listenfd有事件发生就是有新用户连接了
-void Acceptor::handleRead()
+void Acceptor::pause()
 {
-	InetAddress peerAddr;
-	int connfd = _acceptSocket.accept(peerAddr);
-	if (connfd >= 0)
-	{
-		// 轮询找到subLoop 唤醒并分发当前的新客户端的Channel
-		if (_newConnectionCallback)
-			_newConnectionCallback(connfd, peerAddr);
-		else
-			::close(connfd);
-	}
-	else
-	{
-		LOG_ERROR("%s:%s:%d accept err:%d\n", __FILE__, __FUNCTION__, __LINE__, errno);
-		if (errno == EMFILE)	
-			LOG_ERROR("%s:%s:%d sockfd reached limit\n", __FILE__, __FUNCTION__, __LINE__);
-	}
+	if (_listening)
+		_acceptChannel.disableReading();
 }
 
 
+void Acceptor::resume()
+{
+	if (_listening && !_acceptChannel.isReading())
+		_acceptChannel.enableReading();
+}
+
+// listenfd有事件发生就是有新用户连接了 循环accept直到队列为空或用完本次的配额
+void Acceptor::handleRead()
+{
+	for (int i = 0; i < _acceptBudget; i++)
+	{
+		InetAddress peerAddr;
+		int connfd = _acceptSocket.accept(peerAddr);
+		if (connfd >= 0)
+		{
+			// 轮询找到subLoop 唤醒并分发当前的新客户端的Channel
+			if (_newConnectionCallback)
+				_newConnectionCallback(connfd, peerAddr);
+			else
+				::close(connfd);
+			continue;
+		}
 
+		int savedErrno = errno;
+		if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK)
+			break;
+		if (savedErrno == EMFILE || savedErrno == ENFILE)
+		{
+			// 连接留在队列里listenfd会持续可读 用预留的fd接受后立即关闭 让客户端尽快得知连接失败
+			LOG_ERROR("%s:%s:%d sockfd reached limit, dropping a pending connection\n", __FILE__, __FUNCTION__, __LINE__);
+			if (_idleFd < 0)
+				break;
+			::close(_idleFd);
+			_idleFd = ::accept(_acceptSocket.fd(), nullptr, nullptr);
+			if (_idleFd >= 0)
+				::close(_idleFd);
+			_idleFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+			continue;
+		}
+		// ECONNABORTED等错误只影响队列中的这一个连接 继续处理后面的
+		LOG_ERROR("%s:%s:%d accept err:%d\n", __FILE__, __FUNCTION__, __LINE__, savedErrno);
+		if (savedErrno != ECONNABORTED && savedErrno != EPROTO && savedErrno != EPERM && savedErrno != EINTR)
+			break;
+	}
+}
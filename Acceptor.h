@@ -14,14 +14,23 @@ class Acceptor : public noncopyable
 {
 public:
 	using NewConnectionCallback = std::function<void(int sockfd, const InetAddress& addr)>;
+	static constexpr int kDefaultAcceptBudget = 64;
 
 	Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reuseport);
+	// 接管旧进程交来的监听socket(Handover) 已经bind并listen 队列中的连接原样保留
+	Acceptor(EventLoop* loop, int listenfd);
 	~Acceptor();
 	
 	void setNewConnectionCallback(NewConnectionCallback cb) { _newConnectionCallback = std::move(cb); }
+	// 每次可读事件最多accept的连接数 连接风暴时不必每个连接都经过一轮epoll_wait 又不至于长时间占住mainloop
+	void setAcceptBudget(int budget) { _acceptBudget = budget > 0 ? budget : 1; }
 
 	bool listening() const { return _listening; }
+	int fd() const { return _acceptSocket.fd(); }
 	void listen();
+	// 暂停/恢复accept 监听socket保持打开 暂停期间到达的连接留在队列中 在所属loop中调用
+	void pause();
+	void resume();
 
 private:
 	void handleRead();
@@ -31,6 +40,8 @@ private:
 	Socket _acceptSocket;
 	Channel _acceptChannel; // 存放listen套接字
 	bool _listening;
+	int _acceptBudget;
+	int _idleFd;	// 预留的空闲fd 进程fd耗尽(EMFILE)时关闭它腾出一个fd 接受并立即关闭排队的连接 否则listenfd会一直可读而空转
 };
 
 
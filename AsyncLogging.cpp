@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <chrono>
+
+#include "AsyncLogging.h"
+#include "LogFile.h"
+
+
+AsyncLogging::AsyncLogging(const std::string& basename, off_t rollSize, int flushInterval, size_t maxBuffers, DropPolicy policy) :
+	_basename{ basename }, _rollSize{ rollSize }, _flushInterval{ flushInterval }, _maxBuffers{ std::max<size_t>(maxBuffers, 4) },
+	_policy{ policy }, _running{ false }, _thread{ std::bind(&AsyncLogging::threadFunc, this), "Logging" },
+	_currentBuffer{ new LogBuffer }, _nextBuffer{ new LogBuffer }, _allocated{ 2 }, _dropped{ 0 },
+	_flushRequested{ 0 }, _flushed{ 0 }, _droppedTotal{ 0 }
+{
+	_buffers.reserve(_maxBuffers);
+}
+
+
+AsyncLogging::~AsyncLogging()
+{
+	if (_running)
+		stop();
+}
+
+
+void AsyncLogging::start()
+{
+	_running = true;
+	_thread.start();
+}
+
+
+void AsyncLogging::stop()
+{
+	_running = false;
+	_cond.notify_one();
+	_thread.join();
+}
+
+
+void AsyncLogging::append(const char* logline, size_t len)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_currentBuffer->avail() > len)
+	{
+		_currentBuffer->append(logline, len);
+		return;
+	}
+
+	// 当前缓冲区写满 交给后台线程 换一块新的
+	BufferPtr full = std::move(_currentBuffer);
+	if (_nextBuffer)
+	{
+		_currentBuffer = std::move(_nextBuffer);
+	}
+	else if (_allocated < _maxBuffers)
+	{
+		_currentBuffer.reset(new LogBuffer);
+		_allocated++;
+	}
+	else if (_policy == DropPolicy::DropOldest && !_buffers.empty())
+	{
+		// 后台线程跟不上 丢掉积压最久的一块 腾出来继续写
+		_currentBuffer = std::move(_buffers.front());
+		_buffers.erase(_buffers.begin());
+		_dropped += _currentBuffer->len;
+		_droppedTotal += _currentBuffer->len;
+		_currentBuffer->len = 0;
+	}
+	else
+	{
+		// 没有可用的缓冲区 丢弃这一条
+		_currentBuffer = std::move(full);
+		_dropped += len;
+		_droppedTotal += len;
+		return;
+	}
+
+	_buffers.push_back(std::move(full));
+	_currentBuffer->append(logline, len);
+	_cond.notify_one();
+}
+
+
+void AsyncLogging::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (!_running)
+		return;
+	uint64_t seq = ++_flushRequested;
+	_cond.notify_one();
+	// 后台线程自身出错时调用flush会等不到结果 最多等待几个写出周期
+	_flushedCond.wait_for(lock, std::chrono::seconds(_flushInterval + 2), [this, seq]() {
+		return _flushed >= seq || !_running;
+	});
+}
+
+
+void AsyncLogging::threadFunc()
+{
+	LogFile output(_basename, _rollSize);
+	BufferPtr newBuffer1(new LogBuffer);
+	BufferPtr newBuffer2(new LogBuffer);
+	std::vector<BufferPtr> buffersToWrite;
+	buffersToWrite.reserve(_maxBuffers);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_allocated += 2;
+	}
+
+	bool running = true;
+	while (running)
+	{
+		uint64_t dropped = 0;
+		uint64_t flushSeq = 0;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_buffers.empty() && _flushRequested == _flushed && _running)
+				_cond.wait_for(lock, std::chrono::seconds(_flushInterval));
+			// stop之后再写出最后一轮
+			running = _running;
+
+			_buffers.push_back(std::move(_currentBuffer));
+			_currentBuffer = std::move(newBuffer1);
+			buffersToWrite.swap(_buffers);
+			if (!_nextBuffer)
+				_nextBuffer = std::move(newBuffer2);
+			dropped = _dropped;
+			_dropped = 0;
+			flushSeq = _flushRequested;
+		}
+
+		if (dropped > 0)
+		{
+			char note[128];
+			int len = ::snprintf(note, sizeof(note), "[ERROR]AsyncLogging dropped %lu bytes of logs, backend too slow\n", dropped);
+			output.append(note, len);
+		}
+		for (const BufferPtr& buffer : buffersToWrite)
+			output.append(buffer->data.get(), buffer->len);
+
+		// 留两块补充给前端 其余的释放 下一次需要时再分配
+		size_t freed = 0;
+		while (buffersToWrite.size() > 2)
+		{
+			buffersToWrite.pop_back();
+			freed++;
+		}
+		if (!newBuffer1)
+		{
+			newBuffer1 = std::move(buffersToWrite.back());
+			buffersToWrite.pop_back();
+			newBuffer1->len = 0;
+		}
+		if (!newBuffer2 && !buffersToWrite.empty())
+		{
+			newBuffer2 = std::move(buffersToWrite.back());
+			buffersToWrite.pop_back();
+			newBuffer2->len = 0;
+		}
+		freed += buffersToWrite.size();
+		buffersToWrite.clear();
+		output.flush();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_allocated -= freed;
+			_flushed = flushSeq;
+		}
+		_flushedCond.notify_all();
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_flushedCond.notify_all();
+}
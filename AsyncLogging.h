@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+#include "Thread.h"
+
+/// @brief 双缓冲的异步日志后端 前端线程只在锁内把日志拷贝进当前缓冲区 后台线程定期换出写满的缓冲区写入LogFile
+/// 缓冲区总数不超过maxBuffers(至少4个) 全部用完后按DropPolicy丢弃日志 内存占用不超过 maxBuffers * kBufferSize
+/// 使用方式:
+///     AsyncLogging log("/var/log/server", 64 * 1024 * 1024);
+///     log.start();
+///     Logger::instance().setOutput(std::bind(&AsyncLogging::append, &log, _1, _2), std::bind(&AsyncLogging::flush, &log));
+class AsyncLogging : noncopyable
+{
+public:
+	enum class DropPolicy
+	{
+		DropOldest,		// 丢弃最早积压的缓冲区 保留最新的日志
+		DropNewest		// 丢弃新写入的日志 保留最早的日志
+	};
+
+	static constexpr size_t kBufferSize = 4 * 1024 * 1024;
+
+	AsyncLogging(const std::string& basename, off_t rollSize, int flushInterval = 3,
+		size_t maxBuffers = 16, DropPolicy policy = DropPolicy::DropOldest);
+	~AsyncLogging();
+
+	// 线程安全 由Logger的输出函数调用
+	void append(const char* logline, size_t len);
+	// 线程安全 阻塞到此前append的日志全部写入文件并fflush 后台线程未运行时立即返回
+	void flush();
+
+	void start();
+	void stop();
+
+	uint64_t droppedBytes() const { return _droppedTotal; }
+
+private:
+	struct LogBuffer
+	{
+		LogBuffer() : data{ new char[kBufferSize] }, len{ 0 } {}
+
+		size_t avail() const { return kBufferSize - len; }
+		void append(const char* buf, size_t n)
+		{
+			::memcpy(data.get() + len, buf, n);
+			len += n;
+		}
+
+		std::unique_ptr<char[]> data;
+		size_t len;
+	};
+	using BufferPtr = std::unique_ptr<LogBuffer>;
+
+	void threadFunc();
+
+	const std::string _basename;
+	const off_t _rollSize;
+	const int _flushInterval;
+	const size_t _maxBuffers;
+	const DropPolicy _policy;
+
+	std::atomic<bool> _running;
+	Thread _thread;
+
+	std::mutex _mutex;
+	std::condition_variable _cond;			// 唤醒后台线程
+	std::condition_variable _flushedCond;	// 通知flush的调用者
+	BufferPtr _currentBuffer;				// 以下均由_mutex保护
+	BufferPtr _nextBuffer;
+	std::vector<BufferPtr> _buffers;		// 写满等待后台线程写出的缓冲区
+	size_t _allocated;						// 前后台共有的缓冲区数
+	uint64_t _dropped;						// 上次写出后丢弃的字节数
+	uint64_t _flushRequested;
+	uint64_t _flushed;
+	std::atomic<uint64_t> _droppedTotal;
+};
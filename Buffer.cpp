@@ -1,6 +1,10 @@
 #include <cerrno>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "Buffer.h"
 
 
@@ -53,7 +57,7 @@ ssize_t Buffer::readFd(int fd, int* saveErrno)
 	}
 	else // extrabuf里面也写入了n-writable长度的数据
 	{
-		_writerIndex = _buffer.size();
+		_writerIndex += writable;
 		append(extrabuf, n - writable); // 对_buffer扩容 并将extrabuf存储的另一部分数据追加至_buffer
 	}
 	return n;
@@ -69,4 +73,91 @@ ssize_t Buffer::writeFd(int fd, int* saveErrno)
 		*saveErrno = errno;
 	}
 	return n;
-}
\ No newline at end of file
+}
+
+bool Buffer::useMirroredRing(size_t capacity)
+{
+	if (_ring)
+		return true;
+	return remapRing(std::max(capacity, readableBytes()));
+}
+
+
+bool Buffer::remapRing(size_t capacity)
+{
+	size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+	capacity = (capacity + pageSize - 1) / pageSize * pageSize;
+	int fd = ::memfd_create("mymuduo-buffer", MFD_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (::ftruncate(fd, static_cast<off_t>(capacity)) < 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// 先占住两倍容量的连续地址 再把memfd固定映射到前后两半 映射建立后fd就不再需要了
+	void* base = ::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+	char* ring = static_cast<char*>(base);
+	if (::mmap(ring, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+		|| ::mmap(ring + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		::munmap(base, 2 * capacity);
+		::close(fd);
+		return false;
+	}
+	::close(fd);
+
+	size_t readable = readableBytes();
+	::memcpy(ring, peek(), readable);
+	unmapRing();
+	std::vector<char>().swap(_buffer);
+	_ring = ring;
+	_base = ring;
+	_ringCapacity = capacity;
+	_readerIndex = 0;
+	_writerIndex = readable;
+	return true;
+}
+
+
+// 按两倍扩容 映射失败时退回vector 保证调用者要求的可写空间
+void Buffer::growRing(size_t len)
+{
+	size_t readable = readableBytes();
+	if (remapRing(std::max(_ringCapacity * 2, readable + len)))
+		return;
+	std::vector<char> buffer(kCheapPrepend + readable + len);
+	::memcpy(buffer.data() + kCheapPrepend, peek(), readable);
+	unmapRing();
+	_buffer.swap(buffer);
+	_base = _buffer.data();
+	_readerIndex = kCheapPrepend;
+	_writerIndex = kCheapPrepend + readable;
+}
+
+
+void Buffer::unmapRing()
+{
+	if (_ring)
+	{
+		::munmap(_ring, 2 * _ringCapacity);
+		_ring = nullptr;
+		_ringCapacity = 0;
+	}
+}
+
+
+bool Buffer::pinMmapThreshold(size_t threshold)
+{
+#ifdef __GLIBC__
+	return ::mallopt(M_MMAP_THRESHOLD, static_cast<int>(threshold)) == 1;
+#else
+	return false;
+#endif
+}
@@ -2,10 +2,16 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <sys/types.h>
 
 /// @brief 网络库底层的缓冲区类型定义
+/// 默认以std::vector存储 数据读走后剩余的部分在空间不够时搬回头部 容量不够时扩容并整体拷贝
+/// useMirroredRing切换为镜像环形缓冲区: 同一块内存(memfd)在虚拟地址上连续映射两次 环形的可读、可写区域总是连续的
+/// 读写索引越过容量时整体减去容量即可 不需要搬移数据 适合持续大流量的连接 接口与vector方式完全相同
 class Buffer
 {
 public:
@@ -15,21 +21,70 @@ public:
 	explicit Buffer(size_t initalSize = kInitialSize) : _buffer(kCheapPrepend + initalSize)
 		, _readerIndex(kCheapPrepend)
 		, _writerIndex(kCheapPrepend)
+		, _base(_buffer.data())
+		, _ring(nullptr)
+		, _ringCapacity(0)
 	{
 	}
+	~Buffer() { unmapRing(); }
+
+	// 拷贝得到的总是vector方式的缓冲区
+	Buffer(const Buffer& rhs) : Buffer(std::max(rhs.readableBytes(), kInitialSize)) { append(rhs.peek(), rhs.readableBytes()); }
+	Buffer& operator=(const Buffer& rhs)
+	{
+		if (this != &rhs)
+		{
+			Buffer copy(rhs);
+			swap(copy);
+		}
+		return *this;
+	}
+	Buffer(Buffer&& rhs) noexcept : Buffer(0) { swap(rhs); }
+	Buffer& operator=(Buffer&& rhs) noexcept
+	{
+		swap(rhs);
+		return *this;
+	}
+
+	// 切换为容量至少为capacity(向上取整到页大小的整数倍)的镜像环形缓冲区 已有的数据保留 之后容量不够时按两倍扩容
+	// 创建memfd或映射失败时返回false 仍使用vector
+	bool useMirroredRing(size_t capacity);
+	bool mirroredRing() const { return _ring != nullptr; }
+
+	// 进程级设置 把glibc的mmap阈值固定为threshold 超过它的缓冲区总是单独mmap 释放时直接munmap还给系统
+	// glibc默认在释放一个mmap的大块后把阈值提高到它的大小 之后扩容出的大缓冲区都分配在loop线程的arena里 释放后作为arena的top留着不还
+	// 配合TcpServer::setBufferShrink使用才能真正降低突发后的RSS 会改变整个进程的malloc行为 由程序在启动时自行决定是否调用
+	// 非glibc时什么都不做 返回false
+	static bool pinMmapThreshold(size_t threshold = 128 * 1024);
 
 	size_t readableBytes() const { return _writerIndex - _readerIndex; }
-	size_t writableBytes() const { return _buffer.size() - _writerIndex; }
+	size_t writableBytes() const { return _ring ? _ringCapacity - readableBytes() : _buffer.size() - _writerIndex; }
 	size_t prependableBytes() const { return _readerIndex; }
+	// 底层数组实际占用的内存 环形缓冲区的两次映射共用同一块物理内存
+	size_t internalCapacity() const { return _ring ? _ringCapacity : _buffer.capacity(); }
 
 	// 返回缓冲区中可读数据的起始地址
 	const char* peek() const { return begin() + _readerIndex; }
 
+	// 在可读区域中查找"\r\n" 找不到返回nullptr
+	const char* findCRLF() const { return findCRLF(peek()); }
+	const char* findCRLF(const char* start) const
+	{
+		const void* crlf = ::memmem(start, beginWrite() - start, kCRLF, 2);
+		return static_cast<const char*>(crlf);
+	}
+
 	void retrieve(size_t len)
 	{
 		if (len < readableBytes())
 		{
 			_readerIndex += len; // 说明应用只读取了可读缓冲区数据的一部分，就是len长度 还剩下readerIndex+=_len到writerIndex的数据未读
+			// 环形缓冲区的读索引进入第二次映射后整体回退一圈 可读区域不动
+			if (_ring && _readerIndex >= _ringCapacity)
+			{
+				_readerIndex -= _ringCapacity;
+				_writerIndex -= _ringCapacity;
+			}
 		}
 		else // len == readableBytes()
 		{
@@ -38,8 +93,8 @@ public:
 	}
 	void retrieveAll()
 	{
-		_readerIndex = kCheapPrepend;
-		_writerIndex = kCheapPrepend;
+		_readerIndex = _ring ? 0 : kCheapPrepend;
+		_writerIndex = _readerIndex;
 	}
 
 	// 把onMessage函数上报的Buffer数据 转成string类型的数据返回
@@ -67,21 +122,67 @@ public:
 		std::copy(data, data + len, beginWrite());
 		_writerIndex += len;
 	}
+	void append(std::string_view str) { append(str.data(), str.size()); }
+
+	// 直接在可写区域写入数据后 调用hasWritten移动写索引 省去一次拷贝
+	void hasWritten(size_t len) { _writerIndex += len; }
+
+	// 可读数据的起始地址 供协议层原地修改数据(如websocket解掩码)
+	char* beginRead() { return begin() + _readerIndex; }
+
 	char* beginWrite() { return begin() + _writerIndex; }
 	const char* beginWrite() const { return begin() + _writerIndex; }
 
+	// 把底层数组缩小到刚好容纳可读数据再加reserve字节(至少kInitialSize) 突发流量过后归还扩容出来的内存
+	// 环形缓冲区换成按同样大小向上取整的环
+	void shrink(size_t reserve)
+	{
+		size_t capacity = std::max(readableBytes() + reserve, kInitialSize);
+		if (_ring)
+		{
+			if (capacity < _ringCapacity)
+				remapRing(capacity);
+			return;
+		}
+		Buffer other(capacity);
+		other.append(peek(), readableBytes());
+		swap(other);
+	}
+	void swap(Buffer& rhs)
+	{
+		_buffer.swap(rhs._buffer);
+		std::swap(_readerIndex, rhs._readerIndex);
+		std::swap(_writerIndex, rhs._writerIndex);
+		std::swap(_base, rhs._base);
+		std::swap(_ring, rhs._ring);
+		std::swap(_ringCapacity, rhs._ringCapacity);
+	}
+
 	// 从fd上读取数据
 	ssize_t readFd(int fd, int* saveErrno);
 	// 通过fd发送数据
 	ssize_t writeFd(int fd, int* saveErrno);
 
 private:
-	// vector底层数组首元素的地址 也就是数组的起始地址
-	char* begin() { return _buffer.data(); }
-	const char* begin() const { return _buffer.data(); }
+	static constexpr char kCRLF[] = "\r\n";
+
+	// vector底层数组首元素的地址 也就是数组的起始地址 环形缓冲区为第一次映射的起始地址
+	char* begin() { return _base; }
+	const char* begin() const { return _base; }
+
+	// 映射一个至少capacity字节的新环 把可读数据拷贝过去后替换原来的环(或vector)
+	bool remapRing(size_t capacity);
+	void growRing(size_t len);
+	void unmapRing();
 
 	void makeSpace(size_t len)
 	{
+		// 环形缓冲区的可写空间只能靠扩容增加 已读的部分在retrieve时就已经回收
+		if (_ring)
+		{
+			growRing(len);
+			return;
+		}
 		// xxx标示reader中已读的部分
 		/**
 		 * | kCheapPrepend |xxx| reader | writer |            
@@ -90,6 +191,7 @@ private:
 		if (writableBytes() + prependableBytes() < len + kCheapPrepend) // 也就是说 len > xxx + writer的部分
 		{
 			_buffer.resize(_writerIndex + len);
+			_base = _buffer.data();
 		}
 		else // 这里说明 len <= xxx + writer 把reader搬到从xxx开始 使得xxx后面是一段连续空间
 		{
@@ -105,4 +207,9 @@ private:
 	std::vector<char> _buffer;  // 用动态数组作为缓冲区,可自动扩容
 	size_t _readerIndex;  		// 读索引
 	size_t _writerIndex;  		// 写索引
+	char* _base;				// 存储的起始地址 _buffer.data()或_ring 每次访问数据都要用 不必再判断是哪种方式
+	// 镜像环形缓冲区 [_ring, _ring + _ringCapacity)与[_ring + _ringCapacity, _ring + 2 * _ringCapacity)映射同一块内存
+	// 读索引总在第一次映射内 写索引不超过读索引加容量
+	char* _ring;
+	size_t _ringCapacity;
 };
@@ -0,0 +1,168 @@
+#include <algorithm>
+
+#include "BufferBudget.h"
+#include "EventLoop.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+
+BufferBudget& BufferBudget::instance()
+{
+	static BufferBudget budget;
+	return budget;
+}
+
+
+BufferBudget::LoopAccount& BufferBudget::account()
+{
+	static thread_local LoopAccount* t_account = nullptr;
+	if (t_account == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_accounts.emplace_back(new LoopAccount());
+		t_account = _accounts.back().get();
+	}
+	return *t_account;
+}
+
+
+BufferBudget::Stats BufferBudget::stats() const
+{
+	Stats stats;
+	stats.limitBytes = limit();
+	stats.usedBytes = _used.load(std::memory_order_relaxed);
+	stats.peakBytes = _peak.load(std::memory_order_relaxed);
+	stats.overBudget = overBudget();
+	stats.refusedConnections = _refusedConnections.load(std::memory_order_relaxed);
+	stats.pausedReads = _pausedReads.load(std::memory_order_relaxed);
+	stats.evictions = _evictions.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto&& account : _accounts)
+		stats.connections += account->connectionCount.load(std::memory_order_relaxed);
+	return stats;
+}
+
+
+void BufferBudget::attachLoop(EventLoop* loop)
+{
+	loop->runInLoop([this, loop]() {
+		LoopAccount* account = &this->account();
+		if (account->attached)
+			return;
+		account->attached = true;
+		loop->runEvery(kReconcileInterval, [this, account]() { reconcile(account); });
+	});
+}
+
+
+void BufferBudget::addConnection(const std::shared_ptr<TcpConnection>& conn)
+{
+	LoopAccount& account = this->account();
+	account.connections.emplace(conn.get(), conn);
+	account.connectionCount.store(account.connections.size(), std::memory_order_relaxed);
+}
+
+
+void BufferBudget::removeConnection(TcpConnection* conn, size_t accountedBytes)
+{
+	LoopAccount& account = this->account();
+	account.connections.erase(conn);
+	account.connectionCount.store(account.connections.size(), std::memory_order_relaxed);
+	add(-static_cast<int64_t>(accountedBytes));
+}
+
+
+void BufferBudget::add(int64_t delta)
+{
+	// 只有本线程写 发布用普通的store 不需要带lock前缀的原子加
+	LoopAccount& account = this->account();
+	account.held += delta;
+	account.published.store(account.held, std::memory_order_relaxed);
+	// 用上次汇总时其他loop的占用估算总量 不等下次汇总就开始拒绝连接、暂停读
+	size_t limit = this->limit();
+	if (delta > 0 && limit > 0 && account.held + account.others > static_cast<int64_t>(limit) && !overBudget())
+		_overBudget.store(true, std::memory_order_relaxed);
+}
+
+
+void BufferBudget::notePausedRead(const std::shared_ptr<TcpConnection>& conn)
+{
+	account().paused.push_back(conn);
+	_pausedReads.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void BufferBudget::reconcile(LoopAccount* account)
+{
+	int64_t total = 0;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto&& other : _accounts)
+			total += other->published.load(std::memory_order_relaxed);
+	}
+	account->others = total - account->held;
+	size_t used = static_cast<size_t>(std::max<int64_t>(total, 0));
+	_used.store(used, std::memory_order_relaxed);
+	size_t peak = _peak.load(std::memory_order_relaxed);
+	while (used > peak && !_peak.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+		;
+
+	// 超出预算后降到90%以下才算恢复 避免在预算附近来回切换
+	size_t limit = this->limit();
+	bool over = _overBudget.load(std::memory_order_relaxed);
+	if (limit > 0 && !_overBudgetLogged && used > limit)
+	{
+		over = true;
+		_overBudgetLogged = true;
+		LOG_WARN("BufferBudget: %zu bytes held by connection buffers, over budget %zu\n", used, limit);
+	}
+	else if (over && (limit == 0 || used <= limit / 10 * 9))
+	{
+		over = false;
+		_overBudgetLogged = false;
+		LOG_WARN("BufferBudget: %zu bytes held by connection buffers, back within budget %zu\n", used, limit);
+	}
+	_overBudget.store(over, std::memory_order_relaxed);
+
+	if (!over)
+	{
+		for (auto&& weak : account->paused)
+		{
+			if (TcpConnectionPtr conn = weak.lock())
+				conn->resumeBudgetPausedRead();
+		}
+		account->paused.clear();
+	}
+	else if (used > limit / 10 * 9 && account->held > 0)
+	{
+		// 暂停读之后占用不会再自行下降 一直强制关闭到恢复线以下 按本loop在总占用中的比例分摊
+		size_t target = limit / 10 * 9;
+		int64_t share = static_cast<int64_t>(static_cast<double>(used - target) * account->held / total);
+		if (share > 0)
+			evict(account, share);
+	}
+}
+
+
+void BufferBudget::evict(LoopAccount* account, int64_t bytes)
+{
+	std::vector<std::pair<size_t, TcpConnectionPtr>> candidates;
+	for (auto&& [ptr, weak] : account->connections)
+	{
+		TcpConnectionPtr conn = weak.lock();
+		if (conn && conn->connected())
+			candidates.emplace_back(conn->bufferBytes(), std::move(conn));
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+	int64_t freed = 0;
+	for (auto&& [held, conn] : candidates)
+	{
+		if (freed >= bytes)
+			break;
+		LOG_WARN("BufferBudget: evicting [%s] holding %zu bytes\n", conn->name().data(), held);
+		conn->forceClose();
+		freed += static_cast<int64_t>(held);
+		_evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+}
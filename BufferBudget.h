@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "noncopyable.h"
+
+class EventLoop;
+class TcpConnection;
+
+
+/// @brief 进程内所有连接缓冲区(TcpConnection的输入、输出Buffer)占用内存的预算
+/// 每个loop线程有自己的计数 连接的缓冲区容量变化时只修改所在loop的计数(单写者 不需要原子加)
+/// 各loop每kReconcileInterval秒汇总一次所有loop的计数 两次汇总之间用上次汇总的结果估算总量 超出预算时:
+///  1. TcpServer拒绝新连接(accept后立即关闭)
+///  2. 收到数据后缓冲区中仍有数据未处理或未发出的连接暂停读 回到预算以内后恢复
+///  3. 各loop按自己在总占用中的比例分摊超出恢复线(预算的90%)的部分 从本loop中占用最大的连接开始强制关闭
+/// 在TcpServer::start之前setLimit 为0时(默认)不统计 连接的热路径上只多一次判断
+class BufferBudget : noncopyable
+{
+public:
+	static constexpr double kReconcileInterval = 0.1;
+
+	struct Stats
+	{
+		size_t limitBytes = 0;
+		size_t usedBytes = 0;			// 最近一次汇总的占用
+		size_t peakBytes = 0;
+		size_t connections = 0;			// 参与统计的连接数
+		bool overBudget = false;
+		uint64_t refusedConnections = 0;	// 超出预算时拒绝的新连接
+		uint64_t pausedReads = 0;			// 超出预算时暂停读的次数
+		uint64_t evictions = 0;				// 超出预算时强制关闭的连接
+	};
+
+	static BufferBudget& instance();
+
+	void setLimit(size_t bytes) { _limit.store(bytes, std::memory_order_relaxed); }
+	size_t limit() const { return _limit.load(std::memory_order_relaxed); }
+	bool enabled() const { return limit() > 0; }
+	bool overBudget() const { return _overBudget.load(std::memory_order_relaxed); }
+	Stats stats() const;
+
+	// 以下在loop线程中调用
+	// 在loop中开始定期汇总 TcpServer::start对它的每个loop调用 同一个loop只启动一次
+	void attachLoop(EventLoop* loop);
+	// 连接建立后登记 连接销毁时注销 注销时扣除它仍计入的字节
+	void addConnection(const std::shared_ptr<TcpConnection>& conn);
+	void removeConnection(TcpConnection* conn, size_t accountedBytes);
+	// 连接的缓冲区容量变化
+	void add(int64_t delta);
+	// 超出预算时连接暂停了读 回到预算以内时由本loop恢复
+	void notePausedRead(const std::shared_ptr<TcpConnection>& conn);
+	void noteRefusedConnection() { _refusedConnections.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+	/// @brief 一个loop线程的计数 held只由该线程修改 published是held给其他线程读的副本
+	struct LoopAccount
+	{
+		int64_t held = 0;
+		int64_t others = 0;		// 上次汇总时其他loop的占用
+		std::atomic<int64_t> published{ 0 };
+		std::atomic<size_t> connectionCount{ 0 };
+		std::unordered_map<TcpConnection*, std::weak_ptr<TcpConnection>> connections;
+		std::vector<std::weak_ptr<TcpConnection>> paused;
+		bool attached = false;
+	};
+
+	BufferBudget() = default;
+
+	LoopAccount& account();
+	void reconcile(LoopAccount* account);
+	void evict(LoopAccount* account, int64_t bytes);
+
+	std::atomic<size_t> _limit{ 0 };
+	std::atomic<bool> _overBudget{ false };
+	std::atomic<bool> _overBudgetLogged{ false };
+	std::atomic<size_t> _used{ 0 };
+	std::atomic<size_t> _peak{ 0 };
+	std::atomic<uint64_t> _refusedConnections{ 0 };
+	std::atomic<uint64_t> _pausedReads{ 0 };
+	std::atomic<uint64_t> _evictions{ 0 };
+
+	mutable std::mutex _mutex;
+	std::vector<std::unique_ptr<LoopAccount>> _accounts;	// 只增不减 loop退出后它的计数随连接的销毁归零
+};
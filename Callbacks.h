@@ -16,6 +16,12 @@ using HighWaterMarkCallback = std::function<void(const TcpConnectionPtr &, size_
 
 using MessageCallback = std::function<void(const TcpConnectionPtr&, Buffer*, Timestamp)>;
 
+using TimerCallback = std::function<void()>;
+
+// 用户没有设置回调时TcpServer/TcpClient使用的默认回调 打印连接状态、丢弃收到的数据
+void defaultConnectionCallback(const TcpConnectionPtr& conn);
+void defaultMessageCallback(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp receiveTime);
+
 
 
 
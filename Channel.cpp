@@ -43,7 +43,7 @@ void Channel::remove()
 
 void Channel::handleEventWithGuard(Timestamp receiveTime)
 {
-	LOG_INFO("channel handleEvent revents:%d\n", _revents);
+	LOG_TRACE("channel handleEvent revents:%d\n", _revents);
 
 	// 关闭
 	if ((_revents & EPOLLHUP) && !(_events & EPOLLIN))
@@ -0,0 +1,242 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+#include "Connector.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+
+/// @brief 创建非阻塞的、cloexec的tcp套接字
+static int createNonBlocking()
+{
+	int sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (sockfd < 0)
+		LOG_FATAL("%s:%s:%d connect socket create err:%d\n", __FILE__, __FUNCTION__, __LINE__, errno);
+	return sockfd;
+}
+
+static int getSocketError(int sockfd)
+{
+	int optval = 0;
+	socklen_t optlen = sizeof(optval);
+	if (::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &optval, &optlen) < 0)
+		return errno;
+	return optval;
+}
+
+/// @brief 连接本机端口时 内核可能把临时端口分配成目标端口 造成自己连自己
+static bool isSelfConnect(int sockfd)
+{
+	sockaddr_in local, peer;
+	socklen_t len = sizeof(local);
+	::memset(&local, 0, sizeof(local));
+	::memset(&peer, 0, sizeof(peer));
+	if (::getsockname(sockfd, (sockaddr*)&local, &len) < 0)
+		return false;
+	len = sizeof(peer);
+	if (::getpeername(sockfd, (sockaddr*)&peer, &len) < 0)
+		return false;
+	return local.sin_port == peer.sin_port && local.sin_addr.s_addr == peer.sin_addr.s_addr;
+}
+
+
+Connector::Connector(EventLoop* loop, const InetAddress& serverAddr) :
+	_loop{ loop }, _serverAddr{ serverAddr }, _connect{ false }, _state{ State::Disconnected },
+	_initRetryDelayMs{ kInitRetryDelayMs }, _maxRetryDelayMs{ kMaxRetryDelayMs }, _retryDelayMs{ kInitRetryDelayMs },
+	_tcpFastOpen{ false }
+{
+}
+
+
+Connector::~Connector()
+{
+	if (_channel)
+		LOG_ERROR("Connector::dtor[%s] destroyed while connecting\n", _serverAddr.toIpPort().c_str());
+}
+
+
+void Connector::setRetryDelay(int initialMs, int maxMs)
+{
+	_initRetryDelayMs = initialMs;
+	_maxRetryDelayMs = std::max(initialMs, maxMs);
+	_retryDelayMs = initialMs;
+}
+
+
+void Connector::start()
+{
+	_connect = true;
+	_loop->runInLoop(std::bind(&Connector::startInLoop, shared_from_this()));
+}
+
+
+void Connector::restart()
+{
+	_state = State::Disconnected;
+	_retryDelayMs = _initRetryDelayMs;
+	_connect = true;
+	startInLoop();
+}
+
+
+void Connector::stop()
+{
+	_connect = false;
+	// loop线程中立即停止 之后紧接着析构TcpClient、loop随即退出时 正在进行的连接也已关闭
+	_loop->runInLoop(std::bind(&Connector::stopInLoop, shared_from_this()));
+}
+
+
+void Connector::startInLoop()
+{
+	if (_connect && _state == State::Disconnected)
+		connect();
+}
+
+
+void Connector::stopInLoop()
+{
+	if (_retryTimer.valid())
+	{
+		_loop->cancel(_retryTimer);
+		_retryTimer = TimerId();
+	}
+	if (_state == State::Connecting)
+	{
+		// _connect已经为false retry只会关闭fd
+		int sockfd = removeAndResetChannel();
+		retry(sockfd);
+	}
+}
+
+
+void Connector::connect()
+{
+	int sockfd = createNonBlocking();
+	if (_tcpFastOpen)
+	{
+#ifdef TCP_FASTOPEN_CONNECT
+		int on = 1;
+		if (::setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) < 0)
+			LOG_ERROR("Connector::connect TCP_FASTOPEN_CONNECT not supported, errno:%d\n", errno);
+#else
+		LOG_ERROR("Connector::connect TCP_FASTOPEN_CONNECT not available on this platform\n");
+#endif
+	}
+
+	int ret = ::connect(sockfd, (sockaddr*)_serverAddr.getSockAddr(), sizeof(sockaddr_in));
+	int savedErrno = (ret == 0) ? 0 : errno;
+	switch (savedErrno)
+	{
+	case 0:
+	case EINPROGRESS:
+	case EINTR:
+	case EISCONN:
+		connecting(sockfd);
+		break;
+
+	// 暂时性的错误 稍后重试
+	case EAGAIN:
+	case EADDRINUSE:
+	case EADDRNOTAVAIL:
+	case ECONNREFUSED:
+	case ENETUNREACH:
+		retry(sockfd);
+		break;
+
+	default:
+		LOG_ERROR("Connector::connect [%s] error:%d\n", _serverAddr.toIpPort().c_str(), savedErrno);
+		::close(sockfd);
+		break;
+	}
+}
+
+
+void Connector::connecting(int sockfd)
+{
+	_state = State::Connecting;
+	_channel.reset(new Channel(_loop, sockfd));
+	_channel->setWriteCallback(std::bind(&Connector::handleWrite, this));
+	_channel->setErrorCallback(std::bind(&Connector::handleError, this));
+	// 连接完成(或失败)时socket变为可写
+	_channel->enableWriting();
+}
+
+
+void Connector::handleWrite()
+{
+	if (_state != State::Connecting)
+		return;
+
+	int sockfd = removeAndResetChannel();
+	int err = getSocketError(sockfd);
+	if (err != 0)
+	{
+		LOG_ERROR("Connector::handleWrite [%s] SO_ERROR:%d\n", _serverAddr.toIpPort().c_str(), err);
+		retry(sockfd);
+	}
+	else if (isSelfConnect(sockfd))
+	{
+		LOG_ERROR("Connector::handleWrite [%s] self connect\n", _serverAddr.toIpPort().c_str());
+		retry(sockfd);
+	}
+	else
+	{
+		_state = State::Connected;
+		if (_connect && _newConnectionCallback)
+			_newConnectionCallback(sockfd);
+		else
+			::close(sockfd);
+	}
+}
+
+
+void Connector::handleError()
+{
+	if (_state != State::Connecting)
+		return;
+
+	int sockfd = removeAndResetChannel();
+	LOG_ERROR("Connector::handleError [%s] SO_ERROR:%d\n", _serverAddr.toIpPort().c_str(), getSocketError(sockfd));
+	retry(sockfd);
+}
+
+
+void Connector::retry(int sockfd)
+{
+	::close(sockfd);
+	_state = State::Disconnected;
+	if (!_connect)
+		return;
+
+	LOG_INFO("Connector::retry connecting to %s in %d milliseconds\n", _serverAddr.toIpPort().c_str(), _retryDelayMs);
+	// 定时器只持有弱引用 Connector先于定时器销毁时什么都不做
+	std::weak_ptr<Connector> weakSelf(shared_from_this());
+	_retryTimer = _loop->runAfter(_retryDelayMs / 1000.0, [weakSelf]() {
+		if (ConnectorPtr self = weakSelf.lock())
+		{
+			self->_retryTimer = TimerId();
+			self->startInLoop();
+		}
+	});
+	_retryDelayMs = std::min(_retryDelayMs * 2, _maxRetryDelayMs);
+}
+
+
+int Connector::removeAndResetChannel()
+{
+	_channel->disableAll();
+	_channel->remove();
+	int sockfd = _channel->fd();
+	// 此时可能正在Channel::handleEvent之中 不能直接释放channel 转交给一个延后执行的回调释放
+	std::shared_ptr<Channel> channel(std::move(_channel));
+	_loop->queueInLoop([channel]() {});
+	return sockfd;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <atomic>
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "TimerId.h"
+
+class Channel;
+class EventLoop;
+
+/// @brief 主动发起连接 TcpClient使用 与Acceptor相对应
+/// 非阻塞connect 通过Channel的可写事件得知连接结果 失败后按指数退避重试 可选TCP Fast Open
+class Connector : public noncopyable, public std::enable_shared_from_this<Connector>
+{
+public:
+	using NewConnectionCallback = std::function<void(int sockfd)>;
+
+	static constexpr int kInitRetryDelayMs = 500;
+	static constexpr int kMaxRetryDelayMs = 30 * 1000;
+
+	Connector(EventLoop* loop, const InetAddress& serverAddr);
+	~Connector();
+
+	void setNewConnectionCallback(NewConnectionCallback cb) { _newConnectionCallback = std::move(cb); }
+	// 重试间隔从initialMs开始每次翻倍 不超过maxMs 需要在start之前设置
+	void setRetryDelay(int initialMs, int maxMs);
+	// 使用TCP_FASTOPEN_CONNECT: connect立即返回 SYN随第一次write发出 服务端也需要开启TCP_FASTOPEN才能省去一个RTT
+	void setTcpFastOpen(bool on) { _tcpFastOpen = on; }
+
+	const InetAddress& serverAddress() const { return _serverAddr; }
+
+	// 线程安全
+	void start();
+	// 连接断开后重新连接 重置重试间隔 只能在loop线程中调用
+	void restart();
+	// 线程安全 停止正在进行的连接和重试
+	void stop();
+
+private:
+	enum class State : int
+	{
+		Disconnected,
+		Connecting,
+		Connected
+	};
+
+	void startInLoop();
+	void stopInLoop();
+	void connect();
+	// connect返回EINPROGRESS等 注册可写事件等待结果
+	void connecting(int sockfd);
+	void handleWrite();
+	void handleError();
+	// 关闭sockfd 若仍需连接则在退避时间后重试
+	void retry(int sockfd);
+	// 注销channel并返回其fd channel本身延后释放 此时可能正处于它的回调之中
+	int removeAndResetChannel();
+
+	EventLoop* _loop;
+	InetAddress _serverAddr;
+	std::atomic<bool> _connect;		// 是否需要连接 stop后为false
+	std::atomic<State> _state;
+	std::unique_ptr<Channel> _channel;
+	NewConnectionCallback _newConnectionCallback;
+	int _initRetryDelayMs;
+	int _maxRetryDelayMs;
+	int _retryDelayMs;
+	TimerId _retryTimer;
+	bool _tcpFastOpen;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
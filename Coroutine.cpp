@@ -0,0 +1,128 @@
+#include <new>
+#include <memory>
+
+#include "Coroutine.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+
+namespace
+{
+	constexpr size_t kSizeClasses = CoroutineFrameAllocator::kMaxCachedSize / CoroutineFrameAllocator::kGranularity;
+
+	struct FreeFrame
+	{
+		FreeFrame* next;
+	};
+
+	/// @brief 一个线程缓存的空闲帧 每个大小级别一条链表
+	struct FramePool
+	{
+		FreeFrame* frames[kSizeClasses] = {};
+		size_t counts[kSizeClasses] = {};
+
+		~FramePool()
+		{
+			for (size_t i = 0; i < kSizeClasses; ++i)
+			{
+				while (FreeFrame* frame = frames[i])
+				{
+					frames[i] = frame->next;
+					::operator delete(frame);
+				}
+			}
+		}
+	};
+
+	// 线程退出时缓存随t_owner析构 之后(其他thread_local对象析构时)才销毁的协程帧直接释放
+	thread_local FramePool* t_pool = nullptr;
+	thread_local bool t_exited = false;
+
+	struct FramePoolOwner
+	{
+		std::unique_ptr<FramePool> pool;
+		~FramePoolOwner()
+		{
+			t_pool = nullptr;
+			t_exited = true;
+		}
+	};
+
+	FramePool* poolForCurrentThread()
+	{
+		if (!t_pool && !t_exited)
+		{
+			static thread_local FramePoolOwner t_owner;
+			t_owner.pool.reset(new FramePool);
+			t_pool = t_owner.pool.get();
+		}
+		return t_pool;
+	}
+
+	// 按kGranularity向上取整后的级别 超出缓存范围时返回kSizeClasses
+	size_t sizeClass(size_t size)
+	{
+		return size == 0 || size > CoroutineFrameAllocator::kMaxCachedSize ? kSizeClasses : (size - 1) / CoroutineFrameAllocator::kGranularity;
+	}
+}
+
+
+void* CoroutineFrameAllocator::allocate(size_t size)
+{
+	size_t index = sizeClass(size);
+	if (index == kSizeClasses)
+		return ::operator new(size);
+	if (FramePool* pool = poolForCurrentThread())
+	{
+		if (FreeFrame* frame = pool->frames[index])
+		{
+			pool->frames[index] = frame->next;
+			pool->counts[index]--;
+			return frame;
+		}
+	}
+	return ::operator new((index + 1) * kGranularity);
+}
+
+
+void CoroutineFrameAllocator::deallocate(void* p, size_t size)
+{
+	size_t index = sizeClass(size);
+	FramePool* pool = index == kSizeClasses ? nullptr : poolForCurrentThread();
+	if (!pool || pool->counts[index] >= kMaxCachedPerSize)
+	{
+		::operator delete(p);
+		return;
+	}
+	FreeFrame* frame = static_cast<FreeFrame*>(p);
+	frame->next = pool->frames[index];
+	pool->frames[index] = frame;
+	pool->counts[index]++;
+}
+
+
+void detail::reportDetachedException(std::exception_ptr exception)
+{
+	try
+	{
+		std::rethrow_exception(exception);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR("spawned coroutine exited with exception: %s\n", e.what());
+	}
+	catch (...)
+	{
+		LOG_ERROR("spawned coroutine exited with unknown exception\n");
+	}
+}
+
+
+void spawn(EventLoop* loop, Task<void> task)
+{
+	Task<void>::Handle handle = std::exchange(task._handle, nullptr);
+	if (!handle)
+		return;
+	handle.promise().detached = true;
+	loop->runInLoop([handle]() { handle.resume(); });
+}
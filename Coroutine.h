@@ -0,0 +1,188 @@
+#pragma once
+
+#include <coroutine>
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <cstddef>
+
+#include "noncopyable.h"
+
+class EventLoop;
+
+
+/// @brief 协程帧的分配器 每个loop线程一个缓存 按64字节分级缓存释放的帧 下一次创建同样大小的协程时直接复用
+/// 协程总是在所属的loop线程中恢复 帧基本都在同一个线程中分配和释放 缓存不加锁
+/// 帧随协程切换到其他loop(co_await otherLoop.post())后在那边释放时 放进那个线程的缓存
+class CoroutineFrameAllocator : noncopyable
+{
+public:
+	static constexpr size_t kGranularity = 64;
+	static constexpr size_t kMaxCachedSize = 4096;	// 更大的帧不缓存
+	static constexpr size_t kMaxCachedPerSize = 256;
+
+	static void* allocate(size_t size);
+	static void deallocate(void* p, size_t size);
+};
+
+
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+	// 分离运行(spawn)的协程抛出的异常没有人接收 只能写日志
+	void reportDetachedException(std::exception_ptr exception);
+
+	struct TaskPromiseBase
+	{
+		std::coroutine_handle<> continuation;	// co_await本协程的协程 结束时切换回去
+		bool detached = false;					// 由spawn启动 结束时自己销毁
+		// 等待者挂起与本协程结束谁先发生 后到的一方负责恢复等待者 本协程可能在其他loop线程中结束
+		std::atomic<bool> awaiterSuspendedOrDone{ false };
+		std::exception_ptr exception;
+
+		static void* operator new(size_t size) { return CoroutineFrameAllocator::allocate(size); }
+		static void operator delete(void* p, size_t size) { CoroutineFrameAllocator::deallocate(p, size); }
+
+		// 创建后不立即运行 由co_await或spawn启动
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			// 同步完成时等待者还在await_suspend中 由它自己继续 异步完成时对称转移到等待者
+			template <typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+			{
+				TaskPromiseBase& promise = handle.promise();
+				if (promise.continuation)
+					return promise.awaiterSuspendedOrDone.exchange(true, std::memory_order_acq_rel) ? promise.continuation : std::noop_coroutine();
+				if (promise.detached)
+				{
+					if (promise.exception)
+						reportDetachedException(promise.exception);
+					handle.destroy();
+				}
+				return std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+
+	template <typename T>
+	struct TaskPromise : TaskPromiseBase
+	{
+		std::optional<T> value;
+
+		Task<T> get_return_object() { return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this)); }
+		template <typename U>
+		void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+		T result()
+		{
+			if (exception)
+				std::rethrow_exception(exception);
+			return std::move(*value);
+		}
+	};
+
+	template <>
+	struct TaskPromise<void> : TaskPromiseBase
+	{
+		Task<void> get_return_object();
+		void return_void() {}
+		void result()
+		{
+			if (exception)
+				std::rethrow_exception(exception);
+		}
+	};
+}
+
+
+/// @brief 协程的返回类型 协程体中可以co_await本库的各种等待对象以及其他Task
+/// 创建后不运行 被co_await时才开始执行 执行完后切回等待者并得到co_return的值(或重新抛出异常)
+/// 最外层的Task交给spawn在loop中运行 协程帧由CoroutineFrameAllocator分配
+///
+///     Task<> session(TcpConnectionPtr conn)
+///     {
+///         for (;;)
+///         {
+///             std::string line = co_await conn->readUntil("\r\n");
+///             if (line.empty())
+///                 co_return;		// 连接已关闭
+///             if (!co_await conn->send(line))
+///                 co_return;
+///         }
+///     }
+///     // 连接回调中
+///     spawn(conn->getLoop(), session(conn));
+template <typename T>
+class Task : noncopyable
+{
+public:
+	using promise_type = detail::TaskPromise<T>;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	explicit Task(Handle handle) : _handle{ handle } {}
+	Task(Task&& other) noexcept : _handle{ std::exchange(other._handle, nullptr) } {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (_handle)
+				_handle.destroy();
+			_handle = std::exchange(other._handle, nullptr);
+		}
+		return *this;
+	}
+	~Task()
+	{
+		if (_handle)
+			_handle.destroy();
+	}
+
+	auto operator co_await() noexcept
+	{
+		struct Awaiter
+		{
+			Handle handle;
+
+			bool await_ready() noexcept { return !handle || handle.done(); }
+			// 在这里运行子协程 它同步完成时返回false不挂起 直接继续 而不是由子协程结束时再恢复等待者
+			// 对称转移在-O0下不一定是尾调用 循环中co_await大量同步完成的子协程会让栈一直增长
+			bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				promise_type& promise = handle.promise();
+				promise.continuation = awaiting;
+				handle.resume();
+				return !promise.awaiterSuspendedOrDone.exchange(true, std::memory_order_acq_rel);
+			}
+			T await_resume() { return handle.promise().result(); }
+		};
+		return Awaiter{ _handle };
+	}
+
+private:
+	friend void spawn(EventLoop* loop, Task<void> task);
+
+	Handle _handle;
+};
+
+
+namespace detail
+{
+	inline Task<void> TaskPromise<void>::get_return_object()
+	{
+		return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+	}
+}
+
+
+/// @brief 在loop中启动task 不等待它结束 在loop线程中调用时立即运行到第一个挂起点 否则投递到loop线程
+/// 协程结束后自己销毁帧 没有捕获的异常写入错误日志
+void spawn(EventLoop* loop, Task<void> task);
@@ -27,26 +27,27 @@ EpollPoller::~EpollPoller()
 
 Timestamp EpollPoller::poll(int timeoutMs, ChannelList& channelList)
 {
-	// 由于频繁调用poll 实际上应该用LOG_DEBUG输出日志更为合理 当遇到并发场景 关闭DEBUG日志提升效率
-    LOG_DEBUG("func=%s => fd total count:%lu\n", __FUNCTION__, channels_.size());
+	// 每次poll、每个事件和每次修改关注的事件都会调用 只输出TRACE日志 默认在编译期去掉
+    LOG_TRACE("func=%s => fd total count:%lu\n", __FUNCTION__, _channels.size());
 
 	int numEvents = ::epoll_wait(_epollfd, _events.data(), static_cast<int>(_events.size()), timeoutMs);
 	Timestamp now{Timestamp::now()};
 
 	if (numEvents > 0)
 	{
-		LOG_DEBUG("%d events happend\n", numEvents);
+		LOG_TRACE("%d events happend\n", numEvents);
 		this->fillActiveChannels(numEvents, channelList);
 		if (numEvents == _events.size())
 			_events.resize(_events.size() * 2);
 	}
 	else if (numEvents == 0)
-		LOG_DEBUG("%s timeout!\n", __FUNCTION__);
+		LOG_TRACE("%s timeout!\n", __FUNCTION__);
 	else
 	{
-		if (errno == EINTR)
+		// 被信号中断不是错误 下一轮重新poll即可
+		if (errno != EINTR)
 		{
-			LOG_ERROR("EpollPoller::poll error!");
+			LOG_ERROR("EpollPoller::poll error:%d\n", errno);
 		}
 	}
 	return now;
@@ -57,7 +58,7 @@ Timestamp EpollPoller::poll(int timeoutMs, ChannelList& channelList)
 void EpollPoller::updateChannel(Channel& channel)
 {
 	const int index = channel.index();
-	LOG_INFO("func=%s => fd=%d events=%d index=%d\n", __FUNCTION__, channel.fd(), channel.events(), index);
+	LOG_TRACE("func=%s => fd=%d events=%d index=%d\n", __FUNCTION__, channel.fd(), channel.events(), index);
 
 	if (index == New || index == Deleted)
 	{
@@ -89,10 +90,11 @@ void EpollPoller::removeChannel(Channel& channel)
 	int fd = channel.fd();
 	_channels.erase(fd);
 
-	LOG_INFO("func=%s => fd=%d\n", __FUNCTION__, fd);
+	LOG_TRACE("func=%s => fd=%d\n", __FUNCTION__, fd);
 
+	// 只有仍注册在epoll中的channel才需要EPOLL_CTL_DEL disableAll之后状态已经是Deleted
 	int index = channel.index();
-	if (Added)
+	if (index == Added)
 		update(EPOLL_CTL_DEL, channel);
 	channel.set_index(New);
 }
@@ -1,4 +1,5 @@
 #include <sys/eventfd.h>
+#include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <cerrno>
@@ -9,6 +10,7 @@
 #include "Logger.h"
 #include "Channel.h"
 #include "Poller.h"
+#include "TimerQueue.h"
 
 using namespace std::placeholders;
 
@@ -17,6 +19,14 @@ using namespace std::placeholders;
 /// @brief 防止一个线程创建多个EventLoop
 thread_local EventLoop* loopInThisThread = nullptr;
 
+/// @brief 对端已关闭的连接上write会触发SIGPIPE 默认动作是终止进程 网络库中统一忽略 由write返回EPIPE处理
+class IgnoreSigPipe
+{
+public:
+	IgnoreSigPipe() { ::signal(SIGPIPE, SIG_IGN); }
+};
+static IgnoreSigPipe ignoreSigPipe;
+
 /// @brief 默认的Poller IO复用接口的超时时间
 constexpr int PollTimeout = 10000;
 
@@ -48,9 +58,11 @@ inline int createEventfd()   // 创建wakeupfd 用来notify唤醒subReactor处
 
 EventLoop::EventLoop() : 
 		_looping{ false }, _quit{ false }, _callingPendingFunctors{ false }, _threadId{ CurrentThread::tid() },
-		_poller{ Poller::newDefaultPoller(this) }, _wakeupFd{ ::createEventfd() }, _wakeupChannel{ new Channel(this, _wakeupFd) }
+		_poller{ Poller::newDefaultPoller(this) }, _timerQueue{ new TimerQueue(this) },
+		_wakeupFd{ ::createEventfd() }, _wakeupChannel{ new Channel(this, _wakeupFd) }
 {
 	LOG_DEBUG("EventLoop created %p in thread %d\n", this, _threadId);
+	_pollReturnTime = Timestamp::now();
 	if (::loopInThisThread)
 		LOG_FATAL("Another EventLoop %p exists in the thread %d\n", ::loopInThisThread, _threadId);
 	else
@@ -152,6 +164,55 @@ void EventLoop::wakeup()
 }
 
 
+/// @brief 从现在开始seconds秒之后的时间点
+static Timer::Clock::time_point fromNow(double seconds)
+{
+	return Timer::Clock::now() + std::chrono::duration_cast<Timer::Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+
+TimerId EventLoop::runAfter(double delay, TimerCallback cb)
+{
+	return _timerQueue->addTimer(std::move(cb), fromNow(delay), 0.0);
+}
+
+
+TimerId EventLoop::runEvery(double interval, TimerCallback cb)
+{
+	return _timerQueue->addTimer(std::move(cb), fromNow(interval), interval);
+}
+
+
+void EventLoop::cancel(TimerId timerId)
+{
+	_timerQueue->cancel(timerId);
+}
+
+
+EventLoop::SleepAwaitable EventLoop::sleep(double seconds)
+{
+	return SleepAwaitable(this, seconds);
+}
+
+
+EventLoop::PostAwaitable EventLoop::post()
+{
+	return PostAwaitable(this);
+}
+
+
+void EventLoop::SleepAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	_loop->runAfter(_seconds, [handle]() { handle.resume(); });
+}
+
+
+void EventLoop::PostAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	_loop->queueInLoop([handle]() { handle.resume(); });
+}
+
+
 // EventLoop的方法 => Poller的方法
 void EventLoop::removeChannel(Channel& channel)
 {
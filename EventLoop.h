@@ -5,13 +5,17 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <coroutine>
 
 #include "noncopyable.h"
 #include "Timestamp.h"
 #include "CurrentThread.h"
+#include "Callbacks.h"
+#include "TimerId.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
 
 
 /// @brief 事件循环，一个线程最多只有一个EventLoop, 主要包含了两个大模块 Channel Poller(epoll的抽象)
@@ -29,6 +33,9 @@ public:
 	void quit();
 
 	Timestamp pollReturnTime() const { return _pollReturnTime; }
+	// 本轮事件循环的当前时间 每次poll返回时刷新一次 同一轮中的回调共用 不必各自读时钟
+	// 只在loop线程中使用 精度足够做超时判断和http的Date头部 测量单个请求的耗时请用Timestamp::now()
+	Timestamp now() const { return _pollReturnTime; }
 
 	/// @brief 立即在当前loop中执行回调函数cb
 	/// @param cb 
@@ -40,6 +47,21 @@ public:
 	/// @brief 通过eventfd唤醒loop所在的线程
 	void wakeup();
 
+	/// @brief 在delay秒之后于loop线程中执行cb 线程安全
+	TimerId runAfter(double delay, TimerCallback cb);
+	/// @brief 每隔interval秒于loop线程中执行一次cb 线程安全
+	TimerId runEvery(double interval, TimerCallback cb);
+	/// @brief 取消定时器 线程安全
+	void cancel(TimerId timerId);
+
+	class SleepAwaitable;
+	class PostAwaitable;
+	/// @brief 协程中 co_await loop->sleep(seconds) 挂起seconds秒 由定时器在本loop线程中恢复 见Coroutine.h
+	SleepAwaitable sleep(double seconds);
+	/// @brief 协程中 co_await loop->post() 挂起并投递到本loop的任务队列 在本loop线程中恢复
+	/// 在本loop线程中调用时让出一轮 先处理其他就绪的事件 在其他线程中调用时协程切换到本loop中继续执行
+	PostAwaitable post();
+
 	// EventLoop的方法 => Poller的方法
 	void updateChannel(Channel& channel);
 	void removeChannel(Channel& channel);
@@ -67,6 +89,7 @@ private:
 
 	Timestamp _pollReturnTime;  // poller返回发生事件的Channel的时间点
 	std::unique_ptr<Poller> _poller; // 一个EventLoop只有一个Poller，所以用独占指针
+	std::unique_ptr<TimerQueue> _timerQueue; // 定时器队列 依赖_poller 必须在其后构造
 
 	int _wakeupFd; // 当mainLoop获取一个新用户的Channel 需通过轮询算法选择一个subLoop 通过该成员唤醒subLoop处理Channel
 	std::unique_ptr<Channel> _wakeupChannel;	// 一个EventLoop只有一个wakeupfd，所以用独占指针
@@ -77,3 +100,32 @@ private:
 	std::vector<Functor> _pendingFunctors;    		// 存储loop需要执行的所有回调操作
 	std::mutex _pendingMtx;  						// 保护上面vector容器的线程安全操作
 };
+
+
+class EventLoop::SleepAwaitable
+{
+public:
+	SleepAwaitable(EventLoop* loop, double seconds) : _loop{ loop }, _seconds{ seconds } {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+
+private:
+	EventLoop* _loop;
+	double _seconds;
+};
+
+
+class EventLoop::PostAwaitable
+{
+public:
+	explicit PostAwaitable(EventLoop* loop) : _loop{ loop } {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+
+private:
+	EventLoop* _loop;
+};
@@ -38,7 +38,7 @@ EventLoop* EventLoopThreadPool::getNextLoop()
 	// 如果只设置一个线程 也就是只有一个mainReactor 无subReactor 那么轮询只有一个线程 getNextLoop()每次都返回当前的_baseLoop
 	EventLoop* loop = _baseloop;
 
-	if (_loops.empty())
+	if (!_loops.empty())
 	{
 		loop = _loops[_next];
 		_next++;
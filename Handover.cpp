@@ -0,0 +1,233 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <cstring>
+#include <vector>
+
+#include "Handover.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+
+namespace
+{
+	// 每条消息的头部 后面紧跟data
+	struct MessageHeader
+	{
+		uint32_t type;
+		uint32_t dataLength;
+		sockaddr_in peer;
+	};
+
+	bool makeAddress(const std::string& path, sockaddr_un* addr)
+	{
+		::memset(addr, 0, sizeof(*addr));
+		addr->sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr->sun_path))
+		{
+			LOG_ERROR("Handover unix socket path too long: %s\n", path.data());
+			return false;
+		}
+		::memcpy(addr->sun_path, path.data(), path.size());
+		return true;
+	}
+}
+
+
+Handover::Handover(int sockfd) : _sockfd{ sockfd }
+{
+	timeval timeout = { kTimeoutSeconds, 0 };
+	::setsockopt(_sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	::setsockopt(_sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+
+Handover::~Handover()
+{
+	::close(_sockfd);
+}
+
+
+std::unique_ptr<Handover> Handover::connect(const std::string& path)
+{
+	sockaddr_un addr;
+	if (!makeAddress(path, &addr))
+		return nullptr;
+	int sockfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sockfd < 0)
+	{
+		LOG_ERROR("Handover::connect socket error:%d\n", errno);
+		return nullptr;
+	}
+	if (::connect(sockfd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		// 没有旧进程在运行 正常冷启动
+		LOG_INFO("Handover::connect %s: no running process (errno %d)\n", path.data(), errno);
+		::close(sockfd);
+		return nullptr;
+	}
+	return std::make_unique<Handover>(sockfd);
+}
+
+
+bool Handover::send(MessageType type, int fd, const InetAddress& peer, const char* data, size_t len)
+{
+	MessageHeader header;
+	::memset(&header, 0, sizeof(header));
+	header.type = static_cast<uint32_t>(type);
+	header.dataLength = static_cast<uint32_t>(len);
+	header.peer = *peer.getSockAddr();
+
+	iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = const_cast<char*>(data);
+	iov[1].iov_len = len;
+
+	msghdr msg;
+	::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len > 0 ? 2 : 1;
+
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+	if (fd >= 0)
+	{
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t n = ::sendmsg(_sockfd, &msg, MSG_NOSIGNAL);
+	if (n != static_cast<ssize_t>(sizeof(header) + len))
+	{
+		LOG_ERROR("Handover::send type %u error:%d\n", header.type, errno);
+		return false;
+	}
+	return true;
+}
+
+
+bool Handover::receive(Message* message)
+{
+	std::vector<char> buffer(sizeof(MessageHeader) + kMaxUnreadBytes);
+	iovec iov = { buffer.data(), buffer.size() };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+	msghdr msg;
+	::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t n = ::recvmsg(_sockfd, &msg, MSG_CMSG_CLOEXEC);
+	message->fd = -1;
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			::memcpy(&message->fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	MessageHeader header;
+	if (n < static_cast<ssize_t>(sizeof(header)) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+	{
+		if (n < 0)
+			LOG_ERROR("Handover::receive error:%d\n", errno);
+		else if (n > 0)
+			LOG_ERROR("Handover::receive malformed message of %ld bytes\n", n);
+		if (message->fd >= 0)
+			::close(message->fd);
+		message->fd = -1;
+		return false;
+	}
+
+	::memcpy(&header, buffer.data(), sizeof(header));
+	if (header.dataLength != n - sizeof(header))
+	{
+		LOG_ERROR("Handover::receive length mismatch\n");
+		if (message->fd >= 0)
+			::close(message->fd);
+		message->fd = -1;
+		return false;
+	}
+	message->type = static_cast<MessageType>(header.type);
+	message->peer.setSockAddr(header.peer);
+	message->data.assign(buffer.data() + sizeof(header), header.dataLength);
+	return true;
+}
+
+
+HandoverListener::HandoverListener(EventLoop* loop, std::string path) :
+	_loop{ loop }, _path{ std::move(path) }, _listenfd{ -1 }, _inode{ 0 }
+{
+}
+
+
+HandoverListener::~HandoverListener()
+{
+	if (_channel)
+	{
+		_channel->disableAll();
+		_channel->remove();
+	}
+	if (_listenfd >= 0)
+		::close(_listenfd);
+
+	// 新进程已经在同一路径上重新监听时 不能删掉它的socket文件
+	struct stat st;
+	if (_inode != 0 && ::stat(_path.data(), &st) == 0 && st.st_ino == _inode)
+		::unlink(_path.data());
+}
+
+
+void HandoverListener::listen()
+{
+	sockaddr_un addr;
+	if (!makeAddress(_path, &addr))
+		return;
+	_listenfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_listenfd < 0)
+	{
+		LOG_ERROR("HandoverListener::listen socket error:%d\n", errno);
+		return;
+	}
+	::unlink(_path.data());
+	if (::bind(_listenfd, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(_listenfd, 4) < 0)
+	{
+		LOG_ERROR("HandoverListener::listen %s error:%d\n", _path.data(), errno);
+		::close(_listenfd);
+		_listenfd = -1;
+		return;
+	}
+	struct stat st;
+	if (::stat(_path.data(), &st) == 0)
+		_inode = st.st_ino;
+
+	_channel.reset(new Channel(_loop, _listenfd));
+	_channel->setReadCallback(std::bind(&HandoverListener::handleRead, this));
+	_channel->enableReading();
+}
+
+
+void HandoverListener::handleRead()
+{
+	// 会话使用阻塞的socket
+	int sockfd = ::accept4(_listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (sockfd < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			LOG_ERROR("HandoverListener::handleRead accept error:%d\n", errno);
+		return;
+	}
+	LOG_INFO("HandoverListener %s: handover requested\n", _path.data());
+	auto handover = std::make_unique<Handover>(sockfd);
+	if (_handoverCallback)
+		_handoverCallback(std::move(handover));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "Channel.h"
+
+class EventLoop;
+
+
+/*
+ * 进程重启时交接监听socket与空闲连接 不丢弃全连接队列 也不引发客户端重连风暴
+ * 旧进程用HandoverListener监听一个Unix socket路径 新进程Handover::connect到该路径后:
+ * 1. 新进程 TcpServer::receiveListeners  <= 旧进程 TcpServer::handover 暂停accept 逐个发送监听socket(Listener)与ListenersDone
+ * 2. 新进程 start后TcpServer::adoptConnections 发送Ack => 旧进程收到Ack后才交出连接 没有收到时恢复accept 继续服务
+ * 3. 新进程逐个接管连接(Connection 附带旧进程中未处理的输入)直到ConnectionsDone 旧进程处理完剩下的连接后退出
+ * 监听socket在交接前后是同一个内核对象 队列中的连接由新进程继续accept
+ */
+
+/// @brief 一次交接会话 封装连接好的SOCK_SEQPACKET Unix socket 每条消息是一个完整的记录 最多带一个fd(SCM_RIGHTS)
+/// 收发都是阻塞的 超时为kTimeoutSeconds 交接只在重启时进行一次 不值得做成非阻塞的状态机
+class Handover : noncopyable
+{
+public:
+	enum class MessageType : uint32_t
+	{
+		Listener = 1,		// 一个监听socket
+		ListenersDone,		// 监听socket已全部发出
+		Ack,				// 新进程已经开始accept 可以交出连接
+		Connection,			// 一个已建立的连接 data为旧进程中未处理的输入
+		ConnectionsDone		// 连接已全部发出 交接结束
+	};
+
+	struct Message
+	{
+		MessageType type;
+		int fd = -1;				// 收到的fd归调用者所有 设置了cloexec
+		InetAddress peer;
+		std::string data;
+	};
+
+	// 未处理的输入超过这么多的连接不参与交接 一条消息要能放进Unix socket的发送缓冲区
+	static constexpr size_t kMaxUnreadBytes = 64 * 1024;
+	static constexpr int kTimeoutSeconds = 5;
+
+	// 接管一个已连接的Unix socket
+	explicit Handover(int sockfd);
+	~Handover();
+
+	// 新进程连接旧进程的HandoverListener 旧进程不存在时返回空
+	static std::unique_ptr<Handover> connect(const std::string& path);
+
+	int fd() const { return _sockfd; }
+
+	bool send(MessageType type, int fd = -1, const InetAddress& peer = InetAddress(), const char* data = nullptr, size_t len = 0);
+	bool receive(Message* message);
+
+private:
+	const int _sockfd;
+};
+
+
+/// @brief 旧进程中监听交接请求的Unix socket 注册在一个loop中 新进程连接上来时把会话交给回调
+/// 监听前会删除路径上已有的socket文件(上一代进程留下的) 析构时只删除自己创建的那个
+class HandoverListener : noncopyable
+{
+public:
+	using HandoverCallback = std::function<void(std::unique_ptr<Handover>)>;
+
+	HandoverListener(EventLoop* loop, std::string path);
+	~HandoverListener();
+
+	void setHandoverCallback(HandoverCallback cb) { _handoverCallback = std::move(cb); }
+	void listen();
+
+private:
+	void handleRead();
+
+	EventLoop* _loop;
+	const std::string _path;
+	int _listenfd;
+	ino_t _inode;		// 本进程创建的socket文件
+	std::unique_ptr<Channel> _channel;
+	HandoverCallback _handoverCallback;
+};
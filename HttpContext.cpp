@@ -0,0 +1,350 @@
+#include <cstring>
+#include <strings.h>
+#include <string_view>
+#include <algorithm>
+
+#include "HttpContext.h"
+#include "Buffer.h"
+
+
+/// @brief 大小写不敏感的比较
+static bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+{
+	return lhs.size() == rhs.size() && ::strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+/// @brief 判断逗号分隔的头部值中是否包含token 如 Connection: keep-alive, Upgrade
+static bool hasToken(std::string_view value, std::string_view token)
+{
+	while (!value.empty())
+	{
+		size_t comma = value.find(',');
+		std::string_view item = value.substr(0, comma);
+		while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+			item.remove_prefix(1);
+		while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+			item.remove_suffix(1);
+		if (equalsIgnoreCase(item, token))
+			return true;
+		if (comma == std::string_view::npos)
+			break;
+		value.remove_prefix(comma + 1);
+	}
+	return false;
+}
+
+static HttpRequest::Method parseMethod(std::string_view method)
+{
+	using Method = HttpRequest::Method;
+	switch (method.size())
+	{
+	case 3:
+		if (method == "GET")
+			return Method::Get;
+		if (method == "PUT")
+			return Method::Put;
+		break;
+	case 4:
+		if (method == "POST")
+			return Method::Post;
+		if (method == "HEAD")
+			return Method::Head;
+		break;
+	case 5:
+		if (method == "PATCH")
+			return Method::Patch;
+		break;
+	case 6:
+		if (method == "DELETE")
+			return Method::Delete;
+		break;
+	case 7:
+		if (method == "OPTIONS")
+			return Method::Options;
+		break;
+	}
+	return Method::Invalid;
+}
+
+
+HttpContext::HttpContext() :
+	_state{ State::ExpectHead }, _scanned{ 0 }, _headLen{ 0 }, _contentLength{ 0 }, _pos{ 0 },
+	_chunkRemaining{ 0 }, _hasContentLength{ false }, _errorStatus{ 0 }
+{
+}
+
+
+HttpContext::ParseResult HttpContext::fail(int status)
+{
+	_errorStatus = status;
+	return ParseResult::Error;
+}
+
+
+bool HttpContext::reject(int status)
+{
+	_errorStatus = status;
+	return false;
+}
+
+
+HttpContext::ParseResult HttpContext::parseRequest(Buffer* buf, Timestamp receiveTime)
+{
+	while (true)
+	{
+		const char* begin = buf->peek();
+		const size_t readable = buf->readableBytes();
+
+		switch (_state)
+		{
+		case State::ExpectHead:
+		{
+			// 从上次扫描结束的位置往回退3个字节开始找 防止"\r\n\r\n"恰好被两次读取截断
+			size_t start = _scanned > 3 ? _scanned - 3 : 0;
+			const void* crlf2 = ::memmem(begin + start, readable - start, "\r\n\r\n", 4);
+			if (crlf2 == nullptr)
+			{
+				if (readable > kMaxHeadSize)
+					return fail(431);
+				_scanned = readable;
+				return ParseResult::Incomplete;
+			}
+
+			_headLen = static_cast<const char*>(crlf2) - begin + 4;
+			if (_headLen > kMaxHeadSize)
+				return fail(431);
+			if (!parseHead(begin, _headLen))
+				return ParseResult::Error;
+			_request._receiveTime = receiveTime;
+			_pos = _headLen;
+
+			if (_request._chunked)
+			{
+				_chunkedBody.clear();
+				_state = State::ExpectChunkSize;
+			}
+			else if (_contentLength > 0)
+			{
+				if (_contentLength > kMaxBodySize)
+					return fail(413);
+				_state = State::ExpectBody;
+			}
+			else
+			{
+				_state = State::GotAll;
+			}
+			break;
+		}
+		case State::ExpectBody:
+			if (readable < _headLen + _contentLength)
+				return ParseResult::Incomplete;
+			_pos = _headLen + _contentLength;
+			_state = State::GotAll;
+			break;
+		case State::ExpectChunkSize:
+		{
+			const char* line = begin + _pos;
+			const char* crlf = buf->findCRLF(line);
+			if (crlf == nullptr)
+			{
+				// chunk-size行不会太长 超长说明是非法数据
+				if (readable - _pos > 1024)
+					return fail(400);
+				return ParseResult::Incomplete;
+			}
+
+			size_t size = 0;
+			const char* p = line;
+			for (; p < crlf && *p != ';'; p++)
+			{
+				int digit;
+				if (*p >= '0' && *p <= '9')
+					digit = *p - '0';
+				else if (*p >= 'a' && *p <= 'f')
+					digit = *p - 'a' + 10;
+				else if (*p >= 'A' && *p <= 'F')
+					digit = *p - 'A' + 10;
+				else
+					return fail(400);
+				size = size * 16 + digit;
+				if (size > kMaxBodySize)
+					return fail(413);
+			}
+			if (p == line)
+				return fail(400);
+
+			_pos = crlf + 2 - begin;
+			if (size == 0)
+			{
+				_state = State::ExpectChunkTrailer;
+			}
+			else
+			{
+				if (_chunkedBody.size() + size > kMaxBodySize)
+					return fail(413);
+				_chunkRemaining = size;
+				_state = State::ExpectChunkData;
+			}
+			break;
+		}
+		case State::ExpectChunkData:
+			// chunk数据后面紧跟着\r\n
+			if (readable < _pos + _chunkRemaining + 2)
+				return ParseResult::Incomplete;
+			if (begin[_pos + _chunkRemaining] != '\r' || begin[_pos + _chunkRemaining + 1] != '\n')
+				return fail(400);
+			_chunkedBody.append(begin + _pos, _chunkRemaining);
+			_pos += _chunkRemaining + 2;
+			_chunkRemaining = 0;
+			_state = State::ExpectChunkSize;
+			break;
+		case State::ExpectChunkTrailer:
+		{
+			// 忽略trailer头部 直到遇到空行
+			const char* crlf = buf->findCRLF(begin + _pos);
+			if (crlf == nullptr)
+			{
+				if (readable - _pos > kMaxHeadSize)
+					return fail(431);
+				return ParseResult::Incomplete;
+			}
+			bool emptyLine = (crlf == begin + _pos);
+			_pos = crlf + 2 - begin;
+			if (emptyLine)
+				_state = State::GotAll;
+			break;
+		}
+		case State::GotAll:
+			// 请求完整之后才确定各个视图的基地址
+			_request._base = begin;
+			if (_request._chunked)
+				_request._body = _chunkedBody;
+			else
+				_request._body = std::string_view(begin + _headLen, _contentLength);
+			return ParseResult::GotRequest;
+		}
+	}
+}
+
+
+void HttpContext::consume(Buffer* buf)
+{
+	buf->retrieve(_pos);
+	_state = State::ExpectHead;
+	_scanned = 0;
+	_headLen = 0;
+	_contentLength = 0;
+	_pos = 0;
+	_chunkRemaining = 0;
+	_hasContentLength = false;
+	_request.reset();
+}
+
+
+/// @brief 解析请求行和头部 [begin, begin+len) 以空行结尾
+bool HttpContext::parseHead(const char* begin, size_t len)
+{
+	const char* end = begin + len;
+	const char* lineEnd = static_cast<const char*>(::memmem(begin, len, "\r\n", 2));
+
+	// 请求行 method SP request-target SP HTTP-version
+	const char* space = std::find(begin, lineEnd, ' ');
+	if (space == lineEnd)
+		return reject(400);
+	_request._method = parseMethod(std::string_view(begin, space - begin));
+	if (_request._method == HttpRequest::Method::Invalid)
+		return reject(501);
+
+	const char* target = space + 1;
+	space = std::find(target, lineEnd, ' ');
+	if (space == lineEnd || space == target)
+		return reject(400);
+	const char* question = std::find(target, space, '?');
+	_request._path = { static_cast<uint32_t>(target - begin), static_cast<uint32_t>(question - target) };
+	if (question != space)
+		_request._query = { static_cast<uint32_t>(question + 1 - begin), static_cast<uint32_t>(space - question - 1) };
+
+	std::string_view version(space + 1, lineEnd - space - 1);
+	if (version == "HTTP/1.1")
+		_request._version = HttpRequest::Version::Http11;
+	else if (version == "HTTP/1.0")
+		_request._version = HttpRequest::Version::Http10;
+	else
+		return reject(505);
+
+	// http/1.1默认长连接 后面的Connection头部可能修改它
+	_request._keepAlive = (_request._version == HttpRequest::Version::Http11);
+
+	// 逐行解析头部 最后一行是空行
+	const char* line = lineEnd + 2;
+	while (line < end - 2)
+	{
+		lineEnd = static_cast<const char*>(::memmem(line, end - line, "\r\n", 2));
+		const char* colon = std::find(line, lineEnd, ':');
+		if (colon == lineEnd || colon == line)
+			return reject(400);
+		if (!parseHeaderField(begin, line, colon, lineEnd))
+			return false;
+		line = lineEnd + 2;
+	}
+
+	// 同时出现Content-Length和chunked是请求走私的典型手法 直接拒绝
+	if (_request._chunked && _hasContentLength)
+		return reject(400);
+	return true;
+}
+
+
+bool HttpContext::parseHeaderField(const char* base, const char* begin, const char* colon, const char* end)
+{
+	if (_request._headerCount == HttpRequest::kMaxHeaders)
+		return reject(431);
+
+	const char* valueBegin = colon + 1;
+	while (valueBegin < end && (*valueBegin == ' ' || *valueBegin == '\t'))
+		valueBegin++;
+	const char* valueEnd = end;
+	while (valueEnd > valueBegin && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+		valueEnd--;
+
+	std::string_view name(begin, colon - begin);
+	std::string_view value(valueBegin, valueEnd - valueBegin);
+
+	if (equalsIgnoreCase(name, "Content-Length"))
+	{
+		size_t length = 0;
+		if (value.empty())
+			return reject(400);
+		for (char c : value)
+		{
+			if (c < '0' || c > '9')
+				return reject(400);
+			length = length * 10 + (c - '0');
+			if (length > kMaxBodySize)
+				return reject(413);
+		}
+		if (_hasContentLength && length != _contentLength)
+			return reject(400);
+		_hasContentLength = true;
+		_contentLength = length;
+	}
+	else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+	{
+		if (!hasToken(value, "chunked"))
+			return reject(501);
+		_request._chunked = true;
+	}
+	else if (equalsIgnoreCase(name, "Connection"))
+	{
+		if (hasToken(value, "close"))
+			_request._keepAlive = false;
+		else if (hasToken(value, "keep-alive"))
+			_request._keepAlive = true;
+	}
+
+	HttpRequest::Header& header = _request._headers[_request._headerCount++];
+	// 偏移都相对于请求的起始位置
+	header.name = { static_cast<uint32_t>(begin - base), static_cast<uint32_t>(name.size()) };
+	header.value = { static_cast<uint32_t>(valueBegin - base), static_cast<uint32_t>(value.size()) };
+	return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#include "HttpRequest.h"
+#include "Timestamp.h"
+
+class Buffer;
+
+/// @brief http请求的增量解析器 每个TcpConnection持有一个 保存在连接的context中
+/// 解析过程只记录偏移量而不拷贝数据 请求完整之前不会从Buffer中取走任何字节
+/// 因此Buffer扩容搬移数据也不影响已经解析的部分 已扫描过的字节也不会重复扫描
+class HttpContext
+{
+public:
+	enum class ParseResult : int
+	{
+		Incomplete, 	// 数据不足 等待下一次可读事件
+		GotRequest, 	// 解析出一个完整的请求 通过request()获取 处理完后必须调用consume()
+		Error			// 请求非法 errorStatus()给出应当回复的状态码
+	};
+
+	static constexpr size_t kMaxHeadSize = 64 * 1024;			// 请求行+头部的最大长度
+	static constexpr size_t kMaxBodySize = 64 * 1024 * 1024;	// body的最大长度
+
+	HttpContext();
+
+	ParseResult parseRequest(Buffer* buf, Timestamp receiveTime);
+
+	// 只有parseRequest返回GotRequest后才有效 其中的视图指向buf 在consume之前有效
+	const HttpRequest& request() const { return _request; }
+
+	// 从buf中取走已处理完的请求 并复位解析状态 准备解析流水线中的下一个请求
+	void consume(Buffer* buf);
+
+	int errorStatus() const { return _errorStatus; }
+
+private:
+	enum class State : int
+	{
+		ExpectHead,
+		ExpectBody,
+		ExpectChunkSize,
+		ExpectChunkData,
+		ExpectChunkTrailer,
+		GotAll
+	};
+
+	bool parseHead(const char* begin, size_t len);
+	bool parseHeaderField(const char* base, const char* begin, const char* colon, const char* end);
+	ParseResult fail(int status);
+	bool reject(int status);
+
+	State _state;
+	size_t _scanned;			// 查找头部结束标记时已经扫描过的字节数
+	size_t _headLen;			// 请求行+头部(包括结尾空行)的长度
+	size_t _contentLength;
+	size_t _pos;				// 当前请求已解析到的位置 也就是请求完整后需要取走的字节数
+	size_t _chunkRemaining;		// 当前chunk还未读到的数据长度
+	bool _hasContentLength;
+	int _errorStatus;
+	std::string _chunkedBody;	// 分块编码的body解码后存放于此 容量在连接的生命周期内复用
+	HttpRequest _request;
+};
@@ -0,0 +1,39 @@
+#include <strings.h>
+
+#include "HttpRequest.h"
+
+
+const char* HttpRequest::methodString() const
+{
+	switch (_method)
+	{
+	case Method::Get:
+		return "GET";
+	case Method::Post:
+		return "POST";
+	case Method::Head:
+		return "HEAD";
+	case Method::Put:
+		return "PUT";
+	case Method::Delete:
+		return "DELETE";
+	case Method::Options:
+		return "OPTIONS";
+	case Method::Patch:
+		return "PATCH";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+std::string_view HttpRequest::getHeader(std::string_view field) const
+{
+	for (size_t i = 0; i < _headerCount; i++)
+	{
+		std::string_view name = view(_headers[i].name);
+		if (name.size() == field.size() && ::strncasecmp(name.data(), field.data(), name.size()) == 0)
+			return view(_headers[i].value);
+	}
+	return std::string_view();
+}
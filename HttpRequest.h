@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+#include "Timestamp.h"
+
+class HttpContext;
+
+/// @brief 一个完整的http请求 所有字段都是指向接收缓冲区(或分块解码后的body)的视图 不做任何拷贝
+/// 视图只在HttpServer调用用户回调期间有效 如需保存请自行拷贝
+class HttpRequest
+{
+public:
+	enum class Method : int
+	{
+		Invalid, Get, Post, Head, Put, Delete, Options, Patch
+	};
+
+	enum class Version : int
+	{
+		Unknown, Http10, Http11
+	};
+
+	// 单个请求允许携带的最大头部数量 超过后返回431
+	static constexpr size_t kMaxHeaders = 64;
+
+	Method method() const { return _method; }
+	const char* methodString() const;
+	Version version() const { return _version; }
+
+	std::string_view path() const { return view(_path); }
+	std::string_view query() const { return view(_query); }
+	std::string_view body() const { return _body; }
+
+	size_t headerCount() const { return _headerCount; }
+	std::string_view headerName(size_t i) const { return view(_headers[i].name); }
+	std::string_view headerValue(size_t i) const { return view(_headers[i].value); }
+	// 按字段名(大小写不敏感)查找头部 不存在时返回空视图
+	std::string_view getHeader(std::string_view field) const;
+
+	// http/1.1默认长连接 http/1.0需要显式指定Connection: keep-alive
+	bool keepAlive() const { return _keepAlive; }
+	bool chunked() const { return _chunked; }
+
+	Timestamp receiveTime() const { return _receiveTime; }
+
+private:
+	friend class HttpContext;
+
+	// 相对于请求起始位置的偏移 接收缓冲区扩容搬移数据后仍然有效
+	struct Span
+	{
+		uint32_t off;
+		uint32_t len;
+	};
+
+	struct Header
+	{
+		Span name;
+		Span value;
+	};
+
+	std::string_view view(Span span) const { return std::string_view(_base + span.off, span.len); }
+
+	void reset()
+	{
+		_method = Method::Invalid;
+		_version = Version::Unknown;
+		_base = nullptr;
+		_path = _query = Span{ 0, 0 };
+		_body = std::string_view();
+		_headerCount = 0;
+		_keepAlive = false;
+		_chunked = false;
+	}
+
+	Method _method = Method::Invalid;
+	Version _version = Version::Unknown;
+	const char* _base = nullptr;	// 请求在接收缓冲区中的起始地址 请求完整后才设置
+	Span _path{ 0, 0 };
+	Span _query{ 0, 0 };
+	std::string_view _body;
+	Header _headers[kMaxHeaders];
+	size_t _headerCount = 0;
+	bool _keepAlive = false;
+	bool _chunked = false;
+	Timestamp _receiveTime;
+};
@@ -0,0 +1,126 @@
+#include <cstdio>
+
+#include "HttpResponse.h"
+#include "Buffer.h"
+
+
+void HttpResponse::reset(bool close)
+{
+	_statusCode = 200;
+	_closeConnection = close;
+	_chunked = false;
+	_date = Timestamp();
+	_statusMessage.clear();
+	_headers.clear();
+	_body.clear();
+}
+
+
+void HttpResponse::setStatusCode(int code, std::string_view message)
+{
+	_statusCode = code;
+	_statusMessage.assign(message.data(), message.size());
+}
+
+
+void HttpResponse::addHeader(std::string_view key, std::string_view value)
+{
+	_headers.append(key.data(), key.size());
+	_headers.append(": ", 2);
+	_headers.append(value.data(), value.size());
+	_headers.append("\r\n", 2);
+}
+
+
+void HttpResponse::appendToBuffer(Buffer* output, bool withBody) const
+{
+	// 状态行和固定头部的最大长度是可以预估的 直接格式化到Buffer的可写区域 省去中间字符串
+	const char* reason = _statusMessage.empty() ? reasonPhrase(_statusCode) : _statusMessage.c_str();
+	output->ensureWritableBytes(_statusMessage.size() + 128);
+	int n = ::snprintf(output->beginWrite(), output->writableBytes(), "HTTP/1.1 %d %s\r\n", _statusCode, reason);
+	output->hasWritten(n);
+
+	if (_chunked)
+	{
+		output->append("Transfer-Encoding: chunked\r\n");
+	}
+	else
+	{
+		n = ::snprintf(output->beginWrite(), output->writableBytes(), "Content-Length: %zu\r\n", _body.size());
+		output->hasWritten(n);
+	}
+
+	if (_date.valid())
+	{
+		// 日期字符串每秒只格式化一次
+		char date[32];
+		size_t len = _date.toHttpDate(date, sizeof(date));
+		output->append("Date: ");
+		output->append(date, len);
+		output->append("\r\n");
+	}
+
+	if (_closeConnection)
+		output->append("Connection: close\r\n");
+	else
+		output->append("Connection: Keep-Alive\r\n");
+
+	output->append(_headers);
+	output->append("\r\n");
+
+	if (!withBody)
+		return;
+
+	if (_chunked)
+	{
+		// 整个body作为一个chunk发送 后面紧跟表示结束的空chunk
+		if (!_body.empty())
+		{
+			char sizeLine[32];
+			n = ::snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", _body.size());
+			output->append(sizeLine, n);
+			output->append(_body);
+			output->append("\r\n");
+		}
+		output->append("0\r\n\r\n");
+	}
+	else
+	{
+		output->append(_body);
+	}
+}
+
+
+const char* HttpResponse::reasonPhrase(int code)
+{
+	switch (code)
+	{
+	case 100: return "Continue";
+	case 101: return "Switching Protocols";
+	case 200: return "OK";
+	case 201: return "Created";
+	case 204: return "No Content";
+	case 206: return "Partial Content";
+	case 301: return "Moved Permanently";
+	case 302: return "Found";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 408: return "Request Timeout";
+	case 411: return "Length Required";
+	case 413: return "Payload Too Large";
+	case 414: return "URI Too Long";
+	case 426: return "Upgrade Required";
+	case 429: return "Too Many Requests";
+	case 431: return "Request Header Fields Too Large";
+	case 500: return "Internal Server Error";
+	case 501: return "Not Implemented";
+	case 502: return "Bad Gateway";
+	case 503: return "Service Unavailable";
+	case 505: return "HTTP Version Not Supported";
+	default: return "Unknown";
+	}
+}
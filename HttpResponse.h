@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "Timestamp.h"
+
+class Buffer;
+
+/// @brief http响应 由用户回调填写 再由HttpServer直接序列化到连接的发送缓冲区中
+/// HttpServer在每个loop线程中复用同一个HttpResponse对象 reset()只清空内容不释放容量 稳态下不产生内存分配
+class HttpResponse
+{
+public:
+	explicit HttpResponse(bool close = false) : _statusCode{ 200 }, _closeConnection{ close }, _chunked{ false } {}
+
+	// 清空上一个响应的内容 保留字符串的容量
+	void reset(bool close);
+
+	// 状态码 原因短语为空时使用标准短语
+	void setStatusCode(int code, std::string_view message = std::string_view());
+	int statusCode() const { return _statusCode; }
+
+	// 设置后输出Date头部 HttpServer使用所在loop本轮的时间
+	void setDate(Timestamp date) { _date = date; }
+
+	void setCloseConnection(bool on) { _closeConnection = on; }
+	bool closeConnection() const { return _closeConnection; }
+
+	// 使用分块传输编码发送body 不再输出Content-Length
+	void setChunked(bool on) { _chunked = on; }
+	bool chunked() const { return _chunked; }
+
+	void setContentType(std::string_view contentType) { addHeader("Content-Type", contentType); }
+	void addHeader(std::string_view key, std::string_view value);
+
+	void setBody(std::string_view body) { _body.assign(body.data(), body.size()); }
+	void appendBody(std::string_view data) { _body.append(data.data(), data.size()); }
+	const std::string& body() const { return _body; }
+
+	// 把响应序列化追加到output中 withBody为false时只输出头部(用于HEAD请求)
+	void appendToBuffer(Buffer* output, bool withBody = true) const;
+
+	static const char* reasonPhrase(int code);
+
+private:
+	int _statusCode;
+	bool _closeConnection;
+	bool _chunked;
+	Timestamp _date;
+	std::string _statusMessage;
+	std::string _headers;	// 已经拼接好的 "Key: Value\r\n" 序列
+	std::string _body;
+};
@@ -0,0 +1,82 @@
+#include <any>
+
+#include "HttpServer.h"
+#include "HttpContext.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief 每个loop线程复用的响应对象和发送缓冲 一次读事件内流水线上的所有响应都序列化到t_output中
+thread_local HttpResponse t_response;
+thread_local Buffer t_output;
+
+
+/// @brief 没有设置回调时一律返回404
+static void defaultHttpCallback(const HttpRequest&, HttpResponse* resp)
+{
+	resp->setStatusCode(404);
+	resp->setCloseConnection(true);
+}
+
+
+HttpServer::HttpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, TcpServer::Option option) :
+	_server(loop, listenAddr, name, option), _httpCallback{ defaultHttpCallback }
+{
+	_server.setConnectionCallback(std::bind(&HttpServer::onConnection, this, _1));
+	_server.setMessageCallback(std::bind(&HttpServer::onMessage, this, _1, _2, _3));
+}
+
+
+void HttpServer::start()
+{
+	LOG_INFO("HttpServer[%s] starts listening on %s\n", _server.name().c_str(), _server.ipPort().c_str());
+	_server.start();
+}
+
+
+void HttpServer::onConnection(const TcpConnectionPtr& conn)
+{
+	if (conn->connected())
+		conn->setContext(HttpContext());
+}
+
+
+void HttpServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime)
+{
+	HttpContext* context = std::any_cast<HttpContext>(conn->getMutableContext());
+	bool close = false;
+
+	// 流水线: 依次处理缓冲区中所有完整的请求 回调是同步执行的 所以响应天然与请求顺序一致
+	while (!close)
+	{
+		HttpContext::ParseResult result = context->parseRequest(buf, receiveTime);
+		if (result == HttpContext::ParseResult::Incomplete)
+			break;
+
+		if (result == HttpContext::ParseResult::Error)
+		{
+			t_response.reset(true);
+			t_response.setDate(receiveTime);
+			t_response.setStatusCode(context->errorStatus());
+			t_response.appendToBuffer(&t_output);
+			buf->retrieveAll();
+			close = true;
+			break;
+		}
+
+		const HttpRequest& request = context->request();
+		t_response.reset(!request.keepAlive());
+		t_response.setDate(receiveTime);
+		_httpCallback(request, &t_response);
+		t_response.appendToBuffer(&t_output, request.method() != HttpRequest::Method::Head);
+		close = t_response.closeConnection();
+		context->consume(buf);
+	}
+
+	if (t_output.readableBytes() > 0)
+		conn->send(&t_output);
+	if (close)
+		conn->shutdown();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "noncopyable.h"
+#include "TcpServer.h"
+
+class HttpRequest;
+class HttpResponse;
+
+/// @brief 基于TcpServer的http/1.1服务器 支持长连接、请求流水线(pipelining)与分块传输编码
+/// 一次可读事件中到达的所有完整请求按顺序依次处理 响应按请求顺序写入同一个Buffer 最后只发送一次
+class HttpServer : public noncopyable
+{
+public:
+	// 用户回调在连接所属的loop线程中同步执行 request的视图只在回调期间有效
+	using HttpCallback = std::function<void(const HttpRequest&, HttpResponse*)>;
+
+	HttpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name,
+		TcpServer::Option option = TcpServer::Option::NoReusePort);
+
+	EventLoop* getLoop() const { return _server.getLoop(); }
+
+	void setHttpCallback(HttpCallback cb) { _httpCallback = std::move(cb); }
+	void setThreadNum(int numThreads) { _server.setThreadNum(numThreads); }
+
+	void start();
+
+private:
+	void onConnection(const TcpConnectionPtr& conn);
+	void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
+
+	TcpServer _server;
+	HttpCallback _httpCallback;
+};
@@ -0,0 +1,113 @@
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+#include "LogFile.h"
+
+
+LogFile::LogFile(const std::string& basename, off_t rollSize) :
+	_basename{ basename }, _rollSize{ rollSize }, _startOfPeriod{ 0 }, _lastRoll{ 0 }, _fp{ nullptr }, _writtenBytes{ 0 }
+{
+	rollFile();
+}
+
+
+LogFile::~LogFile()
+{
+	if (_fp)
+		::fclose(_fp);
+}
+
+
+void LogFile::append(const char* logline, size_t len)
+{
+	if (!_fp)
+		return;
+
+	size_t written = 0;
+	while (written < len)
+	{
+		size_t n = ::fwrite_unlocked(logline + written, 1, len - written, _fp);
+		if (n == 0)
+		{
+			// 日志后端不能再写日志 直接报告到标准错误
+			int err = ::ferror(_fp);
+			if (err)
+				::fprintf(stderr, "LogFile::append() failed %s\n", ::strerror(err));
+			break;
+		}
+		written += n;
+	}
+	_writtenBytes += written;
+
+	if (_writtenBytes > _rollSize)
+	{
+		rollFile();
+	}
+	else
+	{
+		time_t now = ::time(nullptr);
+		if (now / kRollPerSeconds * kRollPerSeconds != _startOfPeriod)
+			rollFile();
+	}
+}
+
+
+void LogFile::flush()
+{
+	if (_fp)
+		::fflush(_fp);
+}
+
+
+bool LogFile::rollFile()
+{
+	time_t now = ::time(nullptr);
+	if (now <= _lastRoll)
+		return false;
+
+	std::string filename = getLogFileName(_basename, now);
+	FILE* fp = ::fopen(filename.c_str(), "ae");	// e: O_CLOEXEC
+	if (!fp)
+	{
+		::fprintf(stderr, "LogFile::rollFile() open %s failed %s\n", filename.c_str(), ::strerror(errno));
+		return false;
+	}
+	if (_fp)
+		::fclose(_fp);
+	_fp = fp;
+	::setbuffer(_fp, _buffer, sizeof(_buffer));
+
+	_lastRoll = now;
+	_startOfPeriod = now / kRollPerSeconds * kRollPerSeconds;
+	_writtenBytes = 0;
+	return true;
+}
+
+
+std::string LogFile::getLogFileName(const std::string& basename, time_t now)
+{
+	std::string filename(basename);
+
+	char timebuf[32];
+	tm tm_time;
+	::localtime_r(&now, &tm_time);
+	::strftime(timebuf, sizeof(timebuf), ".%Y%m%d-%H%M%S.", &tm_time);
+	filename += timebuf;
+
+	char hostname[256];
+	if (::gethostname(hostname, sizeof(hostname)) == 0)
+	{
+		hostname[sizeof(hostname) - 1] = '\0';
+		filename += hostname;
+	}
+	else
+	{
+		filename += "unknownhost";
+	}
+
+	char pidbuf[32];
+	::snprintf(pidbuf, sizeof(pidbuf), ".%d.log", ::getpid());
+	filename += pidbuf;
+	return filename;
+}
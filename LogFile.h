@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+
+/// @brief 滚动的日志文件 超过rollSize字节或跨天时换一个新文件
+/// 文件名为 basename.年月日-时分秒.主机名.pid.log 不加锁 只由AsyncLogging的后台线程写
+class LogFile : noncopyable
+{
+public:
+	LogFile(const std::string& basename, off_t rollSize);
+	~LogFile();
+
+	void append(const char* logline, size_t len);
+	void flush();
+	// 同一秒内不会重复滚动 返回是否换了文件
+	bool rollFile();
+
+	off_t writtenBytes() const { return _writtenBytes; }
+
+private:
+	static std::string getLogFileName(const std::string& basename, time_t now);
+
+	static constexpr int kRollPerSeconds = 60 * 60 * 24;
+	static constexpr size_t kFileBufferSize = 64 * 1024;
+
+	const std::string _basename;
+	const off_t _rollSize;
+	time_t _startOfPeriod;	// 当前文件所在的那一天(UTC)的起始时间
+	time_t _lastRoll;
+	FILE* _fp;
+	off_t _writtenBytes;
+	char _buffer[kFileBufferSize];
+};
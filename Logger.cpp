@@ -1,8 +1,28 @@
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 
 #include "Logger.h"
 #include "Timestamp.h"
 
+static void defaultOutput(const char* msg, size_t len)
+{
+	::fwrite(msg, 1, len, stdout);
+}
+
+static void defaultFlush()
+{
+	::fflush(stdout);
+}
+
+
+std::atomic<LogLevel> Logger::_logLevel{ LogLevel::INFO };
+
+
+Logger::Logger() : _output{ defaultOutput }, _flush{ defaultFlush }
+{
+}
+
 // 获取日志唯一的实例对象 单例
 Logger& Logger::instance()
 {
@@ -10,31 +30,67 @@ Logger& Logger::instance()
 	return logger;
 }
 
-// 设置日志级别
-void Logger::setLogLevel(LogLevel level)
+void Logger::setOutput(OutputFunc output, FlushFunc flush)
 {
-	_logLevel = level;
+	_output = std::move(output);
+	_flush = std::move(flush);
+}
+
+void Logger::flush()
+{
+	_flush();
+}
+
+void Logger::logf(LogLevel level, const char* fmt, ...)
+{
+	char buf[1024];
+	va_list args;
+	va_start(args, fmt);
+	::vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	log(level, buf);
 }
 
 // 写日志 [级别信息] time : msg
-void Logger::log(std::string msg)
+void Logger::log(LogLevel level, const char* msg)
 {
-	std::string pre;
-	switch (_logLevel)
+	const char* pre = "";
+	switch (level)
 	{
+	case LogLevel::TRACE:
+		pre = "[TRACE]";
+		break;
+	case LogLevel::DEBUG:
+		pre = "[DEBUG]";
+		break;
 	case LogLevel::INFO:
-		pre.append("[INFO]");
+		pre = "[INFO]";
+		break;
+	case LogLevel::WARN:
+		pre = "[WARN]";
 		break;
 	case LogLevel::ERROR:
-		pre.append("[ERROR]");
+		pre = "[ERROR]";
 		break;
 	case LogLevel::FATAL:
-		pre.append("[FATAL]");
-		break;
-	case LogLevel::DEBUG:
-		pre.append("[DEBUG]");
+		pre = "[FATAL]";
 		break;
 	}
-	// 打印时间和msg
-	std::cout << pre.append(Timestamp::now().toString()) << " : " << msg;
-}
\ No newline at end of file
+
+	// 整条日志在栈上拼好后一次交给输出 异步后端只需要一次拷贝
+	char time[32];
+	Timestamp::now().toFormattedString(time, sizeof(time));
+	char line[1200];
+	int len = ::snprintf(line, sizeof(line), "%s%s : %s", pre, time, msg);
+	if (len < 0)
+		return;
+	size_t length = std::min<size_t>(len, sizeof(line) - 2);
+	// 每条日志独占一行 格式串末尾漏写换行时补上
+	if (length == 0 || line[length - 1] != '\n')
+		line[length++] = '\n';
+	_output(line, length);
+
+	// 进程即将退出 异步后端中尚未落盘的日志(包括这一条)必须先写出去
+	if (level == LogLevel::FATAL)
+		flush();
+}
@@ -2,76 +2,89 @@
 
 #include <string>
 #include <cstdarg>
+#include <cstdlib>
+#include <atomic>
+#include <functional>
 #include "noncopyable.h"
 
 
-// 定义日志的级别 INFO ERROR FATAL DEBUG
-enum class LogLevel
+// 定义日志的级别 数值越大越重要 低于阈值的日志在格式化之前就被过滤
+enum class LogLevel : int
 {
+	TRACE, // 每个事件一条的跟踪信息 默认在编译期去掉
+	DEBUG, // 调试信息
 	INFO,  // 普通信息
+	WARN,  // 警告信息
 	ERROR, // 错误信息
 	FATAL, // core dump
-	DEBUG, // 调试信息
 };
 
+// 编译期的最低日志级别 低于它的日志语句连同参数求值一起被去掉
+// 默认INFO 定义DEBUG时为TRACE 也可以在编译时用 -DMYMUDUO_MIN_LOG_LEVEL=<级别的数值> 指定
+#ifndef MYMUDUO_MIN_LOG_LEVEL
+#ifdef DEBUG
+#define MYMUDUO_MIN_LOG_LEVEL 0
+#else
+#define MYMUDUO_MIN_LOG_LEVEL 2
+#endif
+#endif
+
 // 日志类,采用单例模式
 class Logger : noncopyable
 {
 public:
+	// 输出一条完整的日志 默认写到标准输出
+	using OutputFunc = std::function<void(const char* msg, size_t len)>;
+	using FlushFunc = std::function<void()>;
+
 	// 获取日志唯一的实例对象 单例
 	static Logger& instance();
-	// 设置日志级别
-	void setLogLevel(LogLevel level);
-	// 写日志
-	void log(std::string msg);
+
+	// 运行期的日志级别阈值 默认INFO 任何线程都可以随时修改
+	static LogLevel logLevel() { return _logLevel.load(std::memory_order_relaxed); }
+	static void setLogLevel(LogLevel level) { _logLevel.store(level, std::memory_order_relaxed); }
+	// 写日志的宏在格式化之前先检查 只是一次relaxed的原子读
+	static bool enabled(LogLevel level) { return level >= logLevel(); }
+
+	// 写日志 级别随每条日志传入 多个线程同时写日志时不会互相覆盖级别
+	void log(LogLevel level, const char* msg);
+	// 格式化后写日志 编译器按printf检查格式与参数
+	void logf(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+	// 把日志交给其他后端 如AsyncLogging 需要在其他线程开始写日志之前设置
+	void setOutput(OutputFunc output, FlushFunc flush);
+	// 等待已写的日志落盘 FATAL日志在退出进程前会调用
+	void flush();
 
 private:
-	LogLevel _logLevel;
+	Logger();
+
+	static std::atomic<LogLevel> _logLevel;
+	OutputFunc _output;
+	FlushFunc _flush;
 };
 
 
-// 用于写日志的宏
-#define LOG_INFO(logmsgFormat, ...)                       \
-    do                                                    \
-    {                                                     \
-        Logger& logger = Logger::instance();              \
-        logger.setLogLevel(LogLevel::INFO);               \
-        char buf[1024] = {0};                             \
-        snprintf(buf, 1024, logmsgFormat, ##__VA_ARGS__); \
-        logger.log(buf);                                  \
+// 用于写日志的宏 编译期级别之外的语句被if constexpr丢弃 运行期先比较阈值再格式化
+#define LOG_IMPL(level, logmsgFormat, ...)                                          \
+    do                                                                              \
+    {                                                                               \
+        if constexpr (static_cast<int>(level) >= MYMUDUO_MIN_LOG_LEVEL)             \
+        {                                                                           \
+            if (Logger::enabled(level))                                             \
+                Logger::instance().logf(level, logmsgFormat, ##__VA_ARGS__);        \
+        }                                                                           \
     } while (false)
 
-#define LOG_ERROR(logmsgFormat, ...)                      \
-    do                                                    \
-    {                                                     \
-        Logger& logger = Logger::instance();              \
-        logger.setLogLevel(LogLevel::ERROR);              \
-        char buf[1024] = {0};                             \
-        snprintf(buf, 1024, logmsgFormat, ##__VA_ARGS__); \
-        logger.log(buf);                                  \
-    } while (false)
+#define LOG_TRACE(logmsgFormat, ...) LOG_IMPL(LogLevel::TRACE, logmsgFormat, ##__VA_ARGS__)
+#define LOG_DEBUG(logmsgFormat, ...) LOG_IMPL(LogLevel::DEBUG, logmsgFormat, ##__VA_ARGS__)
+#define LOG_INFO(logmsgFormat, ...) LOG_IMPL(LogLevel::INFO, logmsgFormat, ##__VA_ARGS__)
+#define LOG_WARN(logmsgFormat, ...) LOG_IMPL(LogLevel::WARN, logmsgFormat, ##__VA_ARGS__)
+#define LOG_ERROR(logmsgFormat, ...) LOG_IMPL(LogLevel::ERROR, logmsgFormat, ##__VA_ARGS__)
 
-#define LOG_FATAL(logmsgFormat, ...)                      \
-    do                                                    \
-    {                                                     \
-        Logger& logger = Logger::instance();              \
-        logger.setLogLevel(LogLevel::FATAL);              \
-        char buf[1024] = {0};                             \
-        snprintf(buf, 1024, logmsgFormat, ##__VA_ARGS__); \
-        logger.log(buf);                                  \
-        exit(EXIT_FAILURE);                               \
+// FATAL不受阈值影响 总是输出后退出进程
+#define LOG_FATAL(logmsgFormat, ...)                                                \
+    do                                                                              \
+    {                                                                               \
+        Logger::instance().logf(LogLevel::FATAL, logmsgFormat, ##__VA_ARGS__);      \
+        exit(EXIT_FAILURE);                                                         \
     } while (false)
-
-#ifdef DEBUG
-#define LOG_DEBUG(logmsgFormat, ...)                      \
-    do                                                    \
-    {                                                     \
-        Logger& logger = Logger::instance();              \
-        logger.setLogLevel(LogLevel::DEBUG);              \
-        char buf[1024] = {0};                             \
-        snprintf(buf, 1024, logmsgFormat, ##__VA_ARGS__); \
-        logger.log(buf);                                  \
-    } while (false)
-#else
-#define LOG_DEBUG(logmsgFormat, ...)
-#endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+#include "PreforkSupervisor.h"
+#include "CurrentThread.h"
+#include "Logger.h"
+
+
+PreforkSupervisor::PreforkSupervisor(int numWorkers, WorkerFunc workerFunc) :
+	_numWorkers{ std::max(1, numWorkers) }, _workerFunc{ std::move(workerFunc) }, _cpuPinning{ false }, _restartDelay{ 1.0 },
+	_restarts{ 0 }, _supervisorPid{ 0 }, _workers(_numWorkers)
+{
+	sigemptyset(&_oldMask);
+}
+
+
+int PreforkSupervisor::run()
+{
+	_supervisorPid = ::getpid();
+
+	// 监管进程同步地等待信号 SIGCHLD表示有工作进程退出 SIGTERM/SIGINT表示整体退出
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	::sigprocmask(SIG_BLOCK, &mask, &_oldMask);
+
+	LOG_INFO("PreforkSupervisor %d starts %d workers\n", _supervisorPid, _numWorkers);
+	for (int i = 0; i < _numWorkers; i++)
+		spawn(i);
+
+	bool stopping = false;
+	while (true)
+	{
+		// 等到下一次有信号或有工作进程到了重新fork的时间
+		Clock::time_point now = Clock::now();
+		Clock::duration wait = std::chrono::seconds(1);
+		for (const Worker& worker : _workers)
+		{
+			if (worker.pid == 0)
+				wait = std::min<Clock::duration>(wait, std::max<Clock::duration>(worker.restartAt - now, Clock::duration::zero()));
+		}
+		auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+		timespec timeout = { static_cast<time_t>(nanoseconds / 1000000000), static_cast<long>(nanoseconds % 1000000000) };
+
+		siginfo_t info;
+		int sig = ::sigtimedwait(&mask, &info, &timeout);
+		if ((sig == SIGTERM || sig == SIGINT) && !stopping)
+		{
+			LOG_INFO("PreforkSupervisor %d got signal %d, stopping workers\n", _supervisorPid, sig);
+			stopping = true;
+			for (const Worker& worker : _workers)
+			{
+				if (worker.pid > 0)
+					::kill(worker.pid, SIGTERM);
+			}
+		}
+
+		reapWorkers(stopping);
+		if (stopping)
+		{
+			if (std::none_of(_workers.begin(), _workers.end(), [](const Worker& worker) { return worker.pid > 0; }))
+				break;
+			continue;
+		}
+
+		now = Clock::now();
+		for (int i = 0; i < _numWorkers; i++)
+		{
+			if (_workers[i].pid == 0 && _workers[i].restartAt <= now)
+			{
+				_restarts++;
+				spawn(i);
+			}
+		}
+	}
+
+	::sigprocmask(SIG_SETMASK, &_oldMask, nullptr);
+	LOG_INFO("PreforkSupervisor %d exits after %d restarts\n", _supervisorPid, _restarts);
+	return 0;
+}
+
+
+void PreforkSupervisor::spawn(int index)
+{
+	Worker& worker = _workers[index];
+	// 缓冲区中还没输出的日志会被子进程复制一份 退出时再输出一遍
+	Logger::instance().flush();
+	pid_t pid = ::fork();
+	if (pid == 0)
+		runWorker(index);
+
+	worker.started = Clock::now();
+	if (pid < 0)
+	{
+		LOG_ERROR("PreforkSupervisor::spawn worker %d fork error:%d\n", index, errno);
+		worker.pid = 0;
+		worker.restartAt = worker.started + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_restartDelay));
+		return;
+	}
+	worker.pid = pid;
+	LOG_INFO("PreforkSupervisor worker %d started, pid %d\n", index, pid);
+}
+
+
+void PreforkSupervisor::runWorker(int index)
+{
+	// fork出的进程只有这一个线程 父进程中缓存的tid已经不对了
+	CurrentThread::t_cachedTid = 0;
+	::sigprocmask(SIG_SETMASK, &_oldMask, nullptr);
+
+	// 监管进程退出时工作进程随之退出 设置之前监管进程可能已经退出了
+	::prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (::getppid() != _supervisorPid)
+		::_exit(EXIT_FAILURE);
+
+	if (_cpuPinning)
+	{
+		long cpus = std::max(1L, ::sysconf(_SC_NPROCESSORS_ONLN));
+		long perWorker = std::max(1L, cpus / _numWorkers);
+		long first = (index * perWorker) % cpus;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (long cpu = first; cpu < first + perWorker && cpu < cpus; cpu++)
+			CPU_SET(cpu, &set);
+		if (::sched_setaffinity(0, sizeof(set), &set) < 0)
+			LOG_ERROR("PreforkSupervisor worker %d sched_setaffinity error:%d\n", index, errno);
+	}
+
+	int code = _workerFunc(index);
+	Logger::instance().flush();
+	::exit(code);
+}
+
+
+void PreforkSupervisor::reapWorkers(bool stopping)
+{
+	int status = 0;
+	pid_t pid;
+	while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		auto it = std::find_if(_workers.begin(), _workers.end(), [pid](const Worker& worker) { return worker.pid == pid; });
+		if (it == _workers.end())
+			continue;
+
+		int index = static_cast<int>(it - _workers.begin());
+		if (WIFSIGNALED(status))
+			LOG_WARN("PreforkSupervisor worker %d (pid %d) killed by signal %d\n", index, pid, WTERMSIG(status));
+		else
+			LOG_INFO("PreforkSupervisor worker %d (pid %d) exited with %d\n", index, pid, WEXITSTATUS(status));
+
+		Clock::time_point now = Clock::now();
+		it->pid = 0;
+		// 刚启动就退出的多半是配置或环境问题 立即重启只会不停地崩溃
+		bool crashLoop = now - it->started < std::chrono::seconds(1);
+		it->restartAt = crashLoop && !stopping ? now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_restartDelay)) : now;
+	}
+}
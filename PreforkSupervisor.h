@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+
+
+/// @brief 多进程prefork模式的监管进程 fork出若干个工作进程 每个工作进程运行自己的EventLoop/TcpServer
+/// 工作进程中的TcpServer使用Option::ReusePort或MultiAcceptor监听同一端口 由内核在进程之间分配新连接
+/// 进程之间不共享分配器、日志等任何状态 一个工作进程崩溃只影响它自己的连接 监管进程会重新fork一个
+/// fork只复制调用线程 run()必须在创建任何线程(EventLoopThreadPool、AsyncLogging等)和EventLoop之前调用
+class PreforkSupervisor : noncopyable
+{
+public:
+	// 在工作进程中执行 参数为工作进程的序号 返回值作为工作进程的退出码
+	using WorkerFunc = std::function<int(int index)>;
+
+	PreforkSupervisor(int numWorkers, WorkerFunc workerFunc);
+
+	// 把工作进程绑定到cpu上 cpu数多于进程数时每个进程分到连续的几个cpu 进程内的loop线程都在这几个cpu上运行
+	void setCpuPinning(bool on) { _cpuPinning = on; }
+	// 工作进程启动后不到1秒就退出时 等待这么久再重新fork 避免崩溃循环占满cpu
+	void setRestartDelay(double seconds) { _restartDelay = seconds; }
+
+	// 启动工作进程并监管 工作进程退出后重新fork 收到SIGTERM/SIGINT时转发给所有工作进程 等它们全部退出后返回0
+	// 在工作进程中不会返回
+	int run();
+
+	// 重新fork工作进程的次数 只在监管进程中有意义
+	int restarts() const { return _restarts; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Worker
+	{
+		pid_t pid = 0;						// 0表示当前没有在运行
+		Clock::time_point started;
+		Clock::time_point restartAt;		// pid为0时 到这个时间重新fork
+	};
+
+	void spawn(int index);
+	[[noreturn]] void runWorker(int index);
+	void reapWorkers(bool stopping);
+
+	const int _numWorkers;
+	WorkerFunc _workerFunc;
+	bool _cpuPinning;
+	double _restartDelay;
+	int _restarts;
+	pid_t _supervisorPid;
+	sigset_t _oldMask;		// run()之前的信号掩码 工作进程中恢复
+	std::vector<Worker> _workers;
+};
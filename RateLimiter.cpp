@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "RateLimiter.h"
+
+
+namespace
+{
+	constexpr double kDefaultBurstSeconds = 0.1;
+	constexpr double kMinBurstBytes = 64 * 1024;
+
+	double burstOr(double burst, double rate, double minimum)
+	{
+		return burst > 0 ? burst : std::max(rate * kDefaultBurstSeconds, minimum);
+	}
+}
+
+
+RateLimiter::RateLimiter(double rate, double burst) :
+	_rate{ rate }, _intervalNanos{ rate > 0 ? 1e9 / rate : 0 },
+	_toleranceNanos{ static_cast<int64_t>(std::max(burst, 1.0) * _intervalNanos) }, _tat{ 0 }
+{
+}
+
+
+double RateLimiter::consume(double n, Timestamp now)
+{
+	if (!enabled() || n <= 0)
+		return 0;
+	int64_t nowNanos = now.microSecondsSinceEpoch() * 1000;
+	int64_t cost = static_cast<int64_t>(n * _intervalNanos);
+	int64_t tat = _tat.load(std::memory_order_relaxed);
+	int64_t newTat;
+	// 空闲了一段时间时从现在开始算 攒下的令牌不超过突发量
+	do
+	{
+		newTat = std::max(tat, nowNanos) + cost;
+	} while (!_tat.compare_exchange_weak(tat, newTat, std::memory_order_relaxed));
+
+	int64_t wait = newTat - _toleranceNanos - nowNanos;
+	return wait > 0 ? wait / 1e9 : 0;
+}
+
+
+TrafficLimitGroup::TrafficLimitGroup(const TrafficLimits& limits) :
+	_limits{ limits },
+	_ingressBytes{ limits.ingressBytesPerSecond, burstOr(limits.burstBytes, limits.ingressBytesPerSecond, kMinBurstBytes) },
+	_ingressMessages{ limits.ingressMessagesPerSecond, burstOr(limits.burstMessages, limits.ingressMessagesPerSecond, 1) },
+	_egressBytes{ limits.egressBytesPerSecond, burstOr(limits.burstBytes, limits.egressBytesPerSecond, kMinBurstBytes) },
+	_egressMessages{ limits.egressMessagesPerSecond, burstOr(limits.burstMessages, limits.egressMessagesPerSecond, 1) }
+{
+}
+
+
+double TrafficLimitGroup::consumeIngress(size_t bytes, size_t messages, Timestamp now)
+{
+	return std::max(_ingressBytes.consume(static_cast<double>(bytes), now), _ingressMessages.consume(static_cast<double>(messages), now));
+}
+
+
+double TrafficLimitGroup::consumeEgress(size_t bytes, size_t messages, Timestamp now)
+{
+	return std::max(_egressBytes.consume(static_cast<double>(bytes), now), _egressMessages.consume(static_cast<double>(messages), now));
+}
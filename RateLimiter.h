@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+
+
+/// @brief 令牌桶限速器 用GCRA实现: 只记录一个"理论到达时间"(tat) 每次消耗令牌把它向后推 不需要定时补充令牌
+/// 令牌在事后扣除(读、写已经发生) 可以透支 consume返回还要等多少秒才回到突发量以内 调用者据此暂停
+/// tat是一个原子变量 多个loop线程共享同一个限速器(同一对端ip的连接、整个TcpServer)时也不加锁
+class RateLimiter : noncopyable
+{
+public:
+	// rate为每秒的令牌数 burst为允许的突发量(至少为1) rate为0时不限速
+	RateLimiter(double rate, double burst);
+
+	bool enabled() const { return _intervalNanos > 0; }
+	double rate() const { return _rate; }
+
+	// 消耗n个令牌 返回需要等待的秒数 0表示不用等
+	double consume(double n, Timestamp now);
+
+private:
+	double _rate;
+	double _intervalNanos;		// 每个令牌的间隔
+	int64_t _toleranceNanos;	// 突发量对应的时长
+	std::atomic<int64_t> _tat;	// 纳秒
+};
+
+
+/// @brief 一组限速 值为0的项不限速 突发量为0时按0.1秒的量(至少64KB或1条消息)
+/// 字节数按实际读写的字节计 消息数在入方向为读事件次数 出方向为send的调用次数
+struct TrafficLimits
+{
+	double ingressBytesPerSecond = 0;
+	double ingressMessagesPerSecond = 0;
+	double egressBytesPerSecond = 0;
+	double egressMessagesPerSecond = 0;
+	double burstBytes = 0;
+	double burstMessages = 0;
+
+	bool enabled() const
+	{
+		return ingressBytesPerSecond > 0 || ingressMessagesPerSecond > 0 || egressBytesPerSecond > 0 || egressMessagesPerSecond > 0;
+	}
+};
+
+
+/// @brief 按TrafficLimits创建的一组限速器 可以由多个连接共享 TcpServer为每个连接、每个对端ip以及整个server各建一组
+class TrafficLimitGroup : noncopyable
+{
+public:
+	explicit TrafficLimitGroup(const TrafficLimits& limits);
+
+	const TrafficLimits& limits() const { return _limits; }
+	// 记录一次读入/写出 返回需要暂停读/写的秒数
+	double consumeIngress(size_t bytes, size_t messages, Timestamp now);
+	double consumeEgress(size_t bytes, size_t messages, Timestamp now);
+
+private:
+	TrafficLimits _limits;
+	RateLimiter _ingressBytes;
+	RateLimiter _ingressMessages;
+	RateLimiter _egressBytes;
+	RateLimiter _egressMessages;
+};
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <strings.h>
+
+#include "RespCodec.h"
+#include "Buffer.h"
+
+/// @brief 协议中整数行(*3\r\n $5\r\n)的最大长度 超过说明不是合法的RESP
+static constexpr size_t kMaxIntegerLine = 32;
+
+
+bool RespCommand::is(std::string_view name) const
+{
+	return _count > 0 && _args[0].size() == name.size()
+		&& ::strncasecmp(_args[0].data(), name.data(), name.size()) == 0;
+}
+
+
+bool RespParser::parse(const Buffer* buf)
+{
+	const char* begin = buf->peek();
+	const size_t readable = buf->readableBytes();
+	// 上次停在一条不完整的命令上 数据还没到齐就不必重新扫描
+	if (readable < _minReadable)
+		return true;
+	_minReadable = 0;
+
+	size_t pos = _consumed;
+	while (pos < readable)
+	{
+		const size_t argsStart = _args.size();
+		Status status = begin[pos] == '*'
+			? parseMultiBulk(begin, readable, pos)
+			: parseInline(begin, readable, pos);
+
+		if (status == Status::Error)
+			return false;
+		if (status == Status::Incomplete)
+		{
+			// 丢弃不完整命令已经解析出的参数 至少要再多收到一个字节才值得重试
+			_args.resize(argsStart);
+			_minReadable = std::max(_minReadable, readable + 1);
+			break;
+		}
+
+		// 空行和*0这样的空命令只消耗字节 不产生命令
+		if (_args.size() > argsStart)
+			_commands.emplace_back(argsStart, _args.size() - argsStart);
+		_consumed = pos;
+	}
+	return true;
+}
+
+
+void RespParser::consume(Buffer* buf)
+{
+	buf->retrieve(_consumed);
+	_minReadable = _minReadable > _consumed ? _minReadable - _consumed : 0;
+	_consumed = 0;
+	_args.clear();
+	_commands.clear();
+}
+
+
+RespParser::Status RespParser::parseInteger(const char* begin, size_t readable, size_t& pos, int64_t* value)
+{
+	const size_t limit = std::min(readable - pos, kMaxIntegerLine);
+	const char* cr = static_cast<const char*>(::memchr(begin + pos, '\r', limit));
+	if (cr == nullptr)
+	{
+		if (limit == kMaxIntegerLine)
+		{
+			_error = "Protocol error: invalid length";
+			return Status::Error;
+		}
+		return Status::Incomplete;
+	}
+	if (cr + 1 == begin + readable)
+		return Status::Incomplete;
+
+	std::from_chars_result result = std::from_chars(begin + pos, cr, *value);
+	if (result.ec != std::errc() || result.ptr != cr || cr[1] != '\n')
+	{
+		_error = "Protocol error: invalid length";
+		return Status::Error;
+	}
+	pos = cr + 2 - begin;
+	return Status::Complete;
+}
+
+
+RespParser::Status RespParser::parseMultiBulk(const char* begin, size_t readable, size_t& pos)
+{
+	size_t cursor = pos + 1;
+	int64_t count = 0;
+	Status status = parseInteger(begin, readable, cursor, &count);
+	if (status != Status::Complete)
+		return status;
+	if (count > kMaxArgs)
+	{
+		_error = "Protocol error: invalid multibulk length";
+		return Status::Error;
+	}
+
+	for (int64_t i = 0; i < count; i++)
+	{
+		if (cursor >= readable)
+			return Status::Incomplete;
+		if (begin[cursor] != '$')
+		{
+			_error = "Protocol error: expected '$'";
+			return Status::Error;
+		}
+
+		cursor++;
+		int64_t length = 0;
+		status = parseInteger(begin, readable, cursor, &length);
+		if (status != Status::Complete)
+			return status;
+		if (length < 0 || length > kMaxBulkSize)
+		{
+			_error = "Protocol error: invalid bulk length";
+			return Status::Error;
+		}
+
+		// 大参数(如SET的value)分多次到达时 记下需要的字节数 到齐之前不再重新扫描
+		const size_t end = cursor + static_cast<size_t>(length) + 2;
+		if (end > readable)
+		{
+			_minReadable = end;
+			return Status::Incomplete;
+		}
+		if (begin[end - 2] != '\r' || begin[end - 1] != '\n')
+		{
+			_error = "Protocol error: bulk string not terminated by CRLF";
+			return Status::Error;
+		}
+		_args.emplace_back(begin + cursor, static_cast<size_t>(length));
+		cursor = end;
+	}
+
+	pos = cursor;
+	return Status::Complete;
+}
+
+
+/// @brief inline命令(如telnet中直接输入的 "PING\r\n") 以空白分隔参数 不支持引号转义
+RespParser::Status RespParser::parseInline(const char* begin, size_t readable, size_t& pos)
+{
+	const char* lineBegin = begin + pos;
+	const char* newline = static_cast<const char*>(::memchr(lineBegin, '\n', readable - pos));
+	if (newline == nullptr)
+	{
+		if (readable - pos > kMaxInlineSize)
+		{
+			_error = "Protocol error: too big inline request";
+			return Status::Error;
+		}
+		return Status::Incomplete;
+	}
+
+	const char* lineEnd = newline;
+	if (lineEnd > lineBegin && lineEnd[-1] == '\r')
+		lineEnd--;
+
+	const char* p = lineBegin;
+	while (p < lineEnd)
+	{
+		while (p < lineEnd && (*p == ' ' || *p == '\t'))
+			p++;
+		const char* argBegin = p;
+		while (p < lineEnd && *p != ' ' && *p != '\t')
+			p++;
+		if (p > argBegin)
+			_args.emplace_back(argBegin, p - argBegin);
+	}
+
+	pos = newline + 1 - begin;
+	return Status::Complete;
+}
+
+
+void RespWriter::appendPrefixed(char type, int64_t value)
+{
+	_output->ensureWritableBytes(kMaxIntegerLine);
+	char* start = _output->beginWrite();
+	char* p = start;
+	*p++ = type;
+	p = std::to_chars(p, start + kMaxIntegerLine - 2, value).ptr;
+	*p++ = '\r';
+	*p++ = '\n';
+	_output->hasWritten(p - start);
+}
+
+
+void RespWriter::simpleString(std::string_view str)
+{
+	_output->ensureWritableBytes(str.size() + 3);
+	char* p = _output->beginWrite();
+	*p = '+';
+	::memcpy(p + 1, str.data(), str.size());
+	::memcpy(p + 1 + str.size(), "\r\n", 2);
+	_output->hasWritten(str.size() + 3);
+}
+
+
+void RespWriter::error(std::string_view message)
+{
+	_output->ensureWritableBytes(message.size() + 3);
+	char* p = _output->beginWrite();
+	*p = '-';
+	::memcpy(p + 1, message.data(), message.size());
+	::memcpy(p + 1 + message.size(), "\r\n", 2);
+	_output->hasWritten(message.size() + 3);
+}
+
+
+void RespWriter::integer(int64_t value)
+{
+	appendPrefixed(':', value);
+}
+
+
+void RespWriter::bulkString(std::string_view str)
+{
+	// 头部和数据一次扩容 避免大value触发两次搬移
+	_output->ensureWritableBytes(kMaxIntegerLine + str.size() + 2);
+	appendPrefixed('$', static_cast<int64_t>(str.size()));
+	char* p = _output->beginWrite();
+	::memcpy(p, str.data(), str.size());
+	::memcpy(p + str.size(), "\r\n", 2);
+	_output->hasWritten(str.size() + 2);
+}
+
+
+void RespWriter::null()
+{
+	if (_protocol >= 3)
+		_output->append("_\r\n");
+	else
+		_output->append("$-1\r\n");
+}
+
+
+void RespWriter::arrayHeader(size_t count)
+{
+	appendPrefixed('*', static_cast<int64_t>(count));
+}
+
+
+void RespWriter::mapHeader(size_t count)
+{
+	if (_protocol >= 3)
+		appendPrefixed('%', static_cast<int64_t>(count));
+	else
+		appendPrefixed('*', static_cast<int64_t>(count * 2));
+}
+
+
+void RespWriter::boolean(bool value)
+{
+	if (_protocol >= 3)
+		_output->append(value ? "#t\r\n" : "#f\r\n");
+	else
+		integer(value ? 1 : 0);
+}
+
+
+void RespWriter::doubleValue(double value)
+{
+	char digits[64];
+	char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+	std::string_view str(digits, end - digits);
+	if (_protocol >= 3)
+	{
+		_output->append(",");
+		_output->append(str);
+		_output->append("\r\n");
+	}
+	else
+	{
+		bulkString(str);
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+class Buffer;
+
+/// @brief 一条redis命令 参数是指向接收缓冲区的视图 只在命令回调期间有效
+class RespCommand
+{
+public:
+	RespCommand(const std::string_view* args, size_t count) : _args{ args }, _count{ count } {}
+
+	size_t size() const { return _count; }
+	std::string_view operator[](size_t i) const { return _args[i]; }
+	std::string_view name() const { return _args[0]; }
+
+	// 大小写不敏感地比较命令名 如 cmd.is("GET")
+	bool is(std::string_view name) const;
+
+private:
+	const std::string_view* _args;
+	size_t _count;
+};
+
+
+/// @brief RESP请求的增量解析器 每个连接一个
+/// 无论RESP2还是RESP3 客户端发送的命令都是由bulk string组成的数组(或inline命令) 所以解析器不区分协议版本
+/// parse()一次解析出缓冲区中所有完整的命令 参数均为零拷贝视图 处理完后调用consume()取走这些字节
+/// 不完整的命令会记录至少还需要多少字节 数据没有到齐之前不会重复扫描
+class RespParser
+{
+public:
+	static constexpr size_t kMaxInlineSize = 64 * 1024;			// inline命令的最大长度
+	static constexpr int64_t kMaxArgs = 1024 * 1024;			// 单条命令的最大参数个数
+	static constexpr int64_t kMaxBulkSize = 512 * 1024 * 1024;	// 单个参数的最大长度
+
+	RespParser() : _consumed{ 0 }, _minReadable{ 0 }, _error{ nullptr } {}
+
+	// 解析buf中所有完整的命令 协议错误时返回false 通过error()获取原因
+	bool parse(const Buffer* buf);
+
+	size_t commandCount() const { return _commands.size(); }
+	RespCommand command(size_t i) const
+	{
+		return RespCommand(_args.data() + _commands[i].first, _commands[i].second);
+	}
+
+	// 从buf中取走已解析的命令 并清空命令列表(保留容量)
+	void consume(Buffer* buf);
+
+	const char* error() const { return _error; }
+
+private:
+	enum class Status : int
+	{
+		Complete,
+		Incomplete,
+		Error
+	};
+
+	// 从begin+pos开始解析一条命令 成功时pos移动到命令末尾
+	Status parseMultiBulk(const char* begin, size_t readable, size_t& pos);
+	Status parseInline(const char* begin, size_t readable, size_t& pos);
+	// 解析以\r\n结尾的整数 如 "*3\r\n" 中的3
+	Status parseInteger(const char* begin, size_t readable, size_t& pos, int64_t* value);
+
+	std::vector<std::string_view> _args;				// 所有命令的参数 平铺存放
+	std::vector<std::pair<size_t, size_t>> _commands;	// 每条命令在_args中的起始下标和参数个数
+	size_t _consumed;		// 已解析的完整命令占用的字节数
+	size_t _minReadable;	// 下一条命令至少需要这么多可读字节才可能完整
+	const char* _error;
+};
+
+
+/// @brief RESP回复编码器 直接写入Buffer 一次读事件的所有回复写入同一个Buffer后一次发送
+/// protocol为2时按RESP2编码 为3时使用RESP3的null、map、boolean、double类型
+class RespWriter
+{
+public:
+	explicit RespWriter(Buffer* output, int protocol = 2) : _output{ output }, _protocol{ protocol } {}
+
+	int protocol() const { return _protocol; }
+	void setProtocol(int protocol) { _protocol = protocol; }
+
+	void simpleString(std::string_view str);
+	void error(std::string_view message);
+	void integer(int64_t value);
+	void bulkString(std::string_view str);
+	void null();
+	void arrayHeader(size_t count);
+	// RESP2中编码为2*count个元素的数组
+	void mapHeader(size_t count);
+	// RESP2中编码为整数0/1
+	void boolean(bool value);
+	// RESP2中编码为bulk string
+	void doubleValue(double value);
+
+private:
+	// 输出 type + 整数 + \r\n
+	void appendPrefixed(char type, int64_t value);
+
+	Buffer* _output;
+	int _protocol;
+};
@@ -0,0 +1,81 @@
+#include <any>
+
+#include "RespServer.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief 每个loop线程复用的发送缓冲 一次读事件内流水线上的所有回复都编码到t_respOutput中
+thread_local Buffer t_respOutput;
+
+
+/// @brief 保存在TcpConnection的context中的连接状态 只在连接所属的loop线程中访问
+struct RespContext
+{
+	RespParser parser;
+	int protocol = 2;	// 连接当前使用的协议版本 客户端通过HELLO切换
+};
+
+
+/// @brief 没有设置回调时一律回复错误
+static void defaultCommandCallback(const TcpConnectionPtr&, const RespCommand& command, RespWriter* writer)
+{
+	std::string message("ERR unknown command '");
+	message.append(command.name());
+	message.append("'");
+	writer->error(message);
+}
+
+
+RespServer::RespServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, TcpServer::Option option) :
+	_server(loop, listenAddr, name, option), _commandCallback{ defaultCommandCallback }
+{
+	_server.setConnectionCallback(std::bind(&RespServer::onConnection, this, _1));
+	_server.setMessageCallback(std::bind(&RespServer::onMessage, this, _1, _2, _3));
+}
+
+
+void RespServer::start()
+{
+	LOG_INFO("RespServer[%s] starts listening on %s\n", _server.name().c_str(), _server.ipPort().c_str());
+	_server.start();
+}
+
+
+void RespServer::onConnection(const TcpConnectionPtr& conn)
+{
+	if (conn->connected())
+		conn->setContext(RespContext());
+
+	if (_connectionCallback)
+		_connectionCallback(conn);
+}
+
+
+void RespServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp)
+{
+	RespContext* context = std::any_cast<RespContext>(conn->getMutableContext());
+	RespWriter writer(&t_respOutput, context->protocol);
+
+	// 先解析出所有完整的命令 参数直接指向buf 回调全部执行完之后才取走这些字节
+	bool ok = context->parser.parse(buf);
+	for (size_t i = 0; i < context->parser.commandCount(); i++)
+		_commandCallback(conn, context->parser.command(i), &writer);
+	context->parser.consume(buf);
+	context->protocol = writer.protocol();
+
+	if (!ok)
+	{
+		// 与redis一致: 回复协议错误后关闭连接
+		LOG_ERROR("RespServer::onMessage [%s] %s\n", conn->name().c_str(), context->parser.error());
+		std::string message("ERR ");
+		message.append(context->parser.error());
+		writer.error(message);
+		buf->retrieveAll();
+	}
+
+	if (t_respOutput.readableBytes() > 0)
+		conn->send(&t_respOutput);
+	if (!ok)
+		conn->shutdown();
+}
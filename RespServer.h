@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "noncopyable.h"
+#include "TcpServer.h"
+#include "RespCodec.h"
+
+/// @brief 基于TcpServer的redis协议(RESP2/RESP3)服务器
+/// 一次可读事件中流水线上的所有完整命令依次交给回调 回复按命令顺序编码进同一个Buffer 最后只发送一次
+class RespServer : public noncopyable
+{
+public:
+	// 回调在连接所属的loop线程中同步执行 command的参数视图只在回调期间有效
+	// 回调中修改writer的协议版本(如处理HELLO 3)会保存到连接上 对之后的回复生效
+	using CommandCallback = std::function<void(const TcpConnectionPtr&, const RespCommand&, RespWriter*)>;
+
+	RespServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name,
+		TcpServer::Option option = TcpServer::Option::NoReusePort);
+
+	EventLoop* getLoop() const { return _server.getLoop(); }
+
+	void setCommandCallback(CommandCallback cb) { _commandCallback = std::move(cb); }
+	void setConnectionCallback(ConnectionCallback cb) { _connectionCallback = std::move(cb); }
+	void setThreadNum(int numThreads) { _server.setThreadNum(numThreads); }
+
+	void start();
+
+private:
+	void onConnection(const TcpConnectionPtr& conn);
+	void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
+
+	TcpServer _server;
+	CommandCallback _commandCallback;
+	ConnectionCallback _connectionCallback;
+};
@@ -23,7 +23,8 @@ void Socket::bindAddress(const InetAddress& localaddr)
 
 void Socket::listen()
 {
-	if (::listen(_sockfd, 1024) < 0)
+	// 全连接队列取系统允许的最大值(net.core.somaxconn) 重连风暴时队列满了客户端的SYN会被丢弃 只能等1秒后重传
+	if (::listen(_sockfd, SOMAXCONN) < 0)
 	{
 		LOG_FATAL("listen sockfd:%d fail\n", _sockfd);
 	}
@@ -0,0 +1,156 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+#include "SpillFile.h"
+#include "Logger.h"
+
+
+namespace
+{
+	std::mutex g_directoryMutex;
+	std::string g_directory = "/tmp";
+
+	int openSpillFile()
+	{
+		std::string directory;
+		{
+			std::lock_guard<std::mutex> lock(g_directoryMutex);
+			directory = g_directory;
+		}
+		int fd = ::open(directory.data(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+		if (fd >= 0)
+			return fd;
+		// 文件系统不支持O_TMPFILE
+		std::string path = directory + "/mymuduo-spill-XXXXXX";
+		fd = ::mkostemp(path.data(), O_CLOEXEC);
+		if (fd >= 0)
+			::unlink(path.data());
+		else
+			LOG_ERROR("SpillFile: cannot create spill file in %s, errno %d\n", directory.data(), errno);
+		return fd;
+	}
+}
+
+
+SpillFile* SpillFile::forCurrentThread()
+{
+	static thread_local std::unique_ptr<SpillFile> t_file;
+	static thread_local bool t_failed = false;
+	if (!t_file && !t_failed)
+	{
+		int fd = openSpillFile();
+		if (fd >= 0)
+			t_file.reset(new SpillFile(fd));
+		else
+			t_failed = true;
+	}
+	return t_file.get();
+}
+
+
+void SpillFile::setDirectory(std::string directory)
+{
+	std::lock_guard<std::mutex> lock(g_directoryMutex);
+	g_directory = std::move(directory);
+}
+
+
+SpillFile::SpillFile(int fd) : _fd{ fd }, _segments{ 0 }
+{
+}
+
+
+SpillFile::~SpillFile()
+{
+	::close(_fd);
+}
+
+
+size_t SpillFile::allocate()
+{
+	if (_freeSegments.empty())
+		return _segments++;
+	size_t segment = _freeSegments.back();
+	_freeSegments.pop_back();
+	return segment;
+}
+
+
+void SpillFile::release(size_t segment)
+{
+	if (::fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, segmentOffset(segment), kSegmentSize) < 0)
+		LOG_DEBUG("SpillFile: punch hole failed, errno %d\n", errno);
+	_freeSegments.push_back(segment);
+}
+
+
+bool SpillQueue::append(const char* data, size_t len, size_t* written)
+{
+	*written = 0;
+	while (*written < len)
+	{
+		if (_segments.empty() || _segments.back().writePos == SpillFile::kSegmentSize)
+			_segments.push_back(Segment{ _file->allocate(), 0, 0 });
+		Segment& segment = _segments.back();
+		size_t n = std::min(len - *written, SpillFile::kSegmentSize - segment.writePos);
+		ssize_t nwrite = ::pwrite(_file->fd(), data + *written, n, _file->segmentOffset(segment.index) + segment.writePos);
+		if (nwrite <= 0)
+		{
+			LOG_ERROR("SpillQueue::append pwrite error:%d\n", errno);
+			if (segment.writePos == 0)
+			{
+				_file->release(segment.index);
+				_segments.pop_back();
+			}
+			return false;
+		}
+		segment.writePos += nwrite;
+		*written += nwrite;
+		_bytes += nwrite;
+	}
+	return true;
+}
+
+
+ssize_t SpillQueue::sendTo(int fd, int* saveErrno)
+{
+	ssize_t total = 0;
+	while (!_segments.empty())
+	{
+		Segment& segment = _segments.front();
+		size_t len = segment.writePos - segment.readPos;
+		off_t offset = _file->segmentOffset(segment.index) + segment.readPos;
+		ssize_t n = len > 0 ? ::sendfile(fd, _file->fd(), &offset, len) : 0;
+		if (n < 0)
+		{
+			*saveErrno = errno;
+			return total > 0 ? total : -1;
+		}
+		segment.readPos += n;
+		_bytes -= n;
+		total += n;
+		// 最后一段还可能继续写入 发完后也归还 下次追加时再分配
+		if (segment.readPos == segment.writePos)
+		{
+			_file->release(segment.index);
+			_segments.pop_front();
+		}
+		if (static_cast<size_t>(n) < len)
+			break;
+	}
+	return total;
+}
+
+
+void SpillQueue::clear()
+{
+	for (const Segment& segment : _segments)
+		_file->release(segment.index);
+	_segments.clear();
+	_bytes = 0;
+}
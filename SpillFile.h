@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+
+
+/// @brief 每个loop线程一个的溢出文件 发送缓冲区过大的连接把后续数据写到这里 而不是留在内存中
+/// 文件以O_TMPFILE打开(不支持时创建后立即unlink) 进程退出后自动删除
+/// 按kSegmentSize分段 每段同一时间只属于一个连接 段中数据发送完后打洞(FALLOC_FL_PUNCH_HOLE)释放磁盘空间 段号放回空闲链表复用
+/// 只能在所属的loop线程中使用
+class SpillFile : noncopyable
+{
+public:
+	static constexpr size_t kSegmentSize = 4 * 1024 * 1024;
+
+	// 本线程的溢出文件 第一次使用时创建 创建失败返回nullptr
+	static SpillFile* forCurrentThread();
+	// 溢出文件所在的目录 默认/tmp 在loop线程第一次溢出之前设置
+	static void setDirectory(std::string directory);
+
+	~SpillFile();
+
+	int fd() const { return _fd; }
+	// 分配一个空段 返回段号
+	size_t allocate();
+	// 归还段 释放它占用的磁盘空间
+	void release(size_t segment);
+	off_t segmentOffset(size_t segment) const { return static_cast<off_t>(segment * kSegmentSize); }
+	// 已分配出去的段数
+	size_t segmentsInUse() const { return _segments - _freeSegments.size(); }
+
+private:
+	explicit SpillFile(int fd);
+
+	int _fd;
+	size_t _segments;					// 文件中已有的段数
+	std::vector<size_t> _freeSegments;
+};
+
+
+/// @brief 一个连接溢出到SpillFile中的数据 按写入顺序由若干段组成 发送时用sendfile从文件直接写入socket
+class SpillQueue : noncopyable
+{
+public:
+	explicit SpillQueue(SpillFile* file) : _file{ file }, _bytes{ 0 } {}
+	~SpillQueue() { clear(); }
+
+	size_t readableBytes() const { return _bytes; }
+	// 追加到最后一段 写满后分配新段 写入失败(如磁盘已满)返回false 已写入的部分保留 *written为写入的字节数
+	bool append(const char* data, size_t len, size_t* written);
+	// 从第一段开始sendfile到fd 直到全部发完或fd写满 返回发送的字节数 出错返回-1并设置*saveErrno
+	ssize_t sendTo(int fd, int* saveErrno);
+	// 丢弃所有数据 归还所有的段
+	void clear();
+
+private:
+	struct Segment
+	{
+		size_t index;
+		size_t readPos;
+		size_t writePos;
+	};
+
+	SpillFile* _file;
+	std::deque<Segment> _segments;
+	size_t _bytes;
+};
@@ -0,0 +1,116 @@
+#include <sys/socket.h>
+#include <cstring>
+#include <cstdio>
+
+#include "TcpClient.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief TcpClient析构后连接才关闭时 不再回调TcpClient 直接在loop中销毁连接
+static void removeDetachedConnection(EventLoop* loop, const TcpConnectionPtr& conn)
+{
+	loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+}
+
+
+TcpClient::TcpClient(EventLoop* loop, const InetAddress& serverAddr, const std::string& name) :
+	_loop{ loop }, _connector{ std::make_shared<Connector>(loop, serverAddr) }, _name{ name },
+	_connectionCallback{ defaultConnectionCallback }, _messageCallback{ defaultMessageCallback }, _retry{ false }, _connect{ false }, _nextConnId{ 1 }
+{
+	_connector->setNewConnectionCallback(std::bind(&TcpClient::newConnection, this, _1));
+	LOG_DEBUG("TcpClient::TcpClient[%s] - connector %p\n", _name.c_str(), _connector.get());
+}
+
+
+TcpClient::~TcpClient()
+{
+	LOG_DEBUG("TcpClient::~TcpClient[%s] - connector %p\n", _name.c_str(), _connector.get());
+	TcpConnectionPtr conn;
+	bool unique = false;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		unique = _connection.use_count() == 1;
+		conn = _connection;
+	}
+
+	if (conn)
+	{
+		// 连接还在 之后关闭时不能再回调已经析构的TcpClient
+		EventLoop* loop = _loop;
+		_loop->runInLoop([loop, conn]() {
+			conn->setCloseCallback(std::bind(removeDetachedConnection, loop, _1));
+		});
+		if (unique)
+			conn->forceClose();
+	}
+	else
+	{
+		_connector->stop();
+	}
+}
+
+
+void TcpClient::connect()
+{
+	LOG_INFO("TcpClient::connect[%s] - connecting to %s\n", _name.c_str(), _connector->serverAddress().toIpPort().c_str());
+	_connect = true;
+	_connector->start();
+}
+
+
+void TcpClient::disconnect()
+{
+	_connect = false;
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_connection)
+		_connection->shutdown();
+}
+
+
+void TcpClient::stop()
+{
+	_connect = false;
+	_connector->stop();
+}
+
+
+void TcpClient::newConnection(int sockfd)
+{
+	sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	::memset(&peer, 0, sizeof(peer));
+	if (::getpeername(sockfd, (sockaddr*)&peer, &len) < 0)
+		LOG_ERROR("TcpClient::newConnection getpeername error:%d\n", errno);
+	InetAddress peerAddr(peer);
+
+	char buf[64];
+	::snprintf(buf, sizeof(buf), "-%s#%d", peerAddr.toIpPort().c_str(), _nextConnId);
+	std::string connName = _name + buf;
+
+	TcpConnectionPtr conn(new TcpConnection(_loop, _nextConnId++, std::move(connName), sockfd, peerAddr));
+	conn->setCallbacks(std::make_shared<TcpConnectionCallbacks>(TcpConnectionCallbacks{
+		_connectionCallback, _messageCallback, _writeCompleteCallback, std::bind(&TcpClient::removeConnection, this, _1) }));
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_connection = conn;
+	}
+	conn->connectEstablished();
+}
+
+
+void TcpClient::removeConnection(const TcpConnectionPtr& conn)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_connection.reset();
+	}
+
+	_loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+	if (_retry && _connect)
+	{
+		LOG_INFO("TcpClient::removeConnection[%s] - reconnecting to %s\n", _name.c_str(), _connector->serverAddress().toIpPort().c_str());
+		_connector->restart();
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "Connector.h"
+#include "TcpConnection.h"
+
+class EventLoop;
+
+/// @brief 对外的客户端编程使用的类 一个TcpClient同一时刻最多持有一个连接
+/// 连接建立后与服务端一样是普通的TcpConnection 运行在构造时指定的loop上 与服务端的连接共用loop和Buffer
+class TcpClient : public noncopyable
+{
+public:
+	TcpClient(EventLoop* loop, const InetAddress& serverAddr, const std::string& name);
+	~TcpClient();
+
+	// 以下三个函数线程安全
+	void connect();
+	// 关闭已建立的连接(半关闭写端)
+	void disconnect();
+	// 停止正在进行的连接和重试
+	void stop();
+
+	TcpConnectionPtr connection() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _connection;
+	}
+
+	EventLoop* getLoop() const { return _loop; }
+	const std::string& name() const { return _name; }
+
+	// 连接断开后自动重连
+	bool retry() const { return _retry; }
+	void enableRetry() { _retry = true; }
+
+	// 连接失败的重试间隔和TCP Fast Open 见Connector 需要在connect之前设置
+	void setRetryDelay(int initialMs, int maxMs) { _connector->setRetryDelay(initialMs, maxMs); }
+	void setTcpFastOpen(bool on) { _connector->setTcpFastOpen(on); }
+
+	// 非线程安全 需要在connect之前设置
+	void setConnectionCallback(ConnectionCallback cb) { _connectionCallback = std::move(cb); }
+	void setMessageCallback(MessageCallback cb) { _messageCallback = std::move(cb); }
+	void setWriteCompleteCallback(WriteCompleteCallback cb) { _writeCompleteCallback = std::move(cb); }
+
+private:
+	// 在loop线程中 Connector连接成功后调用
+	void newConnection(int sockfd);
+	// 在loop线程中 连接关闭时调用
+	void removeConnection(const TcpConnectionPtr& conn);
+
+	EventLoop* _loop;
+	ConnectorPtr _connector;
+	const std::string _name;
+	ConnectionCallback _connectionCallback;
+	MessageCallback _messageCallback;
+	WriteCompleteCallback _writeCompleteCallback;
+	std::atomic<bool> _retry;
+	std::atomic<bool> _connect;
+	int _nextConnId;	// 只在loop线程中访问
+
+	mutable std::mutex _mutex;
+	TcpConnectionPtr _connection;	// 由_mutex保护
+};
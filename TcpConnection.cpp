@@ -1,8 +1,11 @@
 #include <functional>
 #include <string>
+#include <algorithm>
+#include <utility>
 #include <cerrno>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <fcntl.h>
 #include <cstring>
 #include <netinet/tcp.h>
 
@@ -11,6 +14,9 @@
 #include "Socket.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "BufferBudget.h"
+#include "SpillFile.h"
+#include "RateLimiter.h"
 
 using namespace std::placeholders;
 
@@ -25,9 +31,33 @@ static EventLoop* CheckLoopNotNull(EventLoop* loop)
 }
 
 
-TcpConnection::TcpConnection(EventLoop* loop, const std::string& name, int sockfd, const InetAddress& local, const InetAddress& remote)
-	: _loop{ CheckLoopNotNull(loop) }, _name{ name }, _state{ StateE::Connecting }, _reading{ true }, _socket{ new Socket(sockfd) },
-	_channel{ new Channel(loop, sockfd) }, _localAddr{ local }, _peerAddr{ remote }, _highWaterMark{ 64 * 1024 * 1024 }
+void defaultConnectionCallback(const TcpConnectionPtr& conn)
+{
+	LOG_DEBUG("%s -> %s is %s\n", conn->localAddress().toIpPort().c_str(), conn->peerAddress().toIpPort().c_str(),
+		conn->connected() ? "UP" : "DOWN");
+}
+
+
+void defaultMessageCallback(const TcpConnectionPtr&, Buffer* buffer, Timestamp)
+{
+	buffer->retrieveAll();
+}
+
+
+/// @brief 还没有设置任何回调的连接共享的空表
+static const std::shared_ptr<TcpConnectionCallbacks>& emptyCallbacks()
+{
+	static const std::shared_ptr<TcpConnectionCallbacks> callbacks = std::make_shared<TcpConnectionCallbacks>();
+	return callbacks;
+}
+
+
+TcpConnection::TcpConnection(EventLoop* loop, uint64_t id, std::string name, int sockfd, const InetAddress& peer)
+	: _loop{ CheckLoopNotNull(loop) }, _id{ id }, _name{ std::move(name) }, _state{ StateE::Connecting }, _reading{ true }, _readThrottles{ 0 }, _socket{ new Socket(sockfd) },
+	_channel{ new Channel(loop, sockfd) }, _peerAddr{ peer }, _callbacks{ emptyCallbacks() }, _ownsCallbacks{ false }, _highWaterMark{ 64 * 1024 * 1024 },
+	_flowHighWaterMark{ 0 }, _flowLowWaterMark{ 0 }, _throttlingSource{ false }, _budgeted{ false }, _budgetPausedRead{ false }, _bufferBytes{ 0 },
+	_spillThreshold{ 0 }, _shrinkCapacity{ 0 }, _shrinkIdleSeconds{ 0 }, _shrinkScheduled{ false },
+	_rateLimitedRead{ false }, _rateLimitedWrite{ false }, _readWaiter{ nullptr }, _sendWaiter{ nullptr }, _coroutineReading{ false }
 {
 	// 给channel设置相应的回调函数, poller给channel通知感兴趣的事件发生了, channel会调用相应的回调函数
 	_channel->setReadCallback(std::bind(&TcpConnection::handleRead, this, _1));
@@ -35,7 +65,7 @@ TcpConnection::TcpConnection(EventLoop* loop, const std::string& name, int sockf
 	_channel->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
 	_channel->setErrorCallback(std::bind(&TcpConnection::handleError, this));
 
-	LOG_INFO("TcpConnection::ctor[%s] at fd=%d\n", _name.data(), sockfd);
+	LOG_DEBUG("TcpConnection::ctor[%s] at fd=%d\n", _name.data(), sockfd);
 	_socket->setKeepAlive(true);  // 开启tcp探测保活机制
 }
 
@@ -43,20 +73,71 @@ TcpConnection::TcpConnection(EventLoop* loop, const std::string& name, int sockf
 
 TcpConnection::~TcpConnection()
 {
-	LOG_INFO("TcpConnection::dtor[%s] at fd=%d state=%d\n", _name.data(), _channel->fd(), (int)_state);
+	LOG_DEBUG("TcpConnection::dtor[%s] at fd=%d state=%d\n", _name.data(), _channel->fd(), (int)_state);
+}
+
+
+const InetAddress& TcpConnection::localAddress() const
+{
+	std::call_once(_localAddrOnce, [this]() {
+		sockaddr_in local;
+		::memset(&local, 0, sizeof(local));
+		socklen_t addrlen = sizeof(local);
+		if (::getsockname(_socket->fd(), (sockaddr*)&local, &addrlen) < 0)
+			LOG_ERROR("TcpConnection::localAddress [%s] getsockname error:%d\n", _name.c_str(), errno);
+		_localAddr.setSockAddr(local);
+	});
+	return _localAddr;
 }
 
 
+TcpConnectionCallbacks& TcpConnection::mutableCallbacks()
+{
+	if (!_ownsCallbacks)
+	{
+		_callbacks = std::make_shared<TcpConnectionCallbacks>(*_callbacks);
+		_ownsCallbacks = true;
+	}
+	return *_callbacks;
+}
 
-void TcpConnection::send(const std::string& buf)
+
+
+TcpConnection::SendAwaitable TcpConnection::send(const std::string& buf)
 {
 	if (_state == StateE::Connected)
 	{
 		if (_loop->isInLoopThread())
 			sendInLoop(buf.data(), buf.size());
 		else
-			_loop->runInLoop(std::bind(&TcpConnection::sendInLoop, this, buf.data(), buf.size()));
+		{
+			// 跨线程发送时buf可能在回调执行前就被销毁了 必须拷贝一份数据并持有连接的智能指针
+			_loop->runInLoop([conn = shared_from_this(), message = buf]() {
+				conn->sendInLoop(message.data(), message.size());
+			});
+		}
 	}
+	return SendAwaitable(this);
+}
+
+
+TcpConnection::SendAwaitable TcpConnection::send(Buffer* buf)
+{
+	if (_state == StateE::Connected)
+	{
+		if (_loop->isInLoopThread())
+		{
+			sendInLoop(buf->peek(), buf->readableBytes());
+			buf->retrieveAll();
+		}
+		else
+		{
+			_loop->runInLoop([conn = shared_from_this(), message = buf->retrieveAllAsString()]() {
+				conn->sendInLoop(message.data(), message.size());
+			});
+		}
+	}
+	return SendAwaitable(this);
 }
 
 
@@ -71,16 +152,16 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
 	if (_state == StateE::Disconnected)
 		LOG_ERROR("disconnected, give up writing!");
 
-	// 表示_channel第一次开始写数据或者缓冲区没有待发送数据
-	if (!_channel->isWriting() && _outputBuffer.readableBytes() == 0)
+	// 表示_channel第一次开始写数据或者缓冲区没有待发送数据 限速暂停写期间数据排队等待
+	if (!_channel->isWriting() && pendingOutputBytes() == 0 && !_rateLimitedWrite)
 	{
 		nwrite = ::write(_channel->fd(), data, len);
 		if (nwrite >= 0)
 		{
 			remaining = len - nwrite;
-			if (remaining == 0 && _writeCompleteCallback)
+			if (remaining == 0 && _callbacks->writeCompleteCallback)
 				// 既然在这里数据全部发送完成，就不用再给channel设置epollout事件了
-				_loop->queueInLoop(std::bind(_writeCompleteCallback, shared_from_this()));
+				_loop->queueInLoop(std::bind(_callbacks->writeCompleteCallback, shared_from_this()));
 		}
 		else
 		{
@@ -93,6 +174,9 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
 			}
 		}
 	}
+	// 每次send计一条消息 排队的字节在handleWrite真正写出时再扣
+	if (!_limitGroups.empty() && !faultError)
+		limitEgress(nwrite, 1);
 
 	/**
 	 * 说明当前这一次write并没有把数据全部发送出去 剩余的数据需要保存到缓冲区当中
@@ -104,16 +188,263 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
 	if (!faultError && remaining > 0)
 	{
 		// 目前发送缓冲区剩余的待发送的数据的长度
-		size_t oldLen = _outputBuffer.readableBytes();
+		size_t oldLen = pendingOutputBytes();
 		if (oldLen + remaining >= _highWaterMark && oldLen < _highWaterMark && _highWaterMarkCallback)
 			_loop->queueInLoop(std::bind(_highWaterMarkCallback, shared_from_this(), oldLen + remaining));
-		_outputBuffer.append((char*)data + nwrite, remaining);
-		if (!_channel->isWriting())
+		appendOutput((char*)data + nwrite, remaining);
+		if (!_channel->isWriting() && !_rateLimitedWrite)
 			_channel->enableWriting(); // 一定要注册channel的写事件 否则poller不会给channel通知epollout
+		if (_flowHighWaterMark > 0 && !_throttlingSource && pendingOutputBytes() >= _flowHighWaterMark)
+			throttleSource(true);
+		updateBufferBytes();
 	}
 }
 
 
+size_t TcpConnection::pendingOutputBytes() const
+{
+	return _outputBuffer.readableBytes() + (_spill ? _spill->readableBytes() : 0);
+}
+
+
+// 已经在溢出 或者加上这次的数据超过阈值时 超出阈值的部分写入溢出文件 写入失败的部分仍然留在内存中
+void TcpConnection::appendOutput(const char* data, size_t len)
+{
+	size_t inMemory = len;
+	if (_spillThreshold > 0)
+	{
+		size_t buffered = _outputBuffer.readableBytes();
+		if (_spill && _spill->readableBytes() > 0)
+			inMemory = 0;
+		else if (buffered + len > _spillThreshold)
+			inMemory = buffered < _spillThreshold ? _spillThreshold - buffered : 0;
+	}
+	if (inMemory > 0)
+		_outputBuffer.append(data, inMemory);
+	if (inMemory < len)
+	{
+		if (!_spill)
+		{
+			if (SpillFile* file = SpillFile::forCurrentThread())
+				_spill.reset(new SpillQueue(file));
+		}
+		size_t spilled = 0;
+		if (_spill)
+			_spill->append(data + inMemory, len - inMemory, &spilled);
+		// 溢出文件中有数据时再往内存中追加会打乱顺序 只有溢出文件为空时才能退回内存
+		if (inMemory + spilled < len && (!_spill || _spill->readableBytes() == 0))
+			_outputBuffer.append(data + inMemory + spilled, len - inMemory - spilled);
+		else if (inMemory + spilled < len)
+		{
+			LOG_ERROR("TcpConnection::appendOutput [%s] cannot spill %zu bytes, closing\n", _name.data(), len - inMemory - spilled);
+			forceClose();
+		}
+	}
+}
+
+
+// 先发内存中的数据 内存中的发完后再从溢出文件中发送
+ssize_t TcpConnection::writeOutput(int* saveErrno)
+{
+	if (_outputBuffer.readableBytes() > 0)
+	{
+		ssize_t n = _outputBuffer.writeFd(_channel->fd(), saveErrno);
+		if (n > 0)
+			_outputBuffer.retrieve(n);
+		return n;
+	}
+	if (_spill && _spill->readableBytes() > 0)
+		return _spill->sendTo(_channel->fd(), saveErrno);
+	return 0;
+}
+
+
+void TcpConnection::setOutputSpill(size_t threshold)
+{
+	_loop->runInLoop([conn = shared_from_this(), threshold]() {
+		conn->_spillThreshold = threshold;
+	});
+}
+
+
+void TcpConnection::setBufferShrink(size_t maxCapacity, double idleSeconds)
+{
+	_shrinkCapacity = maxCapacity;
+	_shrinkIdleSeconds = idleSeconds;
+}
+
+
+bool TcpConnection::useMirroredBuffers(size_t capacity)
+{
+	bool ok = _inputBuffer.useMirroredRing(capacity);
+	ok = _outputBuffer.useMirroredRing(capacity) && ok;
+	updateBufferBytes();
+	return ok;
+}
+
+
+// 有缓冲区清空且容量超限时才挂一个定时器 平时读写只多一次比较
+void TcpConnection::scheduleShrink(double delay)
+{
+	if (_shrinkScheduled)
+		return;
+	bool input = _inputBuffer.readableBytes() == 0 && _inputBuffer.internalCapacity() > _shrinkCapacity;
+	bool output = pendingOutputBytes() == 0 && _outputBuffer.internalCapacity() > _shrinkCapacity;
+	if (!input && !output)
+		return;
+	_shrinkScheduled = true;
+	std::weak_ptr<TcpConnection> weak(shared_from_this());
+	_loop->runAfter(delay, [weak]() {
+		if (TcpConnectionPtr conn = weak.lock())
+			conn->shrinkBuffers();
+	});
+}
+
+
+void TcpConnection::shrinkBuffers()
+{
+	_shrinkScheduled = false;
+	if (_state != StateE::Connected && _state != StateE::Disconnecting)
+		return;
+	// 期间又有读写 从最近一次读写开始重新计时
+	double idle = timeDifference(_loop->now(), _lastActivity);
+	if (idle < _shrinkIdleSeconds)
+	{
+		scheduleShrink(_shrinkIdleSeconds - idle);
+		return;
+	}
+	if (_inputBuffer.readableBytes() == 0 && _inputBuffer.internalCapacity() > _shrinkCapacity)
+		_inputBuffer.shrink(0);
+	if (pendingOutputBytes() == 0 && _outputBuffer.internalCapacity() > _shrinkCapacity)
+		_outputBuffer.shrink(0);
+	updateBufferBytes();
+}
+
+
+TcpConnection::ReadAwaitable TcpConnection::readExactly(size_t n)
+{
+	return ReadAwaitable(this, n, std::string_view());
+}
+
+
+TcpConnection::ReadAwaitable TcpConnection::readUntil(std::string_view delimiter)
+{
+	return ReadAwaitable(this, 0, delimiter);
+}
+
+
+size_t TcpConnection::ReadAwaitable::available()
+{
+	const Buffer& buffer = _conn->_inputBuffer;
+	size_t readable = buffer.readableBytes();
+	if (_delimiter.empty())
+		return readable >= _bytes ? _bytes : 0;
+	std::string_view data(buffer.peek(), readable);
+	size_t from = _scanned >= _delimiter.size() ? _scanned - _delimiter.size() + 1 : 0;
+	size_t pos = data.find(_delimiter, from);
+	if (pos == std::string_view::npos)
+	{
+		_scanned = readable;
+		return 0;
+	}
+	return pos + _delimiter.size();
+}
+
+
+// 不在连接的loop线程中时不能访问缓冲区 总是挂起 由waitRead在loop线程中检查
+// 此时loop线程可能正在处理读事件 没有事先声明由协程读取的话 读入的数据会先交给消息回调 协程再也读不到
+bool TcpConnection::ReadAwaitable::await_ready()
+{
+	if (_delimiter.empty() && _bytes == 0)
+		return true;
+	if (!_conn->_loop->isInLoopThread())
+	{
+		if (!_conn->_coroutineReading)
+			LOG_FATAL("TcpConnection::ReadAwaitable [%s] first read awaited outside the loop thread without setCoroutineReading\n", _conn->_name.data());
+		return false;
+	}
+	_conn->_coroutineReading = true;
+	return available() > 0 || _conn->_state == StateE::Disconnected;
+}
+
+
+void TcpConnection::ReadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	if (_conn->_loop->isInLoopThread())
+		_conn->waitRead(this);
+	else
+		_conn->_loop->queueInLoop([this, conn = _conn->shared_from_this()]() { conn->waitRead(this); });
+}
+
+
+std::string TcpConnection::ReadAwaitable::await_resume()
+{
+	size_t n = available();
+	return n > 0 ? _conn->_inputBuffer.retrieveAsString(n) : std::string();
+}
+
+
+bool TcpConnection::SendAwaitable::await_ready()
+{
+	return _conn->_loop->isInLoopThread() && _conn->sendReady();
+}
+
+
+// 跨线程的send已经把发送投递到loop中 这里排在它后面 检查时数据已经进入发送队列
+void TcpConnection::SendAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	if (_conn->_loop->isInLoopThread())
+		_conn->waitSend(this);
+	else
+		_conn->_loop->queueInLoop([this, conn = _conn->shared_from_this()]() { conn->waitSend(this); });
+}
+
+
+void TcpConnection::waitRead(ReadAwaitable* waiter)
+{
+	_coroutineReading = true;
+	if (waiter->available() > 0 || _state == StateE::Disconnected)
+	{
+		waiter->_handle.resume();
+		return;
+	}
+	if (_readWaiter)
+		LOG_FATAL("TcpConnection::waitRead [%s] more than one coroutine reading\n", _name.data());
+	_readWaiter = waiter;
+}
+
+
+void TcpConnection::waitSend(SendAwaitable* waiter)
+{
+	if (sendReady())
+	{
+		waiter->_handle.resume();
+		return;
+	}
+	if (_sendWaiter)
+		LOG_FATAL("TcpConnection::waitSend [%s] more than one coroutine sending\n", _name.data());
+	_sendWaiter = waiter;
+}
+
+
+bool TcpConnection::sendReady() const
+{
+	return pendingOutputBytes() < _highWaterMark || _state == StateE::Disconnected;
+}
+
+
+// 连接已经关闭 等待的协程得到空串/false后自行结束
+void TcpConnection::resumeWaiters()
+{
+	if (ReadAwaitable* waiter = std::exchange(_readWaiter, nullptr))
+		waiter->_handle.resume();
+	if (SendAwaitable* waiter = std::exchange(_sendWaiter, nullptr))
+		waiter->_handle.resume();
+}
+
+
 void TcpConnection::shutdown()
 {
 	if (_state == StateE::Connected)
@@ -126,22 +457,117 @@ void TcpConnection::shutdown()
 
 void TcpConnection::shutdownInLoop()
 {
-	// 说明当前outputBuffer_的数据全部向外发送完成
-	if (!_channel->isWriting()) 
+	// 说明当前outputBuffer_的数据全部向外发送完成 限速暂停写时没有关注EPOLLOUT 但队列中还有数据
+	if (!_channel->isWriting() && pendingOutputBytes() == 0)
 	{
 		_socket->shutdownWrite();
 	}
 }
 
+void TcpConnection::forceClose()
+{
+	if (_state == StateE::Connected || _state == StateE::Disconnecting)
+	{
+		setState(StateE::Disconnecting);
+		// 放入队列延后执行 调用者可能正处于该连接的回调之中
+		_loop->queueInLoop(std::bind(&TcpConnection::forceCloseInLoop, shared_from_this()));
+	}
+}
+
+
+void TcpConnection::forceCloseInLoop()
+{
+	if (_state == StateE::Connected || _state == StateE::Disconnecting)
+		handleClose();
+}
+
+
+void TcpConnection::setTcpNoDelay(bool on)
+{
+	_socket->setTcpNoDelay(on);
+}
+
+
+void TcpConnection::startRead()
+{
+	_loop->runInLoop([conn = shared_from_this()]() {
+		conn->_reading = true;
+		conn->updateReading();
+	});
+}
+
+
+void TcpConnection::stopRead()
+{
+	_loop->runInLoop([conn = shared_from_this()]() {
+		conn->_reading = false;
+		conn->updateReading();
+	});
+}
+
+
+// 按用户的要求和流量控制决定是否关注EPOLLIN
+void TcpConnection::updateReading()
+{
+	if (_state != StateE::Connected && _state != StateE::Disconnecting)
+		return;
+	bool reading = _reading && _readThrottles == 0;
+	if (reading && !_channel->isReading())
+		_channel->enableReading();
+	else if (!reading && _channel->isReading())
+		_channel->disableReading();
+}
+
+
+void TcpConnection::throttleReadInLoop(bool on)
+{
+	_readThrottles += on ? 1 : -1;
+	updateReading();
+}
+
+
+void TcpConnection::setFlowControl(const TcpConnectionPtr& source, size_t highWaterMark, size_t lowWaterMark)
+{
+	_loop->runInLoop([conn = shared_from_this(), source = std::weak_ptr<TcpConnection>(source), highWaterMark, lowWaterMark]() {
+		// 换source之前先恢复原来的source
+		if (conn->_throttlingSource)
+			conn->throttleSource(false);
+		conn->_flowControlSource = source;
+		conn->_flowHighWaterMark = highWaterMark;
+		conn->_flowLowWaterMark = std::min(lowWaterMark, highWaterMark);
+	});
+}
+
+
+// source可能在其他loop中 暂停与恢复总是成对地投递到source的loop
+void TcpConnection::throttleSource(bool on)
+{
+	_throttlingSource = on;
+	if (TcpConnectionPtr source = _flowControlSource.lock())
+	{
+		LOG_DEBUG("TcpConnection::throttleSource [%s] %s reading of [%s], %zu bytes pending\n", _name.data(), on ? "pause" : "resume",
+			source->name().data(), pendingOutputBytes());
+		source->getLoop()->runInLoop([source, on]() { source->throttleReadInLoop(on); });
+	}
+}
+
+
 // 连接建立
 void TcpConnection::connectEstablished()
 {
 	setState(StateE::Connected);
 	_channel->tie(shared_from_this());
 	_channel->enableReading(); // 向poller注册channel的EPOLLIN事件
+	BufferBudget& budget = BufferBudget::instance();
+	if (budget.enabled())
+	{
+		_budgeted = true;
+		budget.addConnection(shared_from_this());
+		updateBufferBytes();
+	}
 
 	// 新连接建立 执行回调
-	_connectionCallback(shared_from_this());
+	_callbacks->connectionCallback(shared_from_this());
 }
 
 
@@ -152,9 +578,143 @@ void TcpConnection::connectDestroyed()
 	{
 		setState(StateE::Disconnected);
 		_channel->disableAll(); // 把channel的所有感兴趣的事件从poller中删除掉
-		_connectionCallback(shared_from_this());
+		if (_throttlingSource)
+			throttleSource(false);
+		resumeWaiters();
+		_callbacks->connectionCallback(shared_from_this());
 	}
 	_channel->remove(); // 把channel从poller中删除掉
+	// 溢出文件属于本loop 段必须在loop线程中归还
+	_spill.reset();
+	if (_budgeted)
+	{
+		BufferBudget::instance().removeConnection(this, _bufferBytes);
+		_budgeted = false;
+		_bufferBytes = 0;
+	}
+}
+
+
+// 缓冲区的容量只在读入、追加发送数据时增长 在这两处更新计入预算的字节数
+void TcpConnection::updateBufferBytes()
+{
+	if (!_budgeted)
+		return;
+	size_t bytes = bufferBytes();
+	if (bytes != _bufferBytes)
+	{
+		BufferBudget::instance().add(static_cast<int64_t>(bytes) - static_cast<int64_t>(_bufferBytes));
+		_bufferBytes = bytes;
+	}
+}
+
+
+void TcpConnection::resumeBudgetPausedRead()
+{
+	if (_budgetPausedRead)
+	{
+		_budgetPausedRead = false;
+		throttleReadInLoop(false);
+	}
+}
+
+
+void TcpConnection::setTrafficLimits(std::vector<std::shared_ptr<TrafficLimitGroup>> groups)
+{
+	_limitGroups = std::move(groups);
+}
+
+
+void TcpConnection::setTrafficLimits(const TrafficLimits& limits)
+{
+	std::vector<std::shared_ptr<TrafficLimitGroup>> groups;
+	if (limits.enabled())
+		groups.push_back(std::make_shared<TrafficLimitGroup>(limits));
+	setTrafficLimits(std::move(groups));
+}
+
+
+// 读入的字节已经交给了消息回调 令牌事后扣除 透支多少就停读多久 平时每次读只多几次原子操作 没有锁和内存分配
+void TcpConnection::limitIngress(size_t bytes, Timestamp now)
+{
+	double delay = 0;
+	for (const std::shared_ptr<TrafficLimitGroup>& group : _limitGroups)
+		delay = std::max(delay, group->consumeIngress(bytes, 1, now));
+	if (delay <= 0 || _rateLimitedRead || _state != StateE::Connected)
+		return;
+	_rateLimitedRead = true;
+	throttleReadInLoop(true);
+	std::weak_ptr<TcpConnection> weak(shared_from_this());
+	_loop->runAfter(delay, [weak]() {
+		if (TcpConnectionPtr conn = weak.lock())
+			conn->resumeRateLimitedRead();
+	});
+}
+
+
+void TcpConnection::limitEgress(size_t bytes, size_t messages)
+{
+	double delay = 0;
+	Timestamp now = _loop->now();
+	for (const std::shared_ptr<TrafficLimitGroup>& group : _limitGroups)
+		delay = std::max(delay, group->consumeEgress(bytes, messages, now));
+	if (delay <= 0 || _rateLimitedWrite)
+		return;
+	_rateLimitedWrite = true;
+	if (_channel->isWriting())
+		_channel->disableWriting();
+	std::weak_ptr<TcpConnection> weak(shared_from_this());
+	_loop->runAfter(delay, [weak]() {
+		if (TcpConnectionPtr conn = weak.lock())
+			conn->resumeRateLimitedWrite();
+	});
+}
+
+
+void TcpConnection::resumeRateLimitedRead()
+{
+	if (_rateLimitedRead)
+	{
+		_rateLimitedRead = false;
+		throttleReadInLoop(false);
+	}
+}
+
+
+void TcpConnection::resumeRateLimitedWrite()
+{
+	_rateLimitedWrite = false;
+	if ((_state == StateE::Connected || _state == StateE::Disconnecting) && pendingOutputBytes() > 0 && !_channel->isWriting())
+		_channel->enableWriting();
+}
+
+
+int TcpConnection::detachForHandover(std::string* unread)
+{
+	if (_state != StateE::Connected || pendingOutputBytes() > 0)
+		return -1;
+	int fd = ::fcntl(_socket->fd(), F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		LOG_ERROR("TcpConnection::detachForHandover [%s] dup error:%d\n", _name.data(), errno);
+		return -1;
+	}
+	// 停止读之后到达的数据留在内核的接收缓冲区里 由新进程读取
+	unread->assign(_inputBuffer.peek(), _inputBuffer.readableBytes());
+	_inputBuffer.retrieveAll();
+	handleClose();
+	return fd;
+}
+
+
+void TcpConnection::connectAdopted(const std::string& unread)
+{
+	connectEstablished();
+	if (!unread.empty() && _state == StateE::Connected)
+	{
+		_inputBuffer.append(unread);
+		_callbacks->messageCallback(shared_from_this(), &_inputBuffer, Timestamp::now());
+	}
 }
 
 
@@ -166,7 +726,33 @@ void TcpConnection::handleRead(Timestamp receiveTime)
 	if (n > 0)
 	{
 		// 已建立连接的用户有可读事件发生了 调用用户传入的回调操作onMessage shared_from_this就是获取了TcpConnection的智能指针
-		_messageCallback(shared_from_this(), &_inputBuffer, receiveTime);
+		// 由协程读取的连接 数据够了才恢复等待的协程 协程直接在这里运行到下一个挂起点
+		if (_readWaiter)
+		{
+			if (_readWaiter->available() > 0)
+				std::exchange(_readWaiter, nullptr)->_handle.resume();
+		}
+		else if (!_coroutineReading)
+			_callbacks->messageCallback(shared_from_this(), &_inputBuffer, receiveTime);
+		if (!_limitGroups.empty())
+			limitIngress(n, receiveTime);
+		if (_budgeted)
+		{
+			updateBufferBytes();
+			// 超出预算时数据还堆在缓冲区中的连接不再读入新的数据 已读入的请求照常处理 能及时处理完的连接不受影响
+			bool backlogged = _inputBuffer.readableBytes() > 0 || pendingOutputBytes() > 0;
+			if (backlogged && !_budgetPausedRead && _state == StateE::Connected && BufferBudget::instance().overBudget())
+			{
+				_budgetPausedRead = true;
+				throttleReadInLoop(true);
+				BufferBudget::instance().notePausedRead(shared_from_this());
+			}
+		}
+		if (_shrinkCapacity > 0)
+		{
+			_lastActivity = _loop->now();
+			scheduleShrink(_shrinkIdleSeconds);
+		}
 	}
 	else if (n == 0)  // 对端断开连接
 		handleClose();
@@ -184,18 +770,32 @@ void TcpConnection::handleWrite()
 	if (_channel->isWriting())
 	{
 		int saveError = 0;
-		ssize_t n = _outputBuffer.writeFd(_channel->fd(), &saveError);
+		ssize_t n = writeOutput(&saveError);
 		if (n > 0)
 		{
-			_outputBuffer.retrieve(n);
-			if (_outputBuffer.readableBytes() == 0)
+			if (!_limitGroups.empty())
+				limitEgress(n, 0);
+			size_t pending = pendingOutputBytes();
+			if (_throttlingSource && pending <= _flowLowWaterMark)
+				throttleSource(false);
+			if (_shrinkCapacity > 0)
+			{
+				_lastActivity = _loop->now();
+				if (pending == 0)
+					scheduleShrink(_shrinkIdleSeconds);
+			}
+			if (pending == 0)
 			{
-				_channel->disableWriting();
-				if (_writeCompleteCallback)  // TcpConnection对象在其所在的subloop中 向pendingFunctors_中加入回调
-					_loop->queueInLoop(std::bind(_writeCompleteCallback, shared_from_this()));
+				if (_channel->isWriting())
+					_channel->disableWriting();
+				if (_callbacks->writeCompleteCallback)  // TcpConnection对象在其所在的subloop中 向pendingFunctors_中加入回调
+					_loop->queueInLoop(std::bind(_callbacks->writeCompleteCallback, shared_from_this()));
 				if (_state == StateE::Disconnecting)
 					shutdownInLoop();  		// 在当前所属的loop中把TcpConnection删除掉
 			}
+			// 协程可能接着发送 放在发送队列的处理之后
+			if (_sendWaiter && sendReady())
+				std::exchange(_sendWaiter, nullptr)->_handle.resume();
 		}
 		else
 		{
@@ -211,13 +811,17 @@ void TcpConnection::handleWrite()
 
 void TcpConnection::handleClose()
 {
-	LOG_INFO("TcpConnection::handleClose fd=%d state=%d\n", _channel->fd(), (int)_state);
+	LOG_TRACE("TcpConnection::handleClose fd=%d state=%d\n", _channel->fd(), (int)_state);
 	setState(StateE::Disconnected);
 	_channel->disableAll();
+	// 不会再发送了 不能让source一直停着
+	if (_throttlingSource)
+		throttleSource(false);
 
 	TcpConnectionPtr connPtr(shared_from_this());
-	_connectionCallback(connPtr); 			// 执行连接关闭的回调
-	_closeCallback(connPtr);      			// 执行关闭连接的回调 执行的是TcpServer::removeConnection回调方法   // must be the last line
+	resumeWaiters();
+	_callbacks->connectionCallback(connPtr); 			// 执行连接关闭的回调
+	_callbacks->closeCallback(connPtr);      			// 执行关闭连接的回调 执行的是TcpServer::removeConnection回调方法   // must be the last line
 }
 
 
@@ -3,6 +3,11 @@
 #include <memory>
 #include <string>
 #include <atomic>
+#include <any>
+#include <mutex>
+#include <vector>
+#include <coroutine>
+#include <string_view>
 
 #include "noncopyable.h"
 #include "InetAddress.h"
@@ -13,6 +18,20 @@
 class Channel;
 class EventLoop;
 class Socket;
+class SpillQueue;
+class TrafficLimitGroup;
+struct TrafficLimits;
+
+
+/// @brief 连接上的用户回调 TcpServer/TcpClient组装好一份后由它创建的连接共享 不必为每个连接逐个拷贝std::function
+/// 连接单独设置某个回调时才复制出自己的一份(写时复制) 不会影响其他连接
+struct TcpConnectionCallbacks
+{
+	ConnectionCallback connectionCallback;
+	MessageCallback messageCallback;
+	WriteCompleteCallback writeCompleteCallback;
+	CloseCallback closeCallback;
+};
 
 
 /*
@@ -22,37 +41,109 @@ class Socket;
 class TcpConnection : public noncopyable, public std::enable_shared_from_this<TcpConnection>
 {
 public:
-	TcpConnection(EventLoop* loop, const std::string& nameArg, int sockfd, const InetAddress& local, const InetAddress& peer);
+	// 本端地址在第一次调用localAddress()时才通过getsockname获取 建立连接时省去一次系统调用
+	TcpConnection(EventLoop* loop, uint64_t id, std::string name, int sockfd, const InetAddress& peer);
 	~TcpConnection();
 
 	EventLoop* getLoop() const { return _loop; }
+	// 创建者分配的连接编号 在同一个TcpServer/TcpClient中唯一
+	uint64_t id() const { return _id; }
 	const std::string& name() const { return _name; }
-	const InetAddress& localAddress() const { return _localAddr; }
+	const InetAddress& localAddress() const;
 	const InetAddress& peerAddress() const { return _peerAddr; }
 
 	bool connected() const { return _state == StateE::Connected; }
 
-	// 发送数据
-	void send(const std::string& buf);
+	class ReadAwaitable;
+	class SendAwaitable;
+
+	// 发送数据 返回值只在协程中使用(见Coroutine.h) 普通调用直接丢弃
+	// co_await conn->send(buf): 发送队列(pendingOutputBytes)低于高水位时不挂起 否则等它降到高水位以下再继续 返回连接是否仍然可以发送
+	// 高水位由setHighWaterMarkCallback设置 默认64MB 回调可以为空
+	SendAwaitable send(const std::string& buf);
+	// 发送Buffer中的全部可读数据 发送后buf被清空 在loop线程中调用时不会产生额外的拷贝
+	SendAwaitable send(Buffer* buf);
+	// 协程中读取 co_await的结果为取走的数据 连接关闭时为空串(已读入但不满足条件的数据留在输入缓冲区中)
+	// 一个连接同时只能有一个协程等待读 第一次co_await之后 读入的数据留在输入缓冲区中等协程取走 不再调用消息回调
+	// 协程总是在本连接的loop线程中恢复 在其他线程中co_await时协程切换到本连接的loop中继续执行
+	// 在其他线程中第一次co_await读之前必须先调用setCoroutineReading 否则LOG_FATAL
+	// 恰好读取n个字节
+	ReadAwaitable readExactly(size_t n);
+	// 读到delimiter为止 结果包括delimiter delimiter在co_await结束之前必须有效
+	ReadAwaitable readUntil(std::string_view delimiter);
+	// 声明本连接的输入由协程读取 之后读入的数据留在输入缓冲区中 不再调用消息回调
+	// 在本连接的loop线程中co_await读时自动声明 读的协程spawn到其他loop时要在连接回调中先调用 否则协程开始读之前到达的数据会交给消息回调
+	void setCoroutineReading() { _coroutineReading = true; }
 	// 关闭连接
 	void shutdown();
+	// 强制关闭连接 不等待发送缓冲区中的数据发送完毕
+	void forceClose();
+	// 禁用nagle算法 一次请求的回复分多次发送时 避免后面的小包等待前一个包的ack
+	void setTcpNoDelay(bool on);
+
+	// 停止/恢复读取 可以在任意线程中调用 停止期间对端的数据留在内核的接收缓冲区中 由TCP的流量控制让对端慢下来
+	// 停止读期间也察觉不到对端关闭连接
+	void startRead();
+	void stopRead();
+	// 用户是否要求读取 只能在loop线程中访问
+	bool isReading() const { return _reading; }
+
+	// 内置的流量控制: 本连接的发送缓冲区达到highWaterMark时让source停止读 降到lowWaterMark及以下时恢复 可以在任意线程中调用
+	// source可以是本连接自己(回显等每个请求都产生回复的服务) 也可以是代理中向本连接转发数据的上游连接 两者可以在不同的loop中
+	// 一个source可以同时受多个连接控制 所有连接都降到低水位才恢复读 与startRead/stopRead互不影响 本连接关闭时恢复source的读
+	void setFlowControl(const TcpConnectionPtr& source, size_t highWaterMark, size_t lowWaterMark);
+	// 发送队列超过threshold后 后续数据写入本loop的溢出文件(SpillFile) socket可写时用sendfile从文件发送 threshold为0时关闭
+	// 数据的顺序、写完成回调以及高水位回调、流量控制看到的待发送字节数都与全部留在内存中时相同 可以在任意线程中调用
+	void setOutputSpill(size_t threshold);
+	// 缓冲区收缩: 输入或输出缓冲区的容量超过maxCapacity时 在它清空并且连接idleSeconds秒没有读写之后缩回Buffer::kInitialSize
+	// maxCapacity为0时不收缩(默认) 在connectEstablished之前或loop线程中调用 TcpServer::setBufferShrink为所有连接设置
+	// glibc下缩回的内存要还给系统还需程序自己调用一次Buffer::pinMmapThreshold 这里不改变进程级的malloc设置
+	void setBufferShrink(size_t maxCapacity, double idleSeconds);
+	// 输入、输出缓冲区换成至少capacity字节的镜像环形缓冲区(Buffer::useMirroredRing) 持续大流量时省去makeSpace的搬移
+	// 每个环占两段内存映射(受vm.max_map_count限制) 适合少量长时间大流量的连接 在loop线程中调用(如连接回调中) 失败时仍用vector
+	bool useMirroredBuffers(size_t capacity);
+	// 限速: 每次读入、写出后从每一组中扣除令牌 任一组透支时停止关注EPOLLIN/EPOLLOUT 由loop的定时器在令牌够用时恢复
+	// 组可以由多个连接共享(同一对端ip、整个TcpServer) 在connectEstablished之前或loop线程中调用 TcpServer::setTrafficLimits为所有连接设置
+	void setTrafficLimits(std::vector<std::shared_ptr<TrafficLimitGroup>> groups);
+	// 只限制本连接
+	void setTrafficLimits(const TrafficLimits& limits);
+
+
+	// 上层协议(如http)保存在连接上的解析状态
+	void setContext(const std::any& context) { _context = context; }
+	const std::any& getContext() const { return _context; }
+	std::any* getMutableContext() { return &_context; }
 
+	// 接收缓冲区 上层协议暂停处理输入后 可以在之后的回调中继续处理其中积压的数据 只能在loop线程中访问
+	Buffer* inputBuffer() { return &_inputBuffer; }
+	// 发送缓冲区中还没写入内核的数据 只能在loop线程中访问
+	const Buffer* outputBuffer() const { return &_outputBuffer; }
+	// 所有待发送的字节数 包括溢出到文件中的部分 只能在loop线程中访问
+	size_t pendingOutputBytes() const;
+	// 输入、输出缓冲区占用的内存 只能在loop线程中访问
+	size_t bufferBytes() const { return _inputBuffer.internalCapacity() + _outputBuffer.internalCapacity(); }
 
+	// 使用共享的回调表 在connectEstablished之前调用
+	void setCallbacks(std::shared_ptr<TcpConnectionCallbacks> callbacks)
+	{
+		_callbacks = std::move(callbacks);
+		_ownsCallbacks = false;
+	}
 	void setConnectionCallback(ConnectionCallback cb)
 	{
-		_connectionCallback = std::move(cb);
+		mutableCallbacks().connectionCallback = std::move(cb);
 	}
 	void setMessageCallback(MessageCallback cb)
 	{
-		_messageCallback = std::move(cb);
+		mutableCallbacks().messageCallback = std::move(cb);
 	}
 	void setWriteCompleteCallback(WriteCompleteCallback cb)
 	{
-		_writeCompleteCallback = std::move(cb);
+		mutableCallbacks().writeCompleteCallback = std::move(cb);
 	}
 	void setCloseCallback(CloseCallback cb)
 	{
-		_closeCallback = std::move(cb);
+		mutableCallbacks().closeCallback = std::move(cb);
 	}
 	void setHighWaterMarkCallback(HighWaterMarkCallback cb, size_t highWaterMark)
 	{
@@ -65,6 +156,13 @@ public:
 	// 连接销毁
 	void connectDestroyed();
 
+	// 进程交接(Handover)时把连接交给新进程 在loop线程中调用
+	// 发送缓冲区为空时返回dup出的fd 未处理的输入移入unread 随后像对端关闭一样移除本连接(不shutdown 新进程持有的fd使连接保持打开)
+	// 还有数据没发完时返回-1 连接不受影响
+	int detachForHandover(std::string* unread);
+	// 代替connectEstablished接管旧进程交来的连接 旧进程中未处理的输入先放入接收缓冲区再交给消息回调
+	void connectAdopted(const std::string& unread);
+
 private:
 	enum StateE : int
 	{
@@ -75,6 +173,7 @@ private:
 	};
 
 	void setState(StateE state) { _state = state; }
+	TcpConnectionCallbacks& mutableCallbacks();
 
 	void handleRead(Timestamp receiveTime);
 	void handleWrite();
@@ -82,31 +181,123 @@ private:
 	void handleError();
 
 	void sendInLoop(const void* data, size_t len);
+	void appendOutput(const char* data, size_t len);
+	ssize_t writeOutput(int* saveErrno);
+	void updateReading();
+	void throttleReadInLoop(bool on);
+	void throttleSource(bool on);
+	void updateBufferBytes();
+	void scheduleShrink(double delay);
+	void shrinkBuffers();
+	// 超出内存预算时暂停的读 由BufferBudget在回到预算以内时恢复
+	friend class BufferBudget;
+	void resumeBudgetPausedRead();
+	void limitIngress(size_t bytes, Timestamp now);
+	void limitEgress(size_t bytes, size_t messages);
+	void resumeRateLimitedRead();
+	void resumeRateLimitedWrite();
 	void shutdownInLoop();
+	void forceCloseInLoop();
+	void waitRead(ReadAwaitable* waiter);
+	void waitSend(SendAwaitable* waiter);
+	bool sendReady() const;
+	void resumeWaiters();
 
 	// 这里是baseloop还是subloop由TcpServer中创建的线程数决定, 若为多Reactor 该loop_指向subloop 若为单Reactor 该loop_指向baseloop
 	EventLoop* _loop;
+	const uint64_t _id;
 	const std::string _name;
 	std::atomic<StateE> _state;
-	bool _reading;
+	bool _reading;			// 用户是否要求读取(startRead/stopRead)
+	int _readThrottles;		// 有多少个连接因流量控制让本连接暂停读 不为0时不读
 
 	// Socket Channel 这里和Acceptor类似  Acceptor => mainloop  TcpConnection => subloop
 	std::unique_ptr<Socket> _socket;
 	std::unique_ptr<Channel> _channel;
 
-	const InetAddress _localAddr;
+	mutable std::once_flag _localAddrOnce;
+	mutable InetAddress _localAddr;
 	const InetAddress _peerAddr;
 
 	// 这些回调TcpServer也有 用户通过写入TcpServer注册 TcpServer再将注册的回调传递给TcpConnection TcpConnection再将回调注册到Channel中
-	ConnectionCallback _connectionCallback;
-	MessageCallback _messageCallback;
-	WriteCompleteCallback _writeCompleteCallback;
+	std::shared_ptr<TcpConnectionCallbacks> _callbacks;
+	bool _ownsCallbacks;	// _callbacks是否为本连接独有 共享的回调表不能原地修改
 	HighWaterMarkCallback _highWaterMarkCallback;
-	CloseCallback _closeCallback;
 	size_t _highWaterMark;
 
+	// 流量控制 本连接的发送缓冲区决定_flowControlSource是否读取
+	std::weak_ptr<TcpConnection> _flowControlSource;
+	size_t _flowHighWaterMark;		// 为0时不做流量控制
+	size_t _flowLowWaterMark;
+	bool _throttlingSource;			// 是否已经让source暂停读
+
+	// 进程的缓冲区内存预算(BufferBudget) 连接建立时开启了预算才参与统计
+	bool _budgeted;
+	bool _budgetPausedRead;			// 是否因超出预算暂停了读
+	size_t _bufferBytes;			// 已计入预算的字节数
+
+	// 发送队列的溢出 _spill中的数据总是排在_outputBuffer之后
+	size_t _spillThreshold;			// 为0时不溢出
+	std::unique_ptr<SpillQueue> _spill;
+
+	// 缓冲区收缩 只有容量超过_shrinkCapacity的连接才启动定时器
+	size_t _shrinkCapacity;			// 为0时不收缩
+	double _shrinkIdleSeconds;
+	bool _shrinkScheduled;
+	Timestamp _lastActivity;		// 最近一次读写的loop时间
+
+	// 限速 为空时不限速
+	std::vector<std::shared_ptr<TrafficLimitGroup>> _limitGroups;
+	bool _rateLimitedRead;			// 是否因入方向透支暂停了读
+	bool _rateLimitedWrite;			// 是否因出方向透支暂停了写 期间的数据留在发送队列中
+
+	// 挂起在本连接上的协程 由handleRead/handleWrite在条件满足时恢复 连接关闭时全部恢复
+	ReadAwaitable* _readWaiter;
+	SendAwaitable* _sendWaiter;
+	std::atomic<bool> _coroutineReading;	// 输入由协程读取 不再调用消息回调 其他线程中co_await时检查
+
+	std::any _context;
+
 	// 数据缓冲区,用户态的缓冲区
 	Buffer _inputBuffer;    // 接收缓冲区
 	Buffer _outputBuffer;   // 发送缓冲区 用户send向_outputBuffer发送
 };
 
+
+class TcpConnection::ReadAwaitable
+{
+public:
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle);
+	std::string await_resume();
+
+private:
+	friend class TcpConnection;
+	ReadAwaitable(TcpConnection* conn, size_t bytes, std::string_view delimiter)
+		: _conn{ conn }, _bytes{ bytes }, _delimiter{ delimiter }, _scanned{ 0 } {}
+
+	// 输入缓冲区中满足条件时要取走的字节数 不满足时为0
+	size_t available();
+
+	TcpConnection* _conn;
+	size_t _bytes;					// readExactly的字节数
+	std::string_view _delimiter;	// readUntil的分隔符 为空时按字节数读取
+	size_t _scanned;				// 已经找过、没有分隔符的字节数 新数据到来时接着往后找
+	std::coroutine_handle<> _handle;
+};
+
+
+class TcpConnection::SendAwaitable
+{
+public:
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle);
+	bool await_resume() const { return _conn->connected(); }
+
+private:
+	friend class TcpConnection;
+	explicit SendAwaitable(TcpConnection* conn) : _conn{ conn } {}
+
+	TcpConnection* _conn;
+	std::coroutine_handle<> _handle;
+};
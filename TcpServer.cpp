@@ -1,9 +1,17 @@
 #include <functional>
-#include <string.h>
+#include <charconv>
+#include <algorithm>
+#include <future>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <fcntl.h>
 
 #include "TcpServer.h"
 #include "Logger.h"
 #include "TcpConnection.h"
+#include "BufferBudget.h"
 
 using namespace std::placeholders;
 
@@ -16,17 +24,35 @@ static EventLoop* checkLoopNotNull(EventLoop* loop)
 }
 
 TcpServer::TcpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, Option option) :
-	_loop{ checkLoopNotNull(loop) }, _ipPort{ listenAddr.toIpPort() }, _name{ name }, _acceptor{ new Acceptor(loop, listenAddr, option == Option::ReusePort) },
-	_threadPool{ new EventLoopThreadPool(loop, name) }, _nextConnId{ 1 }, _started{ 0 }
+	_loop{ checkLoopNotNull(loop) }, _ipPort{ listenAddr.toIpPort() }, _name{ name }, _listenAddr{ listenAddr }, _option{ option },
+	_acceptBudget{ Acceptor::kDefaultAcceptBudget }, _cpuSteering{ false }, _shrinkCapacity{ 0 }, _shrinkIdleSeconds{ 0 }, _peerLimitsPruneSize{ 1024 }, _nextAdoptAcceptor{ 0 }, _threadPool{ new EventLoopThreadPool(loop, name) },
+	_connectionCallback{ defaultConnectionCallback }, _messageCallback{ defaultMessageCallback }, _nextConnId{ 1 }, _started{ 0 }
 {
-	// 当有新用户连接时，Acceptor类中绑定的_acceptChannel会有读事件发生，执行handleRead()调用TcpServer::newConnection回调
-	_acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, _1, _2));
+	// 监听socket在start中创建 进程交接时新进程要先接收旧进程的监听socket 不能在这里bind同一个端口
 }
 
 
 TcpServer::~TcpServer()
 {
-	for (auto&& [name, ptr] : _connections)
+	for (int fd : _adoptedListenFds)
+		::close(fd);
+
+	// 各loop的Acceptor和连接表只能在所属loop中销毁 此时线程池还没有析构 subloop仍在运行
+	for (auto&& acceptor : _loopAcceptors)
+	{
+		LoopAcceptor* state = acceptor.get();
+		std::promise<void> done;
+		state->loop->runInLoop([state, &done]() {
+			state->acceptor.reset();
+			for (auto&& [id, conn] : state->connections)
+				conn->connectDestroyed();
+			state->connections.clear();
+			done.set_value();
+		});
+		done.get_future().wait();
+	}
+
+	for (auto&& [id, ptr] : _connections)
 	{
 		TcpConnectionPtr conn(ptr);
 		ptr.reset(); // 把原始的智能指针复位 让栈空间的TcpConnectionPtr conn指向该对象 当conn出了其作用域 即可释放智能指针指向的对象
@@ -41,49 +67,308 @@ void TcpServer::setThreadNum(int num)
 }
 
 
+void TcpServer::setAcceptBudget(int budget)
+{
+	_acceptBudget = budget;
+	if (_acceptor)
+		_acceptor->setAcceptBudget(budget);
+}
+
+
 void TcpServer::start()
 {
 	// 防止一个TcpServer对象被start多次
 	if (_started++ == 0)
 	{
 		_threadPool->start(_threadInitCallback);  // 启动线程池
-		_loop->runInLoop(std::bind(&Acceptor::listen, _acceptor.get()));
+		if (BufferBudget::instance().enabled())
+		{
+			for (EventLoop* loop : _threadPool->getAllLoops())
+				BufferBudget::instance().attachLoop(loop);
+		}
+		if (_cpuSteering)
+			startCpuSteering();
+		if (_option == Option::MultiAcceptor)
+		{
+			startLoopAcceptors();
+		}
+		else
+		{
+			if (_adoptedListenFds.empty())
+				_acceptor.reset(new Acceptor(_loop, _listenAddr, _option == Option::ReusePort));
+			else
+			{
+				_acceptor.reset(new Acceptor(_loop, _adoptedListenFds[0]));
+				for (size_t i = 1; i < _adoptedListenFds.size(); i++)
+				{
+					LOG_ERROR("TcpServer::start [%s] single acceptor cannot adopt listen fd %d, closing it\n", _name.data(), _adoptedListenFds[i]);
+					::close(_adoptedListenFds[i]);
+				}
+			}
+			_acceptor->setAcceptBudget(_acceptBudget);
+			// 当有新用户连接时，Acceptor类中绑定的_acceptChannel会有读事件发生，执行handleRead()调用TcpServer::newConnection回调
+			_acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, _1, _2));
+			_loop->runInLoop(std::bind(&Acceptor::listen, _acceptor.get()));
+		}
+		_adoptedListenFds.clear();
+	}
+}
+
+
+std::string TcpServer::connectionName(uint64_t connId) const
+{
+	// 连接名为 服务器名#编号
+	char id[24];
+	char* idEnd = std::to_chars(id, id + sizeof(id), connId).ptr;
+	std::string connName;
+	connName.reserve(_name.size() + 1 + (idEnd - id));
+	connName.append(_name).append(1, '#').append(id, idEnd);
+	return connName;
+}
+
+
+void TcpServer::startLoopAcceptors()
+{
+	std::vector<EventLoop*> loops = _threadPool->getAllLoops();
+	size_t count = std::max(loops.size(), _adoptedListenFds.size());
+	for (size_t i = 0; i < count; i++)
+	{
+		auto acceptor = std::make_unique<LoopAcceptor>();
+		LoopAcceptor* state = acceptor.get();
+		state->loop = loops[i % loops.size()];
+		// 所有的监听socket都设置SO_REUSEPORT 在bind之前设置 内核才会把它们放进同一个reuseport组
+		// 接管的监听socket已经在旧进程的reuseport组里 新建的socket加入同一个组
+		if (i < _adoptedListenFds.size())
+			state->acceptor.reset(new Acceptor(state->loop, _adoptedListenFds[i]));
+		else
+			state->acceptor.reset(new Acceptor(state->loop, _listenAddr, true));
+		state->acceptor->setAcceptBudget(_acceptBudget);
+		state->acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnectionInLoop, this, state, _1, _2));
+		state->callbacks = std::make_shared<TcpConnectionCallbacks>(TcpConnectionCallbacks{
+			_connectionCallback, _messageCallback, _writeCompleteCallback, std::bind(&TcpServer::removeLoopConnection, this, state, _1) });
+		state->nextConnId = i + 1;
+		_loopAcceptors.push_back(std::move(acceptor));
+	}
+	// 监听socket按listen的先后加入reuseport组 组内下标即cBPF程序返回的值 所以逐个等待listen完成
+	for (auto&& acceptor : _loopAcceptors)
+	{
+		std::promise<void> done;
+		acceptor->loop->runInLoop([&acceptor, &done]() {
+			acceptor->acceptor->listen();
+			done.set_value();
+		});
+		done.get_future().wait();
+	}
+
+	// 接管的reuseport组上仍挂着旧进程的cBPF程序
+	if (!_steeringLoops.empty() && _loopAcceptors.size() > 1 && _adoptedListenFds.empty())
+	{
+		// A = 接收数据包的cpu; A = A % 监听socket数; 返回A作为reuseport组内的下标
+		sock_filter code[] = {
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(_loopAcceptors.size()) },
+			{ BPF_RET | BPF_A, 0, 0, 0 },
+		};
+		sock_fprog prog = { static_cast<unsigned short>(sizeof(code) / sizeof(code[0])), code };
+		if (::setsockopt(_loopAcceptors[0]->acceptor->fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+			LOG_ERROR("TcpServer::startLoopAcceptors [%s] SO_ATTACH_REUSEPORT_CBPF error:%d\n", _name.data(), errno);
+	}
+}
+
+
+// 把各loop线程绑定到cpu上 只有一个loop时不需要选择
+void TcpServer::startCpuSteering()
+{
+	std::vector<EventLoop*> loops = _threadPool->getAllLoops();
+	if (loops.size() <= 1)
+		return;
+
+	long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	for (size_t i = 0; i < loops.size(); i++)
+	{
+		int cpu = static_cast<int>(i % cpus);
+		std::promise<void> done;
+		loops[i]->runInLoop([this, cpu, &done]() {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (::sched_setaffinity(0, sizeof(set), &set) < 0)
+				LOG_ERROR("TcpServer::startCpuSteering [%s] sched_setaffinity cpu %d error:%d\n", _name.data(), cpu, errno);
+			done.set_value();
+		});
+		done.get_future().wait();
 	}
+	_steeringLoops = std::move(loops);
+}
+
+
+// 连接的SO_INCOMING_CPU是最近一次处理它的数据包的cpu 取不到时退回轮询
+EventLoop* TcpServer::loopForIncomingCpu(int sockfd)
+{
+	int cpu = -1;
+	socklen_t len = sizeof(cpu);
+	if (::getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0 || cpu < 0)
+		return _threadPool->getNextLoop();
+	return _steeringLoops[cpu % _steeringLoops.size()];
+}
+
+
+// MultiAcceptor模式 在接收连接的loop线程中直接建立连接 不需要跨线程投递
+void TcpServer::newConnectionInLoop(LoopAcceptor* acceptor, int sockfd, const InetAddress& peerAddr)
+{
+	if (refuseOverBudget(sockfd))
+		return;
+	createLoopConnection(acceptor, sockfd, peerAddr)->connectEstablished();
+}
+
+
+TcpConnectionPtr TcpServer::createLoopConnection(LoopAcceptor* acceptor, int sockfd, const InetAddress& peerAddr)
+{
+	uint64_t connId = acceptor->nextConnId;
+	acceptor->nextConnId += _loopAcceptors.size();
+	std::string connName = connectionName(connId);
+	LOG_DEBUG("TcpServer::newConnectionInLoop [%s] - new connection [%s] from %s\n", _name.data(), connName.data(), peerAddr.toIpPort().data());
+
+	TcpConnectionPtr conn(new TcpConnection(acceptor->loop, connId, std::move(connName), sockfd, peerAddr));
+	conn->setCallbacks(acceptor->callbacks);
+	if (_shrinkCapacity > 0)
+		conn->setBufferShrink(_shrinkCapacity, _shrinkIdleSeconds);
+	applyTrafficLimits(conn, peerAddr);
+	acceptor->connections.emplace(connId, conn);
+	return conn;
+}
+
+
+void TcpServer::removeLoopConnection(LoopAcceptor* acceptor, const TcpConnectionPtr& conn)
+{
+	LOG_DEBUG("TcpServer::removeLoopConnection [%s] - connection %s\n", _name.data(), conn->name().data());
+	acceptor->connections.erase(conn->id());
+	acceptor->loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 }
 
 
 // 有一个新用户连接，acceptor会执行这个回调操作，负责将mainLoop接收到的请求连接(acceptChannel_会有读事件发生)通过回调轮询分发给subLoop去处理
+// 每秒可能有上万次 这里只做必要的工作: 本端地址等用到时再取 回调表所有连接共享 日志只在DEBUG级别输出
 void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
 {
-	// 轮询算法 选择一个subLoop 来管理connfd对应的channel
-	EventLoop* ioLoop = _threadPool->getNextLoop();
-	char buf[64] = { 0 };
-	snprintf(buf, sizeof(buf), "-%s#%d", _ipPort.data(), _nextConnId);
-	_nextConnId++;  // 这里没有设置为原子类是因为其只在mainloop中执行 不涉及线程安全问题
-	std::string connName = _name.append(buf);
+	if (refuseOverBudget(sockfd))
+		return;
+	TcpConnectionPtr conn = createConnection(sockfd, peerAddr);
+
+	// 同一轮事件处理中accept的连接攒起来 在mainloop本轮的doPendingFunctors中按subloop分组投递
+	// 每个subloop一批只入队、唤醒一次 而不是每个连接一次
+	if (_pendingConnections.empty())
+		_loop->queueInLoop(std::bind(&TcpServer::establishPendingConnections, this));
+	_pendingConnections.push_back(std::move(conn));
+}
+
+
+TcpConnectionPtr TcpServer::createConnection(int sockfd, const InetAddress& peerAddr)
+{
+	// 轮询算法 选择一个subLoop 来管理connfd对应的channel 开启按cpu选择时交给接收该连接的cpu上的loop
+	EventLoop* ioLoop = _steeringLoops.empty() ? _threadPool->getNextLoop() : loopForIncomingCpu(sockfd);
+	uint64_t connId = _nextConnId++;  // 这里没有设置为原子类是因为其只在mainloop中执行 不涉及线程安全问题
+	std::string connName = connectionName(connId);
 
-	LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s\n", _name.data(), connName.data(), peerAddr.toIpPort().data());
+	LOG_DEBUG("TcpServer::newConnection [%s] - new connection [%s] from %s\n", _name.data(), connName.data(), peerAddr.toIpPort().data());
 
-	// 通过sockfd获取其绑定的本机的ip地址和端口信息
-	sockaddr_in local;
-	::memset(&local, 0, sizeof(local));
-	socklen_t addrlen = sizeof(local);
-	if (::getsockname(sockfd, (sockaddr*)&local, &addrlen) < 0)
-		LOG_ERROR("sockets::getLocalAddr");
-	
-	InetAddress localAddr(local);
-	TcpConnectionPtr conn(new TcpConnection(ioLoop, connName, sockfd, localAddr, peerAddr));
-	_connections[connName] = conn;
+	if (!_connectionCallbacks)
+	{
+		// 下面的回调都是用户设置给TcpServer => TcpConnection的，至于Channel绑定的则是TcpConnection设置的四个，handleRead,handleWrite... 这下面的回调用于handlexxx函数中
+		// closeCallback设置了如何关闭连接
+		_connectionCallbacks = std::make_shared<TcpConnectionCallbacks>(TcpConnectionCallbacks{
+			_connectionCallback, _messageCallback, _writeCompleteCallback, std::bind(&TcpServer::removeConnection, this, _1) });
+	}
 
-	// 下面的回调都是用户设置给TcpServer => TcpConnection的，至于Channel绑定的则是TcpConnection设置的四个，handleRead,handleWrite... 这下面的回调用于handlexxx函数中
-	conn->setConnectionCallback(_connectionCallback);
-	conn->setMessageCallback(_messageCallback);
-	conn->setWriteCompleteCallback(_writeCompleteCallback);
+	TcpConnectionPtr conn(new TcpConnection(ioLoop, connId, std::move(connName), sockfd, peerAddr));
+	conn->setCallbacks(_connectionCallbacks);
+	if (_shrinkCapacity > 0)
+		conn->setBufferShrink(_shrinkCapacity, _shrinkIdleSeconds);
+	applyTrafficLimits(conn, peerAddr);
+	_connections.emplace(connId, conn);
+	return conn;
+}
 
-	// 设置了如何关闭连接的回调
-	conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, _1));
 
-	ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+void TcpServer::setTrafficLimits(const TrafficLimits& perConnection, const TrafficLimits& perPeer, const TrafficLimits& total)
+{
+	_connectionLimits = perConnection;
+	_peerLimits = perPeer;
+	_totalLimits = total.enabled() ? std::make_shared<TrafficLimitGroup>(total) : nullptr;
+}
+
+
+void TcpServer::applyTrafficLimits(const TcpConnectionPtr& conn, const InetAddress& peerAddr)
+{
+	std::vector<std::shared_ptr<TrafficLimitGroup>> groups;
+	if (_connectionLimits.enabled())
+		groups.push_back(std::make_shared<TrafficLimitGroup>(_connectionLimits));
+	if (_peerLimits.enabled())
+	{
+		uint32_t ip = peerAddr.getSockAddr()->sin_addr.s_addr;
+		std::lock_guard<std::mutex> lock(_peerLimitsMutex);
+		std::weak_ptr<TrafficLimitGroup>& weak = _peerLimitGroups[ip];
+		std::shared_ptr<TrafficLimitGroup> group = weak.lock();
+		if (!group)
+		{
+			group = std::make_shared<TrafficLimitGroup>(_peerLimits);
+			weak = group;
+		}
+		groups.push_back(std::move(group));
+		// 组随该ip最后一个连接销毁 表里只剩失效的weak_ptr 表翻倍时清理一次
+		if (_peerLimitGroups.size() >= _peerLimitsPruneSize)
+		{
+			std::erase_if(_peerLimitGroups, [](const auto& entry) { return entry.second.expired(); });
+			_peerLimitsPruneSize = std::max<size_t>(1024, _peerLimitGroups.size() * 2);
+		}
+	}
+	if (_totalLimits)
+		groups.push_back(_totalLimits);
+	if (!groups.empty())
+		conn->setTrafficLimits(std::move(groups));
+}
+
+
+// 超出缓冲区内存预算时 新连接accept后立即关闭 让客户端尽快得知失败 而不是在队列中等待
+bool TcpServer::refuseOverBudget(int sockfd)
+{
+	BufferBudget& budget = BufferBudget::instance();
+	if (!budget.overBudget())
+		return false;
+	LOG_DEBUG("TcpServer [%s] - over buffer budget, refusing connection\n", _name.data());
+	::close(sockfd);
+	budget.noteRefusedConnection();
+	return true;
+}
+
+
+void TcpServer::establishPendingConnections()
+{
+	std::vector<TcpConnectionPtr> pending;
+	pending.swap(_pendingConnections);
+	std::stable_sort(pending.begin(), pending.end(), [](const TcpConnectionPtr& a, const TcpConnectionPtr& b) {
+		return std::less<EventLoop*>()(a->getLoop(), b->getLoop());
+	});
+
+	for (auto first = pending.begin(); first != pending.end();)
+	{
+		EventLoop* ioLoop = (*first)->getLoop();
+		auto last = std::find_if(first, pending.end(), [ioLoop](const TcpConnectionPtr& conn) { return conn->getLoop() != ioLoop; });
+		if (last - first == 1)
+		{
+			ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, std::move(*first)));
+		}
+		else
+		{
+			ioLoop->runInLoop([batch = std::vector<TcpConnectionPtr>(std::make_move_iterator(first), std::make_move_iterator(last))]() {
+				for (const TcpConnectionPtr& conn : batch)
+					conn->connectEstablished();
+			});
+		}
+		first = last;
+	}
 }
 
 
@@ -95,11 +380,201 @@ void TcpServer::removeConnection(const TcpConnectionPtr& conn)
 
 void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn)
 {
-	LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s\n", _name.data(), conn->name().data());
-	_connections.erase(conn->name());
+	LOG_DEBUG("TcpServer::removeConnectionInLoop [%s] - connection %s\n", _name.data(), conn->name().data());
+	_connections.erase(conn->id());
 	EventLoop* ioLoop = conn->getLoop();
 	ioLoop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 }
 
 
 
+
+
+/// @brief 在loop线程中执行func并等待它完成 在该loop线程中调用时直接执行
+static void runInLoopAndWait(EventLoop* loop, std::function<void()> func)
+{
+	if (loop->isInLoopThread())
+	{
+		func();
+		return;
+	}
+	std::promise<void> done;
+	loop->runInLoop([&func, &done]() {
+		func();
+		done.set_value();
+	});
+	done.get_future().wait();
+}
+
+
+std::vector<std::pair<EventLoop*, Acceptor*>> TcpServer::acceptors() const
+{
+	std::vector<std::pair<EventLoop*, Acceptor*>> acceptors;
+	if (_acceptor)
+		acceptors.emplace_back(_loop, _acceptor.get());
+	for (auto&& state : _loopAcceptors)
+		acceptors.emplace_back(state->loop, state->acceptor.get());
+	return acceptors;
+}
+
+
+bool TcpServer::receiveListeners(Handover& handover)
+{
+	std::vector<int> fds;
+	Handover::Message message;
+	while (handover.receive(&message))
+	{
+		if (message.type == Handover::MessageType::ListenersDone)
+		{
+			LOG_INFO("TcpServer::receiveListeners [%s] - received %zu listen sockets\n", _name.data(), fds.size());
+			_adoptedListenFds.insert(_adoptedListenFds.end(), fds.begin(), fds.end());
+			return !fds.empty();
+		}
+		if (message.type == Handover::MessageType::Listener && message.fd >= 0)
+			fds.push_back(message.fd);
+		else if (message.fd >= 0)
+			::close(message.fd);
+	}
+	LOG_ERROR("TcpServer::receiveListeners [%s] - handover interrupted\n", _name.data());
+	for (int fd : fds)
+		::close(fd);
+	return false;
+}
+
+
+int TcpServer::adoptConnections(Handover& handover)
+{
+	// 此时本进程已经在accept 旧进程收到Ack后才会交出连接
+	if (!handover.send(Handover::MessageType::Ack))
+		return -1;
+
+	int adopted = 0;
+	Handover::Message message;
+	while (handover.receive(&message))
+	{
+		if (message.type == Handover::MessageType::ConnectionsDone)
+		{
+			LOG_INFO("TcpServer::adoptConnections [%s] - adopted %d connections\n", _name.data(), adopted);
+			return adopted;
+		}
+		if (message.type == Handover::MessageType::Connection && message.fd >= 0)
+		{
+			adoptConnection(message.fd, message.peer, std::move(message.data));
+			adopted++;
+		}
+		else if (message.fd >= 0)
+			::close(message.fd);
+	}
+	LOG_ERROR("TcpServer::adoptConnections [%s] - handover interrupted after %d connections\n", _name.data(), adopted);
+	return -1;
+}
+
+
+void TcpServer::adoptConnection(int sockfd, const InetAddress& peerAddr, std::string unread)
+{
+	// 与accept到的连接一样设置非阻塞 这是两个进程共享的打开文件上的标志 旧进程中本来就已设置
+	::fcntl(sockfd, F_SETFL, ::fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	if (_option == Option::MultiAcceptor)
+	{
+		LoopAcceptor* state = _loopAcceptors[_nextAdoptAcceptor++ % _loopAcceptors.size()].get();
+		state->loop->runInLoop([this, state, sockfd, peerAddr, unread = std::move(unread)]() {
+			createLoopConnection(state, sockfd, peerAddr)->connectAdopted(unread);
+		});
+	}
+	else
+	{
+		TcpConnectionPtr conn = createConnection(sockfd, peerAddr);
+		conn->getLoop()->runInLoop([conn, unread = std::move(unread)]() {
+			conn->connectAdopted(unread);
+		});
+	}
+}
+
+
+int TcpServer::handover(Handover& handover, bool passConnections, HandoverFilter filter)
+{
+	// 暂停accept 之后到达的连接留在队列中 由新进程accept
+	std::vector<std::pair<EventLoop*, Acceptor*>> acceptors = this->acceptors();
+	for (auto&& [loop, acceptor] : acceptors)
+		runInLoopAndWait(loop, std::bind(&Acceptor::pause, acceptor));
+
+	bool ok = true;
+	for (auto&& [loop, acceptor] : acceptors)
+		ok = ok && handover.send(Handover::MessageType::Listener, acceptor->fd());
+	ok = ok && handover.send(Handover::MessageType::ListenersDone);
+	Handover::Message message;
+	ok = ok && handover.receive(&message) && message.type == Handover::MessageType::Ack;
+	if (message.fd >= 0)
+		::close(message.fd);
+	if (!ok)
+	{
+		LOG_ERROR("TcpServer::handover [%s] - new process did not take over, resume accepting\n", _name.data());
+		for (auto&& [loop, acceptor] : acceptors)
+			runInLoopAndWait(loop, std::bind(&Acceptor::resume, acceptor));
+		return -1;
+	}
+	LOG_INFO("TcpServer::handover [%s] - %zu listen sockets taken over\n", _name.data(), acceptors.size());
+
+	int passed = 0;
+	if (passConnections)
+	{
+		// 按loop分组 每个loop中摘下本组的空闲连接后 回到这里发送
+		std::vector<std::pair<EventLoop*, std::function<std::vector<TcpConnectionPtr>()>>> groups;
+		if (_option == Option::MultiAcceptor)
+		{
+			for (auto&& state : _loopAcceptors)
+			{
+				LoopAcceptor* acceptor = state.get();
+				groups.emplace_back(acceptor->loop, [acceptor]() {
+					std::vector<TcpConnectionPtr> conns;
+					for (auto&& [id, conn] : acceptor->connections)
+						conns.push_back(conn);
+					return conns;
+				});
+			}
+		}
+		else
+		{
+			std::unordered_map<EventLoop*, std::vector<TcpConnectionPtr>> byLoop;
+			for (auto&& [id, conn] : _connections)
+				byLoop[conn->getLoop()].push_back(conn);
+			for (auto&& [loop, conns] : byLoop)
+				groups.emplace_back(loop, [conns = std::move(conns)]() { return conns; });
+		}
+
+		struct Detached
+		{
+			int fd;
+			InetAddress peer;
+			std::string unread;
+		};
+		for (auto&& [loop, collect] : groups)
+		{
+			std::vector<Detached> detached;
+			runInLoopAndWait(loop, [&collect, &detached, &filter]() {
+				// 摘下连接会从连接表中删除 先复制一份
+				for (const TcpConnectionPtr& conn : collect())
+				{
+					if (!conn->connected() || conn->inputBuffer()->readableBytes() > Handover::kMaxUnreadBytes || (filter && !filter(conn)))
+						continue;
+					Detached item{ -1, conn->peerAddress(), std::string() };
+					item.fd = conn->detachForHandover(&item.unread);
+					if (item.fd >= 0)
+						detached.push_back(std::move(item));
+				}
+			});
+			for (Detached& item : detached)
+			{
+				if (ok && handover.send(Handover::MessageType::Connection, item.fd, item.peer, item.unread.data(), item.unread.size()))
+					passed++;
+				else
+					ok = false;	// 会话断开了 剩下的连接只能关闭
+				::close(item.fd);
+			}
+		}
+	}
+	if (ok)
+		handover.send(Handover::MessageType::ConnectionsDone);
+	LOG_INFO("TcpServer::handover [%s] - %d connections handed over\n", _name.data(), passed);
+	return passed;
+}
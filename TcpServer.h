@@ -4,7 +4,9 @@
 #include <string>
 #include <memory>
 #include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "EventLoop.h"
 #include "Acceptor.h"
@@ -14,45 +16,133 @@
 #include "Callbacks.h"
 #include "TcpConnection.h"
 #include "Buffer.h"
+#include "Handover.h"
+#include "RateLimiter.h"
 
 // 对外的服务器编程使用的类
 class TcpServer : public noncopyable
 {
 public:
 	using ThreadInitCallback = std::function<void(EventLoop*)>;
+	// 进程交接时决定一个空闲连接是否交给新进程 例如上层协议还有未完成的请求状态保存在context中时返回false
+	using HandoverFilter = std::function<bool(const TcpConnectionPtr&)>;
 
 	enum class Option : int
 	{
 		NoReusePort,
-		ReusePort
+		ReusePort,
+		// 每个subloop(没有subloop时为baseloop)各自通过SO_REUSEPORT监听同一端口 拥有自己的连接表
+		// 由内核把新连接分散到各个监听socket 连接的accept、建立、关闭都在同一个线程中完成 不经过mainloop
+		MultiAcceptor
 	};
 
 	TcpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, Option option = Option::NoReusePort);
 	~TcpServer();
 
+	EventLoop* getLoop() const { return _loop; }
+	const std::string& name() const { return _name; }
+	const std::string& ipPort() const { return _ipPort; }
+	// start之后可以通过线程池获取所有的subloop
+	std::shared_ptr<EventLoopThreadPool> threadPool() const { return _threadPool; }
+
 	void setThreadInitCallback(ThreadInitCallback cb) { _threadInitCallback = std::move(cb); }
-	void setConnectionCallback(ConnectionCallback cb) { _connectionCallback = std::move(cb); }
-	void setMessageCallback(MessageCallback cb) { _messageCallback = std::move(cb); }
-	void setWriteCompleteCallback(WriteCompleteCallback cb) { _writeCompleteCallback = std::move(cb); }
+	// 回调应在start之前设置 新连接共享按这些回调组装的同一份回调表
+	void setConnectionCallback(ConnectionCallback cb) { _connectionCallback = std::move(cb); _connectionCallbacks.reset(); }
+	void setMessageCallback(MessageCallback cb) { _messageCallback = std::move(cb); _connectionCallbacks.reset(); }
+	void setWriteCompleteCallback(WriteCompleteCallback cb) { _writeCompleteCallback = std::move(cb); _connectionCallbacks.reset(); }
 
 
 	// 设置底层subloop的个数
 	void setThreadNum(int numThreads);
+	// 每次listenfd可读时最多accept的连接数 默认Acceptor::kDefaultAcceptBudget 在start之前设置
+	void setAcceptBudget(int budget);
+
+	// 按接收连接的cpu选择subloop 在start之前设置
+	// 第i个subloop绑定到第i % cpu数个cpu上 连接交给cpu % loop数号loop 网卡软中断、loop线程和连接的数据留在同一个cpu上
+	// 单acceptor时读取新连接的SO_INCOMING_CPU选择loop; MultiAcceptor时给reuseport组挂上按cpu选择监听socket的cBPF程序
+	// loop数等于cpu数时每个cpu上的连接都留在本cpu的loop上 多于cpu数的loop分不到连接 只有一个loop时不起作用
+	void setCpuSteering(bool on) { _cpuSteering = on; }
+
+	// 连接的输入、输出缓冲区容量超过maxCapacity后 清空并空闲idleSeconds秒时缩回初始大小 见TcpConnection::setBufferShrink
+	// 在start之前设置 maxCapacity为0时不收缩(默认) 需要把内存还给系统时另外调用Buffer::pinMmapThreshold
+	void setBufferShrink(size_t maxCapacity, double idleSeconds)
+	{
+		_shrinkCapacity = maxCapacity;
+		_shrinkIdleSeconds = idleSeconds;
+	}
+
+	// 限速 见TcpConnection::setTrafficLimits 在start之前设置 不需要的一层传默认值
+	// perConnection每个连接一组 perPeer同一对端ip的所有连接共享一组 total整个server的所有连接共享一组
+	// 连接同时受三层限制 任一层透支都会暂停该连接的读或写 共享的组不加锁 只在创建连接时查找对端ip对应的组
+	void setTrafficLimits(const TrafficLimits& perConnection, const TrafficLimits& perPeer = TrafficLimits(), const TrafficLimits& total = TrafficLimits());
 
-	// 开启服务器监听
+	// 开启服务器监听 监听socket在这里创建(或使用receiveListeners收到的socket)
 	void start();
 
+	// 进程交接 见Handover.h 新旧进程应使用相同的Option
+	// 新进程 在start之前调用 接收旧进程的监听socket start时用它们代替新建的socket 失败时返回false 仍可正常start
+	bool receiveListeners(Handover& handover);
+	// 新进程 在start之后于baseloop线程中调用 通知旧进程交出连接并接管收到的连接 返回接管的连接数 交接中断时返回-1
+	int adoptConnections(Handover& handover);
+	// 旧进程 在baseloop线程中调用 暂停accept并交出监听socket 新进程确认后再交出空闲连接
+	// passConnections为true时交出发送缓冲区为空、未处理的输入不超过Handover::kMaxUnreadBytes且通过filter的连接
+	// 交出的连接在本进程中如同被对端关闭 执行连接回调后移除 返回交出的连接数
+	// 新进程没有确认时恢复accept并返回-1 成功后本进程不再accept 应在剩余的连接处理完之后退出
+	int handover(Handover& handover, bool passConnections, HandoverFilter filter = HandoverFilter());
+
 private:
 	void newConnection(int sockfd, const InetAddress& peerAddr);
+	TcpConnectionPtr createConnection(int sockfd, const InetAddress& peerAddr);
+	bool refuseOverBudget(int sockfd);
+	void applyTrafficLimits(const TcpConnectionPtr& conn, const InetAddress& peerAddr);
+	void establishPendingConnections();
 	void removeConnection(const TcpConnectionPtr& conn);
 	void removeConnectionInLoop(const TcpConnectionPtr& conn);
 
+	/// @brief MultiAcceptor模式下一个loop独有的监听socket与连接表 除创建和start外只在该loop线程中访问
+	/// 接管的监听socket多于loop数时 多出来的也各建一个 与其他LoopAcceptor共用loop
+	struct LoopAcceptor
+	{
+		EventLoop* loop;
+		std::unique_ptr<Acceptor> acceptor;
+		std::shared_ptr<TcpConnectionCallbacks> callbacks;
+		std::unordered_map<uint64_t, TcpConnectionPtr> connections;
+		uint64_t nextConnId;	// 各loop的编号按loop个数交错 不会重复
+	};
+
+	void startLoopAcceptors();
+	void startCpuSteering();
+	EventLoop* loopForIncomingCpu(int sockfd);
+	void newConnectionInLoop(LoopAcceptor* acceptor, int sockfd, const InetAddress& peerAddr);
+	TcpConnectionPtr createLoopConnection(LoopAcceptor* acceptor, int sockfd, const InetAddress& peerAddr);
+	void adoptConnection(int sockfd, const InetAddress& peerAddr, std::string unread);
+	std::vector<std::pair<EventLoop*, Acceptor*>> acceptors() const;	// 所有的监听socket及其所在的loop
+	void removeLoopConnection(LoopAcceptor* acceptor, const TcpConnectionPtr& conn);
+	std::string connectionName(uint64_t connId) const;
+
 	EventLoop* _loop;  // baseloop
 
 	std::string _ipPort;
 	std::string _name;
-
-	std::unique_ptr<Acceptor> _acceptor; // 运行在mainloop 任务就是监听新连接事件
+	const InetAddress _listenAddr;
+	const Option _option;
+	int _acceptBudget;
+	bool _cpuSteering;
+	size_t _shrinkCapacity;
+	double _shrinkIdleSeconds;
+	TrafficLimits _connectionLimits;
+	TrafficLimits _peerLimits;
+	std::shared_ptr<TrafficLimitGroup> _totalLimits;	// 没有设置整个server的限速时为空
+	// 对端ip => 该ip的限速组 MultiAcceptor模式下多个loop线程同时创建连接 需要加锁
+	std::mutex _peerLimitsMutex;
+	std::unordered_map<uint32_t, std::weak_ptr<TrafficLimitGroup>> _peerLimitGroups;
+	size_t _peerLimitsPruneSize;			// 表超过这个大小时清理连接都已关闭的ip
+	std::vector<EventLoop*> _steeringLoops;	// 按cpu选择的loop 第i个绑定在第i % cpu数个cpu上
+	std::vector<int> _adoptedListenFds;		// receiveListeners收到、start时接管的监听socket
+	size_t _nextAdoptAcceptor;				// MultiAcceptor模式下接管的连接轮流交给各个LoopAcceptor
+
+	std::unique_ptr<Acceptor> _acceptor; // 运行在mainloop 任务就是监听新连接事件 start时创建 MultiAcceptor模式下为空
+	std::vector<std::unique_ptr<LoopAcceptor>> _loopAcceptors;	// MultiAcceptor模式下每个loop一个
 	std::shared_ptr<EventLoopThreadPool> _threadPool; // one loop per thread
 
 	ConnectionCallback _connectionCallback;       	//有新连接时的回调
@@ -62,8 +152,11 @@ private:
 
 	std::atomic<int> _started;
 
-	int _nextConnId;
-	std::unordered_map<std::string, TcpConnectionPtr> _connections;  // 保存所有的连接
+	std::shared_ptr<TcpConnectionCallbacks> _connectionCallbacks;	// 所有连接共享的回调表 第一个连接到来时组装
+
+	uint64_t _nextConnId;	// 只在mainloop中访问
+	std::vector<TcpConnectionPtr> _pendingConnections;	// 本轮事件处理中新accept、还没有交给subloop的连接 只在mainloop中访问
+	std::unordered_map<uint64_t, TcpConnectionPtr> _connections;  // 保存所有的连接 以连接编号为键
 };
 
 
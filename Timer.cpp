@@ -0,0 +1,12 @@
+#include "Timer.h"
+
+std::atomic<int64_t> Timer::_numCreated(0);
+
+
+void Timer::restart(Clock::time_point now)
+{
+	if (_repeat)
+		_expiration = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_interval));
+	else
+		_expiration = Clock::time_point();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+
+/// @brief 定时器 到期时间使用单调时钟 不受系统时间调整的影响
+class Timer : public noncopyable
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	Timer(TimerCallback cb, Clock::time_point when, double interval) :
+		_callback{ std::move(cb) }, _expiration{ when }, _interval{ interval }, _repeat{ interval > 0.0 },
+		_sequence{ ++_numCreated }
+	{
+	}
+
+	void run() const { _callback(); }
+
+	Clock::time_point expiration() const { return _expiration; }
+	bool repeat() const { return _repeat; }
+	int64_t sequence() const { return _sequence; }
+
+	// 重复定时器在每次到期后 以now为基准计算下一次到期时间
+	void restart(Clock::time_point now);
+
+	static int64_t numCreated() { return _numCreated; }
+
+private:
+	const TimerCallback _callback;
+	Clock::time_point _expiration;
+	const double _interval;		// 重复间隔 单位秒 不重复的定时器为0
+	const bool _repeat;
+	const int64_t _sequence;	// 全局唯一的序号 用于区分地址被复用的Timer对象
+
+	static std::atomic<int64_t> _numCreated;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+class Timer;
+
+/// @brief 定时器的句柄 只用于EventLoop::cancel() 可以拷贝
+class TimerId
+{
+public:
+	TimerId() : _timer{ nullptr }, _sequence{ 0 } {}
+	TimerId(Timer* timer, int64_t sequence) : _timer{ timer }, _sequence{ sequence } {}
+
+	bool valid() const { return _timer != nullptr; }
+
+private:
+	friend class TimerQueue;
+
+	Timer* _timer;
+	int64_t _sequence;
+};
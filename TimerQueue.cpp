@@ -0,0 +1,168 @@
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+#include "TimerQueue.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+
+/// @brief 创建非阻塞、cloexec的timerfd 使用单调时钟
+static int createTimerfd()
+{
+	int timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0)
+		LOG_FATAL("timerfd_create error:%d\n", errno);
+	return timerfd;
+}
+
+/// @brief 把timerfd设置为在when时刻到期
+static void resetTimerfd(int timerfd, Timer::Clock::time_point when)
+{
+	// 已经过期的时间也至少等待100微秒 timerfd的it_value全为0表示停止定时器
+	auto delay = std::chrono::duration_cast<std::chrono::microseconds>(when - Timer::Clock::now());
+	if (delay < std::chrono::microseconds(100))
+		delay = std::chrono::microseconds(100);
+
+	itimerspec newValue;
+	::memset(&newValue, 0, sizeof(newValue));
+	newValue.it_value.tv_sec = static_cast<time_t>(delay.count() / 1000000);
+	newValue.it_value.tv_nsec = static_cast<long>(delay.count() % 1000000 * 1000);
+	if (::timerfd_settime(timerfd, 0, &newValue, nullptr) < 0)
+		LOG_ERROR("timerfd_settime error:%d\n", errno);
+}
+
+/// @brief 读走timerfd上的到期次数 否则LT模式下会一直触发
+static void readTimerfd(int timerfd)
+{
+	uint64_t howmany;
+	ssize_t n = ::read(timerfd, &howmany, sizeof(howmany));
+	if (n != sizeof(howmany))
+		LOG_ERROR("TimerQueue::handleRead() reads %ld bytes instead of 8\n", n);
+}
+
+
+TimerQueue::TimerQueue(EventLoop* loop) :
+	_loop{ loop }, _timerfd{ createTimerfd() }, _timerfdChannel(loop, _timerfd), _callingExpiredTimers{ false }
+{
+	_timerfdChannel.setReadCallback(std::bind(&TimerQueue::handleRead, this));
+	_timerfdChannel.enableReading();
+}
+
+
+TimerQueue::~TimerQueue()
+{
+	_timerfdChannel.disableAll();
+	_timerfdChannel.remove();
+	::close(_timerfd);
+	for (auto&& entry : _timers)
+		delete entry.second;
+}
+
+
+TimerId TimerQueue::addTimer(TimerCallback cb, Timer::Clock::time_point when, double interval)
+{
+	Timer* timer = new Timer(std::move(cb), when, interval);
+	_loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
+	return TimerId(timer, timer->sequence());
+}
+
+
+void TimerQueue::cancel(TimerId timerId)
+{
+	_loop->runInLoop(std::bind(&TimerQueue::cancelInLoop, this, timerId));
+}
+
+
+void TimerQueue::addTimerInLoop(Timer* timer)
+{
+	bool earliestChanged = insert(timer);
+	if (earliestChanged)
+		resetTimerfd(_timerfd, timer->expiration());
+}
+
+
+void TimerQueue::cancelInLoop(TimerId timerId)
+{
+	ActiveTimer timer(timerId._timer, timerId._sequence);
+	auto it = _activeTimers.find(timer);
+	if (it != _activeTimers.end())
+	{
+		_timers.erase(Entry(it->first->expiration(), it->first));
+		delete it->first;
+		_activeTimers.erase(it);
+	}
+	else if (_callingExpiredTimers)
+	{
+		// 定时器正在执行回调(比如在回调中取消自己) 记录下来 防止重复定时器被重新插入
+		_cancelingTimers.insert(timer);
+	}
+}
+
+
+void TimerQueue::handleRead()
+{
+	Timer::Clock::time_point now = Timer::Clock::now();
+	readTimerfd(_timerfd);
+
+	std::vector<Entry> expired = getExpired(now);
+
+	_callingExpiredTimers = true;
+	_cancelingTimers.clear();
+	for (auto&& entry : expired)
+		entry.second->run();
+	_callingExpiredTimers = false;
+
+	reset(expired, now);
+}
+
+
+std::vector<TimerQueue::Entry> TimerQueue::getExpired(Timer::Clock::time_point now)
+{
+	std::vector<Entry> expired;
+	// 第一个到期时间大于now的定时器 之前的都已经到期
+	Entry sentry(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+	auto end = _timers.lower_bound(sentry);
+	std::copy(_timers.begin(), end, std::back_inserter(expired));
+	_timers.erase(_timers.begin(), end);
+
+	for (auto&& entry : expired)
+		_activeTimers.erase(ActiveTimer(entry.second, entry.second->sequence()));
+	return expired;
+}
+
+
+void TimerQueue::reset(const std::vector<Entry>& expired, Timer::Clock::time_point now)
+{
+	for (auto&& entry : expired)
+	{
+		ActiveTimer timer(entry.second, entry.second->sequence());
+		if (entry.second->repeat() && !_cancelingTimers.contains(timer))
+		{
+			entry.second->restart(now);
+			insert(entry.second);
+		}
+		else
+		{
+			delete entry.second;
+		}
+	}
+
+	if (!_timers.empty())
+		resetTimerfd(_timerfd, _timers.begin()->first);
+}
+
+
+bool TimerQueue::insert(Timer* timer)
+{
+	bool earliestChanged = false;
+	Timer::Clock::time_point when = timer->expiration();
+	auto it = _timers.begin();
+	if (it == _timers.end() || when < it->first)
+		earliestChanged = true;
+
+	_timers.insert(Entry(when, timer));
+	_activeTimers.insert(ActiveTimer(timer, timer->sequence()));
+	return earliestChanged;
+}
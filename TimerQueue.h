@@ -0,0 +1,57 @@
+#pragma once
+
+#include <set>
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include "noncopyable.h"
+#include "Channel.h"
+#include "Callbacks.h"
+#include "Timer.h"
+#include "TimerId.h"
+
+class EventLoop;
+
+/// @brief 定时器队列 所有定时器共用一个timerfd 注册在所属loop的Poller中
+/// timerfd总是设置为最早到期的定时器的时间 到期后由loop线程统一处理
+class TimerQueue : public noncopyable
+{
+public:
+	explicit TimerQueue(EventLoop* loop);
+	~TimerQueue();
+
+	// 线程安全 可以在其他线程中调用
+	TimerId addTimer(TimerCallback cb, Timer::Clock::time_point when, double interval);
+	void cancel(TimerId timerId);
+
+private:
+	using Entry = std::pair<Timer::Clock::time_point, Timer*>;
+	using TimerList = std::set<Entry>;
+	using ActiveTimer = std::pair<Timer*, int64_t>;
+	using ActiveTimerSet = std::set<ActiveTimer>;
+
+	void addTimerInLoop(Timer* timer);
+	void cancelInLoop(TimerId timerId);
+
+	// timerfd上有读事件 说明有定时器到期了
+	void handleRead();
+
+	// 取出所有到期的定时器
+	std::vector<Entry> getExpired(Timer::Clock::time_point now);
+	// 重复的定时器重新插入 一次性的定时器删除 并重新设置timerfd
+	void reset(const std::vector<Entry>& expired, Timer::Clock::time_point now);
+
+	// 插入定时器 返回最早到期的定时器是否改变了
+	bool insert(Timer* timer);
+
+	EventLoop* _loop;
+	const int _timerfd;
+	Channel _timerfdChannel;
+
+	TimerList _timers;			// 按到期时间排序的定时器
+	ActiveTimerSet _activeTimers;	// 与_timers内容相同 按Timer地址排序 用于cancel
+
+	bool _callingExpiredTimers;
+	ActiveTimerSet _cancelingTimers;	// 在执行到期回调期间被取消的定时器 不能再重新插入
+};
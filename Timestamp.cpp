@@ -1,6 +1,22 @@
-#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include "Timestamp.h"
 
+// 每个线程缓存最近一次格式化的那一秒 日志和http响应在同一秒内的大量格式化只需拷贝前缀
+static thread_local time_t t_lastLocalSecond = -1;
+static thread_local char t_localTime[32];
+static thread_local size_t t_localTimeLength = 0;
+
+static thread_local time_t t_lastGmtSecond = -1;
+static thread_local char t_httpDate[32];
+static thread_local size_t t_httpDateLength = 0;
+
+static Timestamp fromTimespec(const timespec& ts)
+{
+	return Timestamp(static_cast<int64_t>(ts.tv_sec) * Timestamp::kMicroSecondsPerSecond + ts.tv_nsec / 1000);
+}
+
 Timestamp::Timestamp() : _microSecondsSinceEpoch(0)
 {
 }
@@ -12,19 +28,72 @@ Timestamp::Timestamp(int64_t microSecondsSinceEpoch)
 
 Timestamp Timestamp::now()
 {
-	return Timestamp(time(NULL));
+	timespec ts;
+	::clock_gettime(CLOCK_REALTIME, &ts);
+	return fromTimespec(ts);
+}
+
+Timestamp Timestamp::nowCoarse()
+{
+	timespec ts;
+	::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return fromTimespec(ts);
+}
+
+int64_t Timestamp::monotonicNanoseconds()
+{
+	timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
 }
 
 std::string Timestamp::toString() const
 {
-	char buf[128] = { 0 };
-	tm* tm_time = ::localtime(&_microSecondsSinceEpoch);
-	::snprintf(buf, 128, "%4d/%02d/%02d %02d:%02d:%02d",
-		tm_time->tm_year + 1900,
-		tm_time->tm_mon + 1,
-		tm_time->tm_mday,
-		tm_time->tm_hour,
-		tm_time->tm_min,
-		tm_time->tm_sec);
-	return buf;
+	char buf[32];
+	size_t len = toFormattedString(buf, sizeof(buf), false);
+	return std::string(buf, len);
+}
+
+size_t Timestamp::toFormattedString(char* buf, size_t size, bool showMicroseconds) const
+{
+	time_t seconds = secondsSinceEpoch();
+	if (seconds != t_lastLocalSecond)
+	{
+		tm tm_time;
+		::localtime_r(&seconds, &tm_time);
+		t_localTimeLength = ::strftime(t_localTime, sizeof(t_localTime), "%Y/%m/%d %H:%M:%S", &tm_time);
+		t_lastLocalSecond = seconds;
+	}
+
+	size_t len = std::min(t_localTimeLength, size - 1);
+	::memcpy(buf, t_localTime, len);
+	if (showMicroseconds && size - len > 7)
+	{
+		int micro = static_cast<int>(_microSecondsSinceEpoch % kMicroSecondsPerSecond);
+		len += ::snprintf(buf + len, size - len, ".%06d", micro);
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+size_t Timestamp::toHttpDate(char* buf, size_t size) const
+{
+	time_t seconds = secondsSinceEpoch();
+	if (seconds != t_lastGmtSecond)
+	{
+		// strftime的%a/%b依赖locale http要求固定的英文缩写
+		static const char* kDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+		static const char* kMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+		tm tm_time;
+		::gmtime_r(&seconds, &tm_time);
+		t_httpDateLength = ::snprintf(t_httpDate, sizeof(t_httpDate), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+			kDays[tm_time.tm_wday], tm_time.tm_mday, kMonths[tm_time.tm_mon], tm_time.tm_year + 1900,
+			tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
+		t_lastGmtSecond = seconds;
+	}
+
+	size_t len = std::min(t_httpDateLength, size - 1);
+	::memcpy(buf, t_httpDate, len);
+	buf[len] = '\0';
+	return len;
 }
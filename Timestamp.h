@@ -2,15 +2,53 @@
 
 #include <iostream>
 #include <string>
+#include <cstdint>
+#include <ctime>
 
-/// @brief 时间戳，获取当前时间
+/// @brief 时间戳 微秒精度的墙上时间(自1970年起) 可以直接拷贝
+/// 格式化时每个线程缓存当前这一秒的日期时间前缀 同一秒内不再调用localtime/gmtime
 class Timestamp
 {
 public:
+	static constexpr int64_t kMicroSecondsPerSecond = 1000 * 1000;
+
 	Timestamp();
 	explicit Timestamp(int64_t microSecondsSinceEpoch);
+
+	// clock_gettime(CLOCK_REALTIME) 走vDSO 不陷入内核
 	static Timestamp now();
+	// CLOCK_REALTIME_COARSE 精度为一个时钟节拍(通常1~4ms) 比now()更便宜 适合日志等不需要精确时间的地方
+	static Timestamp nowCoarse();
+	// CLOCK_MONOTONIC的纳秒数 不受系统时间调整影响 用于测量耗时
+	static int64_t monotonicNanoseconds();
+
+	bool valid() const { return _microSecondsSinceEpoch > 0; }
+	int64_t microSecondsSinceEpoch() const { return _microSecondsSinceEpoch; }
+	time_t secondsSinceEpoch() const { return static_cast<time_t>(_microSecondsSinceEpoch / kMicroSecondsPerSecond); }
+
+	// 本地时间 "2024/01/01 12:00:00"
 	std::string toString() const;
+	// 本地时间 "2024/01/01 12:00:00.123456" 写入buf 返回长度 buf至少32字节
+	size_t toFormattedString(char* buf, size_t size, bool showMicroseconds = true) const;
+	// http的Date头部使用的GMT时间 "Sun, 06 Nov 1994 08:49:37 GMT" 写入buf 返回长度 buf至少32字节
+	size_t toHttpDate(char* buf, size_t size) const;
+
+	bool operator<(const Timestamp& rhs) const { return _microSecondsSinceEpoch < rhs._microSecondsSinceEpoch; }
+	bool operator==(const Timestamp& rhs) const { return _microSecondsSinceEpoch == rhs._microSecondsSinceEpoch; }
+
 private:
 	int64_t _microSecondsSinceEpoch;
-};
\ No newline at end of file
+};
+
+// 两个时间之差 单位秒
+inline double timeDifference(Timestamp high, Timestamp low)
+{
+	int64_t diff = high.microSecondsSinceEpoch() - low.microSecondsSinceEpoch();
+	return static_cast<double>(diff) / Timestamp::kMicroSecondsPerSecond;
+}
+
+inline Timestamp addTime(Timestamp timestamp, double seconds)
+{
+	int64_t delta = static_cast<int64_t>(seconds * Timestamp::kMicroSecondsPerSecond);
+	return Timestamp(timestamp.microSecondsSinceEpoch() + delta);
+}
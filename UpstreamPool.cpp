@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "UpstreamPool.h"
+#include "TcpClient.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief 池中的一个上游连接 由自己的TcpClient负责建立
+struct UpstreamPool::Upstream
+{
+	std::unique_ptr<TcpClient> client;
+	TcpConnectionPtr conn;							// 连接建立前为空
+	std::deque<ResponseCallback> inflight;			// 已发出、等待响应的请求 按发送顺序
+	Clock::time_point lastActive;
+	bool closing = false;							// 已决定关闭 不再分配请求
+
+	bool available(size_t maxPipeline) const
+	{
+		return conn && !closing && inflight.size() < maxPipeline;
+	}
+};
+
+
+UpstreamPool::UpstreamPool(EventLoop* loop, const InetAddress& upstreamAddr, const std::string& name,
+	ResponseFramer framer, const Options& options) :
+	_loop{ loop }, _upstreamAddr{ upstreamAddr }, _name{ name }, _framer{ std::move(framer) }, _options{ options },
+	_nextId{ 1 }, _lastConnects{ 0 }, _lastCheck{ Clock::now() }
+{
+	_options.maxPipeline = std::max<size_t>(_options.maxPipeline, 1);
+	_options.maxConnections = std::max<size_t>(_options.maxConnections, 1);
+}
+
+
+UpstreamPool::~UpstreamPool()
+{
+	if (_checkTimer.valid())
+		_loop->cancel(_checkTimer);
+
+	for (auto& upstream : _upstreams)
+	{
+		if (upstream->conn)
+		{
+			// 连接比连接池活得久 不能再回调连接池
+			upstream->conn->setConnectionCallback(defaultConnectionCallback);
+			upstream->conn->setMessageCallback(defaultMessageCallback);
+			upstream->conn.reset();
+		}
+		// TcpClient持有最后一个引用时强制关闭连接
+		upstream->client.reset();
+	}
+
+	for (auto& waiter : _waiters)
+		waiter.callback(false, std::string_view());
+}
+
+
+void UpstreamPool::start()
+{
+	_lastCheck = Clock::now();
+	while (_upstreams.size() < std::min(_options.minIdle, _options.maxConnections))
+		openConnection();
+	_checkTimer = _loop->runEvery(_options.checkInterval, std::bind(&UpstreamPool::check, this));
+}
+
+
+void UpstreamPool::request(std::string_view payload, ResponseCallback cb)
+{
+	_stats.requests++;
+	if (Upstream* upstream = pick())
+	{
+		_stats.hits++;
+		send(upstream, payload, std::move(cb));
+		return;
+	}
+
+	_stats.waits++;
+	_waiters.push_back(Waiter{ std::string(payload), std::move(cb), Clock::now() });
+
+	// 正在建立的连接不够分给排队的请求时 再新建连接
+	size_t connecting = std::count_if(_upstreams.begin(), _upstreams.end(),
+		[](const std::unique_ptr<Upstream>& u) { return !u->conn; });
+	if (connecting * _options.maxPipeline < _waiters.size() && _upstreams.size() < _options.maxConnections)
+		openConnection();
+}
+
+
+UpstreamPool::Stats UpstreamPool::stats() const
+{
+	Stats stats = _stats;
+	stats.connections = _upstreams.size();
+	stats.idle = std::count_if(_upstreams.begin(), _upstreams.end(),
+		[](const std::unique_ptr<Upstream>& u) { return u->conn && !u->closing && u->inflight.empty(); });
+	stats.waiting = _waiters.size();
+	return stats;
+}
+
+
+UpstreamPool::Upstream* UpstreamPool::pick()
+{
+	// 优先空闲连接 取最近使用的那个 其余的空闲连接更容易超时被回收
+	Upstream* best = nullptr;
+	for (auto& upstream : _upstreams)
+	{
+		if (!upstream->available(_options.maxPipeline))
+			continue;
+		if (!best || upstream->inflight.size() < best->inflight.size()
+			|| (upstream->inflight.size() == best->inflight.size() && upstream->lastActive > best->lastActive))
+			best = upstream.get();
+	}
+	return best;
+}
+
+
+void UpstreamPool::send(Upstream* upstream, std::string_view payload, ResponseCallback cb)
+{
+	upstream->inflight.push_back(std::move(cb));
+	upstream->lastActive = Clock::now();
+	upstream->conn->send(std::string(payload));
+}
+
+
+void UpstreamPool::openConnection()
+{
+	char buf[32];
+	::snprintf(buf, sizeof(buf), "-upstream#%d", _nextId);
+	_nextId++;
+
+	auto upstream = std::make_unique<Upstream>();
+	Upstream* raw = upstream.get();
+	upstream->client = std::make_unique<TcpClient>(_loop, _upstreamAddr, _name + buf);
+	upstream->client->setConnectionCallback(std::bind(&UpstreamPool::onConnection, this, raw, _1));
+	upstream->client->setMessageCallback(std::bind(&UpstreamPool::onMessage, this, raw, _1, _2));
+	upstream->lastActive = Clock::now();
+	_upstreams.push_back(std::move(upstream));
+	raw->client->connect();
+}
+
+
+void UpstreamPool::closeConnection(Upstream* upstream)
+{
+	if (upstream->closing)
+		return;
+	upstream->closing = true;
+	_stats.evictions++;
+	if (upstream->conn)
+		upstream->conn->shutdown();
+	else
+	{
+		// 还在连接(重试)中 直接从池中移除
+		upstream->client->stop();
+		auto it = std::find_if(_upstreams.begin(), _upstreams.end(),
+			[upstream](const std::unique_ptr<Upstream>& u) { return u.get() == upstream; });
+		std::shared_ptr<Upstream> removed(std::move(*it));
+		_upstreams.erase(it);
+		_loop->queueInLoop([removed]() {});
+	}
+}
+
+
+void UpstreamPool::dispatchWaiters()
+{
+	while (!_waiters.empty())
+	{
+		Upstream* upstream = pick();
+		if (!upstream)
+			break;
+		Waiter waiter = std::move(_waiters.front());
+		_waiters.pop_front();
+		send(upstream, waiter.payload, std::move(waiter.callback));
+	}
+}
+
+
+void UpstreamPool::onConnection(Upstream* upstream, const TcpConnectionPtr& conn)
+{
+	if (conn->connected())
+	{
+		_stats.connects++;
+		upstream->conn = conn;
+		upstream->lastActive = Clock::now();
+		conn->setTcpNoDelay(true);
+		if (upstream->closing)
+			conn->shutdown();
+		else
+			dispatchWaiters();
+		return;
+	}
+
+	// 连接断开 已发出的请求全部失败 此时处于TcpClient的回调中 Upstream延后释放
+	auto it = std::find_if(_upstreams.begin(), _upstreams.end(),
+		[upstream](const std::unique_ptr<Upstream>& u) { return u.get() == upstream; });
+	if (it == _upstreams.end())
+		return;
+	if (!upstream->closing)
+		_stats.evictions++;
+	std::shared_ptr<Upstream> removed(std::move(*it));
+	_upstreams.erase(it);
+	removed->conn.reset();
+	_loop->queueInLoop([removed]() {});
+
+	std::deque<ResponseCallback> inflight;
+	inflight.swap(removed->inflight);
+	_stats.failures += inflight.size();
+	for (auto& cb : inflight)
+		cb(false, std::string_view());
+
+	// 补上因断开而空缺的连接
+	if (!_waiters.empty() && _upstreams.size() < _options.maxConnections)
+		openConnection();
+}
+
+
+void UpstreamPool::onMessage(Upstream* upstream, const TcpConnectionPtr& conn, Buffer* buf)
+{
+	while (buf->readableBytes() > 0)
+	{
+		if (upstream->inflight.empty())
+		{
+			// 没有请求却收到了数据 连接的状态已经不可信
+			size_t unexpected = buf->readableBytes();
+			LOG_ERROR("UpstreamPool::onMessage [%s] unexpected %zu bytes from upstream\n", conn->name().c_str(), unexpected);
+			buf->retrieveAll();
+			closeConnection(upstream);
+			return;
+		}
+
+		size_t len = _framer(buf->peek(), buf->readableBytes());
+		if (len == 0)
+			break;
+
+		ResponseCallback cb = std::move(upstream->inflight.front());
+		upstream->inflight.pop_front();
+		cb(true, std::string_view(buf->peek(), len));
+		buf->retrieve(len);
+	}
+
+	upstream->lastActive = Clock::now();
+	dispatchWaiters();
+}
+
+
+void UpstreamPool::check()
+{
+	Clock::time_point now = Clock::now();
+
+	// 排队超时的请求
+	auto waitTimeout = std::chrono::duration<double>(_options.waitTimeout);
+	while (!_waiters.empty() && now - _waiters.front().enqueued > waitTimeout)
+	{
+		Waiter waiter = std::move(_waiters.front());
+		_waiters.pop_front();
+		_stats.timeouts++;
+		waiter.callback(false, std::string_view());
+	}
+
+	// 回收空闲连接 从空闲最久的开始: 空闲超过maxIdle个时关闭空闲已满一个检查周期的 空闲超时的只保留minIdle个
+	// 突发结束后刚空闲的连接会在下一次突发中复用 不在请求完成时立即关闭 否则突发之间反复建连、留下TIME_WAIT
+	auto idleTimeout = std::chrono::duration<double>(_options.idleTimeout);
+	auto checkInterval = std::chrono::duration<double>(_options.checkInterval);
+	std::vector<Upstream*> idle;
+	for (auto& upstream : _upstreams)
+	{
+		if (upstream->conn && !upstream->closing && upstream->inflight.empty())
+			idle.push_back(upstream.get());
+	}
+	std::sort(idle.begin(), idle.end(), [](Upstream* a, Upstream* b) { return a->lastActive < b->lastActive; });
+	size_t remaining = idle.size();
+	for (Upstream* upstream : idle)
+	{
+		auto idleFor = now - upstream->lastActive;
+		if (!(remaining > _options.maxIdle && idleFor > checkInterval) && !(remaining > _options.minIdle && idleFor > idleTimeout))
+			break;
+		closeConnection(upstream);
+		remaining--;
+	}
+
+	// 补足minIdle
+	size_t spare = 0;
+	for (auto& upstream : _upstreams)
+	{
+		if (!upstream->closing && (!upstream->conn || upstream->inflight.empty()))
+			spare++;
+	}
+	while (spare < _options.minIdle && _upstreams.size() < _options.maxConnections)
+	{
+		openConnection();
+		spare++;
+	}
+
+	double elapsed = std::chrono::duration<double>(now - _lastCheck).count();
+	if (elapsed > 0)
+		_stats.connectsPerSecond = (_stats.connects - _lastConnects) / elapsed;
+	_lastConnects = _stats.connects;
+	_lastCheck = now;
+}
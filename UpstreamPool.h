@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "Callbacks.h"
+#include "TimerId.h"
+
+class EventLoop;
+class TcpClient;
+
+/// @brief 绑定在一个EventLoop上的上游连接池 所有接口只能在该loop线程中调用 不加锁
+/// 多个loop各自创建自己的连接池(如在TcpServer的ThreadInitCallback中) 请求与上游连接始终在同一个线程
+/// 请求原样写给上游 由ResponseFramer从上游的字节流中切分出完整的响应 按请求顺序交给回调
+/// maxPipeline大于1时 一个上游连接上可以同时有多个未完成的请求(流水线)
+class UpstreamPool : public noncopyable
+{
+public:
+	// 在data中切分出一条完整的响应 返回其长度 不完整时返回0
+	using ResponseFramer = std::function<size_t(const char* data, size_t len)>;
+	// ok为false表示等待超时或上游连接断开 response只在回调期间有效
+	using ResponseCallback = std::function<void(bool ok, std::string_view response)>;
+
+	struct Options
+	{
+		size_t minIdle = 0;				// 健康检查时补足的空闲连接数
+		size_t maxIdle = 8;				// 超过的空闲连接在健康检查时关闭 只关闭空闲已满一个检查周期的
+		size_t maxConnections = 64;		// 包括正在连接的
+		size_t maxPipeline = 1;			// 每个连接上最多同时未完成的请求数
+		double idleTimeout = 60.0;		// 空闲超过该秒数的连接被回收(保留minIdle个)
+		double waitTimeout = 1.0;		// 请求排队等待连接的最长秒数
+		double checkInterval = 1.0;		// 健康检查与统计的周期
+	};
+
+	struct Stats
+	{
+		uint64_t requests = 0;
+		uint64_t hits = 0;			// 请求直接拿到了已建立的连接
+		uint64_t waits = 0;			// 请求需要排队等待连接
+		uint64_t timeouts = 0;		// 排队超时的请求
+		uint64_t failures = 0;		// 已发出但连接断开的请求
+		uint64_t connects = 0;		// 建立的连接总数
+		uint64_t evictions = 0;		// 因空闲过多、空闲超时或出错而关闭的连接
+		double connectsPerSecond = 0;	// 最近一个检查周期的建连速率
+		size_t connections = 0;		// 当前的连接数(包括正在连接的)
+		size_t idle = 0;
+		size_t waiting = 0;
+	};
+
+	UpstreamPool(EventLoop* loop, const InetAddress& upstreamAddr, const std::string& name,
+		ResponseFramer framer, const Options& options);
+	~UpstreamPool();
+
+	// 建立minIdle个连接并开始周期性的健康检查
+	void start();
+
+	// 发送一个请求 有可用连接时立即写出 否则排队
+	void request(std::string_view payload, ResponseCallback cb);
+
+	Stats stats() const;
+	const std::string& name() const { return _name; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+	struct Upstream;
+
+	struct Waiter
+	{
+		std::string payload;
+		ResponseCallback callback;
+		Clock::time_point enqueued;
+	};
+
+	// 选出一个可以立即发送请求的连接 优先最近使用过的空闲连接
+	Upstream* pick();
+	void send(Upstream* upstream, std::string_view payload, ResponseCallback cb);
+	void openConnection();
+	void closeConnection(Upstream* upstream);
+	// 有连接可用后依次发送排队的请求
+	void dispatchWaiters();
+
+	void onConnection(Upstream* upstream, const TcpConnectionPtr& conn);
+	void onMessage(Upstream* upstream, const TcpConnectionPtr& conn, Buffer* buf);
+	void check();
+
+	EventLoop* _loop;
+	InetAddress _upstreamAddr;
+	std::string _name;
+	ResponseFramer _framer;
+	Options _options;
+
+	std::vector<std::unique_ptr<Upstream>> _upstreams;
+	std::deque<Waiter> _waiters;
+	int _nextId;
+	TimerId _checkTimer;
+	Stats _stats;
+	uint64_t _lastConnects;
+	Clock::time_point _lastCheck;
+};
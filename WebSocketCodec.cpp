@@ -0,0 +1,338 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYMUDUO_WEBSOCKET_X86 1
+#endif
+
+#include "WebSocketCodec.h"
+#include "Buffer.h"
+
+
+/// @brief 握手使用的固定GUID RFC 6455 1.3节
+static constexpr char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+
+static inline uint32_t rotateLeft(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+/// @brief SHA-1摘要 只在握手时对几十个字节计算一次 不追求性能
+static void sha1(const std::string& input, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	// 填充: 0x80 若干个0 最后8字节为大端表示的消息比特长度 总长度为64的倍数
+	std::string message(input);
+	uint64_t bitLength = static_cast<uint64_t>(input.size()) * 8;
+	message.push_back(static_cast<char>(0x80));
+	while (message.size() % 64 != 56)
+		message.push_back('\0');
+	for (int i = 7; i >= 0; i--)
+		message.push_back(static_cast<char>(bitLength >> (i * 8)));
+
+	for (size_t chunk = 0; chunk < message.size(); chunk += 64)
+	{
+		const uint8_t* block = reinterpret_cast<const uint8_t*>(message.data() + chunk);
+		uint32_t w[80];
+		for (int i = 0; i < 16; i++)
+			w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+		for (int i = 16; i < 80; i++)
+			w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; i++)
+		{
+			uint32_t f, k;
+			if (i < 20)
+				f = (b & c) | (~b & d), k = 0x5A827999;
+			else if (i < 40)
+				f = b ^ c ^ d, k = 0x6ED9EBA1;
+			else if (i < 60)
+				f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+			else
+				f = b ^ c ^ d, k = 0xCA62C1D6;
+			uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = rotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for (int i = 0; i < 5; i++)
+	{
+		digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+		digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+		digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+		digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+	}
+}
+
+static std::string base64Encode(const uint8_t* data, size_t len)
+{
+	static constexpr char kTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string result;
+	result.reserve((len + 2) / 3 * 4);
+	for (size_t i = 0; i < len; i += 3)
+	{
+		uint32_t group = data[i] << 16;
+		if (i + 1 < len)
+			group |= data[i + 1] << 8;
+		if (i + 2 < len)
+			group |= data[i + 2];
+		result.push_back(kTable[(group >> 18) & 0x3F]);
+		result.push_back(kTable[(group >> 12) & 0x3F]);
+		result.push_back(i + 1 < len ? kTable[(group >> 6) & 0x3F] : '=');
+		result.push_back(i + 2 < len ? kTable[group & 0x3F] : '=');
+	}
+	return result;
+}
+
+
+std::string WebSocketCodec::acceptKey(std::string_view clientKey)
+{
+	std::string input(clientKey);
+	input.append(kWebSocketGuid);
+	uint8_t digest[20];
+	sha1(input, digest);
+	return base64Encode(digest, sizeof(digest));
+}
+
+
+/// @brief 逐字节处理不足一个字长的尾部 强制内联 保证在AVX2函数中也使用VEX编码的指令
+__attribute__((always_inline))
+static inline void unmaskTail(char* data, size_t len, const uint8_t mask[4])
+{
+	for (size_t i = 0; i < len; i++)
+		data[i] ^= mask[i & 3];
+}
+
+
+void WebSocketCodec::unmaskScalar(char* data, size_t len, const uint8_t mask[4])
+{
+	// 把4字节掩码扩展为8字节 一次异或8个字节 每次步进都是4的倍数 所以掩码相位不变
+	uint32_t key32;
+	::memcpy(&key32, mask, sizeof(key32));
+	const uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t value;
+		::memcpy(&value, data + i, sizeof(value));
+		value ^= key64;
+		::memcpy(data + i, &value, sizeof(value));
+	}
+	unmaskTail(data + i, len - i, mask);
+}
+
+
+#ifdef MYMUDUO_WEBSOCKET_X86
+/// @brief SSE2是x86-64的基线指令集 无需运行时检测 一次处理16字节
+static void unmaskSse2(char* data, size_t len, const uint8_t mask[4])
+{
+	uint32_t key32;
+	::memcpy(&key32, mask, sizeof(key32));
+	const __m128i key = _mm_set1_epi32(static_cast<int>(key32));
+
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(value, key));
+	}
+	unmaskTail(data + i, len - i, mask);
+}
+
+/// @brief AVX2一次处理32字节 只在运行时检测到cpu支持时才会被调用
+/// 尾部也在本函数内处理 不调用SSE2版本 避免AVX与传统SSE指令混用带来的状态切换开销
+__attribute__((target("avx2")))
+static void unmaskAvx2(char* data, size_t len, const uint8_t mask[4])
+{
+	uint32_t key32;
+	::memcpy(&key32, mask, sizeof(key32));
+	const __m256i key = _mm256_set1_epi32(static_cast<int>(key32));
+
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(value, key));
+	}
+	if (i + 16 <= len)
+	{
+		__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(value, _mm256_castsi256_si128(key)));
+		i += 16;
+	}
+	unmaskTail(data + i, len - i, mask);
+	_mm256_zeroupper();
+}
+#endif
+
+
+using UnmaskFunc = void (*)(char*, size_t, const uint8_t*);
+
+struct UnmaskImpl
+{
+	UnmaskFunc func;
+	const char* name;
+};
+
+/// @brief 进程启动时根据cpu特性选定一次 之后每次调用只是一次间接调用
+static UnmaskImpl selectUnmaskImpl()
+{
+#ifdef MYMUDUO_WEBSOCKET_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return { unmaskAvx2, "avx2" };
+	return { unmaskSse2, "sse2" };
+#else
+	return { WebSocketCodec::unmaskScalar, "scalar" };
+#endif
+}
+
+static const UnmaskImpl g_unmaskImpl = selectUnmaskImpl();
+
+
+void WebSocketCodec::unmask(char* data, size_t len, const uint8_t mask[4])
+{
+	// 小帧直接走标量路径 省去一次间接调用
+	if (len < 32)
+		unmaskScalar(data, len, mask);
+	else
+		g_unmaskImpl.func(data, len, mask);
+}
+
+
+const char* WebSocketCodec::unmaskImplName()
+{
+	return g_unmaskImpl.name;
+}
+
+
+WebSocketCodec::ParseResult WebSocketCodec::parseFrame(Buffer* buf, size_t maxPayload, Frame* frame, uint16_t* closeCode)
+{
+	const size_t readable = buf->readableBytes();
+	if (readable < 2)
+		return ParseResult::Incomplete;
+
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(buf->peek());
+	const bool fin = p[0] & 0x80;
+	const uint8_t opcode = p[0] & 0x0F;
+	const bool masked = p[1] & 0x80;
+	uint64_t length = p[1] & 0x7F;
+
+	// 没有协商扩展 RSV位必须为0 客户端发来的帧必须带掩码
+	if ((p[0] & 0x70) != 0 || !masked)
+	{
+		*closeCode = kProtocolError;
+		return ParseResult::Error;
+	}
+	switch (static_cast<Opcode>(opcode))
+	{
+	case Opcode::Continuation:
+	case Opcode::Text:
+	case Opcode::Binary:
+	case Opcode::Close:
+	case Opcode::Ping:
+	case Opcode::Pong:
+		break;
+	default:
+		*closeCode = kProtocolError;
+		return ParseResult::Error;
+	}
+
+	size_t headerLen = 2;
+	if (length == 126)
+	{
+		if (readable < 4)
+			return ParseResult::Incomplete;
+		length = (p[2] << 8) | p[3];
+		headerLen = 4;
+	}
+	else if (length == 127)
+	{
+		if (readable < 10)
+			return ParseResult::Incomplete;
+		length = 0;
+		for (int i = 2; i < 10; i++)
+			length = (length << 8) | p[i];
+		headerLen = 10;
+	}
+
+	// 控制帧不能分片 payload不超过125字节
+	if ((opcode & 0x08) && (!fin || length > 125))
+	{
+		*closeCode = kProtocolError;
+		return ParseResult::Error;
+	}
+	if (length > maxPayload)
+	{
+		*closeCode = kMessageTooBig;
+		return ParseResult::Error;
+	}
+
+	const uint8_t* mask = p + headerLen;
+	headerLen += 4;
+	if (readable < headerLen + length)
+		return ParseResult::Incomplete;
+
+	frame->fin = fin;
+	frame->opcode = static_cast<Opcode>(opcode);
+	frame->payload = buf->beginRead() + headerLen;
+	frame->length = static_cast<size_t>(length);
+	frame->frameLength = headerLen + frame->length;
+	unmask(frame->payload, frame->length, mask);
+	return ParseResult::GotFrame;
+}
+
+
+void WebSocketCodec::encodeFrame(Buffer* output, Opcode opcode, std::string_view payload, bool fin)
+{
+	uint8_t header[10];
+	size_t headerLen = 2;
+	const uint64_t length = payload.size();
+
+	header[0] = static_cast<uint8_t>((fin ? 0x80 : 0x00) | static_cast<uint8_t>(opcode));
+	if (length < 126)
+	{
+		header[1] = static_cast<uint8_t>(length);
+	}
+	else if (length <= 0xFFFF)
+	{
+		header[1] = 126;
+		header[2] = static_cast<uint8_t>(length >> 8);
+		header[3] = static_cast<uint8_t>(length);
+		headerLen = 4;
+	}
+	else
+	{
+		header[1] = 127;
+		for (int i = 0; i < 8; i++)
+			header[2 + i] = static_cast<uint8_t>(length >> ((7 - i) * 8));
+		headerLen = 10;
+	}
+
+	output->append(reinterpret_cast<const char*>(header), headerLen);
+	output->append(payload);
+}
+
+
+void WebSocketCodec::encodeClose(Buffer* output, uint16_t code, std::string_view reason)
+{
+	char payload[125];
+	payload[0] = static_cast<char>(code >> 8);
+	payload[1] = static_cast<char>(code);
+	size_t reasonLen = std::min(reason.size(), sizeof(payload) - 2);
+	::memcpy(payload + 2, reason.data(), reasonLen);
+	encodeFrame(output, Opcode::Close, std::string_view(payload, 2 + reasonLen));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+class Buffer;
+
+/// @brief websocket(RFC 6455)的帧编解码 全部为无状态的静态函数 连接级的状态(分片重组等)由WebSocketServer维护
+class WebSocketCodec
+{
+public:
+	enum class Opcode : uint8_t
+	{
+		Continuation = 0x0,
+		Text = 0x1,
+		Binary = 0x2,
+		Close = 0x8,
+		Ping = 0x9,
+		Pong = 0xA
+	};
+
+	// 关闭码
+	static constexpr uint16_t kNormalClosure = 1000;
+	static constexpr uint16_t kGoingAway = 1001;
+	static constexpr uint16_t kProtocolError = 1002;
+	static constexpr uint16_t kMessageTooBig = 1009;
+
+	struct Frame
+	{
+		bool fin;
+		Opcode opcode;
+		char* payload;		// 指向Buffer内部 已经原地解掩码
+		size_t length;		// payload长度
+		size_t frameLength;	// 整个帧(头部+payload)的长度 处理完后从Buffer中取走这么多字节
+	};
+
+	enum class ParseResult : int
+	{
+		Incomplete,
+		GotFrame,
+		Error
+	};
+
+	/// @brief 解析buf可读区域起始处的一个客户端帧 帧完整后才会原地解掩码 不会从buf中取走数据
+	/// @param maxPayload 单帧payload的上限 超过时返回Error并将closeCode置为1009
+	static ParseResult parseFrame(Buffer* buf, size_t maxPayload, Frame* frame, uint16_t* closeCode);
+
+	/// @brief 把一个服务端帧(不带掩码)追加到output中
+	static void encodeFrame(Buffer* output, Opcode opcode, std::string_view payload, bool fin = true);
+	static void encodeClose(Buffer* output, uint16_t code, std::string_view reason = std::string_view());
+
+	/// @brief 原地解掩码 运行时根据cpu特性选择AVX2/SSE2/标量实现
+	static void unmask(char* data, size_t len, const uint8_t mask[4]);
+	/// @brief 每次处理8字节的标量实现 作为对照基准
+	static void unmaskScalar(char* data, size_t len, const uint8_t mask[4]);
+	/// @brief 当前选中的解掩码实现的名字 "avx2" "sse2" "scalar"
+	static const char* unmaskImplName();
+
+	/// @brief 握手时根据客户端的Sec-WebSocket-Key计算Sec-WebSocket-Accept
+	static std::string acceptKey(std::string_view clientKey);
+};
@@ -0,0 +1,367 @@
+#include <any>
+#include <strings.h>
+
+#include "WebSocketServer.h"
+#include "HttpContext.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief 发起关闭握手后等待对端关闭帧的最长时间
+constexpr double kCloseTimeout = 5.0;
+
+/// @brief 每个loop线程复用的发送缓冲 编码一帧后立即发送 不在其中积累数据
+thread_local Buffer t_wsOutput;
+/// @brief handleFrames为当前连接积累的pong、关闭帧等控制帧 一次读事件中的控制帧合并后一次发送
+/// 调用用户回调之前先发给当前连接 回调中向其他连接广播时不会把这些帧带过去
+thread_local Buffer t_wsControl;
+
+
+/// @brief 把线程共享的缓冲发给conn 连接已经断开时send不取走数据 这里丢弃 不能留给下一个连接
+static void flushTo(const TcpConnectionPtr& conn, Buffer* buf)
+{
+	conn->send(buf);
+	buf->retrieveAll();
+}
+
+
+/// @brief 保存在TcpConnection的context中的连接状态 只在连接所属的loop线程中访问
+struct WebSocketContext
+{
+	HttpContext handshake;
+	bool upgraded = false;
+	bool closeSent = false;
+	bool closeReceived = false;
+	bool awaitingPong = false;	// 上一个心跳周期发出ping之后还没有收到任何帧
+	WebSocketCodec::Opcode messageOpcode = WebSocketCodec::Opcode::Continuation;	// 正在重组的分片消息类型 Continuation表示没有
+	std::string message;		// 分片重组缓冲 容量在连接的生命周期内复用
+	TimerId heartbeatTimer;
+};
+
+
+static bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+{
+	return lhs.size() == rhs.size() && ::strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+/// @brief 大小写不敏感地判断逗号分隔的头部值中是否包含token
+static bool containsToken(std::string_view value, std::string_view token)
+{
+	while (!value.empty())
+	{
+		size_t comma = value.find(',');
+		std::string_view item = value.substr(0, comma);
+		while (!item.empty() && item.front() == ' ')
+			item.remove_prefix(1);
+		while (!item.empty() && item.back() == ' ')
+			item.remove_suffix(1);
+		if (equalsIgnoreCase(item, token))
+			return true;
+		if (comma == std::string_view::npos)
+			break;
+		value.remove_prefix(comma + 1);
+	}
+	return false;
+}
+
+/// @brief 发送握手失败的http响应并关闭连接
+static void rejectHandshake(const TcpConnectionPtr& conn, int status)
+{
+	HttpResponse response(true);
+	response.setStatusCode(status);
+	if (status == 426)
+		response.addHeader("Sec-WebSocket-Version", "13");
+	response.appendToBuffer(&t_wsOutput);
+	flushTo(conn, &t_wsOutput);
+	conn->shutdown();
+}
+
+
+WebSocketServer::WebSocketServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, TcpServer::Option option) :
+	_server(loop, listenAddr, name, option), _pingInterval{ 30.0 }, _maxMessageSize{ 16 * 1024 * 1024 }
+{
+	_server.setConnectionCallback(std::bind(&WebSocketServer::onConnection, this, _1));
+	_server.setMessageCallback(std::bind(&WebSocketServer::onMessage, this, _1, _2, _3));
+}
+
+
+void WebSocketServer::start()
+{
+	LOG_INFO("WebSocketServer[%s] starts listening on %s, unmask using %s\n",
+		_server.name().c_str(), _server.ipPort().c_str(), WebSocketCodec::unmaskImplName());
+	_server.start();
+}
+
+
+void WebSocketServer::onConnection(const TcpConnectionPtr& conn)
+{
+	if (conn->connected())
+	{
+		conn->setContext(WebSocketContext());
+	}
+	else
+	{
+		WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+		if (context->heartbeatTimer.valid())
+			conn->getLoop()->cancel(context->heartbeatTimer);
+	}
+
+	if (_connectionCallback)
+		_connectionCallback(conn);
+}
+
+
+void WebSocketServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime)
+{
+	WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+	if (!context->upgraded && !handleHandshake(conn, buf, receiveTime))
+		return;
+
+	// 握手请求之后紧跟着的帧可能在同一次读事件中到达
+	handleFrames(conn, buf);
+}
+
+
+bool WebSocketServer::handleHandshake(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime)
+{
+	WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+	HttpContext::ParseResult result = context->handshake.parseRequest(buf, receiveTime);
+	if (result == HttpContext::ParseResult::Incomplete)
+		return false;
+	if (result == HttpContext::ParseResult::Error)
+	{
+		buf->retrieveAll();
+		rejectHandshake(conn, context->handshake.errorStatus());
+		return false;
+	}
+
+	const HttpRequest& request = context->handshake.request();
+	std::string_view key = request.getHeader("Sec-WebSocket-Key");
+	if (request.method() != HttpRequest::Method::Get
+		|| !containsToken(request.getHeader("Upgrade"), "websocket")
+		|| !containsToken(request.getHeader("Connection"), "Upgrade")
+		|| key.empty())
+	{
+		buf->retrieveAll();
+		rejectHandshake(conn, 400);
+		return false;
+	}
+	if (request.getHeader("Sec-WebSocket-Version") != "13")
+	{
+		buf->retrieveAll();
+		rejectHandshake(conn, 426);
+		return false;
+	}
+
+	// 101响应没有body 不能带Content-Length和Connection: Keep-Alive 这里手工序列化
+	t_wsOutput.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Accept: ");
+	t_wsOutput.append(WebSocketCodec::acceptKey(key));
+	t_wsOutput.append("\r\n\r\n");
+	flushTo(conn, &t_wsOutput);
+
+	context->upgraded = true;
+	if (_openCallback)
+		_openCallback(conn, request);
+	context->handshake.consume(buf);
+
+	startHeartbeat(conn);
+	return true;
+}
+
+
+void WebSocketServer::handleFrames(const TcpConnectionPtr& conn, Buffer* buf)
+{
+	using Codec = WebSocketCodec;
+	WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+	auto flushControl = [&conn]() {
+		if (t_wsControl.readableBytes() > 0)
+			flushTo(conn, &t_wsControl);
+	};
+
+	while (!context->closeReceived)
+	{
+		Codec::Frame frame;
+		uint16_t closeCode = Codec::kNormalClosure;
+		Codec::ParseResult result = Codec::parseFrame(buf, _maxMessageSize, &frame, &closeCode);
+		if (result == Codec::ParseResult::Incomplete)
+			break;
+
+		if (result == Codec::ParseResult::GotFrame)
+		{
+			context->awaitingPong = false;
+			switch (frame.opcode)
+			{
+			case Codec::Opcode::Text:
+			case Codec::Opcode::Binary:
+				if (context->messageOpcode != Codec::Opcode::Continuation)
+				{
+					// 上一条分片消息还没有结束 又来了一条新消息
+					result = Codec::ParseResult::Error;
+					closeCode = Codec::kProtocolError;
+				}
+				else if (frame.fin)
+				{
+					// 最常见的情况: 未分片的消息 直接把Buffer中的数据交给用户
+					if (_messageCallback)
+					{
+						flushControl();
+						_messageCallback(conn, std::string_view(frame.payload, frame.length), frame.opcode);
+					}
+				}
+				else
+				{
+					context->messageOpcode = frame.opcode;
+					context->message.assign(frame.payload, frame.length);
+				}
+				break;
+			case Codec::Opcode::Continuation:
+				if (context->messageOpcode == Codec::Opcode::Continuation)
+				{
+					result = Codec::ParseResult::Error;
+					closeCode = Codec::kProtocolError;
+				}
+				else if (context->message.size() + frame.length > _maxMessageSize)
+				{
+					result = Codec::ParseResult::Error;
+					closeCode = Codec::kMessageTooBig;
+				}
+				else
+				{
+					context->message.append(frame.payload, frame.length);
+					if (frame.fin)
+					{
+						if (_messageCallback)
+						{
+							flushControl();
+							_messageCallback(conn, context->message, context->messageOpcode);
+						}
+						context->messageOpcode = Codec::Opcode::Continuation;
+						context->message.clear();
+					}
+				}
+				break;
+			case Codec::Opcode::Ping:
+				Codec::encodeFrame(&t_wsControl, Codec::Opcode::Pong, std::string_view(frame.payload, frame.length));
+				break;
+			case Codec::Opcode::Pong:
+				break;
+			case Codec::Opcode::Close:
+			{
+				uint16_t code = Codec::kNormalClosure;
+				if (frame.length >= 2)
+					code = static_cast<uint16_t>((static_cast<uint8_t>(frame.payload[0]) << 8) | static_cast<uint8_t>(frame.payload[1]));
+				context->closeReceived = true;
+				// 对端发起关闭 回复关闭帧后关闭写端 我方发起关闭 收到回复即可关闭
+				if (!context->closeSent)
+				{
+					Codec::encodeClose(&t_wsControl, code);
+					context->closeSent = true;
+				}
+				if (_closeCallback)
+				{
+					flushControl();
+					_closeCallback(conn, code);
+				}
+				break;
+			}
+			}
+		}
+
+		if (result == Codec::ParseResult::Error)
+		{
+			LOG_ERROR("WebSocketServer::handleFrames [%s] protocol error, close code %d\n", conn->name().c_str(), closeCode);
+			if (!context->closeSent)
+				Codec::encodeClose(&t_wsControl, closeCode);
+			context->closeSent = true;
+			context->closeReceived = true;
+			buf->retrieveAll();
+			break;
+		}
+		buf->retrieve(frame.frameLength);
+	}
+
+	flushControl();
+	if (context->closeReceived)
+	{
+		buf->retrieveAll();
+		conn->shutdown();
+	}
+}
+
+
+void WebSocketServer::startHeartbeat(const TcpConnectionPtr& conn)
+{
+	if (_pingInterval <= 0.0)
+		return;
+
+	// 定时器只持有弱引用 不延长连接的生命周期 连接断开时在onConnection中取消
+	std::weak_ptr<TcpConnection> weakConn(conn);
+	WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+	context->heartbeatTimer = conn->getLoop()->runEvery(_pingInterval, [weakConn]() {
+		TcpConnectionPtr conn = weakConn.lock();
+		if (!conn || !conn->connected())
+			return;
+		WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+		if (context->awaitingPong)
+		{
+			LOG_INFO("WebSocketServer heartbeat timeout [%s]\n", conn->name().c_str());
+			conn->forceClose();
+			return;
+		}
+		context->awaitingPong = true;
+		WebSocketCodec::encodeFrame(&t_wsOutput, WebSocketCodec::Opcode::Ping, std::string_view());
+		flushTo(conn, &t_wsOutput);
+	});
+}
+
+
+void WebSocketServer::send(const TcpConnectionPtr& conn, std::string_view message, Opcode opcode)
+{
+	if (conn->getLoop()->isInLoopThread())
+	{
+		WebSocketCodec::encodeFrame(&t_wsOutput, opcode, message);
+		flushTo(conn, &t_wsOutput);
+	}
+	else
+	{
+		Buffer frame;
+		WebSocketCodec::encodeFrame(&frame, opcode, message);
+		conn->send(&frame);
+	}
+}
+
+
+void WebSocketServer::close(const TcpConnectionPtr& conn, uint16_t code, std::string_view reason)
+{
+	conn->getLoop()->runInLoop(std::bind(&WebSocketServer::closeInLoop, conn, code, std::string(reason)));
+}
+
+
+void WebSocketServer::closeInLoop(const TcpConnectionPtr& conn, uint16_t code, const std::string& reason)
+{
+	if (!conn->connected())
+		return;
+
+	WebSocketContext* context = std::any_cast<WebSocketContext>(conn->getMutableContext());
+	if (!context->upgraded)
+	{
+		conn->shutdown();
+		return;
+	}
+	if (context->closeSent)
+		return;
+
+	context->closeSent = true;
+	WebSocketCodec::encodeClose(&t_wsOutput, code, reason);
+	flushTo(conn, &t_wsOutput);
+
+	// 对端迟迟不回复关闭帧时强制断开
+	std::weak_ptr<TcpConnection> weakConn(conn);
+	conn->getLoop()->runAfter(kCloseTimeout, [weakConn]() {
+		if (TcpConnectionPtr conn = weakConn.lock())
+			conn->forceClose();
+	});
+}
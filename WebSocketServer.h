@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "noncopyable.h"
+#include "TcpServer.h"
+#include "WebSocketCodec.h"
+
+class HttpRequest;
+
+/// @brief 基于TcpServer的websocket服务器 负责http升级握手、帧解析、分片重组、ping/pong心跳以及关闭握手
+/// 未分片的消息直接以Buffer内部(已原地解掩码)的视图交给用户 不做拷贝
+class WebSocketServer : public noncopyable
+{
+public:
+	using Opcode = WebSocketCodec::Opcode;
+
+	// 握手成功后调用 request的视图只在回调期间有效
+	using OpenCallback = std::function<void(const TcpConnectionPtr&, const HttpRequest&)>;
+	// 收到一条完整的文本或二进制消息 message只在回调期间有效
+	using WebSocketMessageCallback = std::function<void(const TcpConnectionPtr&, std::string_view message, Opcode opcode)>;
+	// 收到对端的关闭帧
+	using WebSocketCloseCallback = std::function<void(const TcpConnectionPtr&, uint16_t code)>;
+
+	WebSocketServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name,
+		TcpServer::Option option = TcpServer::Option::NoReusePort);
+
+	EventLoop* getLoop() const { return _server.getLoop(); }
+
+	void setOpenCallback(OpenCallback cb) { _openCallback = std::move(cb); }
+	void setMessageCallback(WebSocketMessageCallback cb) { _messageCallback = std::move(cb); }
+	void setCloseCallback(WebSocketCloseCallback cb) { _closeCallback = std::move(cb); }
+	void setConnectionCallback(ConnectionCallback cb) { _connectionCallback = std::move(cb); }
+
+	void setThreadNum(int numThreads) { _server.setThreadNum(numThreads); }
+
+	// 心跳间隔 单位秒 每个间隔发送一次ping 连续一个间隔内没有收到任何帧则断开连接 0表示关闭心跳
+	void setPingInterval(double seconds) { _pingInterval = seconds; }
+	// 单条消息(包括分片重组后)的最大长度
+	void setMaxMessageSize(size_t size) { _maxMessageSize = size; }
+
+	void start();
+
+	// 线程安全 发送一条完整消息
+	static void send(const TcpConnectionPtr& conn, std::string_view message, Opcode opcode = Opcode::Text);
+	// 线程安全 发起关闭握手 对端回复关闭帧或超时后断开连接
+	static void close(const TcpConnectionPtr& conn, uint16_t code = WebSocketCodec::kNormalClosure, std::string_view reason = std::string_view());
+
+private:
+	void onConnection(const TcpConnectionPtr& conn);
+	void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
+
+	// 处理http升级请求 成功返回true
+	bool handleHandshake(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
+	// 处理buf中所有完整的帧
+	void handleFrames(const TcpConnectionPtr& conn, Buffer* buf);
+	void startHeartbeat(const TcpConnectionPtr& conn);
+
+	static void closeInLoop(const TcpConnectionPtr& conn, uint16_t code, const std::string& reason);
+
+	TcpServer _server;
+	OpenCallback _openCallback;
+	WebSocketMessageCallback _messageCallback;
+	WebSocketCloseCallback _closeCallback;
+	ConnectionCallback _connectionCallback;
+	double _pingInterval;
+	size_t _maxMessageSize;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+/// @brief 对数-线性分桶的延迟直方图(与HdrHistogram思路相同) 记录单位由调用方决定 一般是纳秒
+/// 小于128的值精确记录 更大的值每个2的幂区间再等分为64个桶 相对误差小于1.6%
+/// 记录只是一次数组自增 不加锁 多线程压测时每个线程各用一个 最后merge
+class Histogram
+{
+public:
+	Histogram() : _counts(kBucketCount, 0), _total{ 0 }, _min{ UINT64_MAX }, _max{ 0 }, _sum{ 0 } {}
+
+	void record(uint64_t value)
+	{
+		_counts[bucketIndex(value)]++;
+		_total++;
+		_sum += value;
+		_min = std::min(_min, value);
+		_max = std::max(_max, value);
+	}
+
+	void merge(const Histogram& other)
+	{
+		for (size_t i = 0; i < kBucketCount; i++)
+			_counts[i] += other._counts[i];
+		_total += other._total;
+		_sum += other._sum;
+		_min = std::min(_min, other._min);
+		_max = std::max(_max, other._max);
+	}
+
+	void reset()
+	{
+		std::fill(_counts.begin(), _counts.end(), 0);
+		_total = 0;
+		_sum = 0;
+		_min = UINT64_MAX;
+		_max = 0;
+	}
+
+	// percentile取值范围 [0, 100]
+	uint64_t percentile(double percentile) const
+	{
+		if (_total == 0)
+			return 0;
+		uint64_t target = static_cast<uint64_t>(percentile / 100.0 * _total + 0.5);
+		target = std::clamp<uint64_t>(target, 1, _total);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < kBucketCount; i++)
+		{
+			seen += _counts[i];
+			if (seen >= target)
+				return std::min(bucketValue(i), _max);
+		}
+		return _max;
+	}
+
+	uint64_t count() const { return _total; }
+	uint64_t min() const { return _total == 0 ? 0 : _min; }
+	uint64_t max() const { return _max; }
+	double mean() const { return _total == 0 ? 0.0 : static_cast<double>(_sum) / _total; }
+
+	// 以HdrHistogram的.hgrm格式输出百分位分布 可以直接交给HdrHistogram的plotter作图
+	// 记录的值除以scale后输出 如以纳秒记录、以毫秒输出时scale为1e6 每当剩余比例减半时输出ticksPerHalfDistance个点
+	void writePercentileDistribution(FILE* out, double scale, int ticksPerHalfDistance = 5) const
+	{
+		::fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+		if (_total == 0)
+			return;
+
+		double percentile = 0.0;
+		double last = 100.0 * (1.0 - 1.0 / _total);
+		while (percentile < last)
+		{
+			double fraction = percentile / 100.0;
+			::fprintf(out, "%12.3f %2.12f %10lu %14.2f\n", this->percentile(percentile) / scale, fraction,
+				static_cast<uint64_t>(std::ceil(fraction * _total)), 1.0 / (1.0 - fraction));
+			double halfDistance = std::pow(2.0, std::floor(std::log2(100.0 / (100.0 - percentile))) + 1);
+			percentile += 100.0 / (halfDistance * ticksPerHalfDistance);
+		}
+		::fprintf(out, "%12.3f %2.12f %10lu\n", _max / scale, 1.0, _total);
+		::fprintf(out, "#[Mean    = %12.3f, Max            = %12.3f]\n", mean() / scale, _max / scale);
+		::fprintf(out, "#[Total count    = %12lu]\n", _total);
+	}
+
+private:
+	static constexpr int kSubBucketBits = 6;
+	static constexpr size_t kLinearCount = 2 << kSubBucketBits;		// 128
+	static constexpr size_t kSubBucketCount = 1 << kSubBucketBits;	// 64
+	static constexpr size_t kBucketCount = kLinearCount + (64 - kSubBucketBits - 1) * kSubBucketCount;
+
+	static size_t bucketIndex(uint64_t value)
+	{
+		if (value < kLinearCount)
+			return value;
+		int msb = 63 - __builtin_clzll(value);
+		int shift = msb - kSubBucketBits;	// 使 value >> shift 落在 [64, 128)
+		return kLinearCount + (shift - 1) * kSubBucketCount + ((value >> shift) - kSubBucketCount);
+	}
+
+	// 返回桶内的最大值 即该桶代表的上界
+	static uint64_t bucketValue(size_t index)
+	{
+		if (index < kLinearCount)
+			return index;
+		size_t shift = (index - kLinearCount) / kSubBucketCount + 1;
+		uint64_t sub = (index - kLinearCount) % kSubBucketCount + kSubBucketCount;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	std::vector<uint64_t> _counts;
+	uint64_t _total;
+	uint64_t _min;
+	uint64_t _max;
+	uint64_t _sum;
+};
@@ -0,0 +1,275 @@
+/*
+ * 快生产者/慢消费者下的发送缓冲区占用 检查TcpConnection::setFlowControl能否把内存限制在高水位附近
+ * 进程内启动一个中转服务器 第一个连接为消费者 第二个连接为生产者 生产者发来的数据全部转发给消费者
+ * 生产者线程用阻塞socket尽快写 消费者线程按-r限速读取
+ * -f on: 消费者连接的发送缓冲区达到高水位时暂停读生产者连接 降到低水位时恢复 生产者被TCP流量控制阻塞在write上
+ * -f off: 不做流量控制 发送队列一直增长 超过-M时提前结束
+ * -S N: 消费者连接的发送队列超过N KB后溢出到磁盘(TcpConnection::setOutputSpill) 配合-f off时内存不再随积压增长
+ * -R N: 两个连接的缓冲区使用N KB起的镜像环形缓冲区(TcpConnection::useMirroredBuffers)
+ * 每10ms采样一次消费者连接的发送队列 输出峰值、进程的最大常驻内存以及两端的吞吐
+ * 生产者发送按字节递增的数据 消费者逐字节校验 检查转发(包括溢出到磁盘的部分)没有乱序或丢失
+ *
+ * 用法: backpressure_bench [-f on|off] [-H 高水位KB] [-L 低水位KB] [-S 溢出阈值KB] [-R 环形缓冲区KB] [-s 服务端subloop数] [-r 消费速率MB/s] [-d 秒数] [-M 上限MB] [-P 端口]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool flowControl = true;
+	size_t highWaterMark = 1024 * 1024;
+	size_t lowWaterMark = 256 * 1024;
+	size_t spillThreshold = 0;
+	size_t ringCapacity = 0;
+	int serverThreads = 2;
+	double consumeRate = 16 * 1024 * 1024;
+	int seconds = 3;
+	size_t limit = 1024 * 1024 * 1024;
+	uint16_t port = 6397;
+};
+
+
+/// @brief 中转服务器中的两个连接 连接回调在各自的loop线程中执行 用锁保护
+struct Relay
+{
+	std::mutex mutex;
+	TcpConnectionPtr sink;		// 消费者
+	TcpConnectionPtr source;	// 生产者
+	std::atomic<size_t> peakPending{ 0 };
+};
+
+
+static int connectTo(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "f:H:L:S:R:s:r:d:M:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'f': options.flowControl = ::strcmp(optarg, "off") != 0; break;
+		case 'H': options.highWaterMark = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 'L': options.lowWaterMark = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 'S': options.spillThreshold = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 'R': options.ringCapacity = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'r': options.consumeRate = ::atof(optarg) * 1024 * 1024; break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'M': options.limit = ::strtoul(optarg, nullptr, 10) * 1024 * 1024; break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-f on|off] [-H high water KB] [-L low water KB] [-S spill threshold KB] [-R ring buffer KB] [-s server threads] [-r consume MB/s] [-d seconds] [-M limit MB] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+static void runClients(const Options& options, EventLoop* loop, Relay* relay)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// 先连消费者 等它在服务端登记后再连生产者
+	int consumerFd = connectTo(options.port);
+	while (true)
+	{
+		std::lock_guard<std::mutex> lock(relay->mutex);
+		if (relay->sink)
+			break;
+	}
+	int producerFd = connectTo(options.port);
+	if (consumerFd < 0 || producerFd < 0)
+	{
+		::fprintf(stderr, "connect failed\n");
+		loop->quit();
+		return;
+	}
+
+	std::atomic<bool> stop{ false };
+	std::atomic<uint64_t> produced{ 0 }, consumed{ 0 }, corrupted{ 0 };
+	// 第i个字节为i % 251 消费者按收到的总字节数校验
+	std::thread producer([&]() {
+		std::vector<char> chunk(64 * 1024);
+		uint64_t offset = 0;
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			for (size_t i = 0; i < chunk.size(); ++i)
+				chunk[i] = static_cast<char>((offset + i) % 251);
+			size_t sent = 0;
+			while (sent < chunk.size() && !stop.load(std::memory_order_relaxed))
+			{
+				ssize_t n = ::send(producerFd, chunk.data() + sent, chunk.size() - sent, MSG_NOSIGNAL);
+				if (n <= 0)
+					break;
+				sent += n;
+			}
+			if (sent < chunk.size())
+				break;
+			offset += sent;
+			produced += sent;
+		}
+	});
+	std::thread consumer([&]() {
+		// 每10ms读取配额内的数据
+		std::vector<char> chunk(64 * 1024);
+		size_t quota = static_cast<size_t>(options.consumeRate / 100);
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			Clock::time_point tick = Clock::now() + std::chrono::milliseconds(10);
+			size_t remaining = quota;
+			while (remaining > 0)
+			{
+				ssize_t n = ::recv(consumerFd, chunk.data(), std::min(remaining, chunk.size()), MSG_DONTWAIT);
+				if (n <= 0)
+					break;
+				uint64_t offset = consumed.load(std::memory_order_relaxed);
+				for (ssize_t i = 0; i < n; ++i)
+				{
+					if (chunk[i] != static_cast<char>((offset + i) % 251))
+						corrupted++;
+				}
+				consumed += n;
+				remaining -= n;
+			}
+			std::this_thread::sleep_until(tick);
+		}
+	});
+
+	Clock::time_point start = Clock::now();
+	bool aborted = false;
+	while (Clock::now() - start < std::chrono::seconds(options.seconds))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (relay->peakPending.load() > options.limit)
+		{
+			aborted = true;
+			break;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	stop = true;
+	// 生产者可能阻塞在write上
+	::shutdown(producerFd, SHUT_RDWR);
+	producer.join();
+	consumer.join();
+
+	rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	::printf("backpressure_bench: flow control %s (high %zu KB, low %zu KB), spill %s, %s buffers, consumer %.1f MB/s, %d server threads, %.2fs%s\n",
+		options.flowControl ? "on" : "off", options.highWaterMark / 1024, options.lowWaterMark / 1024,
+		options.spillThreshold > 0 ? (std::to_string(options.spillThreshold / 1024) + " KB").data() : "off",
+		options.ringCapacity > 0 ? "ring" : "vector", options.consumeRate / 1024 / 1024,
+		options.serverThreads, elapsed, aborted ? " (stopped early: limit exceeded)" : "");
+	::printf("  produced: %.1f MB/s  consumed: %.1f MB/s\n", produced / elapsed / 1024 / 1024, consumed / elapsed / 1024 / 1024);
+	::printf("  peak pending in sink output queue: %.2f MB  max rss: %.1f MB  corrupted bytes: %lu\n", relay->peakPending.load() / 1024.0 / 1024,
+		usage.ru_maxrss / 1024.0, corrupted.load());
+	::fflush(stdout);
+
+	// 服务端仍有大量数据未发出 关闭时的错误与测试无关
+	Logger::setLogLevel(LogLevel::FATAL);
+	::close(producerFd);
+	::close(consumerFd);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	Relay relay;
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "RelayServer");
+	server.setConnectionCallback([&relay, &options](const TcpConnectionPtr& conn) {
+		std::lock_guard<std::mutex> lock(relay.mutex);
+		if (conn->connected() && options.ringCapacity > 0 && !conn->useMirroredBuffers(options.ringCapacity))
+			::fprintf(stderr, "mirrored ring buffer unavailable, using vector\n");
+		if (!conn->connected())
+		{
+			if (conn == relay.sink)
+				relay.sink.reset();
+			else if (conn == relay.source)
+				relay.source.reset();
+			return;
+		}
+		if (!relay.sink)
+		{
+			relay.sink = conn;
+			if (options.spillThreshold > 0)
+				conn->setOutputSpill(options.spillThreshold);
+			// 在消费者连接的loop中采样它的发送队列
+			conn->getLoop()->runEvery(0.01, [&relay, weak = std::weak_ptr<TcpConnection>(conn)]() {
+				if (TcpConnectionPtr sink = weak.lock())
+				{
+					size_t pending = sink->pendingOutputBytes();
+					if (pending > relay.peakPending.load())
+						relay.peakPending = pending;
+				}
+			});
+		}
+		else
+		{
+			relay.source = conn;
+			if (options.flowControl)
+				relay.sink->setFlowControl(conn, options.highWaterMark, options.lowWaterMark);
+		}
+	});
+	server.setMessageCallback([&relay](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		TcpConnectionPtr sink;
+		{
+			std::lock_guard<std::mutex> lock(relay.mutex);
+			sink = relay.sink;
+		}
+		if (sink && conn != sink)
+			sink->send(buf);
+		else
+			buf->retrieveAll();
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop, &relay);
+	loop.loop();
+	controller.join();
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * 不读取回复的慢客户端压满回显服务器的发送缓冲区 检查BufferBudget能否把连接缓冲区占用的内存限制在预算附近
+ * 进程内启动一个回显服务器 -c个慢客户端不停发送数据但从不读取 服务端的回复堆积在各连接的发送缓冲区中
+ * 另有一个正常客户端每10ms做一次小请求的往返 连接断开时重连 统计成功与失败的请求 观察过载时服务是否仍然可用
+ * -B 0: 不设预算 缓冲区一直增长 进程常驻内存超过-M时提前结束
+ * -B N: 预算N MB 超出后拒绝新连接、暂停读并强制关闭占用最大的连接 被关闭的慢客户端立即重连
+ *
+ * 用法: budget_bench [-B 预算MB] [-c 慢客户端数] [-s 服务端subloop数] [-d 秒数] [-M 上限MB] [-P 端口]
+ */
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <fstream>
+#include <string>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "BufferBudget.h"
+#include "Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	size_t budget = 64 * 1024 * 1024;
+	int slowClients = 32;
+	int serverThreads = 2;
+	int seconds = 5;
+	size_t limit = 1024 * 1024 * 1024;
+	uint16_t port = 6398;
+};
+
+
+static int connectTo(uint16_t port, bool sendTimeout)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	if (fd >= 0 && sendTimeout)
+	{
+		timeval timeout = { 0, 1000 };
+		::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	}
+	return fd;
+}
+
+
+// 当前常驻内存 ru_maxrss只有峰值
+static size_t residentBytes()
+{
+	std::ifstream statm("/proc/self/statm");
+	size_t pages = 0, resident = 0;
+	statm >> pages >> resident;
+	return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "B:c:s:d:M:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'B': options.budget = ::strtoul(optarg, nullptr, 10) * 1024 * 1024; break;
+		case 'c': options.slowClients = ::atoi(optarg); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'M': options.limit = ::strtoul(optarg, nullptr, 10) * 1024 * 1024; break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-B budget MB, 0 = off] [-c slow clients] [-s server threads] [-d seconds] [-M limit MB] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::atomic<bool> stop{ false };
+	std::atomic<uint64_t> sent{ 0 }, reconnects{ 0 }, ok{ 0 }, failed{ 0 };
+	std::vector<uint64_t> latencies;
+
+	// 慢客户端 发送超时1ms 接收窗口满了就换下一个连接
+	std::thread slow([&]() {
+		std::vector<int> fds(options.slowClients, -1);
+		std::vector<char> chunk(64 * 1024, 's');
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			for (int& fd : fds)
+			{
+				if (fd < 0)
+				{
+					fd = connectTo(options.port, true);
+					reconnects++;
+					if (fd < 0)
+						continue;
+				}
+				ssize_t n = ::send(fd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
+				if (n > 0)
+					sent += n;
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				{
+					::close(fd);
+					fd = -1;
+				}
+			}
+		}
+		for (int fd : fds)
+		{
+			if (fd >= 0)
+				::close(fd);
+		}
+	});
+
+	// 正常客户端 每个请求等待回复最多100ms
+	std::thread healthy([&]() {
+		int fd = -1;
+		char request[64], reply[64];
+		::memset(request, 'h', sizeof(request));
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			Clock::time_point tick = Clock::now() + std::chrono::milliseconds(10);
+			if (fd < 0)
+				fd = connectTo(options.port, false);
+			bool success = false;
+			Clock::time_point start = Clock::now();
+			if (fd >= 0 && ::send(fd, request, sizeof(request), MSG_NOSIGNAL) == sizeof(request))
+			{
+				size_t got = 0;
+				while (got < sizeof(reply))
+				{
+					pollfd pfd = { fd, POLLIN, 0 };
+					if (::poll(&pfd, 1, 100) <= 0)
+						break;
+					ssize_t n = ::recv(fd, reply + got, sizeof(reply) - got, 0);
+					if (n <= 0)
+						break;
+					got += n;
+				}
+				success = got == sizeof(reply);
+			}
+			if (success)
+			{
+				ok++;
+				latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+			}
+			else
+			{
+				failed++;
+				if (fd >= 0)
+					::close(fd);
+				fd = -1;
+			}
+			std::this_thread::sleep_until(tick);
+		}
+		if (fd >= 0)
+			::close(fd);
+	});
+
+	Clock::time_point start = Clock::now();
+	bool aborted = false;
+	size_t peakRss = 0;
+	while (Clock::now() - start < std::chrono::seconds(options.seconds))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		peakRss = std::max(peakRss, residentBytes());
+		if (peakRss > options.limit)
+		{
+			aborted = true;
+			break;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	stop = true;
+	slow.join();
+	healthy.join();
+
+	BufferBudget::Stats stats = BufferBudget::instance().stats();
+	std::sort(latencies.begin(), latencies.end());
+	uint64_t p99 = latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100];
+	::printf("budget_bench: budget %s, %d slow clients, %d server threads, %.2fs%s\n",
+		options.budget > 0 ? (std::to_string(options.budget / 1024 / 1024) + " MB").data() : "off", options.slowClients,
+		options.serverThreads, elapsed, aborted ? " (stopped early: limit exceeded)" : "");
+	::printf("  slow clients sent: %.1f MB/s  reconnects: %lu\n", sent / elapsed / 1024 / 1024, reconnects.load());
+	::printf("  healthy requests: %lu ok, %lu failed, p99 %lu us\n", ok.load(), failed.load(), p99);
+	if (options.budget > 0)
+	{
+		::printf("  buffers: peak %.1f MB  refused connections: %lu  paused reads: %lu  evictions: %lu\n",
+			stats.peakBytes / 1024.0 / 1024, stats.refusedConnections, stats.pausedReads, stats.evictions);
+	}
+	::printf("  peak rss: %.1f MB\n", peakRss / 1024.0 / 1024);
+	::fflush(stdout);
+
+	// 服务端仍有大量数据未发出 关闭时的错误与测试无关
+	Logger::setLogLevel(LogLevel::FATAL);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// 预算在start之前设置
+	BufferBudget::instance().setLimit(options.budget);
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "BudgetServer");
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		conn->send(buf);
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
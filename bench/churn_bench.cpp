@@ -0,0 +1,259 @@
+/*
+ * 短连接压测 衡量TcpServer建立和销毁连接的开销(accept、创建TcpConnection、分发到subloop、关闭回收)
+ * 进程内启动TcpServer 每个客户端线程循环执行: connect -> 发送1字节 -> 收到回显 -> 服务端回显后shutdown -> 客户端读到EOF后close
+ * 由服务端先关闭 TIME_WAIT留在服务端 客户端的临时端口不会被耗尽
+ * 输出每秒完成的连接数以及一次完整短连接的耗时
+ * -S 模拟重连风暴: 客户端线程同时发起共N个连接并保持 统计服务端全部建立完这些连接(连接回调已执行)所用的时间
+ * -a 选择accept方式: main 由mainloop accept后分发给subloop(默认); multi 每个subloop各自通过SO_REUSEPORT监听同一端口
+ *
+ * 用法: churn_bench [-a main|multi] [-c 客户端线程数] [-s 服务端subloop数] [-d 秒数] [-P 端口] [-S 风暴连接数]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int clients = 4;
+	int serverThreads = 1;
+	int seconds = 10;
+	uint16_t port = 6393;
+	int storm = 0;
+	bool multiAcceptor = false;
+};
+
+
+/// @brief 一个客户端线程 串行地建立短连接 直到stop被置位
+class ChurnClient
+{
+public:
+	explicit ChurnClient(const Options& options) : _options{ options } {}
+
+	void run(const std::atomic<bool>& stop)
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			Clock::time_point start = Clock::now();
+			if (once(addr))
+			{
+				_completed++;
+				_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+			}
+			else
+			{
+				_errors++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	bool once(const sockaddr_in& addr)
+	{
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return false;
+		bool ok = false;
+		char byte = 'c';
+		if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 && ::write(fd, &byte, 1) == 1 && ::read(fd, &byte, 1) == 1)
+			ok = ::read(fd, &byte, 1) == 0;	// 等服务端关闭
+		::close(fd);
+		return ok;
+	}
+
+	const Options& _options;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "a:c:s:d:P:S:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a': options.multiAcceptor = ::strcmp(optarg, "multi") == 0; break;
+		case 'c': options.clients = ::atoi(optarg); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'S': options.storm = ::atoi(optarg); break;
+		default:
+			::fprintf(stderr, "usage: %s [-a main|multi] [-c client threads] [-s server threads] [-d seconds] [-P port] [-S storm connections]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+/// @brief 等待服务器开始监听后启动客户端线程 到时间后汇总结果并退出主loop
+static void runClients(const Options& options, EventLoop* loop, const std::atomic<uint64_t>* accepted)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::atomic<bool> stop{ false };
+	std::vector<std::unique_ptr<ChurnClient>> clients;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < options.clients; i++)
+		clients.emplace_back(new ChurnClient(options));
+
+	uint64_t acceptedBefore = accepted->load();
+	Clock::time_point start = Clock::now();
+	for (auto&& client : clients)
+		threads.emplace_back(&ChurnClient::run, client.get(), std::cref(stop));
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+	stop = true;
+	for (auto&& thread : threads)
+		thread.join();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t completed = 0, errors = 0;
+	for (auto&& client : clients)
+	{
+		total.merge(client->histogram());
+		completed += client->completed();
+		errors += client->errors();
+	}
+
+	::printf("churn_bench: %s acceptor, %d client threads, %d server threads, %.2fs\n",
+		options.multiAcceptor ? "per-loop" : "main-loop", options.clients, options.serverThreads, elapsed);
+	::printf("  connections: %lu  errors: %lu  accepted: %lu  connections/s: %.0f\n",
+		completed, errors, accepted->load() - acceptedBefore, completed / elapsed);
+	::printf("  connect+echo+close(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+	::fflush(stdout);
+	loop->quit();
+}
+
+
+/// @brief 所有客户端线程同时建立连接 服务端对每个连接执行完连接回调后计入accepted 全部计入时风暴结束
+/// 客户端主动关闭 每个连接会在客户端留下一个TIME_WAIT 连续运行时风暴规模不要超过本地端口范围的一半
+static void runStorm(const Options& options, EventLoop* loop, const std::atomic<uint64_t>* accepted)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(options.port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+	std::atomic<int> failed{ 0 };
+	std::vector<std::vector<int>> fds(options.clients);
+	std::vector<std::thread> threads;
+	uint64_t acceptedBefore = accepted->load();
+	uint64_t target = acceptedBefore + options.storm;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < options.clients; i++)
+	{
+		int count = options.storm / options.clients + (i < options.storm % options.clients ? 1 : 0);
+		threads.emplace_back([&, i, count]() {
+			for (int j = 0; j < count; j++)
+			{
+				int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+				if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0)
+					fds[i].push_back(fd);
+				else
+				{
+					failed++;
+					if (fd >= 0)
+						::close(fd);
+				}
+			}
+		});
+	}
+	for (auto&& thread : threads)
+		thread.join();
+	Clock::time_point connected = Clock::now();
+
+	target -= failed;
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(30);
+	while (accepted->load() < target && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	Clock::time_point established = Clock::now();
+
+	double connectMs = std::chrono::duration<double, std::milli>(connected - start).count();
+	double establishMs = std::chrono::duration<double, std::milli>(established - start).count();
+	::printf("churn_bench storm: %s acceptor, %d connections from %d client threads, %d server threads\n",
+		options.multiAcceptor ? "per-loop" : "main-loop", options.storm, options.clients, options.serverThreads);
+	::printf("  connect failures: %d  established: %lu  all connect() returned: %.1f ms  all established: %.1f ms  connections/s: %.0f\n",
+		failed.load(), accepted->load() - acceptedBefore, connectMs, establishMs, (accepted->load() - acceptedBefore) / establishMs * 1000);
+	::fflush(stdout);
+
+	for (auto&& list : fds)
+		for (int fd : list)
+			::close(fd);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	// 服务端的TIME_WAIT以及并发的连接都需要fd
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::atomic<uint64_t> accepted{ 0 };
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "ChurnServer",
+		options.multiAcceptor ? TcpServer::Option::MultiAcceptor : TcpServer::Option::NoReusePort);
+	server.setConnectionCallback([&accepted](const TcpConnectionPtr& conn) {
+		if (conn->connected())
+			accepted.fetch_add(1, std::memory_order_relaxed);
+	});
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		conn->send(buf);
+		conn->shutdown();
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(options.storm > 0 ? runStorm : runClients, std::cref(options), &loop, &accepted);
+	loop.loop();
+	controller.join();
+	return 0;
+}
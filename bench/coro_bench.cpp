@@ -0,0 +1,249 @@
+/*
+ * 协程接口相对回调的开销 进程内启动一个按行回显的服务器 -c个客户端线程各用一个阻塞连接做请求/回复的往返
+ * 每个请求是-b字节(含结尾的\r\n)的一行 收到完整的回复后再发下一个
+ * -m callback: 消息回调中用findCRLF逐行取出并send 不完整的行留在输入缓冲区中等下一次回调
+ * -m coroutine: 每个连接一个协程 循环co_await readUntil("\r\n")与co_await send
+ * 两种写法每行都拷贝出一个std::string再发送 区别只在回调分发与协程的挂起/恢复
+ * -R: 协程spawn到另一个loop线程上启动 第一次co_await读发生在连接的loop之外(连接回调中先setCoroutineReading)
+ *     检查协程开始读之前到达的数据不会交给消息回调 之后协程切换到连接的loop中继续运行
+ * 输出每秒往返次数与往返延迟 详细的单项开销见micro_bench -f coroutine
+ *
+ * 用法: coro_bench [-m callback|coroutine] [-R] [-c 连接数] [-b 每行字节数] [-s 服务端subloop数] [-d 秒数] [-P 端口]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "EventLoopThread.h"
+#include "Coroutine.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool coroutine = true;
+	bool remoteSpawn = false;
+	int connections = 4;
+	size_t lineBytes = 64;
+	int serverThreads = 1;
+	int seconds = 3;
+	uint16_t port = 6402;
+};
+
+static std::atomic<bool> g_stop{ false };
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:Rc:b:s:d:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': options.coroutine = ::strcmp(optarg, "callback") != 0; break;
+		case 'R': options.remoteSpawn = true; break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 'b': options.lineBytes = std::max<size_t>(2, ::strtoul(optarg, nullptr, 10)); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-m callback|coroutine] [-R] [-c connections] [-b line bytes] [-s server threads] [-d seconds] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+static Task<> echoLines(TcpConnectionPtr conn)
+{
+	for (;;)
+	{
+		std::string line = co_await conn->readUntil("\r\n");
+		if (line.empty())
+			co_return;
+		if (!co_await conn->send(line))
+			co_return;
+	}
+}
+
+
+static void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp)
+{
+	while (const char* crlf = buf->findCRLF())
+	{
+		size_t len = crlf + 2 - buf->peek();
+		conn->send(buf->retrieveAsString(len));
+	}
+}
+
+
+static int connectTo(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	int on = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+
+static void runClient(int fd, size_t lineBytes, Histogram* histogram, uint64_t* requests)
+{
+	std::string request(lineBytes - 2, 'c');
+	request += "\r\n";
+	std::vector<char> reply(lineBytes);
+	while (!g_stop.load(std::memory_order_relaxed))
+	{
+		Clock::time_point start = Clock::now();
+		if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+			return;
+		size_t received = 0;
+		while (received < lineBytes)
+		{
+			ssize_t n = ::recv(fd, reply.data() + received, lineBytes - received, 0);
+			if (n <= 0)
+				return;
+			received += n;
+		}
+		histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+		++*requests;
+	}
+}
+
+
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::vector<int> fds;
+	for (int i = 0; i < options.connections; ++i)
+	{
+		int fd = connectTo(options.port);
+		if (fd < 0)
+		{
+			::fprintf(stderr, "connect failed\n");
+			loop->quit();
+			return;
+		}
+		fds.push_back(fd);
+	}
+
+	std::vector<Histogram> histograms(fds.size());
+	std::vector<uint64_t> requests(fds.size(), 0);
+	std::vector<std::thread> clients;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < fds.size(); ++i)
+		clients.emplace_back(runClient, fds[i], options.lineBytes, &histograms[i], &requests[i]);
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+	g_stop = true;
+	for (std::thread& client : clients)
+		client.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t count = 0;
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+		total.merge(histograms[i]);
+		count += requests[i];
+	}
+	::printf("coro_bench: %s%s, %d connections, %zu byte lines, %d server threads, %.1fs\n", options.coroutine ? "coroutine" : "callback",
+		options.coroutine && options.remoteSpawn ? " (spawned on another loop)" : "", options.connections, options.lineBytes, options.serverThreads, seconds);
+	::printf("  requests/s: %.0f  round trip(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f\n", count / seconds, total.mean() / 1000.0,
+		total.percentile(50) / 1000.0, total.percentile(99) / 1000.0, total.percentile(99.9) / 1000.0);
+	::fflush(stdout);
+
+	Logger::setLogLevel(LogLevel::FATAL);
+	for (int fd : fds)
+		::close(fd);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// -R时协程在这个loop上启动 第一次co_await读之后切换到连接所在的loop中运行
+	std::unique_ptr<EventLoopThread> spawnThread;
+	EventLoop* spawnLoop = nullptr;
+	if (options.coroutine && options.remoteSpawn)
+	{
+		spawnThread.reset(new EventLoopThread(EventLoopThread::ThreadInitCallback(), "spawn"));
+		spawnLoop = spawnThread->startLoop();
+	}
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "CoroServer");
+	if (options.coroutine)
+	{
+		server.setConnectionCallback([spawnLoop](const TcpConnectionPtr& conn) {
+			if (conn->connected())
+			{
+				conn->setTcpNoDelay(true);
+				if (spawnLoop)
+				{
+					// 协程在其他loop上开始读之前到达的数据也要留在输入缓冲区中
+					conn->setCoroutineReading();
+					spawn(spawnLoop, echoLines(conn));
+				}
+				else
+					spawn(conn->getLoop(), echoLines(conn));
+			}
+		});
+	}
+	else
+	{
+		server.setConnectionCallback([](const TcpConnectionPtr& conn) {
+			if (conn->connected())
+				conn->setTcpNoDelay(true);
+		});
+		server.setMessageCallback(onMessage);
+	}
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
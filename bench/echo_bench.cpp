@@ -0,0 +1,298 @@
+/*
+ * 回显服务器压测 用于观察日志级别对热路径的影响
+ * 进程内启动echo服务器 每个客户端连接发送一条消息 收齐回显后立即发送下一条 统计每秒消息数和往返延迟
+ * -l 设置运行期的日志级别(默认warn) 低于编译期最低级别(默认INFO)的日志语句已经被去掉
+ * 需要对比每个事件都输出日志的代价时 用 cmake -DMYMUDUO_MIN_LOG_LEVEL=0 编译后以 -l trace 运行
+ *
+ * 用法: echo_bench [-l trace|debug|info|warn|error] [-s 服务端subloop数] [-P 端口] [-d 秒数] [-c 连接数] [-t 客户端线程数] [-b 消息字节数]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using namespace std::placeholders;
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	LogLevel logLevel = LogLevel::WARN;
+	int serverThreads = 1;
+	uint16_t port = 6392;
+	int seconds = 10;
+	int connections = 50;
+	int clientThreads = 1;
+	size_t messageSize = 64;
+};
+
+
+/// @brief 一个客户端长连接 发送一条消息 收齐回显后再发送下一条
+class ClientConnection
+{
+public:
+	ClientConnection(EventLoop* loop, int fd, const std::string& message, Histogram* histogram) :
+		_fd{ fd }, _channel(loop, fd), _message{ message }, _received{ 0 }, _histogram{ histogram }
+	{
+		_channel.setReadCallback(std::bind(&ClientConnection::handleRead, this));
+	}
+
+	~ClientConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		sendMessage();
+	}
+
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void sendMessage()
+	{
+		_sent = Clock::now();
+		_received = 0;
+		ssize_t n = ::write(_fd, _message.data(), _message.size());
+		if (n != static_cast<ssize_t>(_message.size()))
+			_errors++;
+	}
+
+	void handleRead()
+	{
+		int savedErrno = 0;
+		ssize_t n = _input.readFd(_fd, &savedErrno);
+		if (n <= 0)
+		{
+			_errors++;
+			_channel.disableAll();
+			return;
+		}
+
+		_received += _input.readableBytes();
+		_input.retrieveAll();
+		if (_received < _message.size())
+			return;
+
+		_completed++;
+		_histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _sent).count());
+		sendMessage();
+	}
+
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::string& _message;
+	size_t _received;
+	Clock::time_point _sent;
+	Histogram* _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+/// @brief 一个客户端线程 拥有自己的EventLoop和一组连接
+class ClientWorker
+{
+public:
+	ClientWorker(const Options& options, int connections) :
+		_thread(nullptr, "client"), _options{ options }, _connections{ connections }, _message(options.messageSize, 'e')
+	{
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop(std::bind(&ClientWorker::connectAll, this));
+	}
+
+	// 在loop线程中关闭所有连接 并返回统计结果
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			for (auto&& conn : _conns)
+			{
+				_completed += conn->completed();
+				_errors += conn->errors();
+			}
+			_conns.clear();
+			done.set_value();
+		});
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void connectAll()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		for (int i = 0; i < _connections; i++)
+		{
+			int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+			{
+				::perror("connect");
+				::close(fd);
+				continue;
+			}
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			_conns.emplace_back(new ClientConnection(_loop, fd, _message, &_histogram));
+		}
+		for (auto&& conn : _conns)
+			conn->start();
+	}
+
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::string _message;
+	std::vector<std::unique_ptr<ClientConnection>> _conns;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+static const char* levelName(LogLevel level)
+{
+	static const char* names[] = { "trace", "debug", "info", "warn", "error", "fatal" };
+	return names[static_cast<int>(level)];
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "l:s:P:d:c:t:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+		{
+			int level = 0;
+			while (level <= static_cast<int>(LogLevel::FATAL) && ::strcasecmp(optarg, levelName(static_cast<LogLevel>(level))) != 0)
+				level++;
+			if (level > static_cast<int>(LogLevel::FATAL))
+			{
+				::fprintf(stderr, "unknown log level %s\n", optarg);
+				::exit(EXIT_FAILURE);
+			}
+			options.logLevel = static_cast<LogLevel>(level);
+			break;
+		}
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 'b': options.messageSize = ::strtoul(optarg, nullptr, 10); break;
+		default:
+			::fprintf(stderr, "usage: %s [-l trace|debug|info|warn|error] [-s server threads] [-P port] [-d seconds] [-c conns] [-t client threads] [-b message bytes]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+/// @brief 等待服务器开始监听后启动客户端 到时间后汇总结果并退出主loop
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::vector<std::unique_ptr<ClientWorker>> workers;
+	for (int i = 0; i < options.clientThreads; i++)
+	{
+		int conns = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+		workers.emplace_back(new ClientWorker(options, conns));
+	}
+
+	Clock::time_point start = Clock::now();
+	for (auto&& worker : workers)
+		worker->start();
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	for (auto&& worker : workers)
+	{
+		std::promise<void> done;
+		worker->stop(done);
+		done.get_future().wait();
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t completed = 0, errors = 0;
+	for (auto&& worker : workers)
+	{
+		total.merge(worker->histogram());
+		completed += worker->completed();
+		errors += worker->errors();
+	}
+
+	::printf("echo_bench: log level %s (compile-time minimum %d), %d connections, %d client threads, %d server threads, %zu-byte messages, %.2fs\n",
+		levelName(options.logLevel), MYMUDUO_MIN_LOG_LEVEL, options.connections, options.clientThreads, options.serverThreads, options.messageSize, elapsed);
+	::printf("  messages: %lu  errors: %lu  messages/s: %.0f\n", completed, errors, completed / elapsed);
+	::printf("  latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+	::fflush(stdout);
+
+	workers.clear();
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(options.logLevel);
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "EchoServer");
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		conn->send(buf);
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * 带负载重启服务端 统计失败的请求数 对比进程交接(Handover)与直接重启
+ * 每个客户端线程维持一个长连接 循环发送请求(分两次写入 中间间隔-g微秒 使服务端常有收了一半的请求)并等待回复
+ * 请求在超时内没有收到完整的回复、连接被断开或连接不上都记为失败 客户端随后重新连接
+ * 服务端进程由本程序以-R参数重新exec启动 回复每个完整的请求
+ * -m handover: 启动新一代服务端 它通过Unix socket从旧进程接收监听socket与空闲连接(连同未处理的输入) 旧进程处理完剩余的连接后退出
+ * -m restart:  先向旧进程发送SIGTERM 等它退出后再启动新一代服务端
+ *
+ * 用法: handover_bench [-m handover|restart] [-a main|multi] [-s 服务端subloop数] [-c 连接数] [-d 秒数] [-n 重启次数]
+ *                      [-g 请求两半之间的间隔(微秒)] [-P 端口] [-p Unix socket路径]
+ */
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "Handover.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t kRequestSize = 64;
+
+struct Options
+{
+	bool handover = true;
+	bool multiAcceptor = false;
+	int serverThreads = 1;
+	int connections = 32;
+	int seconds = 6;
+	int restarts = 2;
+	int gapUs = 200;
+	uint16_t port = 6396;
+	std::string path = "/tmp/mymuduo_handover_bench.sock";
+	int generation = 0;		// 非0时作为第几代服务端运行
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+
+static void onStopSignal(int)
+{
+	g_stop = 1;
+}
+
+
+/// @brief 一代服务端 先尝试从上一代接管 再监听交接请求 交出后处理完剩余的连接就退出
+static int runServer(const Options& options)
+{
+	::signal(SIGTERM, onStopSignal);
+	int gen = options.generation;
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "HandoverServer",
+		options.multiAcceptor ? TcpServer::Option::MultiAcceptor : TcpServer::Option::NoReusePort);
+	std::atomic<int> live{ 0 };
+	server.setConnectionCallback([&live](const TcpConnectionPtr& conn) {
+		if (conn->connected())
+		{
+			live++;
+			conn->setTcpNoDelay(true);
+		}
+		else
+			live--;
+	});
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		while (buf->readableBytes() >= kRequestSize)
+		{
+			conn->send(std::string(buf->peek(), kRequestSize));
+			buf->retrieve(kRequestSize);
+		}
+	});
+	server.setThreadNum(options.serverThreads);
+
+	std::unique_ptr<Handover> session;
+	if (options.handover && gen > 1)
+	{
+		session = Handover::connect(options.path);
+		if (session && !server.receiveListeners(*session))
+			session.reset();
+	}
+	server.start();
+	if (session)
+	{
+		int adopted = server.adoptConnections(*session);
+		::printf("  gen %d: took over listen sockets and %d connections\n", gen, adopted);
+		::fflush(stdout);
+		session.reset();
+	}
+
+	bool draining = false;
+	Clock::time_point drainDeadline;
+	HandoverListener listener(&loop, options.path);
+	listener.setHandoverCallback([&](std::unique_ptr<Handover> handover) {
+		int passed = server.handover(*handover, true);
+		if (passed < 0)
+			return;
+		::printf("  gen %d: handed over %d connections, %d left to drain\n", gen, passed, live.load());
+		::fflush(stdout);
+		draining = true;
+		drainDeadline = Clock::now() + std::chrono::seconds(2);
+	});
+	if (options.handover)
+		listener.listen();
+
+	loop.runEvery(0.01, [&]() {
+		if (g_stop || (draining && (live == 0 || Clock::now() > drainDeadline)))
+			loop.quit();
+	});
+	loop.loop();
+	if (draining && live > 0)
+	{
+		::printf("  gen %d: closing %d connections that did not drain\n", gen, live.load());
+		::fflush(stdout);
+	}
+	return 0;
+}
+
+
+/// @brief 一个客户端线程 一个连接 串行地发送请求
+class Client
+{
+public:
+	explicit Client(const Options& options) : _options{ options } {}
+
+	void run(const std::atomic<bool>& stop)
+	{
+		char request[kRequestSize];
+		::memset(request, 'r', sizeof(request));
+		int fd = -1;
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			if (fd < 0 && (fd = connect()) < 0)
+			{
+				_connectErrors++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			Clock::time_point start = Clock::now();
+			bool ok = ::send(fd, request, kRequestSize / 2, MSG_NOSIGNAL) == kRequestSize / 2;
+			if (ok && _options.gapUs > 0)
+				std::this_thread::sleep_for(std::chrono::microseconds(_options.gapUs));
+			ok = ok && ::send(fd, request + kRequestSize / 2, kRequestSize / 2, MSG_NOSIGNAL) == kRequestSize / 2;
+			ok = ok && readReply(fd);
+			if (ok)
+			{
+				_completed++;
+				_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+			}
+			else
+			{
+				_failed++;
+				::close(fd);
+				fd = -1;
+			}
+		}
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t failed() const { return _failed; }
+	uint64_t connectErrors() const { return _connectErrors; }
+
+private:
+	int connect()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+		{
+			::close(fd);
+			return -1;
+		}
+		int one = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return fd;
+	}
+
+	// 1秒内收齐回复
+	bool readReply(int fd)
+	{
+		char reply[kRequestSize];
+		size_t received = 0;
+		Clock::time_point deadline = Clock::now() + std::chrono::seconds(1);
+		while (received < kRequestSize)
+		{
+			int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+			pollfd pfd = { fd, POLLIN, 0 };
+			if (timeout <= 0 || ::poll(&pfd, 1, timeout) <= 0)
+				return false;
+			ssize_t n = ::read(fd, reply + received, kRequestSize - received);
+			if (n <= 0)
+				return false;
+			received += n;
+		}
+		return true;
+	}
+
+	const Options& _options;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _failed = 0;
+	uint64_t _connectErrors = 0;
+};
+
+
+/// @brief 以-R gen重新exec本程序作为第gen代服务端
+static pid_t spawnServer(char* argv[], int argc, int gen)
+{
+	// 客户端线程已经在运行 fork之后只调用execv 参数在fork之前准备好
+	std::vector<char*> args(argv, argv + argc);
+	std::string flag = "-R";
+	std::string value = std::to_string(gen);
+	args.push_back(flag.data());
+	args.push_back(value.data());
+	args.push_back(nullptr);
+	pid_t pid = ::fork();
+	if (pid == 0)
+	{
+		::execv("/proc/self/exe", args.data());
+		::_exit(127);
+	}
+	return pid;
+}
+
+
+static bool serverReady(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	bool ok = fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0;
+	if (fd >= 0)
+		::close(fd);
+	return ok;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:a:s:c:d:n:g:P:p:R:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': options.handover = ::strcmp(optarg, "restart") != 0; break;
+		case 'a': options.multiAcceptor = ::strcmp(optarg, "multi") == 0; break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'n': options.restarts = ::atoi(optarg); break;
+		case 'g': options.gapUs = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'p': options.path = optarg; break;
+		case 'R': options.generation = ::atoi(optarg); break;
+		default:
+			::fprintf(stderr, "usage: %s [-m handover|restart] [-a main|multi] [-s server threads] [-c connections] [-d seconds] [-n restarts] [-g gap us] [-P port] [-p unix socket path]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	if (options.generation > 0)
+		return runServer(options);
+
+	::printf("handover_bench: %s, %s acceptor, %d server threads, %d connections, %d restarts in %ds\n",
+		options.handover ? "handover" : "restart", options.multiAcceptor ? "per-loop" : "main-loop",
+		options.serverThreads, options.connections, options.restarts, options.seconds);
+	::fflush(stdout);
+
+	int gen = 1;
+	pid_t server = spawnServer(argv, argc, gen);
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+	while (!serverReady(options.port) && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	std::atomic<bool> stop{ false };
+	std::vector<std::unique_ptr<Client>> clients;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < options.connections; i++)
+		clients.emplace_back(new Client(options));
+	Clock::time_point start = Clock::now();
+	for (auto&& client : clients)
+		threads.emplace_back(&Client::run, client.get(), std::cref(stop));
+
+	// 在运行期间均匀地重启
+	for (int i = 1; i <= options.restarts; i++)
+	{
+		std::this_thread::sleep_until(start + std::chrono::milliseconds(options.seconds * 1000 * i / (options.restarts + 1)));
+		Clock::time_point restartStart = Clock::now();
+		pid_t old = server;
+		if (options.handover)
+		{
+			server = spawnServer(argv, argc, ++gen);
+			::waitpid(old, nullptr, 0);
+		}
+		else
+		{
+			::kill(old, SIGTERM);
+			::waitpid(old, nullptr, 0);
+			server = spawnServer(argv, argc, ++gen);
+		}
+		::printf("  restart %d: old server exited after %.1f ms\n", i,
+			std::chrono::duration<double, std::milli>(Clock::now() - restartStart).count());
+		::fflush(stdout);
+	}
+
+	std::this_thread::sleep_until(start + std::chrono::seconds(options.seconds));
+	stop = true;
+	for (auto&& thread : threads)
+		thread.join();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t completed = 0, failed = 0, connectErrors = 0;
+	for (auto&& client : clients)
+	{
+		total.merge(client->histogram());
+		completed += client->completed();
+		failed += client->failed();
+		connectErrors += client->connectErrors();
+	}
+	::printf("  requests: %lu  requests/s: %.0f  failed requests: %lu  failed connects: %lu\n",
+		completed, completed / elapsed, failed, connectErrors);
+	::printf("  latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+	::fflush(stdout);
+
+	::kill(server, SIGTERM);
+	::waitpid(server, nullptr, 0);
+	return failed + connectErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+/*
+ * wrk风格的http压测
+ * 进程内启动HttpServer 再用若干个客户端loop线程维持大量长连接 每个连接闭环发送请求(可选流水线深度)
+ * 统计QPS以及延迟的p50/p99/p999 全部走回环网卡
+ *
+ * 用法: http_bench [-c 连接数] [-t 客户端线程数] [-s 服务端subloop数] [-d 秒数] [-p 流水线深度] [-P 端口] [-b 响应body字节数]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "HttpServer.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int connections = 1000;
+	int clientThreads = 1;
+	int serverThreads = 1;
+	int seconds = 10;
+	int pipeline = 1;
+	uint16_t port = 8090;
+	size_t bodySize = 13;
+};
+
+
+/// @brief 一个客户端长连接 每次发送pipeline个请求 全部响应收齐后再发送下一批
+class ClientConnection
+{
+public:
+	ClientConnection(EventLoop* loop, int fd, const std::string& requests, int pipeline, Histogram* histogram) :
+		_loop{ loop }, _fd{ fd }, _channel(loop, fd), _requests{ requests }, _pipeline{ pipeline },
+		_outstanding{ 0 }, _histogram{ histogram }
+	{
+		_channel.setReadCallback(std::bind(&ClientConnection::handleRead, this));
+	}
+
+	~ClientConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		sendBatch();
+	}
+
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void sendBatch()
+	{
+		_batchStart = Clock::now();
+		_outstanding = _pipeline;
+		// 请求很小 回环上的发送缓冲区不会写满
+		ssize_t n = ::write(_fd, _requests.data(), _requests.size());
+		if (n != static_cast<ssize_t>(_requests.size()))
+			_errors++;
+	}
+
+	void handleRead()
+	{
+		int savedErrno = 0;
+		ssize_t n = _input.readFd(_fd, &savedErrno);
+		if (n <= 0)
+		{
+			_errors++;
+			_channel.disableAll();
+			return;
+		}
+
+		while (_outstanding > 0)
+		{
+			const char* begin = _input.peek();
+			const void* crlf2 = ::memmem(begin, _input.readableBytes(), "\r\n\r\n", 4);
+			if (crlf2 == nullptr)
+				return;
+			size_t headLen = static_cast<const char*>(crlf2) - begin + 4;
+			const char* length = static_cast<const char*>(::memmem(begin, headLen, "Content-Length: ", 16));
+			size_t bodyLen = length ? ::strtoul(length + 16, nullptr, 10) : 0;
+			if (_input.readableBytes() < headLen + bodyLen)
+				return;
+			if (::strncmp(begin, "HTTP/1.1 200", 12) != 0)
+				_errors++;
+			_input.retrieve(headLen + bodyLen);
+
+			auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _batchStart);
+			_histogram->record(latency.count());
+			_completed++;
+			_outstanding--;
+		}
+		sendBatch();
+	}
+
+	EventLoop* _loop;
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::string& _requests;
+	int _pipeline;
+	int _outstanding;
+	Clock::time_point _batchStart;
+	Histogram* _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+/// @brief 一个客户端线程 拥有自己的EventLoop和一组连接
+class ClientWorker
+{
+public:
+	ClientWorker(const Options& options, int connections) :
+		_thread(nullptr, "client"), _options{ options }, _connections{ connections }
+	{
+		for (int i = 0; i < options.pipeline; i++)
+			_requests.append("GET /hello HTTP/1.1\r\nHost: localhost\r\nUser-Agent: http_bench\r\n\r\n");
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop(std::bind(&ClientWorker::connectAll, this));
+	}
+
+	// 在loop线程中关闭所有连接 并返回统计结果
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			for (auto&& conn : _conns)
+			{
+				_completed += conn->completed();
+				_errors += conn->errors();
+			}
+			_conns.clear();
+			done.set_value();
+		});
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void connectAll()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		for (int i = 0; i < _connections; i++)
+		{
+			int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+			{
+				::perror("connect");
+				::close(fd);
+				continue;
+			}
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			_conns.emplace_back(new ClientConnection(_loop, fd, _requests, _options.pipeline, &_histogram));
+		}
+		for (auto&& conn : _conns)
+			conn->start();
+	}
+
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::string _requests;
+	std::vector<std::unique_ptr<ClientConnection>> _conns;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "c:t:s:d:p:P:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'p': options.pipeline = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'b': options.bodySize = ::strtoul(optarg, nullptr, 10); break;
+		default:
+			::fprintf(stderr, "usage: %s [-c conns] [-t client threads] [-s server threads] [-d seconds] [-p pipeline] [-P port] [-b body bytes]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+
+	EventLoop loop;
+	HttpServer server(&loop, InetAddress(options.port), "HttpBench");
+	const std::string body(options.bodySize, 'x');
+	server.setHttpCallback([&body](const HttpRequest& req, HttpResponse* resp) {
+		if (req.path() == "/hello")
+		{
+			resp->setContentType("text/plain");
+			resp->setBody(body);
+		}
+		else
+		{
+			resp->setStatusCode(404);
+		}
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	// 压测控制线程: 等待服务器开始监听后启动客户端 到时间后汇总结果并退出主loop
+	std::thread controller([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		std::vector<std::unique_ptr<ClientWorker>> workers;
+		for (int i = 0; i < options.clientThreads; i++)
+		{
+			int conns = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+			workers.emplace_back(new ClientWorker(options, conns));
+		}
+
+		Clock::time_point start = Clock::now();
+		for (auto&& worker : workers)
+			worker->start();
+		std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+		for (auto&& worker : workers)
+		{
+			std::promise<void> done;
+			worker->stop(done);
+			done.get_future().wait();
+		}
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		Histogram total;
+		uint64_t completed = 0, errors = 0;
+		for (auto&& worker : workers)
+		{
+			total.merge(worker->histogram());
+			completed += worker->completed();
+			errors += worker->errors();
+		}
+
+		::printf("http_bench: %d connections, %d client threads, %d server threads, pipeline %d, %.2fs\n",
+			options.connections, options.clientThreads, options.serverThreads, options.pipeline, elapsed);
+		::printf("  requests: %lu  errors: %lu  requests/s: %.0f\n", completed, errors, completed / elapsed);
+		::printf("  latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+			total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+			total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+		::fflush(stdout);
+
+		workers.clear();
+		loop.quit();
+	});
+
+	loop.loop();
+	controller.join();
+	return 0;
+}
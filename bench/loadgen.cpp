@@ -0,0 +1,522 @@
+/*
+ * 开环负载生成器 按固定速率发送请求 不等待响应 延迟从"按计划应当发送的时间"算起 不存在协调遗漏(coordinated omission)
+ * 闭环客户端在服务端卡顿时会跟着停发 卡顿期间本应发出的请求没有被计入 开环则会把排队时间全部算进延迟
+ * 每个客户端loop(EventLoopThreadPool)各自承担总速率的一份 在自己的连接上轮流发送 同一连接上的响应按顺序对应请求
+ *
+ *     loadgen -m resp -P 6390 -r 50000 -c 50 -t 2 -d 30 -s 64
+ *     loadgen -m http -P 8000 -r 20000 -c 100 -a poisson -o latency.hgrm
+ *     loadgen -m echo -P 6392 -r 10000 -s 16-4096
+ *
+ * 协议(-m): echo 发送负载 等待同样字节数的回显; resp 发送SET key value(负载为0时发送PING); http 发送GET(负载不为0时发送带body的POST)
+ * 负载大小(-s): 64 固定; 16-4096 均匀分布; exp:256 均值为256的指数分布
+ * 到达过程(-a): const 等间隔; poisson 指数分布的间隔
+ *
+ * 用法: loadgen [-m echo|resp|http] [-H 主机] [-P 端口] [-u http路径] [-r 总速率] [-c 连接数] [-t loop线程数] [-d 秒数]
+ *               [-w 预热秒数] [-s 负载大小] [-a const|poisson] [-k resp的key数量] [-o hgrm文件]
+ */
+#include <unistd.h>
+#include <strings.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <random>
+#include <algorithm>
+
+#include "EventLoop.h"
+#include "EventLoopThreadPool.h"
+#include "InetAddress.h"
+#include "TcpClient.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using namespace std::placeholders;
+using Clock = std::chrono::steady_clock;
+
+enum class Protocol
+{
+	Echo,
+	Resp,
+	Http
+};
+
+/// @brief 负载大小的分布
+struct SizeDistribution
+{
+	enum class Kind { Fixed, Uniform, Exponential } kind = Kind::Fixed;
+	size_t min = 64;
+	size_t max = 64;
+	double mean = 64;
+
+	size_t sample(std::mt19937_64& rng) const
+	{
+		switch (kind)
+		{
+		case Kind::Uniform:
+			return std::uniform_int_distribution<size_t>(min, max)(rng);
+		case Kind::Exponential:
+			return std::min<size_t>(static_cast<size_t>(std::exponential_distribution<double>(1.0 / mean)(rng)), max);
+		default:
+			return min;
+		}
+	}
+};
+
+struct Options
+{
+	Protocol protocol = Protocol::Echo;
+	std::string host = "127.0.0.1";
+	uint16_t port = 6392;
+	std::string path = "/";
+	double rate = 10000;
+	int connections = 10;
+	int threads = 1;
+	int seconds = 10;
+	int warmup = 1;
+	SizeDistribution size;
+	bool poisson = false;
+	int keys = 1000;
+	std::string output;
+};
+
+static constexpr double kTickInterval = 0.001;	// 发送调度的节拍 同一节拍内到期的请求一起发出 延迟仍按各自的计划时间计算
+static constexpr size_t kMaxPayload = 16 * 1024 * 1024;
+
+
+/// @brief 解析一条完整的响应 返回其长度 不完整时返回0 ok表示响应是否成功
+static size_t frameResponse(Protocol protocol, const char* data, size_t len, size_t expected, bool* ok)
+{
+	*ok = true;
+	if (protocol == Protocol::Echo)
+		return len >= expected ? expected : 0;
+
+	if (protocol == Protocol::Resp)
+	{
+		const char* crlf = static_cast<const char*>(::memmem(data, len, "\r\n", 2));
+		if (crlf == nullptr)
+			return 0;
+		size_t lineLen = crlf - data + 2;
+		*ok = data[0] != '-';
+		if (data[0] != '$')
+			return lineLen;
+		long bulk = ::strtol(data + 1, nullptr, 10);
+		if (bulk < 0)
+			return lineLen;
+		size_t total = lineLen + bulk + 2;
+		return total <= len ? total : 0;
+	}
+
+	// http: 只支持Content-Length 服务端按请求顺序返回
+	const char* headerEnd = static_cast<const char*>(::memmem(data, len, "\r\n\r\n", 4));
+	if (headerEnd == nullptr)
+		return 0;
+	size_t headerLen = headerEnd - data + 4;
+	size_t bodyLen = 0;
+	for (const char* line = data; line < headerEnd;)
+	{
+		const char* next = static_cast<const char*>(::memmem(line, headerEnd - line + 2, "\r\n", 2));
+		if (::strncasecmp(line, "Content-Length:", 15) == 0)
+			bodyLen = ::strtoul(line + 15, nullptr, 10);
+		line = next + 2;
+	}
+	*ok = len > 9 && data[9] == '2';
+	return headerLen + bodyLen <= len ? headerLen + bodyLen : 0;
+}
+
+
+/// @brief 一个loop中的发送者 拥有自己的连接、随机数和统计 只在所属loop线程中访问
+class Generator : noncopyable
+{
+public:
+	Generator(EventLoop* loop, const Options& options, int connections, double rate, std::atomic<int>* connected, uint64_t seed) :
+		_loop{ loop }, _options{ options }, _rate{ rate }, _connected{ connected }, _rng(seed), _payload(kMaxPayload, 'x')
+	{
+		InetAddress serverAddr(options.port, options.host);
+		for (int i = 0; i < connections; i++)
+		{
+			auto conn = std::make_unique<Connection>();
+			Connection* raw = conn.get();
+			char name[32];
+			::snprintf(name, sizeof(name), "loadgen%d", i);
+			conn->client.reset(new TcpClient(loop, serverAddr, name));
+			conn->client->setConnectionCallback(std::bind(&Generator::onConnection, this, raw, _1));
+			conn->client->setMessageCallback(std::bind(&Generator::onMessage, this, raw, _1, _2));
+			_conns.push_back(std::move(conn));
+		}
+	}
+
+	void connect()
+	{
+		for (auto& conn : _conns)
+			conn->client->connect();
+	}
+
+	// 以下在loop线程中调用
+	void start(Clock::time_point start, Clock::time_point warmupEnd)
+	{
+		_next = start;
+		_warmupEnd = warmupEnd;
+		_running = true;
+		_tickTimer = _loop->runEvery(kTickInterval, std::bind(&Generator::tick, this));
+		tick();
+	}
+
+	void stop()
+	{
+		_running = false;
+		_loop->cancel(_tickTimer);
+	}
+
+	// 停止后仍未收到响应的请求按截止时间计入延迟 不能因为没等到就忽略
+	// 连接关闭前换回默认回调 之后到达的数据不再访问已经释放的Connection
+	void finish()
+	{
+		Clock::time_point now = Clock::now();
+		for (auto& conn : _conns)
+		{
+			if (conn->conn)
+			{
+				conn->conn->setConnectionCallback(defaultConnectionCallback);
+				conn->conn->setMessageCallback(defaultMessageCallback);
+			}
+			for (const Pending& pending : conn->pending)
+			{
+				_unfinished++;
+				if (pending.intended >= _warmupEnd)
+					_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - pending.intended).count());
+			}
+			conn->pending.clear();
+		}
+		_conns.clear();
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t sent() const { return _sent; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+	uint64_t unfinished() const { return _unfinished; }
+	double maxLagMs() const { return _maxLag / 1e6; }
+
+private:
+	struct Pending
+	{
+		Clock::time_point intended;
+		size_t expected;	// echo需要收到的字节数
+	};
+
+	struct Connection
+	{
+		std::unique_ptr<TcpClient> client;
+		TcpConnectionPtr conn;
+		std::deque<Pending> pending;
+	};
+
+	void onConnection(Connection* conn, const TcpConnectionPtr& tcpConn)
+	{
+		if (tcpConn->connected())
+		{
+			tcpConn->setTcpNoDelay(true);
+			conn->conn = tcpConn;
+			(*_connected)++;
+		}
+		else
+		{
+			conn->conn.reset();
+			if (_running)
+				_errors += conn->pending.size() + 1;
+			conn->pending.clear();
+		}
+	}
+
+	void onMessage(Connection* conn, const TcpConnectionPtr&, Buffer* buf)
+	{
+		Clock::time_point now = Clock::now();
+		while (!conn->pending.empty() && buf->readableBytes() > 0)
+		{
+			const Pending& pending = conn->pending.front();
+			bool ok = true;
+			size_t len = frameResponse(_options.protocol, buf->peek(), buf->readableBytes(), pending.expected, &ok);
+			if (len == 0)
+				break;
+			buf->retrieve(len);
+			if (ok)
+				_completed++;
+			else
+				_errors++;
+			if (pending.intended >= _warmupEnd)
+				_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - pending.intended).count());
+			conn->pending.pop_front();
+		}
+		if (conn->pending.empty())
+			buf->retrieveAll();
+	}
+
+	void tick()
+	{
+		if (!_running)
+			return;
+		Clock::time_point now = Clock::now();
+		if (_next <= now)
+			_maxLag = std::max<int64_t>(_maxLag, std::chrono::duration_cast<std::chrono::nanoseconds>(now - _next).count());
+
+		// 把计划时间已到的请求全部发出 即使服务端还没有回复之前的请求
+		while (_next <= now)
+		{
+			send(_next);
+			double gap = _options.poisson ? std::exponential_distribution<double>(_rate)(_rng) : 1.0 / _rate;
+			_next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap));
+		}
+	}
+
+	void send(Clock::time_point intended)
+	{
+		Connection* conn = _conns[_nextConn].get();
+		_nextConn = (_nextConn + 1) % _conns.size();
+		_sent++;
+		if (!conn->conn)
+		{
+			_errors++;
+			return;
+		}
+
+		size_t size = std::min(_options.size.sample(_rng), kMaxPayload);
+		_output.retrieveAll();
+		char header[256];
+		int n = 0;
+		switch (_options.protocol)
+		{
+		case Protocol::Echo:
+			_output.append(_payload.data(), std::max<size_t>(size, 1));
+			size = std::max<size_t>(size, 1);
+			break;
+		case Protocol::Resp:
+			if (size == 0)
+			{
+				_output.append("*1\r\n$4\r\nPING\r\n", 14);
+			}
+			else
+			{
+				char key[32];
+				int keyLen = ::snprintf(key, sizeof(key), "key:%d", static_cast<int>(_rng() % _options.keys));
+				n = ::snprintf(header, sizeof(header), "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n", keyLen, key, size);
+				_output.append(header, n);
+				_output.append(_payload.data(), size);
+				_output.append("\r\n", 2);
+			}
+			break;
+		case Protocol::Http:
+			if (size == 0)
+				n = ::snprintf(header, sizeof(header), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", _options.path.c_str(), _options.host.c_str());
+			else
+				n = ::snprintf(header, sizeof(header), "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Length: %zu\r\n\r\n",
+					_options.path.c_str(), _options.host.c_str(), size);
+			_output.append(header, n);
+			if (size > 0)
+				_output.append(_payload.data(), size);
+			break;
+		}
+		conn->pending.push_back(Pending{ intended, size });
+		conn->conn->send(&_output);
+	}
+
+	EventLoop* _loop;
+	const Options& _options;
+	double _rate;
+	std::atomic<int>* _connected;
+	std::mt19937_64 _rng;
+	const std::string _payload;
+	std::vector<std::unique_ptr<Connection>> _conns;
+	size_t _nextConn = 0;
+	Buffer _output;
+
+	bool _running = false;
+	TimerId _tickTimer;
+	Clock::time_point _next;
+	Clock::time_point _warmupEnd;
+	int64_t _maxLag = 0;
+
+	Histogram _histogram;
+	uint64_t _sent = 0;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+	uint64_t _unfinished = 0;
+};
+
+
+/// @brief 在loop线程中执行func并等待其完成
+static void runInLoopAndWait(EventLoop* loop, const std::function<void()>& func)
+{
+	std::promise<void> done;
+	loop->runInLoop([&func, &done]() {
+		func();
+		done.set_value();
+	});
+	done.get_future().wait();
+}
+
+
+static SizeDistribution parseSize(const char* arg)
+{
+	SizeDistribution size;
+	if (::strncmp(arg, "exp:", 4) == 0)
+	{
+		size.kind = SizeDistribution::Kind::Exponential;
+		size.mean = ::atof(arg + 4);
+		size.min = 0;
+		size.max = kMaxPayload;
+	}
+	else if (const char* dash = ::strchr(arg, '-'))
+	{
+		size.kind = SizeDistribution::Kind::Uniform;
+		size.min = ::strtoul(arg, nullptr, 10);
+		size.max = std::max(size.min, static_cast<size_t>(::strtoul(dash + 1, nullptr, 10)));
+	}
+	else
+	{
+		size.min = size.max = ::strtoul(arg, nullptr, 10);
+		size.mean = static_cast<double>(size.min);
+	}
+	return size;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:H:P:u:r:c:t:d:w:s:a:k:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			if (::strcmp(optarg, "resp") == 0)
+				options.protocol = Protocol::Resp;
+			else if (::strcmp(optarg, "http") == 0)
+				options.protocol = Protocol::Http;
+			else
+				options.protocol = Protocol::Echo;
+			break;
+		case 'H': options.host = optarg; break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'u': options.path = optarg; break;
+		case 'r': options.rate = ::atof(optarg); break;
+		case 'c': options.connections = std::max(1, ::atoi(optarg)); break;
+		case 't': options.threads = std::max(1, ::atoi(optarg)); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'w': options.warmup = ::atoi(optarg); break;
+		case 's': options.size = parseSize(optarg); break;
+		case 'a': options.poisson = ::strcmp(optarg, "poisson") == 0; break;
+		case 'k': options.keys = std::max(1, ::atoi(optarg)); break;
+		case 'o': options.output = optarg; break;
+		default:
+			::fprintf(stderr, "usage: %s [-m echo|resp|http] [-H host] [-P port] [-u path] [-r rate] [-c conns] [-t threads] [-d seconds] "
+				"[-w warmup seconds] [-s size|min-max|exp:mean] [-a const|poisson] [-k keys] [-o file.hgrm]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	options.threads = std::min(options.threads, options.connections);
+	return options;
+}
+
+
+/// @brief 建立全部连接后同时开始按计划发送 到时间后停止发送 再等待一小段时间收取在途的响应
+static void runGenerators(const Options& options, EventLoop* baseLoop, const std::vector<EventLoop*>& loops)
+{
+	std::atomic<int> connected{ 0 };
+	std::vector<std::unique_ptr<Generator>> generators;
+	for (size_t i = 0; i < loops.size(); i++)
+	{
+		int conns = options.connections / static_cast<int>(loops.size()) + (static_cast<int>(i) < options.connections % static_cast<int>(loops.size()) ? 1 : 0);
+		generators.emplace_back(new Generator(loops[i], options, conns, options.rate / loops.size(), &connected, 12345 + i));
+		generators.back()->connect();
+	}
+
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(10);
+	while (connected < options.connections && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (connected < options.connections)
+		::fprintf(stderr, "only %d of %d connections established\n", connected.load(), options.connections);
+
+	Clock::time_point start = Clock::now() + std::chrono::milliseconds(10);
+	Clock::time_point warmupEnd = start + std::chrono::seconds(options.warmup);
+	for (size_t i = 0; i < loops.size(); i++)
+	{
+		Generator* generator = generators[i].get();
+		loops[i]->runInLoop([generator, start, warmupEnd]() { generator->start(start, warmupEnd); });
+	}
+	std::this_thread::sleep_until(warmupEnd + std::chrono::seconds(options.seconds));
+
+	for (size_t i = 0; i < loops.size(); i++)
+		runInLoopAndWait(loops[i], [&generators, i]() { generators[i]->stop(); });
+	double elapsed = std::chrono::duration<double>(Clock::now() - warmupEnd).count();
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	Histogram total;
+	uint64_t sent = 0, completed = 0, errors = 0, unfinished = 0;
+	double maxLag = 0;
+	for (size_t i = 0; i < loops.size(); i++)
+	{
+		runInLoopAndWait(loops[i], [&, i]() {
+			Generator* generator = generators[i].get();
+			generator->finish();
+			total.merge(generator->histogram());
+			sent += generator->sent();
+			completed += generator->completed();
+			errors += generator->errors();
+			unfinished += generator->unfinished();
+			maxLag = std::max(maxLag, generator->maxLagMs());
+			generators[i].reset();
+		});
+	}
+
+	static const char* protocols[] = { "echo", "resp", "http" };
+	::printf("loadgen: %s %s:%u, target %.0f req/s (%s arrivals), %d connections, %d threads, %ds after %ds warmup\n",
+		protocols[static_cast<int>(options.protocol)], options.host.c_str(), options.port, options.rate,
+		options.poisson ? "poisson" : "constant", options.connections, options.threads, options.seconds, options.warmup);
+	::printf("  sent: %lu  completed: %lu  errors: %lu  unfinished: %lu  achieved: %.0f req/s\n",
+		sent, completed, errors, unfinished, total.count() / elapsed);
+	::printf("  latency from intended send time(us): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  p9999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(90) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.percentile(99.99) / 1000.0, total.max() / 1000.0);
+	if (maxLag > 10.0)
+		::printf("  warning: the generator fell behind its schedule by up to %.1f ms, add threads (-t) or lower the rate\n", maxLag);
+
+	if (!options.output.empty())
+	{
+		FILE* out = ::fopen(options.output.c_str(), "w");
+		if (out)
+		{
+			total.writePercentileDistribution(out, 1e6);
+			::fclose(out);
+			::printf("  percentile distribution (ms) written to %s\n", options.output.c_str());
+		}
+	}
+	::fflush(stdout);
+	baseLoop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	EventLoop loop;
+	EventLoopThreadPool pool(&loop, "loadgen");
+	pool.setThreadNum(options.threads);
+	pool.start(EventLoopThreadPool::ThreadInitCallback());
+
+	std::thread controller(runGenerators, std::cref(options), &loop, pool.getAllLoops());
+	loop.loop();
+	controller.join();
+	return 0;
+}
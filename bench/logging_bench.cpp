@@ -0,0 +1,139 @@
+/*
+ * 日志吞吐与调用方延迟压测
+ * 多个线程同时通过LOG_INFO写日志 统计每秒日志条数以及每次LOG_INFO在调用线程上花费的时间
+ *     -o async  AsyncLogging双缓冲异步写入滚动文件(默认)
+ *     -o sync   在调用线程中加锁直接写入同一种滚动文件 对比同步写文件的代价
+ *     -o null   只格式化不输出 作为格式化本身开销的基线
+ *
+ * 用法: logging_bench [-o async|sync|null] [-t 线程数] [-n 每线程日志条数] [-f 日志目录] [-r 滚动大小MB] [-b 最大缓冲区数] [-D 丢弃最新]
+ */
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "Logger.h"
+#include "LogFile.h"
+#include "AsyncLogging.h"
+#include "Histogram.h"
+
+using namespace std::placeholders;
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	std::string output = "async";
+	int threads = 4;
+	int lines = 1000000;
+	std::string dir = "/tmp";
+	off_t rollSize = 512 * 1024 * 1024;
+	size_t maxBuffers = 16;
+	AsyncLogging::DropPolicy policy = AsyncLogging::DropPolicy::DropOldest;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "o:t:n:f:r:b:D")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o': options.output = optarg; break;
+		case 't': options.threads = ::atoi(optarg); break;
+		case 'n': options.lines = ::atoi(optarg); break;
+		case 'f': options.dir = optarg; break;
+		case 'r': options.rollSize = static_cast<off_t>(::atol(optarg)) * 1024 * 1024; break;
+		case 'b': options.maxBuffers = ::strtoul(optarg, nullptr, 10); break;
+		case 'D': options.policy = AsyncLogging::DropPolicy::DropNewest; break;
+		default:
+			::fprintf(stderr, "usage: %s [-o async|sync|null] [-t threads] [-n lines per thread] [-f dir] [-r roll MB] [-b max buffers] [-D drop newest]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	if (options.output != "async" && options.output != "sync" && options.output != "null")
+	{
+		::fprintf(stderr, "unknown output %s\n", options.output.c_str());
+		::exit(EXIT_FAILURE);
+	}
+	return options;
+}
+
+
+/// @brief 每个线程写lines条日志 每条都记录LOG_INFO本身的耗时
+static void writeLogs(int id, int lines, Histogram* histogram)
+{
+	for (int i = 0; i < lines; i++)
+	{
+		Clock::time_point start = Clock::now();
+		LOG_INFO("logging_bench thread %d line %d abcdefghijklmnopqrstuvwxyz 0123456789\n", id, i);
+		histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	std::string basename = options.dir + "/logging_bench";
+
+	std::unique_ptr<AsyncLogging> async;
+	std::unique_ptr<LogFile> file;
+	std::mutex fileMutex;
+	if (options.output == "async")
+	{
+		async.reset(new AsyncLogging(basename, options.rollSize, 3, options.maxBuffers, options.policy));
+		async->start();
+		Logger::instance().setOutput(std::bind(&AsyncLogging::append, async.get(), _1, _2), std::bind(&AsyncLogging::flush, async.get()));
+	}
+	else if (options.output == "sync")
+	{
+		file.reset(new LogFile(basename, options.rollSize));
+		Logger::instance().setOutput([&file, &fileMutex](const char* msg, size_t len) {
+			std::lock_guard<std::mutex> lock(fileMutex);
+			file->append(msg, len);
+		}, [&file, &fileMutex]() {
+			std::lock_guard<std::mutex> lock(fileMutex);
+			file->flush();
+		});
+	}
+	else
+	{
+		Logger::instance().setOutput([](const char*, size_t) {}, []() {});
+	}
+
+	std::vector<Histogram> histograms(options.threads);
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < options.threads; i++)
+		threads.emplace_back(writeLogs, i, options.lines, &histograms[i]);
+	for (auto& thread : threads)
+		thread.join();
+	double callerElapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// 异步后端写完所有日志才算结束
+	Logger::instance().flush();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	uint64_t dropped = async ? async->droppedBytes() : 0;
+	if (async)
+		async->stop();
+
+	Histogram total;
+	for (auto& histogram : histograms)
+		total.merge(histogram);
+	uint64_t lines = static_cast<uint64_t>(options.threads) * options.lines;
+
+	::printf("logging_bench: output %s, %d threads, %d lines per thread\n", options.output.c_str(), options.threads, options.lines);
+	::printf("  lines/s: %.0f (callers done in %.3fs, all written in %.3fs)  dropped bytes: %lu\n",
+		lines / elapsed, callerElapsed, elapsed, dropped);
+	::printf("  caller latency(ns): mean %.0f  p50 %lu  p99 %lu  p999 %lu  max %lu\n",
+		total.mean(), total.percentile(50), total.percentile(99), total.percentile(99.9), total.max());
+	return 0;
+}
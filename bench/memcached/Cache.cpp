@@ -0,0 +1,252 @@
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "Cache.h"
+
+static constexpr size_t kInitialBuckets = 1024;
+
+static size_t alignUp(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static bool expired(const Cache::Item* item, uint32_t now)
+{
+	return item->exptime != 0 && item->exptime <= now;
+}
+
+
+Cache::Cache(size_t memoryLimit, double factor) :
+	_memoryLimit{ memoryLimit }, _memoryUsed{ 0 }, _buckets(kInitialBuckets, nullptr), _nextCas{ 0 }
+{
+	// 最小的chunk能放下item头部和几十字节的key+value 之后按factor递增 最大的class一个chunk就是一整页
+	size_t size = alignUp(sizeof(Item) + 48);
+	while (size <= kPageSize / 2)
+	{
+		_slabs.push_back(SlabClass{ size });
+		size = alignUp(static_cast<size_t>(size * factor));
+	}
+	_slabs.push_back(SlabClass{ kPageSize });
+}
+
+
+Cache::~Cache()
+{
+	for (char* page : _pages)
+		::free(page);
+}
+
+
+int Cache::slabClassOf(size_t itemSize) const
+{
+	auto it = std::lower_bound(_slabs.begin(), _slabs.end(), itemSize,
+		[](const SlabClass& slab, size_t size) { return slab.chunkSize < size; });
+	return static_cast<int>(it - _slabs.begin());
+}
+
+
+bool Cache::newPage(SlabClass& slab)
+{
+	if (_memoryUsed + kPageSize > _memoryLimit)
+		return false;
+	char* page = static_cast<char*>(::malloc(kPageSize));
+	if (page == nullptr)
+		return false;
+
+	_pages.push_back(page);
+	_memoryUsed += kPageSize;
+	_stats.pages++;
+
+	const uint8_t slabClass = static_cast<uint8_t>(&slab - _slabs.data());
+	const size_t chunks = kPageSize / slab.chunkSize;
+	for (size_t i = 0; i < chunks; i++)
+	{
+		Item* item = reinterpret_cast<Item*>(page + i * slab.chunkSize);
+		item->slabClass = slabClass;
+		item->linked = false;
+		item->next = slab.freeList;
+		slab.freeList = item;
+	}
+	return true;
+}
+
+
+Cache::Item* Cache::find(std::string_view key, uint64_t hash, uint32_t now)
+{
+	for (Item* item = *bucketOf(hash); item != nullptr; item = item->hashNext)
+	{
+		if (item->hash == hash && item->keyView() == key)
+		{
+			if (expired(item, now))
+			{
+				unlinkAndFree(item);
+				return nullptr;
+			}
+			lruUnlink(item);
+			lruPushFront(item);
+			return item;
+		}
+	}
+	return nullptr;
+}
+
+
+Cache::Item* Cache::allocate(std::string_view key, uint64_t hash, uint32_t flags, uint32_t exptime, size_t valueLength, uint32_t now)
+{
+	const size_t total = sizeof(Item) + key.size() + valueLength;
+	if (key.size() > kMaxKeyLength || total > kPageSize)
+		return nullptr;
+
+	SlabClass& slab = _slabs[slabClassOf(total)];
+	if (slab.freeList == nullptr && !newPage(slab))
+	{
+		// 内存已达上限 淘汰本class中最久未使用的item
+		Item* victim = slab.tail;
+		if (victim == nullptr)
+			return nullptr;
+		if (!expired(victim, now))
+			_stats.evictions++;
+		unlinkAndFree(victim);
+	}
+
+	Item* item = slab.freeList;
+	slab.freeList = item->next;
+	item->prev = nullptr;
+	item->next = nullptr;
+	item->hashNext = nullptr;
+	item->hash = hash;
+	item->cas = 0;
+	item->exptime = exptime;
+	item->flags = flags;
+	item->valueLength = static_cast<uint32_t>(valueLength);
+	item->keyLength = static_cast<uint8_t>(key.size());
+	item->linked = false;
+	::memcpy(item->key(), key.data(), key.size());
+	return item;
+}
+
+
+void Cache::link(Item* item)
+{
+	Item** bucket = bucketOf(item->hash);
+	for (Item* old = *bucket; old != nullptr; old = old->hashNext)
+	{
+		if (old->hash == item->hash && old->keyView() == item->keyView())
+		{
+			unlinkAndFree(old);
+			break;
+		}
+	}
+
+	bucket = bucketOf(item->hash);
+	item->hashNext = *bucket;
+	*bucket = item;
+	lruPushFront(item);
+	item->linked = true;
+	item->cas = ++_nextCas;
+	_stats.items++;
+	_stats.bytes += item->keyLength + item->valueLength;
+
+	if (_stats.items > _buckets.size() + _buckets.size() / 2)
+		grow();
+}
+
+
+void Cache::remove(Item* item)
+{
+	unlinkAndFree(item);
+}
+
+
+void Cache::release(Item* item)
+{
+	SlabClass& slab = _slabs[item->slabClass];
+	item->next = slab.freeList;
+	slab.freeList = item;
+}
+
+
+void Cache::flush()
+{
+	for (SlabClass& slab : _slabs)
+	{
+		while (slab.head != nullptr)
+			unlinkAndFree(slab.head);
+	}
+}
+
+
+void Cache::lruUnlink(Item* item)
+{
+	SlabClass& slab = _slabs[item->slabClass];
+	if (item->prev != nullptr)
+		item->prev->next = item->next;
+	else
+		slab.head = item->next;
+	if (item->next != nullptr)
+		item->next->prev = item->prev;
+	else
+		slab.tail = item->prev;
+	item->prev = nullptr;
+	item->next = nullptr;
+}
+
+
+void Cache::lruPushFront(Item* item)
+{
+	SlabClass& slab = _slabs[item->slabClass];
+	item->prev = nullptr;
+	item->next = slab.head;
+	if (slab.head != nullptr)
+		slab.head->prev = item;
+	slab.head = item;
+	if (slab.tail == nullptr)
+		slab.tail = item;
+}
+
+
+void Cache::hashUnlink(Item* item)
+{
+	for (Item** p = bucketOf(item->hash); *p != nullptr; p = &(*p)->hashNext)
+	{
+		if (*p == item)
+		{
+			*p = item->hashNext;
+			break;
+		}
+	}
+	item->hashNext = nullptr;
+}
+
+
+void Cache::grow()
+{
+	std::vector<Item*> buckets(_buckets.size() * 2, nullptr);
+	const size_t mask = buckets.size() - 1;
+	for (Item* head : _buckets)
+	{
+		while (head != nullptr)
+		{
+			Item* next = head->hashNext;
+			head->hashNext = buckets[head->hash & mask];
+			buckets[head->hash & mask] = head;
+			head = next;
+		}
+	}
+	_buckets.swap(buckets);
+}
+
+
+void Cache::unlinkAndFree(Item* item)
+{
+	if (item->linked)
+	{
+		hashUnlink(item);
+		lruUnlink(item);
+		item->linked = false;
+		_stats.items--;
+		_stats.bytes -= item->keyLength + item->valueLength;
+	}
+	release(item);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "noncopyable.h"
+
+/// @brief 单个分片的缓存 只在分片所属的loop线程中访问 不加锁
+/// 内存按1MB的页向系统申请 每页切分成固定大小的chunk归入某个slab class 每个class有自己的空闲链表和LRU链表
+/// 内存达到上限后 从同一class的LRU尾部淘汰 与memcached的做法一致
+class Cache : public noncopyable
+{
+public:
+	static constexpr size_t kPageSize = 1024 * 1024;
+	static constexpr size_t kMaxKeyLength = 250;
+
+	/// @brief item头部之后紧跟key和value 整个item占用一个chunk
+	struct Item
+	{
+		Item* prev;			// LRU链表 靠近头部的是最近使用的
+		Item* next;
+		Item* hashNext;		// 哈希桶链表
+		uint64_t hash;
+		uint64_t cas;
+		uint32_t exptime;	// 绝对时间(秒) 0表示永不过期
+		uint32_t flags;
+		uint32_t valueLength;
+		uint8_t keyLength;
+		uint8_t slabClass;
+		bool linked;		// 是否已经在哈希表和LRU中
+
+		char* key() { return reinterpret_cast<char*>(this + 1); }
+		char* value() { return key() + keyLength; }
+		std::string_view keyView() { return std::string_view(key(), keyLength); }
+		std::string_view valueView() { return std::string_view(value(), valueLength); }
+	};
+
+	struct Stats
+	{
+		uint64_t items = 0;
+		uint64_t bytes = 0;			// 所有item的key+value字节数
+		uint64_t evictions = 0;		// 未过期就被淘汰的item数
+		uint64_t pages = 0;
+	};
+
+	// memoryLimit为本分片最多申请的页内存 factor为相邻slab class的chunk大小之比
+	explicit Cache(size_t memoryLimit, double factor = 1.25);
+	~Cache();
+
+	// 查找未过期的item 命中时移动到LRU头部 过期的item在这里被惰性删除
+	Item* find(std::string_view key, uint64_t hash, uint32_t now);
+
+	// 为key分配一个新item 调用者写入value后再调用link 内存不足或item过大时返回nullptr
+	Item* allocate(std::string_view key, uint64_t hash, uint32_t flags, uint32_t exptime, size_t valueLength, uint32_t now);
+	// 把新item加入哈希表和LRU 替换同key的旧item
+	void link(Item* item);
+	// 删除item并归还内存
+	void remove(Item* item);
+	// 释放一个分配后没有link的item
+	void release(Item* item);
+	// 删除所有item
+	void flush();
+
+	const Stats& stats() const { return _stats; }
+
+private:
+	struct SlabClass
+	{
+		size_t chunkSize;
+		Item* freeList = nullptr;
+		Item* head = nullptr;	// LRU头部
+		Item* tail = nullptr;	// LRU尾部 最先被淘汰
+	};
+
+	int slabClassOf(size_t itemSize) const;
+	// 给slab class申请一页内存并切分 达到内存上限时返回false
+	bool newPage(SlabClass& slab);
+
+	void lruUnlink(Item* item);
+	void lruPushFront(Item* item);
+
+	Item** bucketOf(uint64_t hash) { return &_buckets[hash & (_buckets.size() - 1)]; }
+	void hashUnlink(Item* item);
+	// 负载因子超过1.5时哈希表扩容一倍
+	void grow();
+
+	// 从哈希表和LRU中摘除 并放回空闲链表
+	void unlinkAndFree(Item* item);
+
+	size_t _memoryLimit;
+	size_t _memoryUsed;
+	std::vector<SlabClass> _slabs;
+	std::vector<char*> _pages;
+	std::vector<Item*> _buckets;
+	uint64_t _nextCas;
+	Stats _stats;
+};
@@ -0,0 +1,1027 @@
+#include <any>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+#include "MemcacheServer.h"
+#include "Cache.h"
+#include "EventLoop.h"
+#include "EventLoopThreadPool.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+
+/// @brief 命令行的最大长度 超过后认为客户端出错并断开连接
+static constexpr size_t kMaxLineLength = 2048;
+/// @brief 相对过期时间的上限 超过则视为unix时间戳 与memcached一致
+static constexpr int64_t kRelativeExptimeLimit = 60 * 60 * 24 * 30;
+
+/// @brief 每个loop线程复用的发送缓冲 一次读事件内本地就能完成的回复直接写入这里 最后只发送一次
+thread_local Buffer t_output;
+/// @brief 命令行切分出的参数 容量在线程内复用
+thread_local std::vector<std::string_view> t_tokens;
+/// @brief append/prepend时暂存旧的value 分配新item可能会淘汰旧item
+thread_local std::string t_scratch;
+
+
+enum class Command : uint8_t
+{
+	Get,
+	Gets,
+	Set,
+	Add,
+	Replace,
+	Append,
+	Prepend,
+	Cas,
+	Delete,
+	Incr,
+	Decr,
+	Touch,
+	MetaGet,
+	MetaSet,
+	MetaDelete,
+	FlushAll,
+	Stats
+};
+
+
+/// @brief 一个需要在key所属分片上执行的请求 视图指向连接的接收缓冲区 转发时改为指向ForwardedRequest自己的拷贝
+struct Request
+{
+	Command command;
+	std::string_view key;
+	std::string_view value;
+	std::string_view metaFlags;	// meta命令key(ms为datalen)之后的flag原文
+	uint64_t hash = 0;
+	uint64_t number = 0;		// cas的版本号 incr/decr的增量
+	uint32_t flags = 0;
+	uint32_t exptime = 0;		// 已经换算成绝对时间
+	bool noreply = false;
+};
+
+
+struct ForwardedRequest
+{
+	Request request;
+	std::string key;
+	std::string value;
+	std::string metaFlags;
+	TcpConnectionPtr conn;
+	uint64_t round;
+	size_t slot;
+	std::string reply;
+};
+
+
+/// @brief 一个来源分片发往一个目标分片的一批请求 目标分片执行后原样送回 回复写在每个请求里
+struct ForwardBatch
+{
+	Shard* origin;
+	std::vector<ForwardedRequest> requests;
+};
+
+
+/// @brief 一个subloop拥有的缓存分片 除构造外所有成员只在loop线程中访问
+struct Shard
+{
+	Shard(EventLoop* loop, int index, size_t shardCount, size_t memoryLimit) :
+		loop{ loop }, index{ index }, cache(memoryLimit), outbox(shardCount)
+	{
+	}
+
+	EventLoop* loop;
+	int index;
+	Cache cache;
+	std::vector<std::shared_ptr<ForwardBatch>> outbox;	// 本轮待发往各个分片的批次 按分片下标
+	bool flushScheduled = false;
+
+	uint64_t cmdGet = 0;
+	uint64_t getHits = 0;
+	uint64_t getMisses = 0;
+	uint64_t cmdSet = 0;
+	uint64_t forwarded = 0;	// 本分片的连接转发出去的请求数
+	uint64_t batches = 0;	// 发出的批次数
+};
+
+
+/// @brief 保存在TcpConnection的context中的连接状态 只在连接所属的loop线程中访问
+struct MemcacheContext
+{
+	Shard* home = nullptr;
+	uint64_t round = 0;
+	int pending = 0;			// 本轮还没有返回的转发请求数
+	bool closing = false;
+	// 本轮第一条转发请求及之后的回复 按请求顺序 本地回复可以合并进最后一个本地槽位
+	std::vector<std::string> slots;
+	size_t slotCount = 0;
+	bool lastSlotLocal = false;
+};
+
+
+template <typename Out>
+static void put(Out* out, std::string_view str)
+{
+	out->append(str.data(), str.size());
+}
+
+template <typename Out>
+static void putNumber(Out* out, uint64_t value)
+{
+	char digits[24];
+	char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+	out->append(digits, end - digits);
+}
+
+template <typename T>
+static bool parseNumber(std::string_view str, T* value)
+{
+	std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), *value);
+	return result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+static uint32_t absoluteExptime(int64_t exptime, uint32_t now)
+{
+	if (exptime == 0)
+		return 0;
+	if (exptime < 0)
+		return 1;	// 立即过期
+	if (exptime > kRelativeExptimeLimit)
+		return static_cast<uint32_t>(exptime);
+	return now + static_cast<uint32_t>(exptime);
+}
+
+static uint64_t hashKey(std::string_view key)
+{
+	return std::hash<std::string_view>()(key);
+}
+
+
+/// @brief meta命令的flag 如 mg foo v f t k Oopaque
+struct MetaFlags
+{
+	bool value = false;
+	bool clientFlags = false;
+	bool size = false;
+	bool ttl = false;
+	bool cas = false;
+	bool key = false;
+	bool quiet = false;
+	std::string_view opaque;
+	bool hasNewTtl = false;
+	int64_t newTtl = 0;
+	uint32_t newClientFlags = 0;
+	char mode = 'S';
+};
+
+static MetaFlags parseMetaFlags(std::string_view str)
+{
+	MetaFlags meta;
+	while (!str.empty())
+	{
+		size_t space = str.find(' ');
+		std::string_view token = str.substr(0, space);
+		str = space == std::string_view::npos ? std::string_view() : str.substr(space + 1);
+		if (token.empty())
+			continue;
+
+		std::string_view arg = token.substr(1);
+		switch (token[0])
+		{
+		case 'v': meta.value = true; break;
+		case 'f': meta.clientFlags = true; break;
+		case 's': meta.size = true; break;
+		case 't': meta.ttl = true; break;
+		case 'c': meta.cas = true; break;
+		case 'k': meta.key = true; break;
+		case 'q': meta.quiet = true; break;
+		case 'O': meta.opaque = arg; break;
+		case 'T': meta.hasNewTtl = parseNumber(arg, &meta.newTtl); break;
+		case 'F': parseNumber(arg, &meta.newClientFlags); break;
+		case 'M': meta.mode = arg.empty() ? 'S' : arg[0]; break;
+		default: break;
+		}
+	}
+	return meta;
+}
+
+template <typename Out>
+static void putMetaReturn(Out* out, const MetaFlags& meta, Cache::Item* item, uint32_t now)
+{
+	if (item != nullptr)
+	{
+		if (meta.clientFlags)
+		{
+			put(out, " f");
+			putNumber(out, item->flags);
+		}
+		if (meta.size)
+		{
+			put(out, " s");
+			putNumber(out, item->valueLength);
+		}
+		if (meta.ttl)
+		{
+			if (item->exptime == 0)
+				put(out, " t-1");
+			else
+			{
+				put(out, " t");
+				putNumber(out, item->exptime > now ? item->exptime - now : 0);
+			}
+		}
+		if (meta.cas)
+		{
+			put(out, " c");
+			putNumber(out, item->cas);
+		}
+		if (meta.key)
+		{
+			put(out, " k");
+			put(out, item->keyView());
+		}
+	}
+	if (!meta.opaque.empty())
+	{
+		put(out, " O");
+		put(out, meta.opaque);
+	}
+	put(out, "\r\n");
+}
+
+
+enum class StoreResult
+{
+	Stored,
+	NotStored,
+	Exists,
+	NotFound,
+	TooLarge,
+	OutOfMemory
+};
+
+/// @brief set/add/replace/append/prepend/cas的公共实现
+static StoreResult store(Shard* shard, Command mode, const Request& request, uint32_t now, Cache::Item** stored)
+{
+	Cache& cache = shard->cache;
+	shard->cmdSet++;
+	Cache::Item* old = cache.find(request.key, request.hash, now);
+	switch (mode)
+	{
+	case Command::Add:
+		if (old != nullptr)
+			return StoreResult::NotStored;
+		break;
+	case Command::Replace:
+	case Command::Append:
+	case Command::Prepend:
+		if (old == nullptr)
+			return StoreResult::NotStored;
+		break;
+	case Command::Cas:
+		if (old == nullptr)
+			return StoreResult::NotFound;
+		if (old->cas != request.number)
+			return StoreResult::Exists;
+		break;
+	default:
+		break;
+	}
+
+	uint32_t flags = request.flags;
+	uint32_t exptime = request.exptime;
+	size_t length = request.value.size();
+	if (mode == Command::Append || mode == Command::Prepend)
+	{
+		// 保留旧item的flags和过期时间
+		flags = old->flags;
+		exptime = old->exptime;
+		t_scratch.assign(old->valueView());
+		length += t_scratch.size();
+	}
+	if (sizeof(Cache::Item) + request.key.size() + length > Cache::kPageSize)
+		return StoreResult::TooLarge;
+
+	Cache::Item* item = cache.allocate(request.key, request.hash, flags, exptime, length, now);
+	if (item == nullptr)
+		return StoreResult::OutOfMemory;
+
+	char* value = item->value();
+	if (mode == Command::Append)
+	{
+		::memcpy(value, t_scratch.data(), t_scratch.size());
+		::memcpy(value + t_scratch.size(), request.value.data(), request.value.size());
+	}
+	else if (mode == Command::Prepend)
+	{
+		::memcpy(value, request.value.data(), request.value.size());
+		::memcpy(value + request.value.size(), t_scratch.data(), t_scratch.size());
+	}
+	else
+	{
+		::memcpy(value, request.value.data(), request.value.size());
+	}
+	cache.link(item);
+	if (stored != nullptr)
+		*stored = item;
+	return StoreResult::Stored;
+}
+
+template <typename Out>
+static void putStoreResult(Out* out, StoreResult result)
+{
+	switch (result)
+	{
+	case StoreResult::Stored: put(out, "STORED\r\n"); break;
+	case StoreResult::NotStored: put(out, "NOT_STORED\r\n"); break;
+	case StoreResult::Exists: put(out, "EXISTS\r\n"); break;
+	case StoreResult::NotFound: put(out, "NOT_FOUND\r\n"); break;
+	case StoreResult::TooLarge: put(out, "SERVER_ERROR object too large for cache\r\n"); break;
+	case StoreResult::OutOfMemory: put(out, "SERVER_ERROR out of memory storing object\r\n"); break;
+	}
+}
+
+
+template <typename Out>
+static void executeGet(Shard* shard, const Request& request, uint32_t now, Out* out)
+{
+	shard->cmdGet++;
+	Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+	if (item == nullptr)
+	{
+		shard->getMisses++;
+		return;
+	}
+	shard->getHits++;
+	put(out, "VALUE ");
+	put(out, item->keyView());
+	put(out, " ");
+	putNumber(out, item->flags);
+	put(out, " ");
+	putNumber(out, item->valueLength);
+	if (request.command == Command::Gets)
+	{
+		put(out, " ");
+		putNumber(out, item->cas);
+	}
+	put(out, "\r\n");
+	put(out, item->valueView());
+	put(out, "\r\n");
+}
+
+template <typename Out>
+static void executeIncr(Shard* shard, const Request& request, uint32_t now, Out* out)
+{
+	Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+	if (item == nullptr)
+	{
+		if (!request.noreply)
+			put(out, "NOT_FOUND\r\n");
+		return;
+	}
+
+	uint64_t value = 0;
+	if (!parseNumber(item->valueView(), &value))
+	{
+		if (!request.noreply)
+			put(out, "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n");
+		return;
+	}
+	if (request.command == Command::Incr)
+		value += request.number;
+	else
+		value = request.number > value ? 0 : value - request.number;
+
+	char digits[24];
+	size_t length = std::to_chars(digits, digits + sizeof(digits), value).ptr - digits;
+	Cache::Item* updated = shard->cache.allocate(request.key, request.hash, item->flags, item->exptime, length, now);
+	if (updated == nullptr)
+	{
+		if (!request.noreply)
+			put(out, "SERVER_ERROR out of memory\r\n");
+		return;
+	}
+	::memcpy(updated->value(), digits, length);
+	shard->cache.link(updated);
+	if (!request.noreply)
+	{
+		out->append(digits, length);
+		put(out, "\r\n");
+	}
+}
+
+template <typename Out>
+static void executeMetaGet(Shard* shard, const Request& request, uint32_t now, Out* out)
+{
+	MetaFlags meta = parseMetaFlags(request.metaFlags);
+	shard->cmdGet++;
+	Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+	if (item == nullptr)
+	{
+		shard->getMisses++;
+		if (!meta.quiet)
+			put(out, "EN\r\n");
+		return;
+	}
+	shard->getHits++;
+	if (meta.hasNewTtl)
+		item->exptime = absoluteExptime(meta.newTtl, now);
+
+	if (meta.value)
+	{
+		put(out, "VA ");
+		putNumber(out, item->valueLength);
+	}
+	else
+	{
+		put(out, "HD");
+	}
+	putMetaReturn(out, meta, item, now);
+	if (meta.value)
+	{
+		put(out, item->valueView());
+		put(out, "\r\n");
+	}
+}
+
+template <typename Out>
+static void executeMetaSet(Shard* shard, const Request& request, uint32_t now, Out* out)
+{
+	MetaFlags meta = parseMetaFlags(request.metaFlags);
+	Command mode = Command::Set;
+	switch (meta.mode)
+	{
+	case 'E': case 'e': mode = Command::Add; break;
+	case 'A': case 'a': mode = Command::Append; break;
+	case 'P': case 'p': mode = Command::Prepend; break;
+	case 'R': case 'r': mode = Command::Replace; break;
+	default: break;
+	}
+
+	Request set = request;
+	set.flags = meta.newClientFlags;
+	set.exptime = meta.hasNewTtl ? absoluteExptime(meta.newTtl, now) : 0;
+	Cache::Item* item = nullptr;
+	StoreResult result = store(shard, mode, set, now, &item);
+	switch (result)
+	{
+	case StoreResult::Stored:
+		if (meta.quiet)
+			return;
+		put(out, "HD");
+		break;
+	case StoreResult::NotStored:
+		put(out, "NS");
+		break;
+	case StoreResult::Exists:
+		put(out, "EX");
+		break;
+	case StoreResult::NotFound:
+		put(out, "NF");
+		break;
+	default:
+		putStoreResult(out, result);
+		return;
+	}
+	putMetaReturn(out, meta, item, now);
+}
+
+template <typename Out>
+static void executeStats(Shard* shard, Out* out)
+{
+	const Cache::Stats& stats = shard->cache.stats();
+	const std::pair<const char*, uint64_t> values[] = {
+		{ "curr_items", stats.items },
+		{ "bytes", stats.bytes },
+		{ "evictions", stats.evictions },
+		{ "pages", stats.pages },
+		{ "cmd_get", shard->cmdGet },
+		{ "get_hits", shard->getHits },
+		{ "get_misses", shard->getMisses },
+		{ "cmd_set", shard->cmdSet },
+		{ "forwarded", shard->forwarded },
+		{ "batches", shard->batches },
+	};
+	for (auto&& [name, value] : values)
+	{
+		char line[96];
+		int n = ::snprintf(line, sizeof(line), "STAT shard%d:%s %lu\r\n", shard->index, name, value);
+		out->append(line, n);
+	}
+}
+
+
+/// @brief 在分片所属的loop线程中执行一个请求 回复追加到out(Buffer或std::string)
+template <typename Out>
+static void execute(Shard* shard, const Request& request, uint32_t now, Out* out)
+{
+	switch (request.command)
+	{
+	case Command::Get:
+	case Command::Gets:
+		executeGet(shard, request, now, out);
+		break;
+	case Command::Set:
+	case Command::Add:
+	case Command::Replace:
+	case Command::Append:
+	case Command::Prepend:
+	case Command::Cas:
+	{
+		StoreResult result = store(shard, request.command, request, now, nullptr);
+		if (!request.noreply)
+			putStoreResult(out, result);
+		break;
+	}
+	case Command::Delete:
+	{
+		Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+		if (item != nullptr)
+			shard->cache.remove(item);
+		if (!request.noreply)
+			put(out, item != nullptr ? "DELETED\r\n" : "NOT_FOUND\r\n");
+		break;
+	}
+	case Command::Incr:
+	case Command::Decr:
+		executeIncr(shard, request, now, out);
+		break;
+	case Command::Touch:
+	{
+		Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+		if (item != nullptr)
+			item->exptime = request.exptime;
+		if (!request.noreply)
+			put(out, item != nullptr ? "TOUCHED\r\n" : "NOT_FOUND\r\n");
+		break;
+	}
+	case Command::MetaGet:
+		executeMetaGet(shard, request, now, out);
+		break;
+	case Command::MetaSet:
+		executeMetaSet(shard, request, now, out);
+		break;
+	case Command::MetaDelete:
+	{
+		MetaFlags meta = parseMetaFlags(request.metaFlags);
+		Cache::Item* item = shard->cache.find(request.key, request.hash, now);
+		if (item != nullptr)
+			shard->cache.remove(item);
+		if (item != nullptr && meta.quiet)
+			break;
+		put(out, item != nullptr ? "HD" : "NF");
+		putMetaReturn(out, meta, nullptr, now);
+		break;
+	}
+	case Command::FlushAll:
+		shard->cache.flush();
+		break;
+	case Command::Stats:
+		executeStats(shard, out);
+		break;
+	}
+}
+
+
+/// @brief 本轮还没有转发请求时回复直接写入t_output 否则写入按顺序排列的槽位
+static size_t nextSlot(MemcacheContext* context)
+{
+	if (context->slotCount == context->slots.size())
+		context->slots.emplace_back();
+	else
+		context->slots[context->slotCount].clear();
+	return context->slotCount++;
+}
+
+template <typename F>
+static void withOutput(MemcacheContext* context, F&& f)
+{
+	if (context->slotCount == 0)
+	{
+		f(&t_output);
+	}
+	else
+	{
+		if (!context->lastSlotLocal)
+		{
+			nextSlot(context);
+			context->lastSlotLocal = true;
+		}
+		f(&context->slots[context->slotCount - 1]);
+	}
+}
+
+static void reply(MemcacheContext* context, std::string_view str)
+{
+	withOutput(context, [str](auto* out) { put(out, str); });
+}
+
+
+MemcacheServer::MemcacheServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name, TcpServer::Option option) :
+	_server(loop, listenAddr, name, option), _memoryLimit{ 64 * 1024 * 1024 }
+{
+	_server.setConnectionCallback(std::bind(&MemcacheServer::onConnection, this, _1));
+	_server.setMessageCallback(std::bind(&MemcacheServer::onMessage, this, _1, _2, _3));
+}
+
+
+MemcacheServer::~MemcacheServer() = default;
+
+
+void MemcacheServer::start()
+{
+	_server.start();
+
+	// 线程池启动后才知道所有的subloop 新连接要等baseloop开始循环后才会到来 此时分片已经建好
+	std::vector<EventLoop*> loops = _server.threadPool()->getAllLoops();
+	const size_t perShard = std::max(_memoryLimit / loops.size(), Cache::kPageSize * 4);
+	for (size_t i = 0; i < loops.size(); i++)
+		_shards.emplace_back(new Shard(loops[i], static_cast<int>(i), loops.size(), perShard));
+
+	LOG_INFO("MemcacheServer[%s] starts listening on %s, %zu shards, %zu MB per shard\n",
+		_server.name().c_str(), _server.ipPort().c_str(), _shards.size(), perShard / 1024 / 1024);
+}
+
+
+void MemcacheServer::onConnection(const TcpConnectionPtr& conn)
+{
+	if (!conn->connected())
+		return;
+
+	// 有转发请求时一轮的回复分两次发送
+	conn->setTcpNoDelay(true);
+	MemcacheContext context;
+	for (auto&& shard : _shards)
+	{
+		if (shard->loop == conn->getLoop())
+			context.home = shard.get();
+	}
+	conn->setContext(context);
+}
+
+
+void MemcacheServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp)
+{
+	processInput(conn, buf);
+}
+
+
+void MemcacheServer::processInput(const TcpConnectionPtr& conn, Buffer* buf)
+{
+	MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+	// 上一轮的转发请求还没有全部返回 新数据先留在缓冲区中
+	if (context->pending > 0 || context->closing)
+		return;
+
+	Shard* home = context->home;
+	const uint32_t now = static_cast<uint32_t>(::time(nullptr));
+	const char* begin = buf->peek();
+	const size_t readable = buf->readableBytes();
+	size_t pos = 0;
+	context->round++;
+
+	while (pos < readable && !context->closing)
+	{
+		const char* lineBegin = begin + pos;
+		const char* newline = static_cast<const char*>(::memchr(lineBegin, '\n', readable - pos));
+		if (newline == nullptr)
+		{
+			if (readable - pos > kMaxLineLength)
+			{
+				reply(context, "CLIENT_ERROR line too long\r\n");
+				context->closing = true;
+			}
+			break;
+		}
+		const char* lineEnd = newline > lineBegin && newline[-1] == '\r' ? newline - 1 : newline;
+		size_t next = newline + 1 - begin;
+
+		std::vector<std::string_view>& tokens = t_tokens;
+		tokens.clear();
+		for (const char* p = lineBegin; p < lineEnd;)
+		{
+			while (p < lineEnd && *p == ' ')
+				p++;
+			const char* tokenBegin = p;
+			while (p < lineEnd && *p != ' ')
+				p++;
+			if (p > tokenBegin)
+				tokens.emplace_back(tokenBegin, p - tokenBegin);
+		}
+		if (tokens.empty())
+		{
+			reply(context, "ERROR\r\n");
+			pos = next;
+			continue;
+		}
+
+		std::string_view name = tokens[0];
+		Request request;
+		bool badFormat = false;
+
+		if (name == "get" || name == "gets")
+		{
+			request.command = name == "get" ? Command::Get : Command::Gets;
+			for (size_t i = 1; i < tokens.size(); i++)
+				badFormat |= tokens[i].size() > Cache::kMaxKeyLength;
+			if (tokens.size() < 2 || badFormat)
+			{
+				reply(context, "CLIENT_ERROR bad command line format\r\n");
+			}
+			else
+			{
+				for (size_t i = 1; i < tokens.size(); i++)
+				{
+					request.key = tokens[i];
+					request.hash = hashKey(request.key);
+					dispatch(conn, home, request, now);
+				}
+				reply(context, "END\r\n");
+			}
+		}
+		else if (name == "set" || name == "add" || name == "replace" || name == "append" || name == "prepend" || name == "cas")
+		{
+			// <command> <key> <flags> <exptime> <bytes> [cas unique] [noreply]\r\n<data>\r\n
+			const bool isCas = name == "cas";
+			const size_t required = isCas ? 6 : 5;
+			int64_t exptime = 0;
+			size_t bytes = 0;
+			badFormat = tokens.size() < required || tokens.size() > required + 1
+				|| tokens[1].size() > Cache::kMaxKeyLength
+				|| !parseNumber(tokens[2], &request.flags)
+				|| !parseNumber(tokens[3], &exptime)
+				|| !parseNumber(tokens[4], &bytes)
+				|| (isCas && !parseNumber(tokens[5], &request.number));
+			if (badFormat || bytes > Cache::kPageSize)
+			{
+				// 无法可靠地跳过数据块 回复错误后断开
+				reply(context, badFormat ? "CLIENT_ERROR bad command line format\r\n" : "SERVER_ERROR object too large for cache\r\n");
+				context->closing = true;
+				break;
+			}
+			if (next + bytes + 2 > readable)
+				break;
+			if (begin[next + bytes] != '\r' || begin[next + bytes + 1] != '\n')
+			{
+				reply(context, "CLIENT_ERROR bad data chunk\r\n");
+				context->closing = true;
+				break;
+			}
+
+			switch (name[0])
+			{
+			case 's': request.command = Command::Set; break;
+			case 'a': request.command = name[1] == 'd' ? Command::Add : Command::Append; break;
+			case 'r': request.command = Command::Replace; break;
+			case 'p': request.command = Command::Prepend; break;
+			default: request.command = Command::Cas; break;
+			}
+			request.key = tokens[1];
+			request.hash = hashKey(request.key);
+			request.exptime = absoluteExptime(exptime, now);
+			request.value = std::string_view(begin + next, bytes);
+			request.noreply = tokens.size() == required + 1 && tokens[required] == "noreply";
+			dispatch(conn, home, request, now);
+			next += bytes + 2;
+		}
+		else if (name == "delete" || name == "touch" || name == "incr" || name == "decr")
+		{
+			// delete <key> [noreply]  touch <key> <exptime> [noreply]  incr/decr <key> <delta> [noreply]
+			const size_t required = name == "delete" ? 2 : 3;
+			int64_t exptime = 0;
+			badFormat = tokens.size() < required || tokens.size() > required + 1
+				|| tokens[1].size() > Cache::kMaxKeyLength
+				|| (name == "touch" && !parseNumber(tokens[2], &exptime))
+				|| ((name == "incr" || name == "decr") && !parseNumber(tokens[2], &request.number));
+			if (badFormat)
+			{
+				reply(context, (name == "incr" || name == "decr") && tokens.size() >= 3
+					? "CLIENT_ERROR invalid numeric delta argument\r\n" : "CLIENT_ERROR bad command line format\r\n");
+			}
+			else
+			{
+				request.command = name == "delete" ? Command::Delete
+					: name == "touch" ? Command::Touch
+					: name == "incr" ? Command::Incr : Command::Decr;
+				request.key = tokens[1];
+				request.hash = hashKey(request.key);
+				request.exptime = absoluteExptime(exptime, now);
+				request.noreply = tokens.size() == required + 1 && tokens[required] == "noreply";
+				dispatch(conn, home, request, now);
+			}
+		}
+		else if (name == "mg" || name == "md" || name == "ms")
+		{
+			// mg <key> <flags>*  md <key> <flags>*  ms <key> <datalen> <flags>*\r\n<data>\r\n
+			const bool isSet = name == "ms";
+			const size_t flagsIndex = isSet ? 3 : 2;
+			size_t bytes = 0;
+			badFormat = tokens.size() < flagsIndex
+				|| tokens[1].size() > Cache::kMaxKeyLength
+				|| (isSet && !parseNumber(tokens[2], &bytes));
+			if (badFormat || bytes > Cache::kPageSize)
+			{
+				reply(context, "CLIENT_ERROR bad command line format\r\n");
+				if (isSet)
+				{
+					context->closing = true;
+					break;
+				}
+			}
+			else
+			{
+				if (isSet)
+				{
+					if (next + bytes + 2 > readable)
+						break;
+					if (begin[next + bytes] != '\r' || begin[next + bytes + 1] != '\n')
+					{
+						reply(context, "CLIENT_ERROR bad data chunk\r\n");
+						context->closing = true;
+						break;
+					}
+					request.value = std::string_view(begin + next, bytes);
+					next += bytes + 2;
+				}
+				request.command = name == "mg" ? Command::MetaGet : isSet ? Command::MetaSet : Command::MetaDelete;
+				request.key = tokens[1];
+				request.hash = hashKey(request.key);
+				if (tokens.size() > flagsIndex)
+					request.metaFlags = std::string_view(tokens[flagsIndex].data(), lineEnd - tokens[flagsIndex].data());
+				dispatch(conn, home, request, now);
+			}
+		}
+		else if (name == "mn")
+		{
+			reply(context, "MN\r\n");
+		}
+		else if (name == "flush_all")
+		{
+			request.command = Command::FlushAll;
+			broadcast(conn, home, request);
+			if (tokens.back() != "noreply")
+				reply(context, "OK\r\n");
+		}
+		else if (name == "stats")
+		{
+			request.command = Command::Stats;
+			broadcast(conn, home, request);
+			reply(context, "END\r\n");
+		}
+		else if (name == "version")
+		{
+			reply(context, "VERSION mymuduo-memcache-1.0\r\n");
+		}
+		else if (name == "quit")
+		{
+			context->closing = true;
+		}
+		else
+		{
+			reply(context, "ERROR\r\n");
+		}
+
+		pos = next;
+	}
+
+	// 请求视图都已经用完(转发的请求保存的是拷贝) 可以取走这些字节了
+	if (context->closing)
+		buf->retrieveAll();
+	else
+		buf->retrieve(pos);
+
+	if (t_output.readableBytes() > 0)
+		conn->send(&t_output);
+	if (context->closing && context->pending == 0)
+		conn->shutdown();
+}
+
+
+void MemcacheServer::finishRound(const TcpConnectionPtr& conn)
+{
+	MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+	for (size_t i = 0; i < context->slotCount; i++)
+		t_output.append(context->slots[i]);
+	context->slotCount = 0;
+	context->lastSlotLocal = false;
+	conn->send(&t_output);
+
+	if (context->closing)
+		conn->shutdown();
+	else
+		processInput(conn, conn->inputBuffer());
+}
+
+
+void MemcacheServer::dispatch(const TcpConnectionPtr& conn, Shard* home, const Request& request, uint32_t now)
+{
+	Shard* target = _shards[(request.hash >> 32) % _shards.size()].get();
+	if (target == home)
+	{
+		MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+		withOutput(context, [&](auto* out) { execute(home, request, now, out); });
+	}
+	else
+	{
+		forward(conn, home, target, request);
+	}
+}
+
+
+void MemcacheServer::broadcast(const TcpConnectionPtr& conn, Shard* home, const Request& request)
+{
+	for (auto&& shard : _shards)
+	{
+		if (shard.get() == home)
+		{
+			MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+			withOutput(context, [&](auto* out) { execute(home, request, 0, out); });
+		}
+		else
+		{
+			forward(conn, home, shard.get(), request);
+		}
+	}
+}
+
+
+void MemcacheServer::forward(const TcpConnectionPtr& conn, Shard* home, Shard* target, const Request& request)
+{
+	MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+	std::shared_ptr<ForwardBatch>& batch = home->outbox[target->index];
+	if (!batch)
+	{
+		batch = std::make_shared<ForwardBatch>();
+		batch->origin = home;
+	}
+
+	// 视图指向连接的接收缓冲区 跨线程之前必须拷贝
+	ForwardedRequest& forwarded = batch->requests.emplace_back();
+	forwarded.request = request;
+	forwarded.key.assign(request.key);
+	forwarded.value.assign(request.value);
+	forwarded.metaFlags.assign(request.metaFlags);
+	forwarded.conn = conn;
+	forwarded.round = context->round;
+	forwarded.slot = nextSlot(context);
+	context->lastSlotLocal = false;
+	context->pending++;
+	home->forwarded++;
+
+	// 本轮事件处理完之后才发送 同一轮中发往同一分片的请求合并成一个批次
+	if (!home->flushScheduled)
+	{
+		home->flushScheduled = true;
+		home->loop->queueInLoop(std::bind(&MemcacheServer::flushOutbox, this, home));
+	}
+}
+
+
+void MemcacheServer::flushOutbox(Shard* home)
+{
+	home->flushScheduled = false;
+	for (auto&& shard : _shards)
+	{
+		std::shared_ptr<ForwardBatch> batch = std::move(home->outbox[shard->index]);
+		if (!batch)
+			continue;
+		home->batches++;
+		Shard* target = shard.get();
+		target->loop->queueInLoop([this, target, batch]() { executeBatch(target, batch); });
+	}
+}
+
+
+void MemcacheServer::executeBatch(Shard* target, const std::shared_ptr<ForwardBatch>& batch)
+{
+	const uint32_t now = static_cast<uint32_t>(::time(nullptr));
+	for (ForwardedRequest& forwarded : batch->requests)
+	{
+		forwarded.request.key = forwarded.key;
+		forwarded.request.value = forwarded.value;
+		forwarded.request.metaFlags = forwarded.metaFlags;
+		execute(target, forwarded.request, now, &forwarded.reply);
+	}
+	batch->origin->loop->queueInLoop([this, batch]() { completeBatch(batch); });
+}
+
+
+void MemcacheServer::completeBatch(const std::shared_ptr<ForwardBatch>& batch)
+{
+	for (ForwardedRequest& forwarded : batch->requests)
+	{
+		const TcpConnectionPtr& conn = forwarded.conn;
+		if (!conn->connected())
+			continue;
+		MemcacheContext* context = std::any_cast<MemcacheContext>(conn->getMutableContext());
+		if (context->round != forwarded.round)
+			continue;
+		context->slots[forwarded.slot].swap(forwarded.reply);
+		if (--context->pending == 0)
+			finishRound(conn);
+	}
+	// 在连接所属的loop线程中释放连接的引用 批次对象本身可能在目标线程中析构
+	batch->requests.clear();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "noncopyable.h"
+#include "TcpServer.h"
+
+struct Shard;
+struct ForwardBatch;
+struct Request;
+
+/// @brief memcached文本协议与meta协议的缓存服务器 每个subloop拥有一个缓存分片 分片只在自己的loop线程中访问 不加锁
+/// key按哈希归属某个分片 属于其他分片的请求在本轮事件处理结束时按目标分片打包 一个批次只做一次queueInLoop
+/// 目标分片执行完整个批次后把同一个批次送回 回复按请求顺序写回连接
+/// 一个连接有转发请求没有返回时暂停解析新到达的数据 保证回复顺序
+class MemcacheServer : public noncopyable
+{
+public:
+	MemcacheServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name,
+		TcpServer::Option option = TcpServer::Option::NoReusePort);
+	~MemcacheServer();
+
+	// 分片数等于subloop数 为0时只有baseloop一个分片
+	void setThreadNum(int numThreads) { _server.setThreadNum(numThreads); }
+	// 所有分片的缓存内存上限之和
+	void setMemoryLimit(size_t bytes) { _memoryLimit = bytes; }
+
+	void start();
+
+private:
+	void onConnection(const TcpConnectionPtr& conn);
+	void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
+
+	// 处理buf中所有完整的请求 有请求转发到其他分片时处理完本轮后返回
+	void processInput(const TcpConnectionPtr& conn, Buffer* buf);
+	// 连接本轮的转发请求全部返回 按顺序发送回复后继续处理积压的输入
+	void finishRound(const TcpConnectionPtr& conn);
+
+	// 在key所属的分片上执行请求 本地分片直接执行 其他分片则加入转发批次
+	void dispatch(const TcpConnectionPtr& conn, Shard* home, const Request& request, uint32_t now);
+	// flush_all、stats等需要在所有分片上执行的请求
+	void broadcast(const TcpConnectionPtr& conn, Shard* home, const Request& request);
+	void forward(const TcpConnectionPtr& conn, Shard* home, Shard* target, const Request& request);
+
+	// 在本轮事件处理结束时把所有非空的批次发给目标分片
+	void flushOutbox(Shard* home);
+	// 在目标分片的loop中执行整个批次 然后送回来源分片
+	void executeBatch(Shard* target, const std::shared_ptr<ForwardBatch>& batch);
+	// 在来源分片的loop中把回复交给各个连接
+	void completeBatch(const std::shared_ptr<ForwardBatch>& batch);
+
+	TcpServer _server;
+	size_t _memoryLimit;
+	std::vector<std::unique_ptr<Shard>> _shards;
+};
@@ -0,0 +1,374 @@
+/*
+ * 每个subloop一个缓存分片的memcached服务器 兼容文本协议和meta协议 可以直接用memtier_benchmark、mc-crusher等工具压测
+ * 指定 -d 秒数 时在进程内启动流水线客户端 按比例随机发送set/get 统计每秒请求数和每批次延迟 最后输出服务端各分片的统计
+ *
+ * 用法: memcached_server [-s 服务端subloop数] [-P 端口] [-m 内存MB] [-d 秒数] [-c 连接数] [-t 客户端线程数]
+ *                        [-p 流水线深度] [-k key个数] [-v value字节数] [-r set比例(0~1)]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <random>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "MemcacheServer.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int serverThreads = 1;
+	uint16_t port = 11311;
+	size_t memoryMB = 64;
+	int seconds = 0;
+	int connections = 50;
+	int clientThreads = 1;
+	int pipeline = 16;
+	int keys = 100000;
+	size_t valueSize = 100;
+	double setRatio = 0.1;
+};
+
+
+/// @brief 一个客户端长连接 每次从预先生成的批次中取一批发送 全部回复收齐后再发送下一批
+class ClientConnection
+{
+public:
+	ClientConnection(EventLoop* loop, int fd, const std::vector<std::string>& batches, int pipeline, Histogram* histogram, size_t first) :
+		_fd{ fd }, _channel(loop, fd), _batches{ batches }, _next{ first }, _pipeline{ pipeline }, _outstanding{ 0 }, _histogram{ histogram }
+	{
+		_channel.setReadCallback(std::bind(&ClientConnection::handleRead, this));
+	}
+
+	~ClientConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		sendBatch();
+	}
+
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void sendBatch()
+	{
+		const std::string& batch = _batches[_next];
+		_next = (_next + 1) % _batches.size();
+		_batchStart = Clock::now();
+		_outstanding = _pipeline;
+		ssize_t n = ::write(_fd, batch.data(), batch.size());
+		if (n != static_cast<ssize_t>(batch.size()))
+			_errors++;
+	}
+
+	// 消费一条完整的回复 get的回复是若干VALUE块加END 不完整时返回false
+	bool consumeReply()
+	{
+		size_t offset = 0;
+		while (true)
+		{
+			const char* begin = _input.peek() + offset;
+			size_t readable = _input.readableBytes() - offset;
+			const char* crlf = static_cast<const char*>(::memmem(begin, readable, "\r\n", 2));
+			if (crlf == nullptr)
+				return false;
+			size_t lineLen = crlf - begin + 2;
+			if (::strncmp(begin, "VALUE ", 6) != 0)
+			{
+				if (::strncmp(begin, "STORED", 6) != 0 && ::strncmp(begin, "END", 3) != 0)
+					_errors++;
+				_input.retrieve(offset + lineLen);
+				return true;
+			}
+			// VALUE <key> <flags> <bytes>
+			const char* bytes = static_cast<const char*>(::memrchr(begin, ' ', lineLen));
+			size_t blockLen = lineLen + ::strtoul(bytes + 1, nullptr, 10) + 2;
+			if (blockLen > readable)
+				return false;
+			offset += blockLen;
+		}
+	}
+
+	void handleRead()
+	{
+		int savedErrno = 0;
+		ssize_t n = _input.readFd(_fd, &savedErrno);
+		if (n <= 0)
+		{
+			_errors++;
+			_channel.disableAll();
+			return;
+		}
+
+		while (_outstanding > 0 && consumeReply())
+		{
+			_completed++;
+			_outstanding--;
+		}
+		if (_outstanding > 0)
+			return;
+
+		auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _batchStart);
+		_histogram->record(latency.count());
+		sendBatch();
+	}
+
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::vector<std::string>& _batches;
+	size_t _next;
+	int _pipeline;
+	int _outstanding;
+	Clock::time_point _batchStart;
+	Histogram* _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+/// @brief 一个客户端线程 拥有自己的EventLoop和一组连接
+class ClientWorker
+{
+public:
+	ClientWorker(const Options& options, int connections, unsigned seed) :
+		_thread(nullptr, "client"), _options{ options }, _connections{ connections }
+	{
+		// 预先生成一批随机请求 发送时不再做任何计算
+		std::mt19937 random(seed);
+		std::uniform_int_distribution<int> keyDist(0, options.keys - 1);
+		std::bernoulli_distribution isSet(options.setRatio);
+		const std::string value(options.valueSize, 'v');
+		char line[128];
+		for (int i = 0; i < 1024; i++)
+		{
+			std::string batch;
+			for (int j = 0; j < options.pipeline; j++)
+			{
+				int key = keyDist(random);
+				if (isSet(random))
+				{
+					::snprintf(line, sizeof(line), "set key:%d 0 0 %zu\r\n", key, value.size());
+					batch.append(line).append(value).append("\r\n");
+				}
+				else
+				{
+					::snprintf(line, sizeof(line), "get key:%d\r\n", key);
+					batch.append(line);
+				}
+			}
+			_batches.push_back(std::move(batch));
+		}
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop(std::bind(&ClientWorker::connectAll, this));
+	}
+
+	// 在loop线程中关闭所有连接 并返回统计结果
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			for (auto&& conn : _conns)
+			{
+				_completed += conn->completed();
+				_errors += conn->errors();
+			}
+			_conns.clear();
+			done.set_value();
+		});
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void connectAll()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		for (int i = 0; i < _connections; i++)
+		{
+			int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+			{
+				::perror("connect");
+				::close(fd);
+				continue;
+			}
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			_conns.emplace_back(new ClientConnection(_loop, fd, _batches, _options.pipeline, &_histogram, i * 37 % _batches.size()));
+		}
+		for (auto&& conn : _conns)
+			conn->start();
+	}
+
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::vector<std::string> _batches;
+	std::vector<std::unique_ptr<ClientConnection>> _conns;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+/// @brief 用阻塞socket发送stats 返回服务端各分片的统计
+static std::string queryStats(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+	std::string stats;
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0)
+	{
+		::write(fd, "stats\r\n", 7);
+		char buf[4096];
+		while (stats.size() < 5 || stats.compare(stats.size() - 5, 5, "END\r\n") != 0)
+		{
+			ssize_t n = ::read(fd, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			stats.append(buf, n);
+		}
+	}
+	::close(fd);
+	return stats;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "s:P:m:d:c:t:p:k:v:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'm': options.memoryMB = ::strtoul(optarg, nullptr, 10); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 'p': options.pipeline = ::atoi(optarg); break;
+		case 'k': options.keys = ::atoi(optarg); break;
+		case 'v': options.valueSize = ::strtoul(optarg, nullptr, 10); break;
+		case 'r': options.setRatio = ::atof(optarg); break;
+		default:
+			::fprintf(stderr, "usage: %s [-s server threads] [-P port] [-m memory MB] [-d seconds] [-c conns] [-t client threads]"
+				" [-p pipeline] [-k keys] [-v value bytes] [-r set ratio]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+/// @brief 进程内压测: 等待服务器开始监听后启动客户端 到时间后汇总结果并退出主loop
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::vector<std::unique_ptr<ClientWorker>> workers;
+	for (int i = 0; i < options.clientThreads; i++)
+	{
+		int conns = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+		workers.emplace_back(new ClientWorker(options, conns, i + 1));
+	}
+
+	Clock::time_point start = Clock::now();
+	for (auto&& worker : workers)
+		worker->start();
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	for (auto&& worker : workers)
+	{
+		std::promise<void> done;
+		worker->stop(done);
+		done.get_future().wait();
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t completed = 0, errors = 0;
+	for (auto&& worker : workers)
+	{
+		total.merge(worker->histogram());
+		completed += worker->completed();
+		errors += worker->errors();
+	}
+
+	::printf("memcached_server: %d connections, %d client threads, %d server threads, pipeline %d, %d keys, %zu-byte values, set ratio %.2f, %.2fs\n",
+		options.connections, options.clientThreads, options.serverThreads, options.pipeline, options.keys,
+		options.valueSize, options.setRatio, elapsed);
+	::printf("  requests: %lu  errors: %lu  requests/s: %.0f\n", completed, errors, completed / elapsed);
+	::printf("  batch latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+	::printf("%s", queryStats(options.port).c_str());
+	::fflush(stdout);
+
+	workers.clear();
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+
+	EventLoop loop;
+	MemcacheServer server(&loop, InetAddress(options.port), "MemcacheServer");
+	server.setThreadNum(options.serverThreads);
+	server.setMemoryLimit(options.memoryMB * 1024 * 1024);
+	server.start();
+
+	std::thread controller;
+	if (options.seconds > 0)
+		controller = std::thread(runClients, std::cref(options), &loop);
+
+	loop.loop();
+	if (controller.joinable())
+		controller.join();
+	return 0;
+}
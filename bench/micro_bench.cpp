@@ -0,0 +1,574 @@
+/*
+ * 热点组件的微基准 单独衡量Buffer、EventLoop任务队列与唤醒、EpollPoller、回调分发以及协程的开销
+ * 每一项输出 ns/op 和 allocs/op(本进程替换了全局operator new 统计期间所有线程的堆分配次数)
+ * 修改这些类之后先跑对应的项 再看端到端的压测 比较绝对数值时用 cmake -DCMAKE_BUILD_TYPE=Release 编译
+ *
+ *     micro_bench                     运行全部
+ *     micro_bench -f buffer           只运行名字包含buffer的项
+ *     micro_bench -N 10,1000,10000    poller项使用的fd数量
+ *
+ * 用法: micro_bench [-f 名字过滤] [-n 迭代次数倍率] [-N fd数量列表]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Histogram.h"
+#include "Coroutine.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = ::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return ::operator new(size); }
+void operator delete(void* p) noexcept { ::free(p); }
+void operator delete[](void* p) noexcept { ::free(p); }
+void operator delete(void* p, size_t) noexcept { ::free(p); }
+void operator delete[](void* p, size_t) noexcept { ::free(p); }
+
+
+struct Options
+{
+	std::string filter;
+	double scale = 1.0;
+	std::vector<int> fdCounts{ 10, 100, 1000, 10000 };
+};
+
+static Options g_options;
+
+// 防止编译器把被测的代码整个优化掉
+template <typename T>
+static void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static bool selected(const char* name)
+{
+	return g_options.filter.empty() || ::strstr(name, g_options.filter.c_str()) != nullptr;
+}
+
+static void report(const char* name, uint64_t ops, Clock::duration elapsed, uint64_t allocations)
+{
+	double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+	::printf("%-44s %12.1f ns/op %10.3f allocs/op %12lu ops\n", name, ns / ops, static_cast<double>(allocations) / ops, ops);
+	::fflush(stdout);
+}
+
+/// @brief 重复执行func iterations次 func的单次调用即一次op
+template <typename Func>
+static void bench(const char* name, uint64_t iterations, Func&& func)
+{
+	if (!selected(name))
+		return;
+	iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * g_options.scale));
+	uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+	Clock::time_point start = Clock::now();
+	for (uint64_t i = 0; i < iterations; i++)
+		func();
+	Clock::duration elapsed = Clock::now() - start;
+	report(name, iterations, elapsed, g_allocations.load(std::memory_order_relaxed) - allocations);
+}
+
+
+static void benchBuffer()
+{
+	char data[65536];
+	::memset(data, 'b', sizeof(data));
+
+	{
+		Buffer buffer;
+		bench("buffer/append+retrieveAll 64B", 10000000, [&]() {
+			buffer.append(data, 64);
+			buffer.retrieveAll();
+		});
+	}
+	{
+		Buffer buffer;
+		bench("buffer/append+retrieve 4KB", 2000000, [&]() {
+			buffer.append(data, 4096);
+			buffer.retrieve(4096);
+		});
+	}
+	{
+		// 每次都从初始大小增长到64KB 走makeSpace的扩容分支
+		bench("buffer/makeSpace grow 1KB->64KB by 512B", 100000, [&]() {
+			Buffer buffer;
+			for (size_t i = 0; i < 128; i++)
+				buffer.append(data, 512);
+			doNotOptimize(buffer.readableBytes());
+		});
+	}
+	{
+		// 头部已读的空间足够 makeSpace把剩余数据搬到前面而不扩容
+		Buffer buffer;
+		bench("buffer/makeSpace compact 64B readable", 5000000, [&]() {
+			buffer.append(data, Buffer::kInitialSize - 64);
+			buffer.retrieve(Buffer::kInitialSize - 128);
+			buffer.append(data, 128);
+			buffer.retrieveAll();
+		});
+	}
+
+	// 持续的流: 每次追加一块 按固定大小的帧取走 剩下不足一帧的部分留到下一次
+	// vector方式在可写空间不够时把剩余数据搬回头部 积压越多搬得越多 镜像环形缓冲区不搬移
+	struct Stream
+	{
+		const char* name;
+		size_t chunk;
+		size_t frame;
+		size_t backlog;		// 开始前先积压的字节数
+	};
+	for (const Stream& stream : { Stream{ "1500B in 1000B out", 1500, 1000, 0 }, Stream{ "16KB in 16KB out 192KB backlog", 16384, 16384, 196608 } })
+	{
+		for (bool ring : { false, true })
+		{
+			char name[96];
+			::snprintf(name, sizeof(name), "buffer/stream %s %s", stream.name, ring ? "ring" : "vector");
+			Buffer buffer;
+			if (ring && !buffer.useMirroredRing(256 * 1024))
+				continue;
+			for (size_t i = 0; i < stream.backlog; i += stream.chunk)
+				buffer.append(data, stream.chunk);
+			bench(name, 2000000, [&]() {
+				buffer.append(data, stream.chunk);
+				while (buffer.readableBytes() >= stream.frame + stream.backlog)
+				{
+					doNotOptimize(*buffer.peek());
+					buffer.retrieve(stream.frame);
+				}
+			});
+		}
+	}
+
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+	{
+		::perror("socketpair");
+		return;
+	}
+	int sndbuf = 1024 * 1024;
+	::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	::setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &sndbuf, sizeof(sndbuf));
+	for (size_t size : { 64, 4096, 65536 })
+	{
+		char name[64];
+		::snprintf(name, sizeof(name), "buffer/readFd socketpair %zuB", size);
+		Buffer buffer;
+		int savedErrno = 0;
+		// 写端的开销也计入 用来对比的是不同大小之间以及修改前后的差异
+		bench(name, size >= 65536 ? 50000 : 500000, [&]() {
+			ssize_t written = ::write(fds[0], data, size);
+			size_t received = 0;
+			while (received < static_cast<size_t>(written))
+			{
+				ssize_t n = buffer.readFd(fds[1], &savedErrno);
+				if (n <= 0)
+					break;
+				received += n;
+			}
+			buffer.retrieveAll();
+		});
+	}
+	for (bool ring : { false, true })
+	{
+		// 64KB一次写入 按1000B的帧取走 读入时缓冲区里总有上一次剩下的不足一帧的数据
+		char name[64];
+		::snprintf(name, sizeof(name), "buffer/readFd stream 64KB %s", ring ? "ring" : "vector");
+		Buffer buffer;
+		if (ring && !buffer.useMirroredRing(256 * 1024))
+			continue;
+		int savedErrno = 0;
+		bench(name, 50000, [&]() {
+			ssize_t written = ::write(fds[0], data, sizeof(data));
+			size_t received = 0;
+			while (received < static_cast<size_t>(written))
+			{
+				ssize_t n = buffer.readFd(fds[1], &savedErrno);
+				if (n <= 0)
+					break;
+				received += n;
+				while (buffer.readableBytes() >= 1000)
+					buffer.retrieve(1000);
+			}
+		});
+	}
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+
+/// @brief 其他线程向loop投递任务的吞吐 统计从第一次投递到最后一个任务执行完的时间
+static void benchQueueInLoop()
+{
+	const char* name = "eventloop/queueInLoop throughput";
+	if (!selected(name))
+		return;
+
+	EventLoopThread thread(EventLoopThread::ThreadInitCallback(), "micro");
+	EventLoop* loop = thread.startLoop();
+	uint64_t ops = std::max<uint64_t>(1, static_cast<uint64_t>(2000000 * g_options.scale));
+	uint64_t executed = 0;	// 只在loop线程中修改
+	std::promise<void> done;
+
+	uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+	Clock::time_point start = Clock::now();
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		loop->queueInLoop([&executed, &done, ops]() {
+			if (++executed == ops)
+				done.set_value();
+		});
+	}
+	done.get_future().wait();
+	report(name, ops, Clock::now() - start, g_allocations.load(std::memory_order_relaxed) - allocations);
+}
+
+
+/// @brief loop阻塞在epoll_wait中时 从投递任务到任务开始执行的时间
+static void benchWakeup()
+{
+	const char* name = "eventloop/cross-thread wakeup latency";
+	if (!selected(name))
+		return;
+
+	EventLoopThread thread(EventLoopThread::ThreadInitCallback(), "micro");
+	EventLoop* loop = thread.startLoop();
+	uint64_t ops = std::max<uint64_t>(1, static_cast<uint64_t>(20000 * g_options.scale));
+	Histogram histogram;
+	std::atomic<bool> executed{ false };
+
+	uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+	for (uint64_t i = 0; i < ops; i++)
+	{
+		executed.store(false, std::memory_order_relaxed);
+		Clock::time_point queued = Clock::now();
+		loop->queueInLoop([&histogram, &executed, queued]() {
+			histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - queued).count());
+			executed.store(true, std::memory_order_release);
+		});
+		while (!executed.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		// 等loop重新进入epoll_wait 下一次投递才需要真正的唤醒
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	report(name, ops, std::chrono::nanoseconds(static_cast<int64_t>(histogram.mean())) * ops, g_allocations.load(std::memory_order_relaxed) - allocations);
+	::printf("%-44s p50 %.1fus  p99 %.1fus  p999 %.1fus  max %.1fus\n", "", histogram.percentile(50) / 1000.0,
+		histogram.percentile(99) / 1000.0, histogram.percentile(99.9) / 1000.0, histogram.max() / 1000.0);
+}
+
+
+/// @brief 在nfds个已注册的fd上测epoll_ctl(MOD/ADD+DEL)以及一轮poll+分发的开销
+/// 每个fd是一个eventfd 计数非0时保持可读(水平触发 回调不读取) 计数为0时不可读
+static void benchPoller(int nfds)
+{
+	char updateName[64], churnName[64], pollOneName[64], pollAllName[64];
+	::snprintf(updateName, sizeof(updateName), "poller/updateChannel MOD, %d fds", nfds);
+	::snprintf(churnName, sizeof(churnName), "poller/updateChannel ADD+DEL, %d fds", nfds);
+	::snprintf(pollOneName, sizeof(pollOneName), "poller/poll 1 ready of %d fds", nfds);
+	::snprintf(pollAllName, sizeof(pollAllName), "poller/poll all %d fds ready", nfds);
+	if (!selected(updateName) && !selected(churnName) && !selected(pollOneName) && !selected(pollAllName))
+		return;
+
+	EventLoop loop;
+	std::vector<int> fds;
+	std::vector<std::unique_ptr<Channel>> channels;
+	uint64_t iterations = 0;
+	uint64_t target = 0;
+	for (int i = 0; i < nfds; i++)
+	{
+		int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+		{
+			::perror("eventfd");
+			break;
+		}
+		fds.push_back(fd);
+		channels.emplace_back(new Channel(&loop, fd));
+		channels.back()->enableReading();
+	}
+	if (fds.empty())
+		return;
+	// 第一个fd作为节拍 每一轮poll都可读 回调中计数 达到目标轮数后退出loop
+	channels[0]->setReadCallback([&](Timestamp) {
+		if (++iterations == target)
+			loop.quit();
+	});
+	uint64_t one = 1;
+	::write(fds[0], &one, sizeof(one));
+
+	Channel& channel = *channels[channels.size() / 2];
+	bench(updateName, 1000000, [&]() {
+		channel.enableWriting();
+		channel.disableWriting();
+	});
+	bench(churnName, 500000, [&]() {
+		channel.disableAll();
+		channel.enableReading();
+	});
+
+	auto runPoll = [&](const char* name, uint64_t rounds) {
+		if (!selected(name))
+			return;
+		iterations = 0;
+		target = std::max<uint64_t>(1, static_cast<uint64_t>(rounds * g_options.scale));
+		uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+		Clock::time_point start = Clock::now();
+		loop.loop();
+		report(name, target, Clock::now() - start, g_allocations.load(std::memory_order_relaxed) - allocations);
+	};
+	runPoll(pollOneName, 500000);
+
+	for (size_t i = 1; i < fds.size(); i++)
+		::write(fds[i], &one, sizeof(one));
+	runPoll(pollAllName, std::max<uint64_t>(100, 5000000 / nfds));
+
+	for (size_t i = 0; i < channels.size(); i++)
+	{
+		channels[i]->disableAll();
+		channels[i]->remove();
+		::close(fds[i]);
+	}
+}
+
+
+class Handler
+{
+public:
+	virtual ~Handler() = default;
+	virtual void handle(uint64_t value) = 0;
+};
+
+class CountingHandler : public Handler
+{
+public:
+	void handle(uint64_t value) override { _sum += value; }
+	void onEvent(uint64_t value) { _sum += value; }
+	uint64_t sum() const { return _sum; }
+
+private:
+	uint64_t _sum = 0;
+};
+
+
+/// @brief 回调分发 对比直接调用、虚函数、std::function(小捕获/大捕获/std::bind)的调用与构造开销
+static void benchCallbacks()
+{
+	CountingHandler handler;
+	Handler* base = &handler;
+	doNotOptimize(base);
+
+	bench("callback/direct call", 50000000, [&]() { handler.onEvent(1); });
+	bench("callback/virtual call", 50000000, [&]() { base->handle(1); });
+
+	std::function<void(uint64_t)> small = [&handler](uint64_t value) { handler.onEvent(value); };
+	bench("callback/std::function call, small capture", 50000000, [&]() { small(1); });
+
+	std::function<void(uint64_t)> bound = std::bind(&CountingHandler::onEvent, &handler, std::placeholders::_1);
+	bench("callback/std::function call, std::bind", 50000000, [&]() { bound(1); });
+
+	// 超出std::function内部存储的捕获在构造时需要堆分配 EventLoop::Functor投递时就是这种情况
+	struct Large
+	{
+		CountingHandler* handler;
+		uint64_t padding[4];
+	};
+	bench("callback/std::function construct+call, small", 10000000, [&]() {
+		std::function<void()> func = [&handler]() { handler.onEvent(1); };
+		func();
+	});
+	bench("callback/std::function construct+call, 40B", 10000000, [&]() {
+		Large large{ &handler, { 1, 2, 3, 4 } };
+		std::function<void()> func = [large]() { large.handler->onEvent(large.padding[0]); };
+		func();
+	});
+	doNotOptimize(handler.sum());
+}
+
+
+static Task<uint64_t> nestedTask(uint64_t value)
+{
+	co_return value + 1;
+}
+
+
+static Task<> countTask(uint64_t* counter)
+{
+	++*counter;
+	co_return;
+}
+
+
+// 每次循环co_await一个立即完成的子协程 子协程结束时对称转移回来 循环再多次栈也不会增长
+static Task<> awaitNestedTasks(uint64_t ops, uint64_t* sum)
+{
+	for (uint64_t i = 0; i < ops; i++)
+		*sum = co_await nestedTask(*sum);
+}
+
+
+static Task<> postTasks(EventLoop* loop, uint64_t ops, std::promise<void>* done)
+{
+	for (uint64_t i = 0; i < ops; i++)
+		co_await loop->post();
+	done->set_value();
+}
+
+
+/// @brief 在loop线程中不断把自己重新投递到任务队列 与协程的co_await post对比
+struct Requeue
+{
+	EventLoop* loop;
+	uint64_t remaining;
+	std::promise<void>* done;
+
+	void operator()()
+	{
+		if (--remaining == 0)
+			done->set_value();
+		else
+			loop->queueInLoop(*this);
+	}
+};
+
+
+/// @brief 协程帧的分配、创建并运行一个协程、co_await子协程以及co_await post让出一轮的开销 与对应的回调写法对比
+static void benchCoroutines()
+{
+	{
+		std::vector<void*> frames(16);
+		bench("coroutine/frame alloc+free 256B, per-loop cache", 10000000, [&]() {
+			for (void*& frame : frames)
+				frame = CoroutineFrameAllocator::allocate(256);
+			for (void* frame : frames)
+				CoroutineFrameAllocator::deallocate(frame, 256);
+		});
+		bench("coroutine/frame alloc+free 256B, operator new", 10000000, [&]() {
+			for (void*& frame : frames)
+				frame = ::operator new(256);
+			for (void* frame : frames)
+				::operator delete(frame, 256);
+		});
+	}
+
+	// 没有运行的loop 在创建它的线程中spawn时协程立即运行
+	EventLoop loop;
+	uint64_t counter = 0;
+	bench("coroutine/spawn+run to completion", 5000000, [&]() { spawn(&loop, countTask(&counter)); });
+	doNotOptimize(counter);
+
+	const char* nestedName = "coroutine/co_await completed Task<uint64_t>";
+	if (selected(nestedName))
+	{
+		uint64_t ops = std::max<uint64_t>(1, static_cast<uint64_t>(10000000 * g_options.scale));
+		uint64_t sum = 0;
+		uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+		Clock::time_point start = Clock::now();
+		spawn(&loop, awaitNestedTasks(ops, &sum));
+		report(nestedName, ops, Clock::now() - start, g_allocations.load(std::memory_order_relaxed) - allocations);
+		if (sum != ops)
+			::printf("%-44s wrong result %lu\n", "", sum);
+	}
+
+	const char* requeueName = "eventloop/queueInLoop from loop thread";
+	const char* postName = "coroutine/co_await post from loop thread";
+	if (!selected(requeueName) && !selected(postName))
+		return;
+	EventLoopThread thread(EventLoopThread::ThreadInitCallback(), "micro");
+	EventLoop* threadLoop = thread.startLoop();
+	uint64_t ops = std::max<uint64_t>(1, static_cast<uint64_t>(2000000 * g_options.scale));
+	if (selected(requeueName))
+	{
+		std::promise<void> done;
+		uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+		Clock::time_point start = Clock::now();
+		threadLoop->queueInLoop(Requeue{ threadLoop, ops, &done });
+		done.get_future().wait();
+		report(requeueName, ops, Clock::now() - start, g_allocations.load(std::memory_order_relaxed) - allocations);
+	}
+	if (selected(postName))
+	{
+		std::promise<void> done;
+		uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+		Clock::time_point start = Clock::now();
+		spawn(threadLoop, postTasks(threadLoop, ops, &done));
+		done.get_future().wait();
+		report(postName, ops, Clock::now() - start, g_allocations.load(std::memory_order_relaxed) - allocations);
+	}
+}
+
+
+static std::vector<int> parseList(const char* arg)
+{
+	std::vector<int> values;
+	for (const char* p = arg; *p != '\0';)
+	{
+		values.push_back(::atoi(p));
+		const char* comma = ::strchr(p, ',');
+		if (comma == nullptr)
+			break;
+		p = comma + 1;
+	}
+	return values;
+}
+
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = ::getopt(argc, argv, "f:n:N:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'f': g_options.filter = optarg; break;
+		case 'n': g_options.scale = ::atof(optarg); break;
+		case 'N': g_options.fdCounts = parseList(optarg); break;
+		default:
+			::fprintf(stderr, "usage: %s [-f name filter] [-n iteration scale] [-N fd counts, e.g. 10,1000]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	Logger::setLogLevel(LogLevel::WARN);
+
+	// poller项需要大量fd
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	benchBuffer();
+	benchQueueInLoop();
+	benchWakeup();
+	for (int nfds : g_options.fdCounts)
+		benchPoller(nfds);
+	benchCallbacks();
+	benchCoroutines();
+	return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * 回环上的端到端吞吐与延迟基准 用于发现不同版本之间的性能回退
+ * 服务端是TcpServer回显 客户端是TcpClient 对每一组(消息大小, 连接数, 服务端subloop数)分别运行:
+ *     pingpong 每个连接先发一条消息 此后客户端和服务端都把收到的数据原样发回 统计每秒字节数
+ *     latency  每个连接发送一条消息 收齐回显后再发下一条 统计每秒消息数和往返延迟的p50/p99/p999
+ * 结果以JSON写入 -o 指定的文件 指定 -B 基准文件时逐项对比 吞吐下降或p99上升超过 -r 百分比时返回非零
+ *
+ *     pingpong_bench -b 16,4096,1048576 -c 1,100,1000 -s 1,4 -o result.json
+ *     pingpong_bench -b 16,4096,1048576 -c 1,100,1000 -s 1,4 -B result.json -r 10
+ *
+ * 用法: pingpong_bench [-m pingpong|latency|both] [-b 消息字节数列表] [-c 连接数列表] [-s 服务端subloop数列表]
+ *                      [-t 客户端线程数] [-d 每项秒数] [-P 起始端口] [-o 结果JSON] [-B 基准JSON] [-r 允许的回退百分比]
+ */
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpClient.h"
+#include "Logger.h"
+#include "Histogram.h"
+
+using namespace std::placeholders;
+using Clock = std::chrono::steady_clock;
+
+enum class Mode
+{
+	PingPong,
+	Latency
+};
+
+struct Options
+{
+	bool pingpong = true;
+	bool latency = true;
+	std::vector<size_t> sizes{ 16, 4096, 65536 };
+	std::vector<int> connections{ 1, 100 };
+	std::vector<int> serverThreads{ 1 };
+	int clientThreads = 1;
+	int seconds = 2;
+	uint16_t port = 6400;
+	std::string output;
+	std::string baseline;
+	double tolerance = 10.0;
+};
+
+struct CaseResult
+{
+	std::string name;
+	Mode mode;
+	size_t messageSize;
+	int connections;
+	int serverThreads;
+	double seconds;
+	uint64_t bytes;
+	uint64_t messages;
+	uint64_t errors;
+	Histogram histogram;
+};
+
+
+/// @brief 一个客户端连接 由TcpClient建立 回调都在所属的客户端loop中执行
+class Session : noncopyable
+{
+public:
+	Session(EventLoop* loop, const InetAddress& serverAddr, const std::string& name, Mode mode,
+		const std::string& message, std::atomic<int>* connected) :
+		_client(loop, serverAddr, name), _mode{ mode }, _message{ message }, _connected{ connected }
+	{
+		_client.setConnectionCallback(std::bind(&Session::onConnection, this, _1));
+		_client.setMessageCallback(std::bind(&Session::onMessage, this, _1, _2, _3));
+	}
+
+	~Session()
+	{
+		// 连接可能比Session活得久 之后的事件不能再回调Session
+		if (_conn)
+		{
+			_conn->setConnectionCallback(defaultConnectionCallback);
+			_conn->setMessageCallback(defaultMessageCallback);
+		}
+	}
+
+	void connect() { _client.connect(); }
+
+	// 以下在loop线程中调用
+	void start()
+	{
+		_running = true;
+		if (_conn)
+			sendMessage();
+	}
+
+	void stop() { _running = false; }
+
+	void collect(CaseResult* result) const
+	{
+		result->bytes += _bytes;
+		result->messages += _messages;
+		result->errors += _errors;
+		result->histogram.merge(_histogram);
+	}
+
+private:
+	void onConnection(const TcpConnectionPtr& conn)
+	{
+		if (conn->connected())
+		{
+			conn->setTcpNoDelay(true);
+			_conn = conn;
+			(*_connected)++;
+		}
+		else
+		{
+			if (_running)
+				_errors++;
+			_conn.reset();
+		}
+	}
+
+	void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp)
+	{
+		size_t readable = buf->readableBytes();
+		if (!_running)
+		{
+			buf->retrieveAll();
+			return;
+		}
+		_bytes += readable;
+
+		if (_mode == Mode::PingPong)
+		{
+			// 收到多少发回多少 数据在两端之间来回传递
+			conn->send(buf);
+			return;
+		}
+
+		buf->retrieveAll();
+		_received += readable;
+		if (_received < _message.size())
+			return;
+		_messages++;
+		_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _sent).count());
+		sendMessage();
+	}
+
+	void sendMessage()
+	{
+		_sent = Clock::now();
+		_received = 0;
+		_conn->send(_message);
+	}
+
+	TcpClient _client;
+	TcpConnectionPtr _conn;
+	Mode _mode;
+	const std::string& _message;
+	std::atomic<int>* _connected;
+	bool _running = false;
+	size_t _received = 0;
+	Clock::time_point _sent;
+	uint64_t _bytes = 0;
+	uint64_t _messages = 0;
+	uint64_t _errors = 0;
+	Histogram _histogram;
+};
+
+
+/// @brief 在loop线程中执行func并等待其完成
+static void runInLoopAndWait(EventLoop* loop, const std::function<void()>& func)
+{
+	std::promise<void> done;
+	loop->runInLoop([&func, &done]() {
+		func();
+		done.set_value();
+	});
+	done.get_future().wait();
+}
+
+
+static const char* modeName(Mode mode)
+{
+	return mode == Mode::PingPong ? "pingpong" : "latency";
+}
+
+
+static CaseResult runCase(const Options& options, Mode mode, size_t size, int connections, int serverThreads, uint16_t port)
+{
+	CaseResult result;
+	char name[128];
+	::snprintf(name, sizeof(name), "%s/size=%zu/conns=%d/threads=%d", modeName(mode), size, connections, serverThreads);
+	result.name = name;
+	result.mode = mode;
+	result.messageSize = size;
+	result.connections = connections;
+	result.serverThreads = serverThreads;
+	result.bytes = result.messages = result.errors = 0;
+
+	// 服务端: 一个base loop负责accept 回显由serverThreads个subloop处理
+	EventLoopThread serverThread(EventLoopThread::ThreadInitCallback(), "server");
+	EventLoop* serverLoop = serverThread.startLoop();
+	std::unique_ptr<TcpServer> server;
+	InetAddress serverAddr(port);
+	runInLoopAndWait(serverLoop, [&]() {
+		server.reset(new TcpServer(serverLoop, serverAddr, "PingPongServer"));
+		server->setConnectionCallback([](const TcpConnectionPtr& conn) {
+			if (conn->connected())
+				conn->setTcpNoDelay(true);
+		});
+		server->setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+			conn->send(buf);
+		});
+		server->setThreadNum(serverThreads);
+		server->start();
+	});
+
+	// 客户端: 连接平均分给各个客户端loop
+	const std::string message(size, 'p');
+	std::vector<std::unique_ptr<EventLoopThread>> clientThreads;
+	std::vector<EventLoop*> clientLoops;
+	for (int i = 0; i < options.clientThreads; i++)
+	{
+		clientThreads.emplace_back(new EventLoopThread(EventLoopThread::ThreadInitCallback(), "client"));
+		clientLoops.push_back(clientThreads.back()->startLoop());
+	}
+	std::vector<std::vector<std::unique_ptr<Session>>> sessions(clientLoops.size());
+	std::atomic<int> connected{ 0 };
+	for (int i = 0; i < connections; i++)
+	{
+		size_t index = i % clientLoops.size();
+		char sessionName[32];
+		::snprintf(sessionName, sizeof(sessionName), "client%d", i);
+		sessions[index].emplace_back(new Session(clientLoops[index], serverAddr, sessionName, mode, message, &connected));
+		sessions[index].back()->connect();
+	}
+
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(10 + connections / 1000);
+	while (connected < connections && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (connected < connections)
+		::fprintf(stderr, "%s: only %d of %d connections established\n", name, connected.load(), connections);
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < clientLoops.size(); i++)
+	{
+		clientLoops[i]->runInLoop([&sessions, i]() {
+			for (auto& session : sessions[i])
+				session->start();
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	for (size_t i = 0; i < clientLoops.size(); i++)
+	{
+		runInLoopAndWait(clientLoops[i], [&sessions, &result, i]() {
+			for (auto& session : sessions[i])
+			{
+				session->stop();
+				session->collect(&result);
+			}
+		});
+	}
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (mode == Mode::PingPong)
+		result.messages = result.bytes / size;
+
+	// 先关闭客户端 服务端随之关闭连接 再析构服务端
+	// 客户端关闭时接收缓冲区中还有数据会发送RST 服务端因此报告的连接错误不属于测量结果 这期间不输出日志
+	LogLevel savedLevel = Logger::logLevel();
+	Logger::setLogLevel(LogLevel::FATAL);
+	for (size_t i = 0; i < clientLoops.size(); i++)
+		runInLoopAndWait(clientLoops[i], [&sessions, i]() { sessions[i].clear(); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	runInLoopAndWait(serverLoop, [&server]() { server.reset(); });
+	Logger::setLogLevel(savedLevel);
+	return result;
+}
+
+
+static std::string toJson(const CaseResult& result)
+{
+	const Histogram& h = result.histogram;
+	char json[1024];
+	::snprintf(json, sizeof(json),
+		"{\"name\": \"%s\", \"mode\": \"%s\", \"message_size\": %zu, \"connections\": %d, \"server_threads\": %d, "
+		"\"seconds\": %.3f, \"bytes_per_sec\": %.0f, \"messages_per_sec\": %.0f, \"errors\": %lu, "
+		"\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+		result.name.c_str(), modeName(result.mode), result.messageSize, result.connections, result.serverThreads,
+		result.seconds, result.bytes / result.seconds, result.messages / result.seconds, result.errors,
+		h.percentile(50) / 1000.0, h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+	return json;
+}
+
+
+/// @brief 从一行结果中取出数值字段 结果文件由toJson生成 每项一行
+static double jsonNumber(const std::string& line, const std::string& key)
+{
+	std::string pattern = "\"" + key + "\": ";
+	size_t pos = line.find(pattern);
+	return pos == std::string::npos ? NAN : ::strtod(line.c_str() + pos + pattern.size(), nullptr);
+}
+
+static std::string jsonString(const std::string& line, const std::string& key)
+{
+	std::string pattern = "\"" + key + "\": \"";
+	size_t pos = line.find(pattern);
+	if (pos == std::string::npos)
+		return std::string();
+	pos += pattern.size();
+	return line.substr(pos, line.find('"', pos) - pos);
+}
+
+
+/// @brief 与基准逐项对比 返回是否有超出容忍度的回退
+static bool compareBaseline(const std::string& path, const std::vector<CaseResult>& results, double tolerance)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		::fprintf(stderr, "cannot open baseline %s\n", path.c_str());
+		return true;
+	}
+	std::map<std::string, std::string> baseline;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::string name = jsonString(line, "name");
+		if (!name.empty())
+			baseline[name] = line;
+	}
+
+	bool regressed = false;
+	::printf("\ncompared with %s (tolerance %.1f%%):\n", path.c_str(), tolerance);
+	for (const CaseResult& result : results)
+	{
+		auto it = baseline.find(result.name);
+		if (it == baseline.end())
+		{
+			::printf("  %-40s  (not in baseline)\n", result.name.c_str());
+			continue;
+		}
+
+		std::string current = toJson(result);
+		const char* key = result.mode == Mode::PingPong ? "bytes_per_sec" : "messages_per_sec";
+		double before = jsonNumber(it->second, key);
+		double after = jsonNumber(current, key);
+		double throughputChange = before > 0 ? (after - before) / before * 100 : 0;
+		bool bad = throughputChange < -tolerance;
+
+		double p99Change = 0;
+		if (result.mode == Mode::Latency)
+		{
+			double p99Before = jsonNumber(it->second, "p99_us");
+			double p99After = jsonNumber(current, "p99_us");
+			p99Change = p99Before > 0 ? (p99After - p99Before) / p99Before * 100 : 0;
+			bad = bad || p99Change > tolerance;
+		}
+
+		::printf("  %-40s  %s %+6.1f%%", result.name.c_str(), key, throughputChange);
+		if (result.mode == Mode::Latency)
+			::printf("  p99 %+6.1f%%", p99Change);
+		::printf("%s\n", bad ? "  REGRESSION" : "");
+		regressed = regressed || bad;
+	}
+	return regressed;
+}
+
+
+template <typename T>
+static std::vector<T> parseList(const char* arg)
+{
+	std::vector<T> values;
+	std::stringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		values.push_back(static_cast<T>(::strtoull(item.c_str(), nullptr, 10)));
+	return values;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:b:c:s:t:d:P:o:B:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			options.pingpong = ::strcmp(optarg, "latency") != 0;
+			options.latency = ::strcmp(optarg, "pingpong") != 0;
+			break;
+		case 'b': options.sizes = parseList<size_t>(optarg); break;
+		case 'c': options.connections = parseList<int>(optarg); break;
+		case 's': options.serverThreads = parseList<int>(optarg); break;
+		case 't': options.clientThreads = std::max(1, ::atoi(optarg)); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'o': options.output = optarg; break;
+		case 'B': options.baseline = optarg; break;
+		case 'r': options.tolerance = ::atof(optarg); break;
+		default:
+			::fprintf(stderr, "usage: %s [-m pingpong|latency|both] [-b sizes] [-c conns] [-s server threads] [-t client threads] "
+				"[-d seconds] [-P base port] [-o result.json] [-B baseline.json] [-r tolerance%%]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	// 上万个连接时客户端和服务端的fd都在这个进程里
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::vector<Mode> modes;
+	if (options.pingpong)
+		modes.push_back(Mode::PingPong);
+	if (options.latency)
+		modes.push_back(Mode::Latency);
+
+	// 每一项使用不同的端口 上一项留下的TIME_WAIT不会影响下一项建立连接
+	std::vector<CaseResult> results;
+	uint16_t port = options.port;
+	for (Mode mode : modes)
+		for (int serverThreads : options.serverThreads)
+			for (int connections : options.connections)
+				for (size_t size : options.sizes)
+				{
+					results.push_back(runCase(options, mode, size, connections, serverThreads, port++));
+					const CaseResult& r = results.back();
+					::printf("%-40s  %10.1f MiB/s  %10.0f msg/s", r.name.c_str(), r.bytes / r.seconds / (1024 * 1024), r.messages / r.seconds);
+					if (mode == Mode::Latency)
+						::printf("  p50 %.1fus  p99 %.1fus  p999 %.1fus", r.histogram.percentile(50) / 1000.0,
+							r.histogram.percentile(99) / 1000.0, r.histogram.percentile(99.9) / 1000.0);
+					if (r.errors > 0)
+						::printf("  errors %lu", r.errors);
+					::printf("\n");
+					::fflush(stdout);
+				}
+
+	if (!options.output.empty())
+	{
+		std::ofstream out(options.output);
+		out << "{\n  \"benchmark\": \"pingpong_bench\",\n  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); i++)
+			out << "    " << toJson(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+		out << "  ]\n}\n";
+		::printf("results written to %s\n", options.output.c_str());
+	}
+
+	if (!options.baseline.empty() && compareBaseline(options.baseline, results, options.tolerance))
+		return EXIT_FAILURE;
+	return 0;
+}
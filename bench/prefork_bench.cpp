@@ -0,0 +1,388 @@
+/*
+ * 多进程prefork模式(PreforkSupervisor)与单进程多线程模式的吞吐对比
+ * 先fork出服务端进程 再在本进程中启动客户端 服务端与客户端不共享任何线程
+ * -m prefork: 服务端为PreforkSupervisor 每个工作进程一个EventLoop(可再带-s个subloop) 以SO_REUSEPORT监听同一端口
+ * -m threads: 服务端为单个TcpServer 由mainloop accept后分发给-w个subloop
+ * 客户端用-t个loop线程维持共-c个pingpong连接 输出每秒完成的消息数
+ * -p prefork模式下把工作进程绑定到cpu上(setCpuPinning) threads模式下开启setCpuSteering
+ * -K 在压测进行到一半时kill掉一个工作进程 输出断开的连接数以及监管进程重新fork出的工作进程
+ *
+ * 用法: prefork_bench [-m prefork|threads] [-w 工作进程数/subloop数(默认cpu数)] [-s 每个工作进程的subloop数] [-p 绑定cpu]
+ *                     [-c 连接数] [-t 客户端线程数] [-d 秒数] [-b 消息字节数] [-P 端口] [-K]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "PreforkSupervisor.h"
+#include "Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool prefork = true;
+	int workers = 0;
+	int subloops = 0;
+	bool pinning = false;
+	int connections = 64;
+	int clientThreads = 1;
+	int seconds = 5;
+	size_t messageSize = 64;
+	uint16_t port = 6395;
+	bool killWorker = false;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+
+static void onStopSignal(int)
+{
+	g_stop = 1;
+}
+
+
+/// @brief 服务端进程中运行一个回显TcpServer 收到SIGTERM后退出loop
+static int runEchoServer(const Options& options, TcpServer::Option option, int threads)
+{
+	g_stop = 0;
+	::signal(SIGTERM, onStopSignal);
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "PreforkServer", option);
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		conn->send(buf);
+	});
+	server.setThreadNum(threads);
+	// 多线程模式下的-p 把各loop线程绑定到cpu上 与prefork模式下按进程绑定对应
+	server.setCpuSteering(option == TcpServer::Option::NoReusePort && options.pinning);
+	server.start();
+	loop.runEvery(0.1, [&loop]() {
+		if (g_stop)
+			loop.quit();
+	});
+	loop.loop();
+	return 0;
+}
+
+
+static int runServer(const Options& options)
+{
+	if (!options.prefork)
+		return runEchoServer(options, TcpServer::Option::NoReusePort, options.workers);
+
+	PreforkSupervisor supervisor(options.workers, [&options](int) {
+		return runEchoServer(options, TcpServer::Option::ReusePort, options.subloops);
+	});
+	supervisor.setCpuPinning(options.pinning);
+	return supervisor.run();
+}
+
+
+static int connectTo(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/// @brief 一个pingpong连接 收齐回显后立即发送下一条 对端关闭后记为断开
+class PingPongConnection
+{
+public:
+	PingPongConnection(EventLoop* loop, int fd, const std::string& message) :
+		_fd{ fd }, _channel(loop, fd), _message{ message }
+	{
+		_channel.setReadCallback(std::bind(&PingPongConnection::handleRead, this));
+	}
+
+	~PingPongConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		::write(_fd, _message.data(), _message.size());
+	}
+
+	void pause() { _channel.disableAll(); }
+
+	uint64_t completed() const { return _completed; }
+	bool closed() const { return _closed; }
+
+private:
+	void handleRead()
+	{
+		int savedErrno = 0;
+		if (_input.readFd(_fd, &savedErrno) <= 0)
+		{
+			_closed = true;
+			_channel.disableAll();
+			return;
+		}
+		if (_input.readableBytes() < _message.size())
+			return;
+		_input.retrieveAll();
+		_completed++;
+		::write(_fd, _message.data(), _message.size());
+	}
+
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::string& _message;
+	uint64_t _completed = 0;
+	bool _closed = false;
+};
+
+
+/// @brief 一个客户端loop线程及其上的连接
+class ClientThread
+{
+public:
+	ClientThread(const Options& options, int connections) :
+		_thread(EventLoopThread::ThreadInitCallback(), "client"), _options{ options }, _connections{ connections },
+		_message(options.messageSize, 'p')
+	{
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop([this]() {
+			for (int i = 0; i < _connections; i++)
+			{
+				int fd = connectTo(_options.port);
+				if (fd < 0)
+					continue;
+				int one = 1;
+				::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+				_conns.emplace_back(new PingPongConnection(_loop, fd, _message));
+			}
+			for (auto&& conn : _conns)
+				conn->start();
+		});
+	}
+
+	// 返回完成的消息数与被服务端断开的连接数 连接停止收发但仍保持打开
+	std::pair<uint64_t, int> stop()
+	{
+		std::promise<std::pair<uint64_t, int>> done;
+		_loop->runInLoop([this, &done]() {
+			uint64_t completed = 0;
+			int closed = 0;
+			for (auto&& conn : _conns)
+			{
+				conn->pause();
+				completed += conn->completed();
+				closed += conn->closed();
+			}
+			done.set_value({ completed, closed });
+		});
+		return done.get_future().get();
+	}
+
+	void close()
+	{
+		std::promise<void> done;
+		_loop->runInLoop([this, &done]() {
+			_conns.clear();
+			done.set_value();
+		});
+		done.get_future().get();
+	}
+
+private:
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::string _message;
+	std::vector<std::unique_ptr<PingPongConnection>> _conns;
+};
+
+
+/// @brief 服务端进程的子进程 即prefork模式下的工作进程
+static std::vector<pid_t> childrenOf(pid_t pid)
+{
+	std::vector<pid_t> children;
+	std::ifstream in("/proc/" + std::to_string(pid) + "/task/" + std::to_string(pid) + "/children");
+	pid_t child;
+	while (in >> child)
+		children.push_back(child);
+	return children;
+}
+
+
+static std::string pidList(const std::vector<pid_t>& pids)
+{
+	std::string list;
+	for (pid_t pid : pids)
+		list += (list.empty() ? "" : " ") + std::to_string(pid);
+	return list;
+}
+
+
+static int runClients(const Options& options, pid_t server)
+{
+	// 等服务端开始监听 prefork模式下还要等所有工作进程都起来
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+	while (Clock::now() < deadline)
+	{
+		int fd = connectTo(options.port);
+		if (fd >= 0)
+		{
+			::close(fd);
+			if (!options.prefork || static_cast<int>(childrenOf(server).size()) >= options.workers)
+				break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::vector<std::unique_ptr<ClientThread>> clients;
+	for (int i = 0; i < options.clientThreads; i++)
+	{
+		int count = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+		clients.emplace_back(new ClientThread(options, count));
+	}
+
+	Clock::time_point start = Clock::now();
+	for (auto&& client : clients)
+		client->start();
+
+	std::vector<pid_t> before, after;
+	if (options.killWorker && options.prefork)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.seconds * 500));
+		before = childrenOf(server);
+		if (!before.empty())
+			::kill(before.front(), SIGKILL);
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.seconds * 500));
+		after = childrenOf(server);
+	}
+	else
+		std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	uint64_t completed = 0;
+	int closed = 0;
+	for (auto&& client : clients)
+	{
+		auto [messages, lost] = client->stop();
+		completed += messages;
+		closed += lost;
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	::printf("  messages: %lu  messages/s: %.0f  connections closed by server: %d\n", completed, completed / elapsed, closed);
+	if (!before.empty())
+		::printf("  killed worker %d, workers before: %s  after: %s\n", before.front(), pidList(before).c_str(), pidList(after).c_str());
+	::fflush(stdout);
+
+	// 先让服务端退出再关闭客户端连接 服务端在退出时关闭连接 不会因为客户端断开而报错
+	::kill(server, SIGTERM);
+	int serverStatus = 0;
+	::waitpid(server, &serverStatus, 0);
+	for (auto&& client : clients)
+		client->close();
+	return 0;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:w:s:pc:t:d:b:P:K")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': options.prefork = ::strcmp(optarg, "threads") != 0; break;
+		case 'w': options.workers = ::atoi(optarg); break;
+		case 's': options.subloops = ::atoi(optarg); break;
+		case 'p': options.pinning = true; break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'b': options.messageSize = ::strtoul(optarg, nullptr, 10); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'K': options.killWorker = true; break;
+		default:
+			::fprintf(stderr, "usage: %s [-m prefork|threads] [-w workers] [-s subloops per worker] [-p] [-c connections] [-t client threads] [-d seconds] [-b message bytes] [-P port] [-K]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	if (options.workers <= 0)
+		options.workers = std::max(1, static_cast<int>(::sysconf(_SC_NPROCESSORS_ONLN)));
+	if (options.clientThreads <= 0)
+		options.clientThreads = 1;
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// 在创建任何线程之前fork出服务端进程
+	pid_t server = ::fork();
+	if (server < 0)
+	{
+		::perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (server == 0)
+		::exit(runServer(options));
+
+	::printf("prefork_bench: %s, %d %s%s, %d connections from %d client threads, %zu bytes\n",
+		options.prefork ? "prefork" : "threads", options.workers, options.prefork ? "worker processes" : "subloops",
+		options.pinning ? " pinned" : "", options.connections, options.clientThreads, options.messageSize);
+	::fflush(stdout);
+	return runClients(options, server);
+}
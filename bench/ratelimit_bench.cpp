@@ -0,0 +1,272 @@
+/*
+ * 检查TcpServer::setTrafficLimits的限速效果 进程内启动一个服务器 -c个客户端连接各用一个线程
+ * -m ingress: 客户端用阻塞socket尽快发送 服务端读入后丢弃 统计服务端每个连接读入的字节
+ * -m egress: 服务端在连接建立和每次写完成时发送64KB 客户端尽快读取 统计客户端每个连接收到的字节
+ * -L conn|peer|total: 限速作用在每个连接、每个对端ip还是整个server上 -r为这一层的速率 为0时不限速
+ * 客户端连接依次绑定127.0.0.1~127.0.0.(-p)作为源地址 peer限速时每个ip一份额度
+ * 输出聚合吞吐与按这一层折算的期望值 以及每个连接吞吐的最小/平均/最大值
+ * -r设为远大于实际吞吐的值时限速器从不触发 与-r 0对比即为每次读写扣令牌的开销
+ *
+ * 用法: ratelimit_bench [-m ingress|egress] [-L conn|peer|total] [-r KB/s] [-M 消息/s] [-c 连接数] [-p 源ip数] [-s 服务端subloop数] [-d 秒数] [-P 端口]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "RateLimiter.h"
+#include "Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool ingress = true;
+	std::string scope = "conn";
+	double rate = 1024 * 1024;
+	double messages = 0;
+	int connections = 8;
+	int peers = 2;
+	int serverThreads = 2;
+	int seconds = 3;
+	uint16_t port = 6401;
+};
+
+static std::atomic<bool> g_measuring{ false };
+static const std::string g_chunk(64 * 1024, 'r');
+
+// 服务端每个连接读入的字节 计数器同时保存在连接的context中 限速暂停读的连接察觉不到客户端关闭 不能等连接回调时再收集
+static std::mutex g_mutex;
+static std::vector<std::shared_ptr<std::atomic<size_t>>> g_serverBytes;
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:L:r:M:c:p:s:d:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': options.ingress = ::strcmp(optarg, "egress") != 0; break;
+		case 'L': options.scope = optarg; break;
+		case 'r': options.rate = ::atof(optarg) * 1024; break;
+		case 'M': options.messages = ::atof(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 'p': options.peers = std::max(1, ::atoi(optarg)); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-m ingress|egress] [-L conn|peer|total] [-r KB/s] [-M messages/s] [-c connections] [-p source ips] [-s server threads] [-d seconds] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	if (options.scope != "conn" && options.scope != "peer" && options.scope != "total")
+	{
+		::fprintf(stderr, "unknown scope %s\n", options.scope.data());
+		::exit(EXIT_FAILURE);
+	}
+	return options;
+}
+
+
+static int connectFrom(int index, const Options& options)
+{
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK + index % options.peers);
+	if (::bind(fd, (const sockaddr*)&addr, sizeof(addr)) == 0)
+	{
+		addr.sin_port = ::htons(options.port);
+		addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+		if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0)
+			return fd;
+	}
+	::close(fd);
+	return -1;
+}
+
+
+// 一个客户端连接 ingress时尽快发送 egress时尽快读取并计数 到时间后停止计数 由主线程关闭socket结束
+static void runClient(int fd, bool ingress, std::atomic<size_t>* received)
+{
+	std::vector<char> buf(64 * 1024, 'r');
+	for (;;)
+	{
+		ssize_t n = ingress ? ::send(fd, buf.data(), buf.size(), MSG_NOSIGNAL) : ::recv(fd, buf.data(), buf.size(), 0);
+		if (n <= 0)
+			return;
+		if (!ingress && g_measuring.load(std::memory_order_relaxed))
+			*received += n;
+	}
+}
+
+
+static void report(const Options& options, std::vector<size_t> bytes, double seconds)
+{
+	double total = 0;
+	for (size_t n : bytes)
+		total += n;
+	std::sort(bytes.begin(), bytes.end());
+	double expected = 0;
+	if (options.rate > 0)
+	{
+		int shares = options.scope == "conn" ? options.connections : options.scope == "peer" ? std::min(options.peers, options.connections) : 1;
+		expected = options.rate * shares;
+	}
+	double mb = 1024.0 * 1024;
+	::printf("ratelimit_bench: %s, limit %s %.0f KB/s%s, %d connections from %d ips, %d server threads, %.1fs\n", options.ingress ? "ingress" : "egress",
+		options.scope.data(), options.rate / 1024, options.messages > 0 ? (" " + std::to_string(static_cast<int>(options.messages)) + " msgs/s").data() : "",
+		options.connections, options.peers, options.serverThreads, seconds);
+	if (expected > 0)
+		::printf("  aggregate: %.2f MB/s  expected: %.2f MB/s (%.1f%%)\n", total / seconds / mb, expected / mb, total / seconds / expected * 100);
+	else
+		::printf("  aggregate: %.2f MB/s  (no byte limit)\n", total / seconds / mb);
+	if (!bytes.empty())
+		::printf("  per connection MB/s: min %.3f  avg %.3f  max %.3f\n", bytes.front() / seconds / mb, total / bytes.size() / seconds / mb,
+			bytes.back() / seconds / mb);
+	::fflush(stdout);
+}
+
+
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::vector<int> fds;
+	for (int i = 0; i < options.connections; ++i)
+	{
+		int fd = connectFrom(i, options);
+		if (fd < 0)
+		{
+			::fprintf(stderr, "connect failed\n");
+			loop->quit();
+			return;
+		}
+		fds.push_back(fd);
+	}
+	std::vector<std::atomic<size_t>> received(fds.size());
+	std::vector<std::thread> clients;
+	for (size_t i = 0; i < fds.size(); ++i)
+		clients.emplace_back(runClient, fds[i], options.ingress, &received[i]);
+
+	// 先跑0.5秒把突发额度用掉 再开始计数
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	Clock::time_point start = Clock::now();
+	g_measuring = true;
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+	g_measuring = false;
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Logger::setLogLevel(LogLevel::FATAL);
+	for (int fd : fds)
+		::shutdown(fd, SHUT_RDWR);
+	for (std::thread& client : clients)
+		client.join();
+	for (int fd : fds)
+		::close(fd);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::vector<size_t> bytes;
+	if (options.ingress)
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		for (const std::shared_ptr<std::atomic<size_t>>& n : g_serverBytes)
+			bytes.push_back(n->load());
+	}
+	else
+	{
+		for (const std::atomic<size_t>& n : received)
+			bytes.push_back(n.load());
+	}
+	report(options, std::move(bytes), seconds);
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	TrafficLimits limits;
+	if (options.ingress)
+	{
+		limits.ingressBytesPerSecond = options.rate;
+		limits.ingressMessagesPerSecond = options.messages;
+	}
+	else
+	{
+		limits.egressBytesPerSecond = options.rate;
+		limits.egressMessagesPerSecond = options.messages;
+	}
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "RateLimitServer");
+	if (options.scope == "conn")
+		server.setTrafficLimits(limits);
+	else if (options.scope == "peer")
+		server.setTrafficLimits(TrafficLimits(), limits);
+	else
+		server.setTrafficLimits(TrafficLimits(), TrafficLimits(), limits);
+	bool ingress = options.ingress;
+	server.setConnectionCallback([ingress](const TcpConnectionPtr& conn) {
+		if (!conn->connected())
+			return;
+		if (ingress)
+		{
+			auto counter = std::make_shared<std::atomic<size_t>>(0);
+			conn->setContext(counter);
+			std::lock_guard<std::mutex> lock(g_mutex);
+			g_serverBytes.push_back(std::move(counter));
+		}
+		else
+			conn->send(g_chunk);
+	});
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		if (g_measuring.load(std::memory_order_relaxed))
+			*std::any_cast<std::shared_ptr<std::atomic<size_t>>>(conn->getContext()) += buf->readableBytes();
+		buf->retrieveAll();
+	});
+	if (!ingress)
+	{
+		server.setWriteCompleteCallback([](const TcpConnectionPtr& conn) {
+			if (conn->connected())
+				conn->send(g_chunk);
+		});
+	}
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
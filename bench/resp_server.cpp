@@ -0,0 +1,457 @@
+/*
+ * 内存版GET/SET redis服务器 用于对比流水线下的吞吐
+ * 默认只作为压测目标运行 可以直接用redis-benchmark/redis-cli访问 如:
+ *     redis-benchmark -p 6390 -t set,get -n 1000000 -P 64 -c 50
+ * 指定 -d 秒数 时在进程内启动流水线客户端 交替发送SET/GET 统计每秒命令数和每批次延迟
+ *
+ * 用法: resp_server [-s 服务端subloop数] [-P 端口] [-d 秒数] [-c 连接数] [-t 客户端线程数] [-p 流水线深度] [-v value字节数]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "RespServer.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int serverThreads = 1;
+	uint16_t port = 6390;
+	int seconds = 0;
+	int connections = 50;
+	int clientThreads = 1;
+	int pipeline = 16;
+	size_t valueSize = 3;
+};
+
+
+/// @brief 按key哈希分片加锁的内存kv 多个subloop并发访问时只在同一分片上竞争
+class Store
+{
+public:
+	void set(std::string_view key, std::string_view value)
+	{
+		Shard& shard = shardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.map.find(key);
+		if (it != shard.map.end())
+			it->second.assign(value);
+		else
+			shard.map.emplace(key, value);
+	}
+
+	// 找到时把value编码进writer 在锁内完成拷贝
+	bool get(std::string_view key, RespWriter* writer)
+	{
+		Shard& shard = shardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.map.find(key);
+		if (it == shard.map.end())
+			return false;
+		writer->bulkString(it->second);
+		return true;
+	}
+
+	bool del(std::string_view key)
+	{
+		Shard& shard = shardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.map.find(key);
+		if (it == shard.map.end())
+			return false;
+		shard.map.erase(it);
+		return true;
+	}
+
+private:
+	static constexpr size_t kShards = 16;
+
+	// 支持用string_view直接查找 不为每次GET构造临时string
+	struct Hash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+	};
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, std::string, Hash, std::equal_to<>> map;
+	};
+
+	Shard& shardOf(std::string_view key) { return _shards[Hash()(key) % kShards]; }
+
+	Shard _shards[kShards];
+};
+
+
+static void wrongArgs(const RespCommand& command, RespWriter* writer)
+{
+	std::string message("ERR wrong number of arguments for '");
+	message.append(command.name());
+	message.append("' command");
+	writer->error(message);
+}
+
+
+static void handleCommand(Store* store, const RespCommand& command, RespWriter* writer)
+{
+	if (command.is("GET"))
+	{
+		if (command.size() != 2)
+			wrongArgs(command, writer);
+		else if (!store->get(command[1], writer))
+			writer->null();
+	}
+	else if (command.is("SET"))
+	{
+		if (command.size() != 3)
+			return wrongArgs(command, writer);
+		store->set(command[1], command[2]);
+		writer->simpleString("OK");
+	}
+	else if (command.is("DEL"))
+	{
+		if (command.size() < 2)
+			return wrongArgs(command, writer);
+		int64_t deleted = 0;
+		for (size_t i = 1; i < command.size(); i++)
+			deleted += store->del(command[i]) ? 1 : 0;
+		writer->integer(deleted);
+	}
+	else if (command.is("PING"))
+	{
+		if (command.size() > 1)
+			writer->bulkString(command[1]);
+		else
+			writer->simpleString("PONG");
+	}
+	else if (command.is("HELLO"))
+	{
+		int protocol = writer->protocol();
+		if (command.size() > 1)
+		{
+			protocol = ::atoi(std::string(command[1]).c_str());
+			if (protocol != 2 && protocol != 3)
+				return writer->error("NOPROTO unsupported protocol version");
+		}
+		writer->setProtocol(protocol);
+		writer->mapHeader(3);
+		writer->bulkString("server");
+		writer->bulkString("mymuduo");
+		writer->bulkString("proto");
+		writer->integer(protocol);
+		writer->bulkString("mode");
+		writer->bulkString("standalone");
+	}
+	else if (command.is("CONFIG") || command.is("COMMAND"))
+	{
+		// redis-benchmark启动时会查询配置 回复空数组即可
+		writer->arrayHeader(0);
+	}
+	else
+	{
+		std::string message("ERR unknown command '");
+		message.append(command.name());
+		message.append("'");
+		writer->error(message);
+	}
+}
+
+
+/// @brief 一个客户端长连接 每次发送pipeline个命令 全部回复收齐后再发送下一批
+class ClientConnection
+{
+public:
+	ClientConnection(EventLoop* loop, int fd, const std::string& commands, int pipeline, Histogram* histogram) :
+		_fd{ fd }, _channel(loop, fd), _commands{ commands }, _pipeline{ pipeline }, _outstanding{ 0 }, _histogram{ histogram }
+	{
+		_channel.setReadCallback(std::bind(&ClientConnection::handleRead, this));
+	}
+
+	~ClientConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		sendBatch();
+	}
+
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void sendBatch()
+	{
+		_batchStart = Clock::now();
+		_outstanding = _pipeline;
+		ssize_t n = ::write(_fd, _commands.data(), _commands.size());
+		if (n != static_cast<ssize_t>(_commands.size()))
+			_errors++;
+	}
+
+	// 解析一条回复 不完整时返回0 否则返回回复的字节数
+	size_t replyLength(const char* begin, size_t readable)
+	{
+		const char* crlf = static_cast<const char*>(::memmem(begin, readable, "\r\n", 2));
+		if (crlf == nullptr)
+			return 0;
+		size_t lineLen = crlf - begin + 2;
+		if (begin[0] == '-')
+			_errors++;
+		if (begin[0] != '$')
+			return lineLen;
+		long length = ::strtol(begin + 1, nullptr, 10);
+		if (length < 0)
+			return lineLen;
+		size_t total = lineLen + length + 2;
+		return total <= readable ? total : 0;
+	}
+
+	void handleRead()
+	{
+		int savedErrno = 0;
+		ssize_t n = _input.readFd(_fd, &savedErrno);
+		if (n <= 0)
+		{
+			_errors++;
+			_channel.disableAll();
+			return;
+		}
+
+		while (_outstanding > 0 && _input.readableBytes() > 0)
+		{
+			size_t len = replyLength(_input.peek(), _input.readableBytes());
+			if (len == 0)
+				return;
+			_input.retrieve(len);
+			_completed++;
+			_outstanding--;
+		}
+		if (_outstanding > 0)
+			return;
+
+		auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _batchStart);
+		_histogram->record(latency.count());
+		sendBatch();
+	}
+
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::string& _commands;
+	int _pipeline;
+	int _outstanding;
+	Clock::time_point _batchStart;
+	Histogram* _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+/// @brief 一个客户端线程 拥有自己的EventLoop和一组连接
+class ClientWorker
+{
+public:
+	ClientWorker(const Options& options, int connections) :
+		_thread(nullptr, "client"), _options{ options }, _connections{ connections }
+	{
+		// 一批命令交替为SET和GET 预先编码好 发送时不再做任何计算
+		const std::string value(options.valueSize, 'v');
+		char command[128];
+		for (int i = 0; i < options.pipeline; i++)
+		{
+			std::string key = "key:" + std::to_string(i / 2);
+			if (i % 2 == 0)
+				::snprintf(command, sizeof(command), "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n", key.size(), key.c_str(), value.size());
+			else
+				::snprintf(command, sizeof(command), "*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n", key.size(), key.c_str());
+			_commands.append(command);
+			if (i % 2 == 0)
+				_commands.append(value).append("\r\n");
+		}
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop(std::bind(&ClientWorker::connectAll, this));
+	}
+
+	// 在loop线程中关闭所有连接 并返回统计结果
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			for (auto&& conn : _conns)
+			{
+				_completed += conn->completed();
+				_errors += conn->errors();
+			}
+			_conns.clear();
+			done.set_value();
+		});
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+
+private:
+	void connectAll()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		for (int i = 0; i < _connections; i++)
+		{
+			int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+			{
+				::perror("connect");
+				::close(fd);
+				continue;
+			}
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			_conns.emplace_back(new ClientConnection(_loop, fd, _commands, _options.pipeline, &_histogram));
+		}
+		for (auto&& conn : _conns)
+			conn->start();
+	}
+
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::string _commands;
+	std::vector<std::unique_ptr<ClientConnection>> _conns;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "s:P:d:c:t:p:v:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 'p': options.pipeline = ::atoi(optarg); break;
+		case 'v': options.valueSize = ::strtoul(optarg, nullptr, 10); break;
+		default:
+			::fprintf(stderr, "usage: %s [-s server threads] [-P port] [-d seconds] [-c conns] [-t client threads] [-p pipeline] [-v value bytes]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+/// @brief 进程内压测: 等待服务器开始监听后启动客户端 到时间后汇总结果并退出主loop
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::vector<std::unique_ptr<ClientWorker>> workers;
+	for (int i = 0; i < options.clientThreads; i++)
+	{
+		int conns = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+		workers.emplace_back(new ClientWorker(options, conns));
+	}
+
+	Clock::time_point start = Clock::now();
+	for (auto&& worker : workers)
+		worker->start();
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	for (auto&& worker : workers)
+	{
+		std::promise<void> done;
+		worker->stop(done);
+		done.get_future().wait();
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram total;
+	uint64_t completed = 0, errors = 0;
+	for (auto&& worker : workers)
+	{
+		total.merge(worker->histogram());
+		completed += worker->completed();
+		errors += worker->errors();
+	}
+
+	::printf("resp_server: %d connections, %d client threads, %d server threads, pipeline %d, %zu-byte values, %.2fs\n",
+		options.connections, options.clientThreads, options.serverThreads, options.pipeline, options.valueSize, elapsed);
+	::printf("  commands: %lu  errors: %lu  commands/s: %.0f\n", completed, errors, completed / elapsed);
+	::printf("  batch latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		total.mean() / 1000, total.percentile(50) / 1000.0, total.percentile(99) / 1000.0,
+		total.percentile(99.9) / 1000.0, total.max() / 1000.0);
+	::fflush(stdout);
+
+	workers.clear();
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+
+	EventLoop loop;
+	Store store;
+	RespServer server(&loop, InetAddress(options.port), "RespServer");
+	server.setCommandCallback([&store](const TcpConnectionPtr&, const RespCommand& command, RespWriter* writer) {
+		handleCommand(&store, command, writer);
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller;
+	if (options.seconds > 0)
+		controller = std::thread(runClients, std::cref(options), &loop);
+
+	loop.loop();
+	if (controller.joinable())
+		controller.join();
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * 突发流量下连接缓冲区占用的内存随时间的变化 检查TcpServer::setBufferShrink能否在突发过后归还内存
+ * 进程内启动一个回显服务器 -c个长连接每隔-i秒做一次突发: 每个连接先发完-b KB再读回全部回显
+ * 客户端发送期间不读 回显堆积在服务端的发送缓冲区中 把缓冲区撑大
+ * -S on: 缓冲区容量超过-C KB时 清空并空闲-t秒后缩回初始大小
+ * -S off: 不收缩 缓冲区保持突发时的最大容量直到连接关闭
+ * 两种方式都先调用Buffer::pinMmapThreshold 大缓冲区单独mmap 收缩时才能直接还给系统
+ * 每-r毫秒采样一次进程的常驻内存 输出时间线以及空闲期间的平均值
+ *
+ * 用法: shrink_bench [-S on|off] [-c 连接数] [-b 突发KB] [-n 突发次数] [-i 突发间隔秒] [-C 收缩阈值KB] [-t 空闲秒数] [-s 服务端subloop数] [-r 采样间隔ms] [-P 端口]
+ */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <fstream>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool shrink = true;
+	int connections = 8;
+	size_t burst = 16 * 1024 * 1024;	// 回环上的socket缓冲区就能装下几MB 突发要远大于它才会堆积在服务端的发送缓冲区中
+	int bursts = 3;
+	double interval = 2;
+	size_t shrinkCapacity = 64 * 1024;
+	double idleSeconds = 0.5;
+	int serverThreads = 2;
+	int sampleMs = 100;
+	uint16_t port = 6399;
+};
+
+
+static int connectTo(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static size_t residentBytes()
+{
+	std::ifstream statm("/proc/self/statm");
+	size_t pages = 0, resident = 0;
+	statm >> pages >> resident;
+	return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "S:c:b:n:i:C:t:s:r:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'S': options.shrink = ::strcmp(optarg, "off") != 0; break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 'b': options.burst = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 'n': options.bursts = ::atoi(optarg); break;
+		case 'i': options.interval = ::atof(optarg); break;
+		case 'C': options.shrinkCapacity = ::strtoul(optarg, nullptr, 10) * 1024; break;
+		case 't': options.idleSeconds = ::atof(optarg); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'r': options.sampleMs = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-S on|off] [-c connections] [-b burst KB] [-n bursts] [-i interval s] [-C shrink capacity KB] [-t idle s] [-s server threads] [-r sample ms] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+// 所有连接依次发完一次突发 再依次读回全部回显
+static bool burst(const std::vector<int>& fds, size_t bytes)
+{
+	std::vector<char> chunk(64 * 1024, 'b');
+	for (int fd : fds)
+	{
+		size_t sent = 0;
+		while (sent < bytes)
+		{
+			ssize_t n = ::send(fd, chunk.data(), std::min(chunk.size(), bytes - sent), MSG_NOSIGNAL);
+			if (n <= 0)
+				return false;
+			sent += n;
+		}
+	}
+	for (int fd : fds)
+	{
+		size_t received = 0;
+		while (received < bytes)
+		{
+			ssize_t n = ::recv(fd, chunk.data(), std::min(chunk.size(), bytes - received), 0);
+			if (n <= 0)
+				return false;
+			received += n;
+		}
+	}
+	return true;
+}
+
+
+static void runClients(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::vector<int> fds;
+	for (int i = 0; i < options.connections; ++i)
+	{
+		int fd = connectTo(options.port);
+		if (fd < 0)
+		{
+			::fprintf(stderr, "connect failed\n");
+			loop->quit();
+			return;
+		}
+		fds.push_back(fd);
+	}
+
+	// 采样线程 idle为true时的样本计入空闲期间的平均值
+	std::atomic<bool> stop{ false }, idle{ true };
+	std::vector<std::pair<double, size_t>> samples;
+	double idleSum = 0;
+	int idleSamples = 0;
+	size_t peak = 0;
+	Clock::time_point start = Clock::now();
+	std::thread sampler([&]() {
+		while (!stop.load())
+		{
+			size_t rss = residentBytes();
+			samples.emplace_back(std::chrono::duration<double>(Clock::now() - start).count(), rss);
+			peak = std::max(peak, rss);
+			if (idle.load())
+			{
+				idleSum += rss;
+				idleSamples++;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(options.sampleMs));
+		}
+	});
+
+	bool ok = true;
+	for (int i = 0; i < options.bursts && ok; ++i)
+	{
+		idle = false;
+		Clock::time_point burstStart = Clock::now();
+		ok = burst(fds, options.burst);
+		idle = true;
+		std::this_thread::sleep_until(burstStart + std::chrono::duration<double>(options.interval));
+	}
+	stop = true;
+	sampler.join();
+
+	::printf("shrink_bench: shrink %s (capacity %zu KB, idle %.2fs), %d connections, %d bursts of %zu KB every %.1fs, %d server threads%s\n",
+		options.shrink ? "on" : "off", options.shrinkCapacity / 1024, options.idleSeconds, options.connections, options.bursts,
+		options.burst / 1024, options.interval, options.serverThreads, ok ? "" : " (burst failed)");
+	::printf("  rss over time (s, MB):");
+	for (size_t i = 0; i < samples.size(); i += std::max<size_t>(1, samples.size() / 20))
+		::printf(" %.1f:%.0f", samples[i].first, samples[i].second / 1024.0 / 1024);
+	::printf("\n  peak rss: %.1f MB  mean rss while idle: %.1f MB  final rss: %.1f MB\n", peak / 1024.0 / 1024,
+		idleSamples > 0 ? idleSum / idleSamples / 1024 / 1024 : 0.0, samples.empty() ? 0.0 : samples.back().second / 1024.0 / 1024);
+	::fflush(stdout);
+
+	Logger::setLogLevel(LogLevel::FATAL);
+	for (int fd : fds)
+		::close(fd);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Buffer::pinMmapThreshold();
+
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "ShrinkServer");
+	server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+		conn->send(buf);
+	});
+	if (options.shrink)
+		server.setBufferShrink(options.shrinkCapacity, options.idleSeconds);
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runClients, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * 按cpu选择subloop(TcpServer::setCpuSteering)的检查与压测
+ *
+ * -m check: 检查选择是否正确 每个cpu上绑定一个客户端线程建立若干连接 回环连接的数据包由发送方所在的cpu处理
+ *           服务端在连接回调所在的loop线程中比较sched_getcpu()与客户端发来的cpu编号 有连接被交给其他cpu上的loop时返回非零
+ * -m bench: 每个cpu上绑定一个客户端线程 各自在自己的连接上做pingpong 对比开启(-S on)与关闭(-S off)时的吞吐
+ *           同时用perf_event_open统计整个进程的cache miss、cpu迁移和上下文切换次数(硬件计数器不可用时只输出软件计数)
+ *
+ * 用法: steering_bench [-m check|bench] [-a main|multi] [-S on|off] [-s 服务端subloop数(默认cpu数)] [-c 每个cpu的连接数]
+ *                       [-d 秒数] [-b 消息字节数] [-P 端口]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+using namespace std::placeholders;
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	bool check = true;
+	bool multiAcceptor = false;
+	bool steering = true;
+	int serverThreads = 0;
+	int connections = 16;
+	int seconds = 5;
+	size_t messageSize = 64;
+	uint16_t port = 6394;
+};
+
+static int g_cpus = 1;
+
+
+static void pinToCpu(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (::sched_setaffinity(0, sizeof(set), &set) < 0)
+		::perror("sched_setaffinity");
+}
+
+static int connectTo(uint16_t port)
+{
+	sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = ::htons(port);
+	addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/// @brief 进程级的perf计数器 inherit使之后创建的线程也被计入
+class PerfCounter
+{
+public:
+	PerfCounter(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr;
+		::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.inherit = 1;
+		attr.disabled = 1;
+		_fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+	~PerfCounter()
+	{
+		if (_fd >= 0)
+			::close(_fd);
+	}
+
+	bool available() const { return _fd >= 0; }
+	void enable() { if (_fd >= 0) ::ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0); }
+	void disable() { if (_fd >= 0) ::ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0); }
+	uint64_t value() const
+	{
+		uint64_t count = 0;
+		if (_fd < 0 || ::read(_fd, &count, sizeof(count)) != sizeof(count))
+			return 0;
+		return count;
+	}
+
+private:
+	int _fd;
+};
+
+
+/// @brief 一个pingpong连接 收齐回显后立即发送下一条
+class PingPongConnection
+{
+public:
+	PingPongConnection(EventLoop* loop, int fd, const std::string& message) :
+		_fd{ fd }, _channel(loop, fd), _message{ message }
+	{
+		_channel.setReadCallback(std::bind(&PingPongConnection::handleRead, this));
+	}
+
+	~PingPongConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		::write(_fd, _message.data(), _message.size());
+	}
+
+	uint64_t completed() const { return _completed; }
+
+private:
+	void handleRead()
+	{
+		int savedErrno = 0;
+		if (_input.readFd(_fd, &savedErrno) <= 0)
+		{
+			_channel.disableAll();
+			return;
+		}
+		if (_input.readableBytes() < _message.size())
+			return;
+		_input.retrieveAll();
+		_completed++;
+		::write(_fd, _message.data(), _message.size());
+	}
+
+	int _fd;
+	Channel _channel;
+	Buffer _input;
+	const std::string& _message;
+	uint64_t _completed = 0;
+};
+
+
+/// @brief 绑定在一个cpu上的客户端loop线程
+class CpuClient
+{
+public:
+	CpuClient(const Options& options, int cpu) :
+		_thread(EventLoopThread::ThreadInitCallback(), "client"), _options{ options }, _cpu{ cpu }, _message(options.messageSize, 'p')
+	{
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop([this]() {
+			pinToCpu(_cpu);
+			for (int i = 0; i < _options.connections; i++)
+			{
+				int fd = connectTo(_options.port);
+				if (fd < 0)
+					continue;
+				int one = 1;
+				::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+				_conns.emplace_back(new PingPongConnection(_loop, fd, _message));
+			}
+			for (auto&& conn : _conns)
+				conn->start();
+		});
+	}
+
+	uint64_t stop()
+	{
+		std::promise<uint64_t> done;
+		_loop->runInLoop([this, &done]() {
+			uint64_t completed = 0;
+			for (auto&& conn : _conns)
+				completed += conn->completed();
+			_conns.clear();
+			done.set_value(completed);
+		});
+		return done.get_future().get();
+	}
+
+private:
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _cpu;
+	std::string _message;
+	std::vector<std::unique_ptr<PingPongConnection>> _conns;
+};
+
+
+/// @brief 每个cpu上的客户端线程各自建立连接并发送本cpu的编号 服务端回复是否由同一个cpu上的loop处理
+static int runCheck(const Options& options)
+{
+	int mismatched = 0;
+	for (int cpu = 0; cpu < g_cpus; cpu++)
+	{
+		std::promise<std::pair<int, int>> result;
+		std::thread client([&options, cpu, &result]() {
+			pinToCpu(cpu);
+			int matched = 0, total = 0;
+			for (int i = 0; i < options.connections; i++)
+			{
+				int fd = connectTo(options.port);
+				if (fd < 0)
+					continue;
+				int32_t expected = cpu;
+				char reply = 0;
+				if (::write(fd, &expected, sizeof(expected)) == sizeof(expected) && ::read(fd, &reply, 1) == 1)
+				{
+					total++;
+					matched += reply == '1';
+				}
+				::close(fd);
+			}
+			result.set_value({ matched, total });
+		});
+		auto [matched, total] = result.get_future().get();
+		client.join();
+		::printf("  cpu %d: %d connections, %d handled by the loop on cpu %d\n", cpu, total, matched, cpu);
+		mismatched += total - matched;
+	}
+	::printf("steering check: %s\n", mismatched == 0 ? "ok" : "FAILED");
+	::fflush(stdout);
+	return mismatched == 0 ? 0 : 1;
+}
+
+
+/// @brief 在主线程启动服务器之前打开 服务端loop线程和之后创建的客户端线程都会被计入
+struct PerfCounters
+{
+	PerfCounter cacheMisses{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES };
+	PerfCounter migrations{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS };
+	PerfCounter switches{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES };
+};
+
+
+static int runBench(const Options& options, PerfCounters& counters)
+{
+	PerfCounter& cacheMisses = counters.cacheMisses;
+	PerfCounter& migrations = counters.migrations;
+	PerfCounter& switches = counters.switches;
+
+	std::vector<std::unique_ptr<CpuClient>> clients;
+	for (int cpu = 0; cpu < g_cpus; cpu++)
+		clients.emplace_back(new CpuClient(options, cpu));
+
+	cacheMisses.enable();
+	migrations.enable();
+	switches.enable();
+	Clock::time_point start = Clock::now();
+	for (auto&& client : clients)
+		client->start();
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+	// 客户端直接关闭仍在收发的连接 服务端会报EPIPE/ECONNRESET 这些错误与测试无关
+	Logger::setLogLevel(LogLevel::FATAL);
+	uint64_t completed = 0;
+	for (auto&& client : clients)
+		completed += client->stop();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	cacheMisses.disable();
+	migrations.disable();
+	switches.disable();
+
+	::printf("  messages: %lu  messages/s: %.0f\n", completed, completed / elapsed);
+	if (cacheMisses.available())
+		::printf("  cache misses: %lu (%.1f per message)\n", cacheMisses.value(), static_cast<double>(cacheMisses.value()) / completed);
+	else
+		::printf("  cache misses: hardware counter unavailable\n");
+	::printf("  cpu migrations: %lu  context switches: %lu (%.2f per message)\n", migrations.value(), switches.value(),
+		static_cast<double>(switches.value()) / completed);
+	::fflush(stdout);
+	return 0;
+}
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "m:a:S:s:c:d:b:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': options.check = ::strcmp(optarg, "bench") != 0; break;
+		case 'a': options.multiAcceptor = ::strcmp(optarg, "multi") == 0; break;
+		case 'S': options.steering = ::strcmp(optarg, "off") != 0; break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'b': options.messageSize = ::strtoul(optarg, nullptr, 10); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-m check|bench] [-a main|multi] [-S on|off] [-s server threads] [-c conns per cpu] [-d seconds] [-b message bytes] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	if (options.serverThreads <= 0)
+		options.serverThreads = g_cpus;
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	g_cpus = static_cast<int>(::sysconf(_SC_NPROCESSORS_ONLN));
+	if (g_cpus < 1)
+		g_cpus = 1;
+	Options options = parseOptions(argc, argv);
+	Logger::setLogLevel(LogLevel::WARN);
+
+	rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	PerfCounters counters;
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(options.port), "SteeringServer",
+		options.multiAcceptor ? TcpServer::Option::MultiAcceptor : TcpServer::Option::NoReusePort);
+	if (options.check)
+	{
+		server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+			if (buf->readableBytes() < sizeof(int32_t))
+				return;
+			int32_t expected;
+			::memcpy(&expected, buf->peek(), sizeof(expected));
+			buf->retrieveAll();
+			conn->send(std::string(1, ::sched_getcpu() == expected ? '1' : '0'));
+		});
+	}
+	else
+	{
+		server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+			conn->send(buf);
+		});
+	}
+	server.setThreadNum(options.serverThreads);
+	server.setCpuSteering(options.steering);
+	server.start();
+
+	int status = 0;
+	std::thread controller([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		::printf("steering_bench: %s, %s acceptor, steering %s, %d cpus, %d server threads\n", options.check ? "check" : "bench",
+			options.multiAcceptor ? "per-loop" : "main-loop", options.steering ? "on" : "off", g_cpus, options.serverThreads);
+		status = options.check ? runCheck(options) : runBench(options, counters);
+		loop.quit();
+	});
+	loop.loop();
+	controller.join();
+	return status;
+}
@@ -0,0 +1,204 @@
+/*
+ * 上游连接池压测 对比每个请求新建上游连接与复用/流水线的差别
+ * 主loop运行一个只回复PING的redis协议上游 另一个loop上的UpstreamPool模拟代理向上游转发请求
+ * 始终保持 -c 个未完成的请求 每完成一个立即发出下一个 统计请求数、延迟与连接池的命中/等待/建连
+ *
+ *     upstream_pool_bench -i 0              每个请求一个新连接(用完即关)
+ *     upstream_pool_bench -i 8              复用空闲连接
+ *     upstream_pool_bench -i 8 -m 4 -p 16   4个连接上流水线
+ *
+ * 用法: upstream_pool_bench [-s 上游subloop数] [-P 端口] [-d 秒数] [-c 并发请求数] [-i 最大空闲连接] [-m 最大连接数] [-p 每连接流水线深度]
+ */
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <string_view>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "InetAddress.h"
+#include "RespServer.h"
+#include "UpstreamPool.h"
+#include "Histogram.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int serverThreads = 0;
+	uint16_t port = 6391;
+	int seconds = 3;
+	int concurrency = 32;
+	size_t maxIdle = 8;
+	size_t maxConnections = 64;
+	size_t pipeline = 1;
+};
+
+static constexpr std::string_view kPing = "*1\r\n$4\r\nPING\r\n";
+
+
+/// @brief 上游的每个响应都是一行 "+PONG\r\n"
+static size_t frameLine(const char* data, size_t len)
+{
+	const void* lf = ::memchr(data, '\n', len);
+	return lf ? static_cast<const char*>(lf) - data + 1 : 0;
+}
+
+
+/// @brief 运行在连接池所在的loop中 维持固定数量的未完成请求
+class Driver
+{
+public:
+	Driver(EventLoop* loop, const Options& options) :
+		_loop{ loop }, _concurrency{ options.concurrency }
+	{
+		UpstreamPool::Options poolOptions;
+		poolOptions.maxIdle = options.maxIdle;
+		poolOptions.maxConnections = options.maxConnections;
+		poolOptions.maxPipeline = options.pipeline;
+		poolOptions.waitTimeout = 1.0;
+		_pool.reset(new UpstreamPool(loop, InetAddress(options.port), "bench", frameLine, poolOptions));
+	}
+
+	void start()
+	{
+		_pool->start();
+		_running = true;
+		for (int i = 0; i < _concurrency; i++)
+			issue();
+	}
+
+	// 停止发出新请求 在loop线程中收集结果后释放连接池
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			_running = false;
+			_stats = _pool->stats();
+			_pool.reset();
+			done.set_value();
+		});
+	}
+
+	const Histogram& histogram() const { return _histogram; }
+	uint64_t completed() const { return _completed; }
+	uint64_t errors() const { return _errors; }
+	const UpstreamPool::Stats& stats() const { return _stats; }
+
+private:
+	void issue()
+	{
+		Clock::time_point sent = Clock::now();
+		_pool->request(kPing, [this, sent](bool ok, std::string_view response) {
+			if (ok && response == "+PONG\r\n")
+			{
+				_completed++;
+				_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+			}
+			else
+			{
+				_errors++;
+			}
+			// 下一个下游请求在之后的事件中到来 而不是在上游响应的回调里 否则刚空闲的连接总会被立即复用
+			if (_running)
+				_loop->queueInLoop([this]() { if (_running) issue(); });
+		});
+	}
+
+	EventLoop* _loop;
+	int _concurrency;
+	std::unique_ptr<UpstreamPool> _pool;
+	bool _running = false;
+	Histogram _histogram;
+	uint64_t _completed = 0;
+	uint64_t _errors = 0;
+	UpstreamPool::Stats _stats;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "s:P:d:c:i:m:p:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'c': options.concurrency = ::atoi(optarg); break;
+		case 'i': options.maxIdle = ::strtoul(optarg, nullptr, 10); break;
+		case 'm': options.maxConnections = ::strtoul(optarg, nullptr, 10); break;
+		case 'p': options.pipeline = ::strtoul(optarg, nullptr, 10); break;
+		default:
+			::fprintf(stderr, "usage: %s [-s server threads] [-P port] [-d seconds] [-c concurrency] [-i max idle] [-m max connections] [-p pipeline]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+/// @brief 等待上游开始监听后在另一个loop中启动Driver 到时间后汇总结果并退出主loop
+static void runDriver(const Options& options, EventLoop* loop)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// driver在loop线程结束之后析构 loop中可能还有引用它的回调
+	std::unique_ptr<Driver> driverPtr;
+	EventLoopThread thread(EventLoopThread::ThreadInitCallback(), "pool");
+	EventLoop* poolLoop = thread.startLoop();
+	driverPtr.reset(new Driver(poolLoop, options));
+	Driver& driver = *driverPtr;
+
+	Clock::time_point start = Clock::now();
+	poolLoop->runInLoop([&driver]() { driver.start(); });
+	std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+
+	std::promise<void> done;
+	driver.stop(done);
+	done.get_future().wait();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	const Histogram& histogram = driver.histogram();
+	const UpstreamPool::Stats& stats = driver.stats();
+	::printf("upstream_pool_bench: concurrency %d, max idle %zu, max connections %zu, pipeline %zu, %d server threads, %.2fs\n",
+		options.concurrency, options.maxIdle, options.maxConnections, options.pipeline, options.serverThreads, elapsed);
+	::printf("  requests: %lu  errors: %lu  requests/s: %.0f\n", driver.completed(), driver.errors(), driver.completed() / elapsed);
+	::printf("  latency(us): mean %.1f  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		histogram.mean() / 1000, histogram.percentile(50) / 1000.0, histogram.percentile(99) / 1000.0,
+		histogram.percentile(99.9) / 1000.0, histogram.max() / 1000.0);
+	::printf("  pool: hits %lu  waits %lu  timeouts %lu  failures %lu  connects %lu (%.0f/s)  evictions %lu  open %zu\n",
+		stats.hits, stats.waits, stats.timeouts, stats.failures, stats.connects, stats.connects / elapsed,
+		stats.evictions, stats.connections);
+	::fflush(stdout);
+
+	loop->quit();
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+
+	EventLoop loop;
+	RespServer server(&loop, InetAddress(options.port), "Upstream");
+	server.setCommandCallback([](const TcpConnectionPtr&, const RespCommand& command, RespWriter* writer) {
+		if (command.is("PING"))
+			writer->simpleString("PONG");
+		else
+			writer->error("ERR unknown command");
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller(runDriver, std::cref(options), &loop);
+	loop.loop();
+	controller.join();
+	return 0;
+}
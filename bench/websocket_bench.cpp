@@ -0,0 +1,304 @@
+/*
+ * websocket压测
+ * 1. 解掩码吞吐: 标量实现与运行时选中的SIMD实现(AVX2/SSE2)在不同payload长度下的GB/s
+ * 2. 小消息汇聚(fan-in): 大量客户端连接持续发送带掩码的小消息 统计服务端每秒收到的消息数
+ *
+ * 用法: websocket_bench [-c 连接数] [-t 客户端线程数] [-s 服务端subloop数] [-d 秒数] [-m 消息字节数] [-P 端口]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Channel.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "WebSocketServer.h"
+#include "WebSocketCodec.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	int connections = 100;
+	int clientThreads = 1;
+	int serverThreads = 1;
+	int seconds = 5;
+	size_t messageSize = 32;
+	uint16_t port = 8092;
+};
+
+static std::atomic<uint64_t> g_messages{ 0 };
+static std::atomic<uint64_t> g_bytes{ 0 };
+
+
+/// @brief 比较标量与SIMD解掩码在不同长度下的吞吐
+static void benchUnmask()
+{
+	const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	const size_t sizes[] = { 16, 64, 125, 1024, 16 * 1024, 1024 * 1024 };
+	::printf("unmask throughput (GB/s), simd impl = %s\n", WebSocketCodec::unmaskImplName());
+	::printf("  %10s %10s %10s %8s\n", "bytes", "scalar", "simd", "speedup");
+
+	for (size_t size : sizes)
+	{
+		std::vector<char> data(size, 'a');
+		// 每种长度大约处理256MB数据
+		const size_t iterations = std::max<size_t>(1, (1UL << 28) / size);
+
+		auto run = [&](void (*unmask)(char*, size_t, const uint8_t*)) {
+			Clock::time_point start = Clock::now();
+			for (size_t i = 0; i < iterations; i++)
+				unmask(data.data(), size, mask);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			return static_cast<double>(size) * iterations / seconds / 1e9;
+		};
+
+		double scalar = run(WebSocketCodec::unmaskScalar);
+		double simd = run(WebSocketCodec::unmask);
+		::printf("  %10zu %10.2f %10.2f %7.2fx\n", size, scalar, simd, simd / scalar);
+	}
+}
+
+
+/// @brief 一个客户端连接 只要socket可写就持续发送预先编码好的一批消息
+class ClientConnection
+{
+public:
+	ClientConnection(EventLoop* loop, int fd, const std::string& frames) :
+		_fd{ fd }, _channel(loop, fd), _frames{ frames }, _offset{ 0 }
+	{
+		_channel.setWriteCallback(std::bind(&ClientConnection::handleWrite, this));
+		_channel.setReadCallback(std::bind(&ClientConnection::handleRead, this));
+	}
+
+	~ClientConnection()
+	{
+		_channel.disableAll();
+		_channel.remove();
+		::close(_fd);
+	}
+
+	void start()
+	{
+		_channel.enableReading();
+		_channel.enableWriting();
+	}
+
+private:
+	void handleWrite()
+	{
+		ssize_t n = ::write(_fd, _frames.data() + _offset, _frames.size() - _offset);
+		if (n > 0)
+			_offset = (_offset + n) % _frames.size();
+	}
+
+	// 丢弃服务端发来的ping等数据
+	void handleRead()
+	{
+		char buf[4096];
+		if (::read(_fd, buf, sizeof(buf)) <= 0)
+			_channel.disableAll();
+	}
+
+	int _fd;
+	Channel _channel;
+	const std::string& _frames;
+	size_t _offset;
+};
+
+
+class ClientWorker
+{
+public:
+	ClientWorker(const Options& options, int connections) :
+		_thread(nullptr, "client"), _options{ options }, _connections{ connections }
+	{
+		// 预先编码一批带掩码的文本帧 客户端发送时不再做任何计算
+		std::string payload(options.messageSize, 'm');
+		const uint8_t mask[4] = { 0xA1, 0xB2, 0xC3, 0xD4 };
+		for (int i = 0; i < 64; i++)
+		{
+			_frames.push_back(static_cast<char>(0x81));
+			if (payload.size() < 126)
+			{
+				_frames.push_back(static_cast<char>(0x80 | payload.size()));
+			}
+			else
+			{
+				_frames.push_back(static_cast<char>(0x80 | 126));
+				_frames.push_back(static_cast<char>(payload.size() >> 8));
+				_frames.push_back(static_cast<char>(payload.size()));
+			}
+			_frames.append(reinterpret_cast<const char*>(mask), 4);
+			std::string masked(payload);
+			WebSocketCodec::unmaskScalar(masked.data(), masked.size(), mask);
+			_frames.append(masked);
+		}
+	}
+
+	void start()
+	{
+		_loop = _thread.startLoop();
+		_loop->runInLoop(std::bind(&ClientWorker::connectAll, this));
+	}
+
+	void stop(std::promise<void>& done)
+	{
+		_loop->runInLoop([this, &done]() {
+			_conns.clear();
+			done.set_value();
+		});
+	}
+
+private:
+	void connectAll()
+	{
+		sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = ::htons(_options.port);
+		addr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+
+		const char request[] = "GET /push HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+
+		for (int i = 0; i < _connections; i++)
+		{
+			int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+			{
+				::perror("connect");
+				::close(fd);
+				continue;
+			}
+
+			// 阻塞地完成握手 再切换到非阻塞模式
+			::write(fd, request, sizeof(request) - 1);
+			std::string response;
+			char buf[1024];
+			while (response.find("\r\n\r\n") == std::string::npos)
+			{
+				ssize_t n = ::read(fd, buf, sizeof(buf));
+				if (n <= 0)
+					break;
+				response.append(buf, n);
+			}
+			if (response.compare(0, 12, "HTTP/1.1 101") != 0)
+			{
+				::fprintf(stderr, "handshake failed: %s\n", response.c_str());
+				::close(fd);
+				continue;
+			}
+
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			_conns.emplace_back(new ClientConnection(_loop, fd, _frames));
+		}
+		for (auto&& conn : _conns)
+			conn->start();
+	}
+
+	EventLoopThread _thread;
+	EventLoop* _loop = nullptr;
+	const Options& _options;
+	int _connections;
+	std::string _frames;
+	std::vector<std::unique_ptr<ClientConnection>> _conns;
+};
+
+
+static Options parseOptions(int argc, char* argv[])
+{
+	Options options;
+	int opt;
+	while ((opt = ::getopt(argc, argv, "c:t:s:d:m:P:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': options.connections = ::atoi(optarg); break;
+		case 't': options.clientThreads = ::atoi(optarg); break;
+		case 's': options.serverThreads = ::atoi(optarg); break;
+		case 'd': options.seconds = ::atoi(optarg); break;
+		case 'm': options.messageSize = ::strtoul(optarg, nullptr, 10); break;
+		case 'P': options.port = static_cast<uint16_t>(::atoi(optarg)); break;
+		default:
+			::fprintf(stderr, "usage: %s [-c conns] [-t client threads] [-s server threads] [-d seconds] [-m message bytes] [-P port]\n", argv[0]);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	return options;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Options options = parseOptions(argc, argv);
+	benchUnmask();
+
+	EventLoop loop;
+	WebSocketServer server(&loop, InetAddress(options.port), "WebSocketBench");
+	server.setMessageCallback([](const TcpConnectionPtr&, std::string_view message, WebSocketServer::Opcode) {
+		g_messages.fetch_add(1, std::memory_order_relaxed);
+		g_bytes.fetch_add(message.size(), std::memory_order_relaxed);
+	});
+	server.setThreadNum(options.serverThreads);
+	server.start();
+
+	std::thread controller([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		std::vector<std::unique_ptr<ClientWorker>> workers;
+		for (int i = 0; i < options.clientThreads; i++)
+		{
+			int conns = options.connections / options.clientThreads + (i < options.connections % options.clientThreads ? 1 : 0);
+			workers.emplace_back(new ClientWorker(options, conns));
+		}
+		for (auto&& worker : workers)
+			worker->start();
+
+		// 连接全部建立后再开始计数
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		uint64_t startMessages = g_messages.load();
+		uint64_t startBytes = g_bytes.load();
+		Clock::time_point start = Clock::now();
+		std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+		uint64_t messages = g_messages.load() - startMessages;
+		uint64_t bytes = g_bytes.load() - startBytes;
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		for (auto&& worker : workers)
+		{
+			std::promise<void> done;
+			worker->stop(done);
+			done.get_future().wait();
+		}
+
+		::printf("websocket fan-in: %d connections, %d client threads, %d server threads, %zu-byte messages, %.2fs\n",
+			options.connections, options.clientThreads, options.serverThreads, options.messageSize, elapsed);
+		::printf("  messages: %lu  messages/s: %.0f  payload MB/s: %.1f\n", messages, messages / elapsed, bytes / elapsed / 1e6);
+		::fflush(stdout);
+
+		workers.clear();
+		loop.quit();
+	});
+
+	loop.loop();
+	controller.join();
+	return 0;
+}